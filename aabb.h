@@ -7,18 +7,24 @@
 #ifndef AABB_H
 #define AABB_H
 
-class aabb {
+#include "ray_packet.h"
+
+template <typename T>
+class basic_aabb {
     public:
+        typedef basic_interval<T> interval;
+        typedef basic_vec3<T> point3;
+
         interval x, y, z;
 
-        aabb() {} // defualt AABB is empty
+        basic_aabb() {} // defualt AABB is empty
 
-        aabb(const interval& x, const interval& y, const interval& z)
+        basic_aabb(const interval& x, const interval& y, const interval& z)
             : x(x), y(y), z(z) {
                 pad();
             }
 
-        aabb(const point3& a, const point3& b) {
+        basic_aabb(const point3& a, const point3& b) {
 
             x = (a[0] <= b[0]) ? interval(a[0], b[0]) : interval(b[0], a[0]);
             y = (a[1] <= b[1]) ? interval(a[1], b[1]) : interval(b[1], a[1]);
@@ -27,7 +33,7 @@ class aabb {
             pad();
         }
 
-        aabb(const aabb& box0, const aabb& box1) {
+        basic_aabb(const basic_aabb& box0, const basic_aabb& box1) {
             x = interval(box0.x, box1.x);
             y = interval(box0.y, box1.y);
             z = interval(box0.z, box1.z);
@@ -39,13 +45,13 @@ class aabb {
             return x;
         }
 
-        bool hit(const ray& r, interval ray_t) const {
+        bool hit(const basic_ray<T>& r, interval ray_t) const {
             const point3& ray_orig = r.origin();
-            const vec3& ray_dir = r.direction();
+            const point3& ray_dir = r.direction();
 
             for (int axis = 0; axis < 3; axis++) {
                 const interval& ax = axis_interval(axis);
-                const double adinv = 1.0 / ray_dir[axis];
+                const T adinv = 1 / ray_dir[axis];
 
                 auto t0 = (ax.min - ray_orig[axis]) * adinv;
                 auto t1 = (ax.max - ray_orig[axis]) * adinv; 
@@ -63,6 +69,18 @@ class aabb {
             return true;
         }
 
+        // Slab test against every lane of a packet. Returns the subset of active lanes that hit the box.
+        unsigned hit_packet(const ray_packet& p, unsigned active) const {
+            if (p.size <= 4) return slab_lanes<4>(p) & active;
+            if (p.size <= 8) return slab_lanes<8>(p) & active;
+            return slab_lanes<max_packet_size>(p) & active;
+        }
+
+        T surface_area() const {
+            T dx = x.size(), dy = y.size(), dz = z.size();
+            return 2 * (dx * dy + dy * dz + dz * dx);
+        }
+
         int longest_axis() const {
             if (x.size() > y.size()) {
                 return x.size() > z.size() ? 0 : 2;
@@ -71,25 +89,48 @@ class aabb {
             }
         }
 
-        static const aabb empty, universe;
+        static const basic_aabb empty, universe;
     private:
+        // Branch free over a fixed lane count so the compiler can vectorise it.
+        template <int lanes>
+        unsigned slab_lanes(const ray_packet& p) const {
+            unsigned mask = 0;
+            for (int i = 0; i < lanes; i++) {
+                T tx0 = (x.min - p.ox[i]) * p.inv_dx[i], tx1 = (x.max - p.ox[i]) * p.inv_dx[i];
+                T ty0 = (y.min - p.oy[i]) * p.inv_dy[i], ty1 = (y.max - p.oy[i]) * p.inv_dy[i];
+                T tz0 = (z.min - p.oz[i]) * p.inv_dz[i], tz1 = (z.max - p.oz[i]) * p.inv_dz[i];
+
+                T t_enter = std::max(std::max(p.tmin[i], std::min(tx0, tx1)), std::max(std::min(ty0, ty1), std::min(tz0, tz1)));
+                T t_exit = std::min(std::min(p.tmax[i], std::max(tx0, tx1)), std::min(std::max(ty0, ty1), std::max(tz0, tz1)));
+
+                mask |= unsigned(t_enter < t_exit) << i;
+            }
+            return mask;
+        }
+
         void pad() {
             // Adjust bounding box so that no side is narrower than a delta, used for quads and tris.
-            double delta = 0.0001;
+            T delta = T(0.0001);
             if (x.size() < delta) x = x.expand(delta);
             if (y.size() < delta) y = y.expand(delta);
             if (z.size() < delta) z = z.expand(delta);
         }
 };
 
-const aabb aabb::empty = aabb(interval::empty, interval::empty, interval::empty);
-const aabb aabb::universe = aabb(interval::universe, interval::universe, interval::universe);
+template <typename T>
+const basic_aabb<T> basic_aabb<T>::empty = basic_aabb<T>(basic_interval<T>::empty, basic_interval<T>::empty, basic_interval<T>::empty);
+template <typename T>
+const basic_aabb<T> basic_aabb<T>::universe = basic_aabb<T>(basic_interval<T>::universe, basic_interval<T>::universe, basic_interval<T>::universe);
+
+using aabb = basic_aabb<real>;
 
-aabb operator+(const aabb& bbox, const vec3& offset) {
-    return aabb(bbox.x + offset.x(), bbox.y + offset.y(), bbox.z + offset.z());
+template <typename T>
+basic_aabb<T> operator+(const basic_aabb<T>& bbox, const basic_vec3<T>& offset) {
+    return basic_aabb<T>(bbox.x + offset.x(), bbox.y + offset.y(), bbox.z + offset.z());
 }
 
-aabb operator+(const vec3& offset, const aabb& bbox) {
+template <typename T>
+basic_aabb<T> operator+(const basic_vec3<T>& offset, const basic_aabb<T>& bbox) {
     return bbox + offset;
 }
 
@@ -0,0 +1,215 @@
+/**
+ * Casey Gehling
+ *
+ * Defines animations: a world whose camera and moving objects are keyframed over a range of frames, rendered one
+ * frame after another in one process. Everything loaded for the first frame (textures, meshes and their BVHs) is
+ * kept for the rest, the top level BVH is updated rather than built again, and the render threads wait in a pool
+ * between frames. Each frame is written out on its own thread while the next one renders.
+ */
+
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "camera.h"
+#include "dynamic_bvh.h"
+
+#include <cassert>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <utility>
+
+// Values keyed at frames, linearly interpolated between keys and held before the first and after the last. An
+// empty track is T's default everywhere.
+template <typename T>
+class keyframe_track {
+    public:
+        keyframe_track& key(double frame, const T& value) {
+            auto at = keys.begin();
+            while (at != keys.end() && at->first <= frame) ++at;
+            keys.insert(at, std::make_pair(frame, value));
+            return *this;
+        }
+
+        bool empty() const { return keys.empty(); }
+
+        T at(double frame) const {
+            if (keys.empty()) return T();
+            if (frame <= keys.front().first) return keys.front().second;
+            for (size_t k = 1; k < keys.size(); k++) {
+                if (frame < keys[k].first) {
+                    const double s = (frame - keys[k - 1].first) / (keys[k].first - keys[k - 1].first);
+                    return keys[k - 1].second + real(s) * (keys[k].second - keys[k - 1].second);
+                }
+            }
+            return keys.back().second;
+        }
+
+    private:
+        std::vector<std::pair<double, T> > keys; // in frame order
+};
+
+// Totals for one call to render_animation
+struct animation_stats {
+    int frames = 0;
+    double seconds = 0;
+    double render_seconds = 0;
+    double update_seconds = 0; // posing the camera and objects and updating the BVH
+    double write_seconds = 0; // on the writer thread, overlapping the renders
+
+    double frames_per_minute() const { return seconds > 0 ? 60.0 * frames / seconds : 0; }
+};
+
+class animation {
+    public:
+        int first_frame = 0, last_frame = 0; // rendered inclusive
+
+        // Camera keys. Empty tracks leave the camera's own setting.
+        keyframe_track<point3> lookfrom, lookat;
+        keyframe_track<double> vfov;
+
+        animation() : bvh(make_shared<dynamic_bvh>()) {}
+
+        int frame_count() const { return last_frame - first_frame + 1; }
+
+        // Add an object that stays where it is
+        void add(shared_ptr<hittable> object) { bvh->add(object); }
+
+        // Add an object moved by offset at each frame
+        shared_ptr<translate> add(shared_ptr<hittable> object, const keyframe_track<vec3>& offset) {
+            auto moving = make_shared<translate>(object, offset.at(first_frame));
+            bvh->add(moving, true);
+            movers.push_back(std::make_pair(moving, offset));
+            return moving;
+        }
+
+        // Circle the camera once around where it looks, about the up axis, over the frames
+        void orbit(const camera& cam) {
+            const vec3 arm = cam.lookfrom - cam.lookat;
+            for (int frame = first_frame; frame <= last_frame; frame++) {
+                const double angle = 2 * pi * (frame - first_frame) / frame_count();
+                const double c = std::cos(angle), s = std::sin(angle);
+                lookfrom.key(frame, cam.lookat + vec3(c * arm.x() + s * arm.z(), arm.y(), -s * arm.x() + c * arm.z()));
+            }
+        }
+
+        // Pose the camera and the moving objects at frame. The first call builds the BVH, later ones update it.
+        bvh_update_stats set_frame(int frame, camera& cam) {
+            if (!lookfrom.empty()) cam.lookfrom = lookfrom.at(frame);
+            if (!lookat.empty()) cam.lookat = lookat.at(frame);
+            if (!vfov.empty()) cam.vfov = vfov.at(frame);
+            for (auto& mover : movers) {
+                mover.first->set_offset(mover.second.at(frame));
+            }
+            if (!built) {
+                bvh->build();
+                built = true;
+                return bvh_update_stats();
+            }
+            return bvh->update();
+        }
+
+        shared_ptr<hittable> world() const { return bvh; }
+
+    private:
+        shared_ptr<dynamic_bvh> bvh;
+        std::vector<std::pair<shared_ptr<translate>, keyframe_track<vec3> > > movers;
+        bool built = false;
+};
+
+// Write a framebuffer of linear colors as a PPM
+inline bool write_ppm(const std::string& path, const std::vector<color>& framebuffer, int width, int height) {
+    std::ofstream out(path);
+    if (!out) return false;
+    out << "P3\n" << width << ' ' << height << "\n255\n";
+    for (const color& pixel : framebuffer) {
+        write_color(out, pixel);
+    }
+    return bool(out);
+}
+
+// Whether pattern has exactly one printf conversion, and it's of an int (%d or %i, with flags, width and
+// precision), so frame_path can printf the frame number into it. %% is allowed anywhere.
+inline bool valid_frame_pattern(const std::string& pattern) {
+    int conversions = 0;
+    for (size_t i = 0; i < pattern.size(); i++) {
+        if (pattern[i] != '%') continue;
+        if (++i < pattern.size() && pattern[i] == '%') continue;
+        while (i < pattern.size() && strchr("-+ #0", pattern[i])) i++;
+        while (i < pattern.size() && isdigit((unsigned char)pattern[i])) i++;
+        if (i < pattern.size() && pattern[i] == '.') {
+            i++;
+            while (i < pattern.size() && isdigit((unsigned char)pattern[i])) i++;
+        }
+        if (i >= pattern.size() || (pattern[i] != 'd' && pattern[i] != 'i')) return false;
+        conversions++;
+    }
+    return conversions == 1;
+}
+
+// Name of frame's image, pattern with the frame number printf'd in (e.g. "frames/frame_%04d.ppm"). pattern must
+// pass valid_frame_pattern.
+inline std::string frame_path(const std::string& pattern, int frame) {
+    assert(valid_frame_pattern(pattern));
+    std::vector<char> path(pattern.size() + 32);
+    snprintf(path.data(), path.size(), pattern.c_str(), frame);
+    return std::string(path.data());
+}
+
+// Render every frame of anim with cam, writing each to frame_path(pattern, frame). Renders on cam.pool, started
+// with cam.num_threads threads if it isn't set. Frame f is rendered with seed cam.seed + f.
+inline animation_stats render_animation(animation& anim, camera& cam, const std::string& pattern) {
+    if (!cam.pool) cam.pool = make_shared<thread_pool>(cam.num_threads);
+    const uint64_t base_seed = cam.seed;
+    const bool show_progress = cam.show_progress;
+    cam.show_progress = false;
+
+    animation_stats stats;
+    std::thread writer;
+    std::vector<color> written; // the frame the writer thread has
+    double write_seconds = 0;
+    bool write_failed = false;
+    const auto start = profile_clock::now();
+
+    for (int frame = anim.first_frame; frame <= anim.last_frame; frame++) {
+        auto step_start = profile_clock::now();
+        const bvh_update_stats update = anim.set_frame(frame, cam);
+        const double update_seconds = std::chrono::duration<double>(profile_clock::now() - step_start).count();
+
+        cam.seed = base_seed + uint64_t(frame);
+        std::vector<color> framebuffer = cam.render_framebuffer(*anim.world());
+
+        // Frame before this one has had this one's render to be written
+        if (writer.joinable()) writer.join();
+        stats.write_seconds += write_seconds;
+        written.swap(framebuffer);
+        const std::string path = frame_path(pattern, frame);
+        const int width = cam.image_width, height = cam.height();
+        writer = std::thread([&written, &write_seconds, &write_failed, path, width, height]() {
+            const auto write_start = profile_clock::now();
+            if (!write_ppm(path, written, width, height)) write_failed = true;
+            write_seconds = std::chrono::duration<double>(profile_clock::now() - write_start).count();
+        });
+
+        stats.frames++;
+        stats.render_seconds += cam.stats.seconds;
+        stats.update_seconds += update_seconds;
+        if (show_progress) {
+            std::clog << "Frame " << frame << " (" << stats.frames << " of " << anim.frame_count() << "): "
+                      << cam.stats.seconds << " s render, " << update_seconds << " s BVH update";
+            if (update.rebuilt_subtrees > 0) std::clog << " (" << update.rebuilt_nodes << " nodes rebuilt)";
+            std::clog << std::endl;
+        }
+    }
+    if (writer.joinable()) writer.join();
+    stats.write_seconds += write_seconds;
+    stats.seconds = std::chrono::duration<double>(profile_clock::now() - start).count();
+
+    cam.seed = base_seed;
+    cam.show_progress = show_progress;
+    if (write_failed) std::cerr << "ERROR: Could not write some frames of " << pattern << std::endl;
+    return stats;
+}
+
+#endif
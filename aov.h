@@ -0,0 +1,212 @@
+/**
+ * Casey Gehling
+ *
+ * Defines arbitrary output variables (AOVs): extra framebuffer layers rendered in the same pass as the
+ * image, for compositing and for the denoiser. Each layer is opt-in through a bitmask and stored as float
+ * planes, so layers that are not asked for are never allocated or written.
+ */
+
+#ifndef AOV_H
+#define AOV_H
+
+#include "exr.h"
+#include "hittable.h"
+#include "material.h"
+
+#include <sstream>
+
+enum aov_layer {
+    aov_depth = 1 << 0, // distance to the first hit, 0 where the ray escaped
+    aov_normal = 1 << 1, // world space normal at the first hit, facing the camera
+    aov_albedo = 1 << 2, // material::albedo at the first hit, background (or environment) color on a miss
+    aov_material_id = 1 << 3, // material::id at the first hit, 0 on a miss
+    aov_object_id = 1 << 4, // hittable::object_id at the first hit, 0 on a miss
+    aov_emission = 1 << 5, // light seen directly: emitters and background or environment seen by camera rays
+    aov_direct = 1 << 6, // light reaching the first hit straight from an emitter, the background or the environment
+    aov_indirect = 1 << 7 // everything after two or more bounces
+};
+
+// Emission + direct + indirect adds up to the image
+const unsigned aov_radiance_split = aov_emission | aov_direct | aov_indirect;
+
+// Layers the denoiser is guided by
+const unsigned aov_denoise_features = aov_depth | aov_normal | aov_albedo;
+
+const unsigned aov_all = (1 << 8) - 1;
+
+struct aov_layer_info {
+    const char* name;
+    unsigned layer;
+    int first_channel;
+    int channels;
+};
+
+// Channel planes, in layer order
+enum aov_channel {
+    aov_ch_depth = 0,
+    aov_ch_normal = 1,
+    aov_ch_albedo = 4,
+    aov_ch_material_id = 7,
+    aov_ch_object_id = 8,
+    aov_ch_emission = 9,
+    aov_ch_direct = 12,
+    aov_ch_indirect = 15,
+    aov_ch_count = 18
+};
+
+const aov_layer_info aov_layers[] = {
+    { "depth", aov_depth, aov_ch_depth, 1 },
+    { "normal", aov_normal, aov_ch_normal, 3 },
+    { "albedo", aov_albedo, aov_ch_albedo, 3 },
+    { "material_id", aov_material_id, aov_ch_material_id, 1 },
+    { "object_id", aov_object_id, aov_ch_object_id, 1 },
+    { "emission", aov_emission, aov_ch_emission, 3 },
+    { "direct", aov_direct, aov_ch_direct, 3 },
+    { "indirect", aov_indirect, aov_ch_indirect, 3 }
+};
+
+const int aov_layer_count = sizeof(aov_layers) / sizeof(aov_layers[0]);
+
+// Parse a comma separated list of layer names (or "all") into a layer mask. Returns false on an unknown name.
+inline bool parse_aov_layers(const std::string& list, unsigned& layers) {
+    std::stringstream names(list);
+    std::string name;
+    while (std::getline(names, name, ',')) {
+        if (name == "all") {
+            layers |= aov_all;
+            continue;
+        }
+        int l = 0;
+        while (l < aov_layer_count && name != aov_layers[l].name) l++;
+        if (l == aov_layer_count) return false;
+        layers |= aov_layers[l].layer;
+    }
+    return true;
+}
+
+class aov_buffers {
+    public:
+        unsigned layers = 0;
+        int width = 0;
+        int height = 0;
+
+        // Allocate the planes of the given layers, zeroed. Id planes start at -1 until a sample claims them.
+        void allocate(unsigned layer_mask, int w, int h) {
+            layers = layer_mask;
+            width = w;
+            height = h;
+            for (int l = 0; l < aov_layer_count; l++) {
+                const aov_layer_info& info = aov_layers[l];
+                for (int c = info.first_channel; c < info.first_channel + info.channels; c++) {
+                    if (layers & info.layer) {
+                        planes[c].assign(size_t(w) * h, is_id(info.layer) ? -1.0f : 0.0f);
+                    } else {
+                        std::vector<float>().swap(planes[c]);
+                    }
+                }
+            }
+        }
+
+        bool has(unsigned layer_mask) const { return (layers & layer_mask) != 0; }
+
+        // Add one sample's first hit (or miss, when rec is null) to the pixel. Depth, normal and albedo are
+        // summed and averaged by normalize(); ids are taken from the first sample to reach the pixel.
+        void add_first_hit(int pixel, const ray& r, const hit_record* rec, const color& background) {
+            if (layers & aov_albedo) add3(aov_ch_albedo, pixel, rec ? rec->mat->albedo(*rec) : background);
+            if (!rec) {
+                if (layers & aov_material_id) claim_id(aov_ch_material_id, pixel, 0);
+                if (layers & aov_object_id) claim_id(aov_ch_object_id, pixel, 0);
+                return;
+            }
+            if (layers & aov_depth) planes[aov_ch_depth][pixel] += float(rec->t * r.direction().length());
+            if (layers & aov_normal) add3(aov_ch_normal, pixel, rec->normal);
+            if (layers & aov_material_id) claim_id(aov_ch_material_id, pixel, rec->mat->id);
+            if (layers & aov_object_id) claim_id(aov_ch_object_id, pixel, rec->object_id);
+        }
+
+        // Add one sample's radiance, split into emission, direct and indirect.
+        void add_radiance(int pixel, const color* split) {
+            if (layers & aov_emission) add3(aov_ch_emission, pixel, split[0]);
+            if (layers & aov_direct) add3(aov_ch_direct, pixel, split[1]);
+            if (layers & aov_indirect) add3(aov_ch_indirect, pixel, split[2]);
+        }
+
+        // Turn per-sample sums into averages. Ids are left as they are, apart from unclaimed ones becoming 0.
+        void normalize(double sample_scale) {
+            const float scale = float(sample_scale);
+            for (int l = 0; l < aov_layer_count; l++) {
+                const aov_layer_info& info = aov_layers[l];
+                if (!(layers & info.layer)) continue;
+                for (int c = info.first_channel; c < info.first_channel + info.channels; c++) {
+                    for (float& v : planes[c]) v = is_id(info.layer) ? std::fmax(v, 0.0f) : v * scale;
+                }
+            }
+        }
+
+        // Copy a tile rendered into its own buffers to (x0,y0) of this one.
+        void copy_tile(const aov_buffers& tile, int x0, int y0) {
+            for (int c = 0; c < aov_ch_count; c++) {
+                if (planes[c].empty()) continue;
+                for (int y = 0; y < tile.height; y++) {
+                    std::copy(
+                        tile.planes[c].begin() + size_t(y) * tile.width,
+                        tile.planes[c].begin() + size_t(y + 1) * tile.width,
+                        planes[c].begin() + size_t(y0 + y) * width + x0
+                    );
+                }
+            }
+        }
+
+        color albedo(int pixel) const { return get3(aov_ch_albedo, pixel); }
+        vec3 normal(int pixel) const { return get3(aov_ch_normal, pixel); }
+        double depth(int pixel) const { return planes[aov_ch_depth][pixel]; }
+
+        // Write the image as R, G, B plus every allocated layer to a multi-layer EXR.
+        bool write_exr(const std::string& filename, const std::vector<color>& image) const {
+            std::vector<float> beauty[3];
+            std::vector<exr_channel> channels;
+            static const char* rgb[3] = { "R", "G", "B" };
+            static const char* xyz[3] = { "X", "Y", "Z" };
+
+            for (int k = 0; k < 3; k++) {
+                beauty[k].resize(image.size());
+                for (size_t i = 0; i < image.size(); i++) beauty[k][i] = float(image[i][k]);
+                exr_channel c = { rgb[k], beauty[k].data() };
+                channels.push_back(c);
+            }
+
+            for (int l = 0; l < aov_layer_count; l++) {
+                const aov_layer_info& info = aov_layers[l];
+                if (!(layers & info.layer)) continue;
+                for (int k = 0; k < info.channels; k++) {
+                    std::string name = (info.layer == aov_depth) ? "Z" : info.name;
+                    if (info.channels == 3) name += std::string(".") + ((info.layer == aov_normal) ? xyz[k] : rgb[k]);
+                    exr_channel c = { name, planes[info.first_channel + k].data() };
+                    channels.push_back(c);
+                }
+            }
+
+            return exr_writer::write(filename, width, height, channels);
+        }
+
+    private:
+        std::vector<float> planes[aov_ch_count];
+
+        static bool is_id(unsigned layer) { return (layer & (aov_material_id | aov_object_id)) != 0; }
+
+        void add3(int channel, int pixel, const vec3& v) {
+            planes[channel][pixel] += float(v.x());
+            planes[channel + 1][pixel] += float(v.y());
+            planes[channel + 2][pixel] += float(v.z());
+        }
+
+        vec3 get3(int channel, int pixel) const {
+            return vec3(planes[channel][pixel], planes[channel + 1][pixel], planes[channel + 2][pixel]);
+        }
+
+        void claim_id(int channel, int pixel, int id) {
+            if (planes[channel][pixel] < 0) planes[channel][pixel] = float(id);
+        }
+};
+
+#endif
@@ -0,0 +1,137 @@
+/**
+ * Casey Gehling
+ *
+ * Animation throughput. Renders the first frames of a scene's animation two ways and reports frames per minute for
+ * each: one frame at a time as separate renders would, setting the scene up again (textures, meshes, BVHs) and
+ * starting new threads for every frame and writing each before the next starts, and as one animation, keeping
+ * the scene, its BVH and the render threads and writing each frame while the next renders. The frames must come
+ * out the same both ways. --no-file-caches turns off the texture and BVH files, so setting a scene up again pays
+ * for decoding its images and building its mesh BVHs, as a first run would.
+ *
+ * Usage (from the repository root, so scene assets resolve):
+ *   ./bench/bench_animation [--scene 18] [--frames 12] [--width 200] [--spp 8] [--threads 0] [--dir /tmp]
+ *                           [--no-file-caches]
+ */
+
+#include "../scenes.h"
+
+#include <fstream>
+#include <sstream>
+
+struct animation_config {
+    int scene = 18;
+    int frames = 12;
+    int width = 200;
+    int spp = 8;
+    int threads = 0;
+    std::string directory = "/tmp";
+    bool file_caches = true;
+};
+
+// The scene's animation as configured, from a fixed seed so both ways build the same scene
+void set_up(const animation_config& config, camera& cam, animation& anim) {
+    seed_random(1);
+    scene_animation(config.scene, cam, anim);
+    cam.image_width = config.width;
+    cam.samples_per_pixel = config.spp;
+    cam.num_threads = config.threads;
+    cam.show_progress = false;
+    cam.seed = 0;
+    anim.last_frame = std::min(anim.last_frame, anim.first_frame + config.frames - 1);
+}
+
+std::string read_file(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+}
+
+int main(int argc, const char* argv[]) {
+    animation_config config;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--scene" && has_value) {
+            config.scene = atoi(argv[++i]);
+        } else if (arg == "--frames" && has_value) {
+            config.frames = atoi(argv[++i]);
+        } else if (arg == "--width" && has_value) {
+            config.width = atoi(argv[++i]);
+        } else if (arg == "--spp" && has_value) {
+            config.spp = atoi(argv[++i]);
+        } else if (arg == "--threads" && has_value) {
+            config.threads = atoi(argv[++i]);
+        } else if (arg == "--dir" && has_value) {
+            config.directory = argv[++i];
+        } else if (arg == "--no-file-caches") {
+            config.file_caches = false;
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return -1;
+        }
+    }
+    if (config.scene < 1 || config.scene > scene_count) {
+        std::cerr << "Unknown scene: " << config.scene << std::endl;
+        return -1;
+    }
+
+    if (!config.file_caches) {
+        texture_cache::global().set_file_directory("");
+        bvh_cache::global().set_directory("");
+    }
+
+    const std::string separate_pattern = config.directory + "/bench_animation_separate_%04d.ppm";
+    const std::string animation_pattern = config.directory + "/bench_animation_%04d.ppm";
+    std::clog.setstate(std::ios::failbit); // loaders report every load
+
+    // Every frame from nothing
+    int first = 0, last = -1;
+    auto start = profile_clock::now();
+    double setup_seconds = 0;
+    for (int frame = 0; last < 0 || frame <= last - first; frame++) {
+        const auto setup_start = profile_clock::now();
+        camera cam;
+        animation anim;
+        set_up(config, cam, anim);
+        first = anim.first_frame;
+        last = anim.last_frame;
+        anim.set_frame(first + frame, cam);
+        setup_seconds += std::chrono::duration<double>(profile_clock::now() - setup_start).count();
+
+        cam.seed = uint64_t(first + frame);
+        std::vector<color> framebuffer = cam.render_framebuffer(*anim.world());
+        write_ppm(frame_path(separate_pattern, first + frame), framebuffer, cam.image_width, cam.height());
+    }
+    const double separate_seconds = std::chrono::duration<double>(profile_clock::now() - start).count();
+    const int frames = last - first + 1;
+
+    // One animation
+    start = profile_clock::now();
+    camera cam;
+    animation anim;
+    set_up(config, cam, anim);
+    const double animation_setup = std::chrono::duration<double>(profile_clock::now() - start).count();
+    animation_stats stats = render_animation(anim, cam, animation_pattern);
+    const double animation_seconds = std::chrono::duration<double>(profile_clock::now() - start).count();
+    std::clog.clear();
+
+    int different = 0;
+    for (int frame = first; frame <= last; frame++) {
+        const std::string a = frame_path(separate_pattern, frame), b = frame_path(animation_pattern, frame);
+        if (read_file(a) != read_file(b) || read_file(a).empty()) different++;
+        remove(a.c_str());
+        remove(b.c_str());
+    }
+
+    printf("scene %d (%s), %d frames at %dx%d, %d spp, %d threads\n", config.scene, scenes[config.scene - 1].name,
+        frames, cam.image_width, cam.height(), config.spp, cam.pool->size());
+    printf("%-22s %8.2f s %8.1f frames/min   (%.3f s setting up scenes)\n", "separate frames",
+        separate_seconds, 60.0 * frames / separate_seconds, setup_seconds);
+    printf("%-22s %8.2f s %8.1f frames/min   (%.3f s setting up, %.3f s rendering, %.4f s updating the BVH, %.3f s writing alongside)\n",
+        "animation", animation_seconds, 60.0 * frames / animation_seconds, animation_setup, stats.render_seconds,
+        stats.update_seconds, stats.write_seconds);
+    printf("%d of %d frames differ\n", different, frames);
+    return different == 0 ? 0 : 1;
+}
@@ -0,0 +1,178 @@
+/**
+ * Casey Gehling
+ *
+ * Per-frame acceleration structure cost for a scripted animation. A field of static spheres is crossed by dynamic
+ * ones: most orbit a point of their own, and some fly straight across the field over the animation. Each frame the
+ * dynamic spheres are moved, then the top level BVH is made ready each way: a new bvh_node, a dynamic_bvh built
+ * again, a dynamic_bvh updated with subtree rebuilds, and one refit only. The same rays are traced through all of
+ * them, to check they find the same hits and to count the nodes each visits.
+ *
+ * Usage:
+ *   ./bench/bench_dynamic [--static 20000] [--dynamic 200] [--fliers 20] [--frames 60] [--threshold 1.2]
+ *                         [--rays 10000]
+ */
+
+#include "../scenes.h"
+#include "../dynamic_bvh.h"
+
+struct dynamic_config {
+    int static_count = 20000;
+    int dynamic_count = 200;
+    int fliers = 20; // of the dynamic spheres, those crossing the whole field rather than orbiting
+    int frames = 60;
+    double threshold = 1.2;
+    int rays = 10000;
+};
+
+// Where dynamic sphere i is at frame f of frames
+struct motion_script {
+    point3 center;
+    vec3 axis; // orbit radius, or for fliers the whole path
+    double speed, phase;
+    bool flies;
+
+    vec3 offset(int f, int frames) const {
+        if (flies) return center + (double(f) / frames - 0.5) * axis;
+        const double angle = speed * f + phase;
+        return center + vec3(axis.x() * std::cos(angle), axis.y() * std::sin(2 * angle), axis.z() * std::sin(angle));
+    }
+};
+
+// Distances to the nearest hits of the rays, summed, and the nodes visited per ray
+double trace(const hittable& world, const std::vector<ray>& rays, double& nodes_per_ray) {
+    thread_counters() = traversal_counters();
+    double sum = 0;
+    for (const ray& r : rays) {
+        hit_record rec;
+        if (world.hit(r, interval(0.001, infinity), rec)) sum += rec.t;
+    }
+    nodes_per_ray = double(thread_counters().node_visits) / rays.size();
+    return sum;
+}
+
+double seconds_since(profile_clock::time_point start) {
+    return std::chrono::duration<double>(profile_clock::now() - start).count();
+}
+
+int main(int argc, const char* argv[]) {
+    dynamic_config config;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--static" && has_value) {
+            config.static_count = atoi(argv[++i]);
+        } else if (arg == "--dynamic" && has_value) {
+            config.dynamic_count = atoi(argv[++i]);
+        } else if (arg == "--fliers" && has_value) {
+            config.fliers = atoi(argv[++i]);
+        } else if (arg == "--frames" && has_value) {
+            config.frames = atoi(argv[++i]);
+        } else if (arg == "--threshold" && has_value) {
+            config.threshold = atof(argv[++i]);
+        } else if (arg == "--rays" && has_value) {
+            config.rays = atoi(argv[++i]);
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return -1;
+        }
+    }
+
+    seed_random(1);
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    hittable_list world;
+    dynamic_bvh updated, refit_only;
+    refit_only.rebuild_threshold = infinity;
+    updated.rebuild_threshold = config.threshold;
+
+    for (int i = 0; i < config.static_count; i++) {
+        auto s = make_shared<sphere>(point3(random_double(-50, 50), random_double(0, 4), random_double(-50, 50)), random_double(0.2, 0.6), white);
+        world.add(s);
+        updated.add(s);
+        refit_only.add(s);
+    }
+
+    std::vector<shared_ptr<translate> > movers;
+    std::vector<motion_script> scripts;
+    for (int i = 0; i < config.dynamic_count; i++) {
+        motion_script script;
+        script.flies = i < config.fliers;
+        script.center = point3(random_double(-40, 40), random_double(1, 3), random_double(-40, 40));
+        script.axis = script.flies ? vec3(random_double(-80, 80), 0, random_double(-80, 80))
+            : vec3(random_double(1, 8), random_double(0.5, 1), random_double(1, 8));
+        script.speed = random_double(0.05, 0.2);
+        script.phase = random_double(0, 2 * pi);
+        scripts.push_back(script);
+
+        auto mover = make_shared<translate>(make_shared<sphere>(point3(0, 0, 0), random_double(0.3, 1), white), script.offset(0, config.frames));
+        movers.push_back(mover);
+        world.add(mover);
+        updated.add(mover, true);
+        refit_only.add(mover, true);
+    }
+    updated.build();
+    refit_only.build();
+
+    // From above the field, down into it
+    std::vector<ray> rays;
+    for (int i = 0; i < config.rays; i++) {
+        const point3 origin(random_double(-60, 60), 30, random_double(-60, 60));
+        const point3 target(random_double(-50, 50), random_double(0, 4), random_double(-50, 50));
+        rays.push_back(ray(origin, target - origin, 0));
+    }
+
+    printf("%d static spheres, %d dynamic (%d flying across), %d frames, %d rays a frame, rebuild threshold %.2f\n\n",
+        config.static_count, config.dynamic_count, config.fliers, config.frames, config.rays, config.threshold);
+    printf("%5s %13s %13s %13s %10s %10s   %s\n", "frame", "bvh_node ms", "build ms", "update ms", "refit ms",
+        "rebuilt", "nodes/ray: bvh_node  build  update  refit");
+
+    double total_node = 0, total_build = 0, total_update = 0, total_refit = 0;
+    double total_visits[4] = {};
+    size_t total_rebuilt = 0;
+    int mismatches = 0;
+    for (int f = 1; f <= config.frames; f++) {
+        for (size_t i = 0; i < movers.size(); i++) movers[i]->set_offset(scripts[i].offset(f, config.frames));
+
+        auto start = profile_clock::now();
+        auto tree = make_shared<bvh_node>(world);
+        const double node_seconds = seconds_since(start);
+
+        start = profile_clock::now();
+        dynamic_bvh fresh;
+        for (const auto& object : world.objects) fresh.add(object, fresh.size() >= size_t(config.static_count));
+        fresh.build();
+        const double build_seconds = seconds_since(start);
+
+        start = profile_clock::now();
+        const bvh_update_stats stats = updated.update();
+        const double update_seconds = seconds_since(start);
+
+        start = profile_clock::now();
+        refit_only.update();
+        const double refit_seconds = seconds_since(start);
+
+        double visits[4];
+        const double sums[4] = { trace(*tree, rays, visits[0]), trace(fresh, rays, visits[1]),
+            trace(updated, rays, visits[2]), trace(refit_only, rays, visits[3]) };
+        if (sums[1] != sums[0] || sums[2] != sums[0] || sums[3] != sums[0]) mismatches++;
+
+        total_node += node_seconds;
+        total_build += build_seconds;
+        total_update += update_seconds;
+        total_refit += refit_seconds;
+        total_rebuilt += stats.rebuilt_nodes;
+        for (int k = 0; k < 4; k++) total_visits[k] += visits[k];
+        if (f % 10 == 0 || f == config.frames) {
+            printf("%5d %13.3f %13.3f %13.3f %10.3f %10zu   %19.1f %6.1f %7.1f %6.1f\n", f, 1e3 * node_seconds,
+                1e3 * build_seconds, 1e3 * update_seconds, 1e3 * refit_seconds, stats.rebuilt_nodes, visits[0],
+                visits[1], visits[2], visits[3]);
+        }
+    }
+
+    const double n = config.frames;
+    printf("\nmean  %13.3f %13.3f %13.3f %10.3f %10.0f   %19.1f %6.1f %7.1f %6.1f\n", 1e3 * total_node / n,
+        1e3 * total_build / n, 1e3 * total_update / n, 1e3 * total_refit / n, total_rebuilt / n,
+        total_visits[0] / n, total_visits[1] / n, total_visits[2] / n, total_visits[3] / n);
+    printf("%d of %d frames found different hits\n", mismatches, config.frames);
+    return mismatches == 0 ? 0 : 1;
+}
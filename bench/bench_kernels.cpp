@@ -0,0 +1,443 @@
+/**
+ * Casey Gehling
+ *
+ * Microbenchmarks for the intersection and shading kernels. Each kernel runs over a pre-generated batch
+ * of coherent (camera-like) or incoherent (random) rays, with warmup passes and repeated timed passes,
+ * and reports ns/op statistics and throughput. Isolates kernel changes from whole-scene noise.
+ *
+ * Usage (from the repository root, so textures resolve):
+ *   ./bench/bench_kernels [--rays 65536] [--reps 15] [--warmup 3] [--filter <substring>]
+ */
+
+#include "../scenes.h"
+
+#include <functional>
+#include <sstream>
+
+struct kernel_config {
+    int batch_size = 1 << 16;
+    int reps = 15;
+    int warmup = 3;
+    std::string filter;
+};
+
+struct kernel_stats {
+    double min_ns, median_ns, mean_ns, stddev_ns;
+};
+
+// Sink for kernel results so the compiler can't discard the work.
+volatile double bench_sink;
+
+// Rays from one eye point through a narrow grid of directions, like adjacent camera pixels.
+std::vector<ray> coherent_rays(int n, const point3& eye, const point3& target, double spread) {
+    std::vector<ray> rays;
+    rays.reserve(n);
+    int side = int(std::sqrt(double(n)));
+    vec3 w = unit_vector(target - eye);
+    vec3 u = unit_vector(cross(vec3(0,1,0), w));
+    vec3 v = cross(w, u);
+    for (int i = 0; i < n; i++) {
+        double x = (double(i % side) / side - 0.5) * spread;
+        double y = (double(i / side % side) / side - 0.5) * spread;
+        rays.push_back(ray(eye, w + x * u + y * v, random_double()));
+    }
+    return rays;
+}
+
+// Rays with random origins in a box around the object and random directions toward it.
+std::vector<ray> incoherent_rays(int n, const point3& center, double extent) {
+    std::vector<ray> rays;
+    rays.reserve(n);
+    for (int i = 0; i < n; i++) {
+        point3 origin = center + extent * random_unit_vector();
+        point3 target = center + 0.5 * extent * vec3::random(-1,1);
+        rays.push_back(ray(origin, target - origin, random_double()));
+    }
+    return rays;
+}
+
+std::vector<point3> random_points(int n, double extent) {
+    std::vector<point3> points;
+    points.reserve(n);
+    for (int i = 0; i < n; i++) points.push_back(vec3::random(-extent, extent));
+    return points;
+}
+
+class kernel_bench {
+    public:
+        kernel_bench(const kernel_config& config) : config(config) {}
+
+        // Time op(i) for every i in [0, n). One pass over the batch is one sample.
+        void run(const std::string& name, int n, std::function<double(int)> op) {
+            if (!selected(name)) return;
+
+            double sum = 0;
+            for (int pass = 0; pass < config.warmup; pass++) {
+                for (int i = 0; i < n; i++) sum += op(i);
+            }
+
+            std::vector<double> samples;
+            for (int pass = 0; pass < config.reps; pass++) {
+                auto start = profile_clock::now();
+                for (int i = 0; i < n; i++) sum += op(i);
+                auto end = profile_clock::now();
+                samples.push_back(std::chrono::duration<double, std::nano>(end - start).count() / n);
+            }
+            bench_sink = sum;
+
+            kernel_stats s = summarize(samples);
+            printf("%-36s %10.2f %10.2f %10.2f %8.2f %12.2f\n",
+                name.c_str(), s.min_ns, s.median_ns, s.mean_ns, s.stddev_ns, 1e3 / s.median_ns);
+        }
+
+        // Whether name passes the --filter
+        bool selected(const std::string& name) const {
+            return config.filter.empty() || name.find(config.filter) != std::string::npos;
+        }
+
+        void header() const {
+            printf("%-36s %10s %10s %10s %8s %12s\n", "kernel", "min ns", "median ns", "mean ns", "stddev", "Mops/s");
+        }
+
+    private:
+        kernel_config config;
+
+        static kernel_stats summarize(std::vector<double> samples) {
+            std::sort(samples.begin(), samples.end());
+            kernel_stats s;
+            s.min_ns = samples.front();
+            s.median_ns = samples[samples.size() / 2];
+            s.mean_ns = 0;
+            for (double x : samples) s.mean_ns += x;
+            s.mean_ns /= samples.size();
+            s.stddev_ns = 0;
+            for (double x : samples) s.stddev_ns += (x - s.mean_ns) * (x - s.mean_ns);
+            s.stddev_ns = std::sqrt(s.stddev_ns / samples.size());
+            return s;
+        }
+};
+
+// Benchmark obj.hit over coherent and incoherent batches aimed at its bounding box.
+void bench_hit(kernel_bench& bench, const std::string& name, const hittable& obj, int n) {
+    aabb box = obj.bounding_box();
+    point3 center(0.5 * (box.x.min + box.x.max), 0.5 * (box.y.min + box.y.max), 0.5 * (box.z.min + box.z.max));
+    double extent = std::fmax(box.x.size(), std::fmax(box.y.size(), box.z.size()));
+
+    std::vector<ray> coherent = coherent_rays(n, center + vec3(0.3, 0.2, 2) * extent, center, 0.6);
+    std::vector<ray> incoherent = incoherent_rays(n, center, 2 * extent);
+
+    bench.run(name + " coherent", n, [&](int i) {
+        hit_record rec;
+        return obj.hit(coherent[i], interval(0.001, infinity), rec) ? rec.t : 0.0;
+    });
+    bench.run(name + " incoherent", n, [&](int i) {
+        hit_record rec;
+        return obj.hit(incoherent[i], interval(0.001, infinity), rec) ? rec.t : 0.0;
+    });
+}
+
+// Reference for grid_medium: the same density marched in fixed steps, sampling it at each step's midpoint
+class marched_medium : public hittable {
+    public:
+        marched_medium(const grid_medium& medium, double step) : medium(medium), step(step) {}
+
+        aabb bounding_box() const override { return medium.bounding_box(); }
+
+        // Scatter where the optical depth reaches an exponentially distributed target
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            real t0, t1;
+            if (!clip(r, ray_t, t0, t1)) return false;
+            const real dt = step / r.direction().length();
+            real target = -std::log(1 - random_double());
+            for (real t = t0; t < t1; t += dt) {
+                real depth = medium.density(r.at(t + 0.5 * dt)) * step;
+                if (depth >= target) {
+                    rec.t = t + dt * target / depth;
+                    rec.p = r.at(rec.t);
+                    return true;
+                }
+                target -= depth;
+            }
+            return false;
+        }
+
+        real transmittance(const ray& r, interval ray_t) const {
+            real t0, t1;
+            if (!clip(r, ray_t, t0, t1)) return 1;
+            const real dt = step / r.direction().length();
+            real depth = 0;
+            for (real t = t0; t < t1; t += dt) depth += medium.density(r.at(t + 0.5 * dt)) * step;
+            return std::exp(-depth);
+        }
+
+    private:
+        const grid_medium& medium;
+        real step;
+
+        bool clip(const ray& r, interval ray_t, real& t0, real& t1) const {
+            aabb box = medium.bounding_box();
+            t0 = ray_t.min;
+            t1 = ray_t.max;
+            for (int axis = 0; axis < 3; axis++) {
+                real a = (box.axis_interval(axis).min - r.origin()[axis]) / r.direction()[axis];
+                real b = (box.axis_interval(axis).max - r.origin()[axis]) / r.direction()[axis];
+                t0 = std::fmax(t0, std::fmin(a, b));
+                t1 = std::fmin(t1, std::fmax(a, b));
+            }
+            return t0 < t1;
+        }
+};
+
+// Benchmark a heterogeneous medium's distance sampling and transmittance against fixed-step marching
+// through the same density, reporting the mean transmittance each estimates over the batch.
+void bench_grid_medium(kernel_bench& bench, const grid_medium& medium, double step, int n) {
+    marched_medium marched(medium, step);
+    bench_hit(bench, "grid_medium::hit", medium, n);
+    bench_hit(bench, "grid_medium::hit fixed-step", marched, n);
+
+    aabb box = medium.bounding_box();
+    point3 center(0.5 * (box.x.min + box.x.max), 0.5 * (box.y.min + box.y.max), 0.5 * (box.z.min + box.z.max));
+    double extent = std::fmax(box.x.size(), std::fmax(box.y.size(), box.z.size()));
+    std::vector<ray> rays = incoherent_rays(n, center, 2 * extent);
+
+    if (bench.selected("grid_medium::transmittance")) {
+        double tracked = 0, stepped = 0;
+        for (int i = 0; i < n; i++) {
+            tracked += medium.transmittance(rays[i], interval(0.001, infinity));
+            stepped += marched.transmittance(rays[i], interval(0.001, infinity));
+        }
+        printf("%-36s %10.4f %10.4f\n", "grid_medium mean T ratio, fixed-step", tracked / n, stepped / n);
+    }
+
+    bench.run("grid_medium::transmittance", n, [&](int i) {
+        return medium.transmittance(rays[i], interval(0.001, infinity));
+    });
+    bench.run("grid_medium::transmittance fixed-step", n, [&](int i) {
+        return marched.transmittance(rays[i], interval(0.001, infinity));
+    });
+}
+
+void bench_aabb(kernel_bench& bench, int n) {
+    aabb box(point3(-1,-1,-1), point3(1,1,1));
+    std::vector<ray> coherent = coherent_rays(n, point3(0.6, 0.4, 4), point3(0,0,0), 0.6);
+    std::vector<ray> incoherent = incoherent_rays(n, point3(0,0,0), 4);
+
+    bench.run("aabb::hit coherent", n, [&](int i) {
+        return box.hit(coherent[i], interval(0.001, infinity)) ? 1.0 : 0.0;
+    });
+    bench.run("aabb::hit incoherent", n, [&](int i) {
+        return box.hit(incoherent[i], interval(0.001, infinity)) ? 1.0 : 0.0;
+    });
+}
+
+// Coherent rays grouped into full packets, tmax reset to the start of the ray.
+std::vector<ray_packet> coherent_packets(int n, const point3& eye, const point3& target, double spread) {
+    std::vector<ray> rays = coherent_rays(n, eye, target, spread);
+    std::vector<ray_packet> packets(n / max_packet_size);
+    for (size_t i = 0; i < packets.size(); i++) {
+        packets[i].size = max_packet_size;
+        for (int lane = 0; lane < max_packet_size; lane++) {
+            packets[i].set(lane, rays[i * max_packet_size + lane], interval(0.001, infinity));
+        }
+    }
+    return packets;
+}
+
+void reset_packet(ray_packet& p) {
+    for (int lane = 0; lane < p.size; lane++) p.tmax[lane] = infinity;
+}
+
+// Benchmark obj.hit_packet under every instruction set the CPU supports, one op per 16 ray packet, after
+// checking that each set hits the same lanes at the same t as the scalar hit.
+void bench_hit_packet(kernel_bench& bench, const std::string& name, const hittable& obj, int n) {
+    aabb box = obj.bounding_box();
+    point3 center(0.5 * (box.x.min + box.x.max), 0.5 * (box.y.min + box.y.max), 0.5 * (box.z.min + box.z.max));
+    double extent = std::fmax(box.x.size(), std::fmax(box.y.size(), box.z.size()));
+    std::vector<ray_packet> packets = coherent_packets(n, center + vec3(0.3, 0.2, 2) * extent, center, 0.6);
+
+    const simd_isa all[] = { simd_isa::scalar, simd_isa::sse42, simd_isa::avx2, simd_isa::avx512 };
+    for (simd_isa isa : all) {
+        if (!set_simd_isa(isa)) continue;
+
+        int mismatches = 0;
+        for (ray_packet& p : packets) {
+            hit_record recs[max_packet_size];
+            reset_packet(p);
+            unsigned hits = obj.hit_packet(p, lane_mask(p.size), recs);
+            for (int lane = 0; lane < p.size; lane++) {
+                hit_record rec;
+                bool hit = obj.hit(p.rays[lane], interval(0.001, infinity), rec);
+                bool packet_hit = (hits >> lane) & 1;
+                if (hit != packet_hit || (hit && rec.t != recs[lane].t)) mismatches++;
+            }
+        }
+        if (mismatches) std::cerr << name << " " << simd_isa_name(isa) << ": " << mismatches << " lanes differ from hit" << std::endl;
+
+        bench.run(name + " x16 " + simd_isa_name(isa), int(packets.size()), [&](int i) {
+            hit_record recs[max_packet_size];
+            reset_packet(packets[i]);
+            return double(obj.hit_packet(packets[i], lane_mask(max_packet_size), recs));
+        });
+    }
+    set_simd_isa(best_simd_isa());
+}
+
+void bench_aabb_packet(kernel_bench& bench, int n) {
+    aabb box(point3(-1,-1,-1), point3(1,1,1));
+    std::vector<ray_packet> packets = coherent_packets(n, point3(0.6, 0.4, 4), point3(0,0,0), 0.6);
+
+    const simd_isa all[] = { simd_isa::scalar, simd_isa::sse42, simd_isa::avx2, simd_isa::avx512 };
+    for (simd_isa isa : all) {
+        if (!simd_supported(isa)) continue;
+        const simd_kernel_table& kernels = simd_table(isa);
+        bench.run(std::string("aabb::hit_packet x16 ") + simd_isa_name(isa), int(packets.size()), [&](int i) {
+            return double(kernels.aabb_hit(box, packets[i]));
+        });
+    }
+}
+
+// One row of 256 pixels of an a-trous pass with taps 4 pixels apart, per instruction set, over noisy color and
+// features with edges. Each set's image must match the scalar set's.
+void bench_atrous(kernel_bench& bench) {
+    const int width = 256, height = 64;
+    const size_t pixels = size_t(width) * height;
+    std::vector<real> planes[13];
+    for (auto& plane : planes) plane.resize(pixels);
+    for (size_t i = 0; i < pixels; i++) {
+        const int x = int(i % width), y = int(i / width);
+        const bool wall = x > width / 2 + y / 4;
+        for (int c = 0; c < 3; c++) planes[c][i] = real(random_double(0, 2));
+        const vec3 n = wall ? vec3(1, 0, 0) : vec3(0, 1, 0);
+        for (int c = 0; c < 3; c++) planes[3 + c][i] = real(n[c]);
+        for (int c = 0; c < 3; c++) planes[6 + c][i] = real(wall ? 0.2 + 0.1 * c : 0.7);
+        planes[9][i] = real(wall ? 4 + 0.01 * x : 9 - 0.02 * y);
+    }
+
+    atrous_pass pass;
+    pass.r = planes[0].data(); pass.g = planes[1].data(); pass.b = planes[2].data();
+    pass.nx = planes[3].data(); pass.ny = planes[4].data(); pass.nz = planes[5].data();
+    pass.ar = planes[6].data(); pass.ag = planes[7].data(); pass.ab = planes[8].data();
+    pass.depth = planes[9].data();
+    pass.width = width;
+    pass.height = height;
+    pass.step = 4;
+    pass.inv_color = real(1 / (4.0 * 4.0));
+    pass.inv_normal = real(1 / (0.3 * 0.3));
+    pass.inv_albedo = real(1 / (0.1 * 0.1));
+    pass.inv_depth = real(1 / (0.1 * 0.1));
+
+    std::vector<real> reference(3 * pixels);
+    pass.out_r = &reference[0]; pass.out_g = &reference[pixels]; pass.out_b = &reference[2 * pixels];
+    simd_table(simd_isa::scalar).atrous_rows(pass, 0, height);
+    pass.out_r = planes[10].data(); pass.out_g = planes[11].data(); pass.out_b = planes[12].data();
+
+    const simd_isa all[] = { simd_isa::scalar, simd_isa::sse42, simd_isa::avx2, simd_isa::avx512 };
+    for (simd_isa isa : all) {
+        if (!simd_supported(isa)) continue;
+        const simd_kernel_table& kernels = simd_table(isa);
+        kernels.atrous_rows(pass, 0, height);
+        int mismatches = 0;
+        for (size_t i = 0; i < pixels; i++) {
+            if (planes[10][i] != reference[i] || planes[11][i] != reference[pixels + i] || planes[12][i] != reference[2 * pixels + i]) mismatches++;
+        }
+        if (mismatches) std::cerr << "atrous_rows " << simd_isa_name(isa) << ": " << mismatches << " pixels differ from scalar" << std::endl;
+
+        bench.run(std::string("atrous_rows 256 px ") + simd_isa_name(isa), height, [&](int i) {
+            kernels.atrous_rows(pass, i, i + 1);
+            return double(pass.out_r[size_t(i) * width]);
+        });
+    }
+}
+
+int main(int argc, const char* argv[]) {
+    kernel_config config;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--rays" && has_value) {
+            config.batch_size = atoi(argv[++i]);
+        } else if (arg == "--reps" && has_value) {
+            config.reps = atoi(argv[++i]);
+        } else if (arg == "--warmup" && has_value) {
+            config.warmup = atoi(argv[++i]);
+        } else if (arg == "--filter" && has_value) {
+            config.filter = argv[++i];
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return -1;
+        }
+    }
+
+    seed_random(1);
+    const int n = config.batch_size;
+    kernel_bench bench(config);
+    bench.header();
+
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+
+    // Intersection kernels
+    sphere ball(point3(0,0,0), 1, white);
+    sphere moving_ball(point3(0,0,0), point3(0,0.5,0), 1, white);
+    quad square(point3(-1,-1,0), vec3(2,0,0), vec3(0,2,0), white);
+    tri triangle(point3(-1,-1,0), vec3(2,0,0), vec3(0,2,0), white);
+    oriented_box cube(point3(-1,-1,-1), point3(1,1,1), white);
+    constant_medium fog(box(point3(-1,-1,-1), point3(1,1,1), white), 0.5, color(1,1,1));
+    constant_medium fog_ball(make_shared<sphere>(point3(0,0,0), 1, white), 0.5, color(1,1,1));
+
+    bench_hit(bench, "sphere::hit", ball, n);
+    bench_hit(bench, "sphere::hit moving", moving_ball, n);
+    bench_hit(bench, "quad::hit", square, n);
+    bench_hit(bench, "tri::hit", triangle, n);
+    bench_hit(bench, "oriented_box::hit", cube, n);
+    bench_aabb(bench, n);
+    bench_hit(bench, "constant_medium::hit", fog, n);
+    bench_hit(bench, "constant_medium::hit sphere", fog_ball, n);
+
+    // The cloud from scene 16, marched in half voxel steps
+    grid_medium cloud(density_grid::perlin_cloud(64, 3, 0.15), point3(-5,0.5,-5), point3(5,6.5,5), 40, color(1,1,1));
+    bench_grid_medium(bench, cloud, 0.5 * 10 / 63, n);
+
+    // Packet kernels per instruction set
+    bench_hit_packet(bench, "sphere::hit_packet", ball, n);
+    bench_hit_packet(bench, "sphere::hit_packet moving", moving_ball, n);
+    bench_hit_packet(bench, "quad::hit_packet", square, n);
+    bench_hit_packet(bench, "tri::hit_packet", triangle, n);
+    bench_aabb_packet(bench, n);
+    bench_atrous(bench);
+
+    // Shading kernels
+    perlin noise;
+    std::vector<point3> points = random_points(n, 8);
+    bench.run("perlin::noise", n, [&](int i) { return noise.noise(points[i]); });
+    bench.run("perlin::turbulance depth 7", n, [&](int i) { return noise.turbulance(points[i], 7); });
+
+    image_texture diamond("textures/diamond.jpg");
+    image_texture moon("textures/moon_texture.jpeg");
+    std::vector<point3> uvs = random_points(n, 1);
+    bench.run("image_texture::value small", n, [&](int i) {
+        return diamond.value(std::fabs(uvs[i].x()), std::fabs(uvs[i].y()), uvs[i]).x();
+    });
+    bench.run("image_texture::value large", n, [&](int i) {
+        return moon.value(std::fabs(uvs[i].x()), std::fabs(uvs[i].y()), uvs[i]).x();
+    });
+    // A minified lookup, the footprint three texels across so it blends mip levels 1 and 2
+    std::vector<hit_record> footprints(n);
+    for (int i = 0; i < n; i++) {
+        footprints[i].u = std::fabs(uvs[i].x());
+        footprints[i].v = std::fabs(uvs[i].y());
+        footprints[i].dudx = 3.0 / 800;
+        footprints[i].dvdy = 3.0 / 400;
+    }
+    bench.run("image_texture::value footprint", n, [&](int i) {
+        return moon.value(footprints[i]).x();
+    });
+
+    std::ostringstream out;
+    std::vector<color> colors = random_points(n, 1);
+    bench.run("write_color", n, [&](int i) {
+        if (i == 0) out.str("");
+        write_color(out, colors[i]);
+        return 0.0;
+    });
+}
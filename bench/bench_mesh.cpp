@@ -0,0 +1,322 @@
+/**
+ * Casey Gehling
+ *
+ * Load time benchmark for triangle meshes. Builds a large OBJ file out of copies of models/teapot.obj and
+ * models/sword.obj laid out on a grid, then times getting it ready to render each way: tinyobjloader into tris
+ * and a bvh_node, the parallel OBJ parser into a triangle_mesh, and mapping the mesh file written from that, with
+ * and without its BVH, and parsing again with the BVH taken from the BVH cache. Each is checked against the
+ * others by tracing the same rays through them. Then compares the cost of tracing rays through BVHs built with
+ * and without spatial splits, for each model alone and for the tiled file.
+ *
+ * Usage (from the repository root, so the models resolve):
+ *   ./bench/bench_mesh [--copies 64] [--reps 3] [--threads 0] [--dir /tmp] [--keep]
+ */
+
+#include "../scenes.h"
+
+#include <dirent.h>
+#include <fstream>
+#include <functional>
+#include <sstream>
+
+struct mesh_config {
+    int copies = 64; // of each model
+    int reps = 3;
+    int threads = 0;
+    std::string directory = "/tmp";
+    bool keep = false; // leave the generated files behind
+};
+
+// Lines of an OBJ file, split into its vertices and its faces
+struct obj_lines {
+    std::vector<std::string> vertices, faces;
+    int vertex_count = 0;
+};
+
+obj_lines read_obj(const std::string& path) {
+    obj_lines obj;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, 2, "v ") == 0) {
+            obj.vertices.push_back(line);
+            obj.vertex_count++;
+        } else if (line.compare(0, 2, "f ") == 0) {
+            obj.faces.push_back(line);
+        }
+    }
+    return obj;
+}
+
+// Write copies of each model side by side, each copy's vertices moved over and its face indices renumbered
+bool write_tiled_obj(const std::string& path, const std::vector<obj_lines>& models, int copies) {
+    std::ofstream out(path);
+    if (!out) return false;
+    const int side = int(std::ceil(std::sqrt(double(copies * models.size()))));
+    int copy = 0, vertex_base = 0;
+    for (int c = 0; c < copies; c++) {
+        for (const auto& model : models) {
+            const double dx = 4.0 * (copy % side), dz = 4.0 * (copy / side);
+            copy++;
+            out << "o copy_" << copy << "\n";
+            for (const auto& line : model.vertices) {
+                std::istringstream fields(line.substr(2));
+                double x, y, z;
+                fields >> x >> y >> z;
+                out << "v " << x + dx << " " << y << " " << z + dz << "\n";
+            }
+            for (const auto& line : model.faces) {
+                std::istringstream fields(line.substr(2));
+                std::string token;
+                out << "f";
+                while (fields >> token) {
+                    const size_t slash = token.find('/');
+                    const int index = atoi(token.substr(0, slash).c_str()) + vertex_base;
+                    out << " " << index << (slash == std::string::npos ? "" : token.substr(slash));
+                }
+                out << "\n";
+            }
+            vertex_base += model.vertex_count;
+        }
+    }
+    return bool(out);
+}
+
+// Seconds for the fastest of reps calls of load, keeping the last result
+template <typename T>
+double time_load(int reps, std::function<T()> load, T& result) {
+    double best = infinity;
+    for (int rep = 0; rep < reps; rep++) {
+        auto start = profile_clock::now();
+        result = load();
+        best = std::min(best, std::chrono::duration<double>(profile_clock::now() - start).count());
+    }
+    return best;
+}
+
+// Sum of the distances to the nearest hit over a fixed set of rays into box, to compare meshes loaded different ways
+double trace_sum(const hittable& object, const aabb& box) {
+    seed_random(7);
+    const point3 center(box.x.min + box.x.size() / 2, box.y.min + box.y.size() / 2, box.z.min + box.z.size() / 2);
+    const vec3 size(box.x.size(), box.y.size(), box.z.size());
+    double sum = 0;
+    for (int i = 0; i < 20000; i++) {
+        // From all around, at random points of the box
+        const point3 origin = center + size.length() * random_unit_vector();
+        const vec3 r = vec3::random(-0.5, 0.5);
+        const point3 target = center + vec3(r.x() * size.x(), r.y() * size.y(), r.z() * size.z());
+        hit_record rec;
+        if (object.hit(ray(origin, target - origin, 0), interval(0.001, infinity), rec)) sum += rec.t;
+    }
+    return sum;
+}
+
+// Nodes visited and triangles tested per ray by trace_sum, and how long it took
+void traversal_report(const std::string& name, const hittable& object, const aabb& box, size_t triangles, size_t references) {
+    thread_counters() = traversal_counters();
+    auto start = profile_clock::now();
+    const double checksum = trace_sum(object, box);
+    const double seconds = std::chrono::duration<double>(profile_clock::now() - start).count();
+    printf("%-34s %9zu refs (+%4.1f%%) %7.1f nodes/ray %7.1f tests/ray %7.3f s   checksum %.6f\n", name.c_str(),
+        references, 100.0 * (double(references) / triangles - 1), thread_counters().node_visits / 20000.0,
+        thread_counters().prim_tests / 20000.0, seconds, checksum);
+}
+
+// Traversal cost of the model at path with an object split BVH and with spatial splits
+void compare_splits(const std::string& name, const std::string& path, shared_ptr<material> mat, int threads) {
+    mesh_build_options spatial;
+    spatial.spatial_splits = true;
+    auto objects = parse_obj(path, mat, threads, mesh_build_options());
+    auto start = profile_clock::now();
+    auto split = parse_obj(path, mat, threads, spatial);
+    const double spatial_seconds = std::chrono::duration<double>(profile_clock::now() - start).count();
+    if (!objects || !split) return;
+
+    printf("%s (%zu triangles, spatial split build and parse %.3f s)\n", name.c_str(), objects->triangles(), spatial_seconds);
+    const aabb box = objects->bounding_box();
+    traversal_report("  object splits", *objects, box, objects->triangles(), objects->references());
+    traversal_report("  spatial splits", *split, box, split->triangles(), split->references());
+}
+
+// A mesh of long thin triangles, one of them held twice, built with spatial splits so references repeat too. Written
+// without its BVH, from the built mesh, the mapped file and a BVH from the cache, every triangle must be written
+// once, the held twice one twice, and trace the same as the built mesh.
+bool check_repeated_triangle(const std::string& directory, shared_ptr<material> mat) {
+    std::vector<float> positions;
+    std::vector<uint32_t> indices;
+    for (int i = 0; i < 400; i++) {
+        const float x = float(i % 20), z = float(i / 20);
+        const float corners[9] = { x, 0, z, x + 9, 1, z + 6, x + 0.3f, 0.2f, z };
+        positions.insert(positions.end(), corners, corners + 9);
+        for (uint32_t k = 0; k < 3; k++) indices.push_back(3 * uint32_t(i) + k);
+    }
+    const std::vector<uint32_t> repeated(indices.begin() + 3 * 17, indices.begin() + 3 * 18);
+    indices.insert(indices.end(), repeated.begin(), repeated.end());
+    const size_t triangles = indices.size() / 3;
+
+    mesh_build_options spatial;
+    spatial.spatial_splits = true;
+    const std::string cache_directory = directory + "/repeated_bvh_cache";
+    bvh_cache::global().set_directory(cache_directory);
+    triangle_mesh built(positions, indices, mat, spatial);
+    triangle_mesh cached(positions, indices, mat, spatial);
+    bvh_cache::global().set_directory("");
+    const aabb box = built.bounding_box();
+    const double expected = trace_sum(built, box);
+
+    const std::string mesh_path = directory + "/repeated.rmesh", bare_path = directory + "/repeated_bare.rmesh";
+    bool ok = built.references() > triangles && cached.bvh_from_cache() && built.write(mesh_path);
+    auto mapped = ok ? triangle_mesh::open(mesh_path, mat) : nullptr;
+    const triangle_mesh* sources[] = { &built, mapped.get(), &cached };
+    for (const triangle_mesh* source : sources) {
+        if (!ok || !source) {
+            ok = false;
+            break;
+        }
+        auto bare = source->write(bare_path, false) ? triangle_mesh::open(bare_path, mat) : nullptr;
+        ok = bare && bare->triangles() == triangles && bare->references() == triangles && trace_sum(*bare, box) == expected;
+    }
+    printf("%-34s %9zu triangles, %zu refs: %s\n", "repeated triangle, written bare", triangles, built.references(),
+        ok ? "every triangle read back" : "FAILED");
+    remove(mesh_path.c_str());
+    remove(bare_path.c_str());
+    if (DIR* dir = opendir(cache_directory.c_str())) {
+        while (dirent* entry = readdir(dir)) {
+            if (entry->d_name[0] != '.') remove((cache_directory + "/" + entry->d_name).c_str());
+        }
+        closedir(dir);
+        rmdir(cache_directory.c_str());
+    }
+    return ok;
+}
+
+void report(const std::string& name, double seconds, size_t triangles, double checksum) {
+    printf("%-34s %9.3f s %9.2f Mtri/s   checksum %.6f\n", name.c_str(), seconds, triangles / seconds / 1e6, checksum);
+}
+
+int main(int argc, const char* argv[]) {
+    mesh_config config;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--copies" && has_value) {
+            config.copies = atoi(argv[++i]);
+        } else if (arg == "--reps" && has_value) {
+            config.reps = atoi(argv[++i]);
+        } else if (arg == "--threads" && has_value) {
+            config.threads = atoi(argv[++i]);
+        } else if (arg == "--dir" && has_value) {
+            config.directory = argv[++i];
+        } else if (arg == "--keep") {
+            config.keep = true;
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return -1;
+        }
+    }
+
+    const std::string obj_path = config.directory + "/bench_mesh.obj";
+    const std::string mesh_path = config.directory + "/bench_mesh.rmesh";
+    const std::string bare_path = config.directory + "/bench_mesh_no_bvh.rmesh";
+    std::vector<obj_lines> models = { read_obj("models/teapot.obj"), read_obj("models/sword.obj") };
+    if (models[0].faces.empty() || models[1].faces.empty() || !write_tiled_obj(obj_path, models, config.copies)) {
+        std::cerr << "ERROR: Could not write " << obj_path << " from the models." << std::endl;
+        return 1;
+    }
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    const std::string bvh_directory = config.directory + "/bench_mesh_bvh";
+    bvh_cache::global().set_directory(""); // timed further down
+
+    shared_ptr<triangle_mesh> parsed;
+    double parse_seconds = time_load<shared_ptr<triangle_mesh>>(config.reps, [&]() {
+        return parse_obj(obj_path, white, config.threads);
+    }, parsed);
+    if (!parsed) return 1;
+    const size_t triangles = parsed->triangles();
+    const aabb box = parsed->bounding_box();
+
+    std::ifstream obj_size(obj_path, std::ios::binary | std::ios::ate);
+    printf("%d copies of teapot.obj and sword.obj: %zu vertices, %zu triangles, %.1f MB of OBJ\n",
+        config.copies, parsed->vertices(), triangles, double(obj_size.tellg()) / (1 << 20));
+
+    std::clog.setstate(std::ios::failbit); // mesh() reports every load
+    shared_ptr<hittable> reference;
+    double tinyobj_seconds = time_load<shared_ptr<hittable>>(config.reps, [&]() -> shared_ptr<hittable> {
+        return make_shared<bvh_node>(*mesh(obj_path, white));
+    }, reference);
+    std::clog.clear();
+    report("tinyobj + tris + bvh_node", tinyobj_seconds, triangles, trace_sum(*reference, box));
+    reference.reset();
+
+    report("parse_obj + triangle_mesh", parse_seconds, triangles, trace_sum(*parsed, box));
+
+    // Once to store the BVH, then timed taking it from the cache
+    bvh_cache::global().set_directory(bvh_directory);
+    shared_ptr<triangle_mesh> cached = parse_obj(obj_path, white, config.threads);
+    double cached_seconds = time_load<shared_ptr<triangle_mesh>>(config.reps, [&]() {
+        return parse_obj(obj_path, white, config.threads);
+    }, cached);
+    bvh_cache::global().set_directory("");
+    if (!cached || !cached->bvh_from_cache()) {
+        std::cerr << "ERROR: The BVH wasn't taken from " << bvh_directory << "." << std::endl;
+        return 1;
+    }
+    report("parse_obj, BVH from cache", cached_seconds, triangles, trace_sum(*cached, box));
+    cached.reset();
+
+    bool written = false;
+    double write_seconds = time_load<bool>(config.reps, [&]() {
+        return parsed->write(mesh_path) && parsed->write(bare_path, false);
+    }, written);
+    if (!written) {
+        std::cerr << "ERROR: Could not write " << mesh_path << "." << std::endl;
+        return 1;
+    }
+    std::ifstream mesh_size(mesh_path, std::ios::binary | std::ios::ate);
+    printf("%-34s %9.3f s   %.1f MB, %.1f bytes/triangle\n", "write .rmesh (with and without BVH)", write_seconds,
+        double(mesh_size.tellg()) / (1 << 20), parsed->bytes_per_triangle());
+
+    shared_ptr<triangle_mesh> bare;
+    double bare_seconds = time_load<shared_ptr<triangle_mesh>>(config.reps, [&]() {
+        return triangle_mesh::open(bare_path, white);
+    }, bare);
+    if (!bare) return 1;
+    report("map .rmesh, build BVH", bare_seconds, triangles, trace_sum(*bare, box));
+
+    // The first trace after mapping pays for faulting the file's pages in, so it is timed with the load
+    shared_ptr<triangle_mesh> mapped;
+    double checksum = 0;
+    double map_seconds = time_load<shared_ptr<triangle_mesh>>(config.reps, [&]() {
+        return triangle_mesh::open(mesh_path, white);
+    }, mapped);
+    if (!mapped) return 1;
+    auto start = profile_clock::now();
+    checksum = trace_sum(*mapped, box);
+    double first_trace = std::chrono::duration<double>(profile_clock::now() - start).count();
+    report("map .rmesh with BVH", map_seconds, triangles, checksum);
+    printf("%-34s %9.3f s\n", "  first 20000 rays after mapping", first_trace);
+    mapped.reset();
+    bare.reset();
+    parsed.reset();
+
+    if (!check_repeated_triangle(config.directory, white)) return 1;
+
+    printf("\nTraversal cost, 20000 rays\n");
+    compare_splits("sword.obj", "models/sword.obj", white, config.threads);
+    compare_splits("teapot.obj", "models/teapot.obj", white, config.threads);
+    compare_splits("tiled", obj_path, white, config.threads);
+
+    if (!config.keep) {
+        remove(obj_path.c_str());
+        remove(mesh_path.c_str());
+        remove(bare_path.c_str());
+        if (DIR* dir = opendir(bvh_directory.c_str())) {
+            while (dirent* entry = readdir(dir)) {
+                if (entry->d_name[0] != '.') remove((bvh_directory + "/" + entry->d_name).c_str());
+            }
+            closedir(dir);
+            rmdir(bvh_directory.c_str());
+        }
+    }
+}
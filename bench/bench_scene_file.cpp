@@ -0,0 +1,208 @@
+/**
+ * Casey Gehling
+ *
+ * Scene file load time. Writes a large scene file, in text and in binary: many spheres with a palette of
+ * materials, generated meshes each placed several times as instances, and textures naming the same few images
+ * again and again. Then it times reading each form, and building the scene with its assets loaded on one thread
+ * and on all of them. The same rays are traced through every build, which must find the same hits. The mesh BVHs
+ * are built each time unless --bvh-cache is given.
+ *
+ * Usage (from the repository root, so the images resolve):
+ *   ./bench/bench_scene_file [--spheres 200000] [--meshes 8] [--triangles 40000] [--instances 4] [--textures 64]
+ *                            [--threads 0] [--dir /tmp/bench_scene_file] [--bvh-cache]
+ */
+
+#include "../scene_file.h"
+
+#include <sys/stat.h>
+
+struct scene_file_config {
+    int spheres = 200000;
+    int meshes = 8;
+    int triangles = 40000; // about, per mesh
+    int instances = 4; // of each mesh
+    int textures = 64;
+    int threads = 0;
+    std::string directory = "/tmp/bench_scene_file";
+    bool bvh_cache = false;
+};
+
+double seconds_since(profile_clock::time_point start) {
+    return std::chrono::duration<double>(profile_clock::now() - start).count();
+}
+
+// Random number that a float holds exactly, as exporters write them
+double random_value(double min, double max) {
+    return double(float(random_double(min, max)));
+}
+
+// A lumpy sphere of about triangles triangles, as an OBJ file
+bool write_blob(const std::string& path, int triangles) {
+    const int rows = std::max(4, int(std::sqrt(triangles / 2.0)));
+    FILE* out = fopen(path.c_str(), "w");
+    if (!out) return false;
+    const double lumps = random_double(2, 6), depth = random_double(0.05, 0.2);
+    for (int j = 0; j <= rows; j++) {
+        const double theta = pi * j / rows;
+        for (int i = 0; i < rows; i++) {
+            const double phi = 2 * pi * i / rows;
+            const double r = 1 + depth * std::sin(lumps * theta) * std::cos(lumps * phi);
+            fprintf(out, "v %.6f %.6f %.6f\n", r * std::sin(theta) * std::cos(phi), r * std::cos(theta),
+                r * std::sin(theta) * std::sin(phi));
+        }
+    }
+    for (int j = 0; j < rows; j++) {
+        for (int i = 0; i < rows; i++) {
+            const int a = j * rows + i + 1, b = j * rows + (i + 1) % rows + 1;
+            fprintf(out, "f %d %d %d\nf %d %d %d\n", a, b, a + rows, b, b + rows, a + rows);
+        }
+    }
+    return fclose(out) == 0;
+}
+
+// Distances to the nearest hits of rays, summed
+double trace(const hittable& world, const std::vector<ray>& rays) {
+    double sum = 0;
+    for (const ray& r : rays) {
+        hit_record rec;
+        if (world.hit(r, interval(0.001, infinity), rec)) sum += rec.t;
+    }
+    return sum;
+}
+
+size_t file_size(const std::string& path) {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 ? size_t(info.st_size) : 0;
+}
+
+int main(int argc, const char* argv[]) {
+    scene_file_config config;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--spheres" && has_value) {
+            config.spheres = atoi(argv[++i]);
+        } else if (arg == "--meshes" && has_value) {
+            config.meshes = atoi(argv[++i]);
+        } else if (arg == "--triangles" && has_value) {
+            config.triangles = atoi(argv[++i]);
+        } else if (arg == "--instances" && has_value) {
+            config.instances = atoi(argv[++i]);
+        } else if (arg == "--textures" && has_value) {
+            config.textures = atoi(argv[++i]);
+        } else if (arg == "--threads" && has_value) {
+            config.threads = atoi(argv[++i]);
+        } else if (arg == "--dir" && has_value) {
+            config.directory = argv[++i];
+        } else if (arg == "--bvh-cache") {
+            config.bvh_cache = true;
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return -1;
+        }
+    }
+    if (!config.bvh_cache) bvh_cache::global().set_directory("");
+    mkdir(config.directory.c_str(), 0755);
+
+    // The scene
+    seed_random(1);
+    const char* images[] = { "textures/moon_texture.jpeg", "textures/diamond.jpg", "skybox/front.jpg",
+        "skybox/left.jpg", "skybox/right.jpg", "skybox/top.jpg" };
+    std::ostringstream text;
+    text.precision(9); // enough for every float to read back the same
+    text << "# Generated by bench_scene_file\n";
+    text << "camera aspect_ratio 16/9 width 400 spp 16 max_depth 20 background 0.7 0.8 1\n";
+    text << "camera vfov 40 lookfrom 0 30 120 lookat 0 2 0\n";
+    for (int t = 0; t < config.textures; t++) {
+        text << "texture image" << t << " image " << images[t % 6] << "\n";
+        text << "material textured" << t << " lambertian image" << t << "\n";
+    }
+    for (int m = 0; m < 16; m++) {
+        if (m % 4 == 3) text << "material plain" << m << " metal " << random_value(0.5, 1) << ' ' << random_value(0.5, 1) << ' ' << random_value(0.5, 1) << ' ' << random_value(0, 0.3) << "\n";
+        else text << "material plain" << m << " lambertian " << random_value(0.1, 0.9) << ' ' << random_value(0.1, 0.9) << ' ' << random_value(0.1, 0.9) << "\n";
+    }
+    for (int m = 0; m < config.meshes; m++) {
+        const std::string path = config.directory + "/blob" + std::to_string(m) + ".obj";
+        if (!write_blob(path, config.triangles)) {
+            std::cerr << "ERROR: Could not write " << path << std::endl;
+            return -1;
+        }
+        text << "object blob" << m << " mesh " << path << " plain" << m % 16 << "\n";
+        for (int k = 0; k < config.instances; k++) {
+            text << "instance blob" << m << " rotate_y " << random_value(0, 360) << " translate "
+                 << random_value(-60, 60) << ' ' << random_value(2, 6) << ' ' << random_value(-60, 60) << "\n";
+        }
+    }
+    for (int s = 0; s < config.spheres; s++) {
+        const bool textured = config.textures > 0 && s % 8 == 0;
+        text << "sphere " << random_value(-60, 60) << ' ' << random_value(0, 8) << ' ' << random_value(-60, 60) << ' '
+             << random_value(0.1, 0.5) << (textured ? " textured" : " plain") << (textured ? s % config.textures : s % 16) << "\n";
+    }
+    text << "sphere 0 -1000 0 1000 plain0\n";
+
+    const std::string text_path = config.directory + "/large.scene", binary_path = config.directory + "/large.rscene";
+    {
+        std::ofstream out(text_path);
+        out << text.str();
+    }
+    scene_file converted;
+    if (!converted.read(text_path) || !converted.write(binary_path)) return -1;
+
+    std::vector<ray> rays;
+    for (int i = 0; i < 20000; i++) {
+        const point3 origin(random_double(-80, 80), 40, random_double(-80, 80));
+        const point3 target(random_double(-60, 60), random_double(0, 8), random_double(-60, 60));
+        rays.push_back(ray(origin, target - origin, 0));
+    }
+
+    std::clog.setstate(std::ios::failbit); // mesh loads are reported
+
+    // Reading each form
+    auto start = profile_clock::now();
+    scene_file from_text;
+    if (!from_text.read(text_path)) return -1;
+    const double text_seconds = seconds_since(start);
+    start = profile_clock::now();
+    scene_file from_binary;
+    if (!from_binary.read(binary_path)) return -1;
+    const double binary_seconds = seconds_since(start);
+
+    // Building it, once to bring the files into memory, then with assets on one thread and on all
+    struct build_result {
+        scene_load_stats stats;
+        double seconds, hits;
+    };
+    auto build = [&](scene_file& file, int threads) {
+        build_result result;
+        file.num_threads = threads;
+        camera cam;
+        hittable_list world;
+        seed_random(1);
+        const auto start = profile_clock::now();
+        if (!file.build(cam, world, &result.stats)) exit(EXIT_FAILURE);
+        result.seconds = seconds_since(start);
+        result.hits = trace(world, rays);
+        return result;
+    };
+    build(from_text, config.threads);
+    const build_result serial = build(from_text, 1);
+    const build_result parallel = build(from_binary, config.threads);
+    std::clog.clear();
+
+    const int thread_count = config.threads > 0 ? config.threads : int(std::max(1u, std::thread::hardware_concurrency()));
+    printf("%zu statements: %d spheres, %d meshes of about %d triangles placed %d times each, %d textures of %zu images\n",
+        from_text.statement_count(), config.spheres, config.meshes, config.triangles, config.instances, config.textures,
+        parallel.stats.images);
+    printf("%-26s %8.3f s  %6.1f MB  %6.2f M statements/s\n", "read text", text_seconds,
+        file_size(text_path) / 1048576.0, from_text.statement_count() / text_seconds / 1e6);
+    printf("%-26s %8.3f s  %6.1f MB  %6.2f M statements/s\n", "read binary", binary_seconds,
+        file_size(binary_path) / 1048576.0, from_binary.statement_count() / binary_seconds / 1e6);
+    printf("%-26s %8.3f s  (%.3f s assets, %.3f s the rest)\n", "build, assets on 1 thread", serial.seconds,
+        serial.stats.asset_seconds, serial.stats.build_seconds);
+    printf("build, assets on %-2d threads %8.3f s  (%.3f s assets, %.3f s the rest)\n", thread_count, parallel.seconds,
+        parallel.stats.asset_seconds, parallel.stats.build_seconds);
+    const bool same = serial.hits == parallel.hits;
+    printf("%s\n", same ? "both builds found the same hits" : "builds found different hits");
+    return same ? 0 : 1;
+}
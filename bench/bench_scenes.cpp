@@ -0,0 +1,322 @@
+/**
+ * Casey Gehling
+ *
+ * Reproducible benchmark over the built-in scenes. Every scene is rendered with a fixed seed,
+ * resolution, sample count and thread count, and timed. Results are written as JSON so runs can be
+ * compared across commits.
+ *
+ * Usage (from the repository root, so scene assets resolve):
+ *   ./bench/bench_scenes [--width 200] [--spp 16] [--threads 1] [--seed 1] [--scenes 1,5,8]
+ *                        [--depth <max bounces, 1 for primary visibility only>] [--packet 1|4|8|16]
+ *                        [--integrator recursive|wavefront] [--denoise] [--simd scalar|sse4.2|avx2|avx512]
+ *                        [--texture-budget <MB>] [--texture-cache <dir>|off] [--bvh-cache <dir>|off]
+ *                        [--sbvh] [--motion-segments <n, 0 for union bounds>]
+ *                        [--references bench/references] [--write-references] [--label <name>]
+ *                        [--out bench_results.json]
+ */
+
+#include "../scenes.h"
+
+#include <fstream>
+#include <sstream>
+#include <sys/resource.h>
+
+struct bench_config {
+    int width = 200;
+    int spp = 16;
+    int threads = 1;
+    uint64_t seed = 1;
+    int depth = 0; // 0 keeps each scene's max_depth
+    int packet = 1;
+    std::string integrator = "recursive";
+    bool denoise = false;
+    simd_isa simd = best_simd_isa();
+    double texture_budget_mb = 0; // 0 keeps the texture cache's default
+    std::string texture_files = texture_cache::default_file_directory(); // empty decodes every image
+    std::string bvh_files = bvh_cache::default_directory(); // empty builds every mesh BVH
+    bool sbvh = false; // spatial splits in mesh BVHs
+    int motion_segments = sphere_set::motion_segments(); // time segments of sphere sets with moving spheres
+    std::vector<int> scene_ids;
+    std::string reference_dir = "bench/references";
+    bool write_references = false;
+    std::string label;
+    std::string out_file = "bench_results.json";
+};
+
+struct bench_result {
+    int id;
+    std::string name;
+    int width, height;
+    double build_seconds;
+    render_stats stats;
+    texture_cache_stats textures; // loads and evictions during this scene
+    bvh_cache_stats bvhs; // mesh BVHs built and mapped while building this scene
+    long peak_rss_kb;
+    uint64_t checksum;
+    double psnr; // against the stored reference, negative when there is none
+};
+
+// Peak resident set size of this process so far.
+long peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+// Quantize a framebuffer exactly as write_color does.
+std::vector<unsigned char> to_bytes(const std::vector<color>& framebuffer) {
+    std::vector<unsigned char> bytes;
+    bytes.reserve(framebuffer.size() * 3);
+    for (const auto& c : framebuffer) {
+        bytes.push_back(color_byte(c.x()));
+        bytes.push_back(color_byte(c.y()));
+        bytes.push_back(color_byte(c.z()));
+    }
+    return bytes;
+}
+
+// FNV-1a over the quantized image.
+uint64_t checksum(const std::vector<unsigned char>& bytes) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (auto b : bytes) {
+        hash ^= b;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+bool read_ppm(const std::string& filename, int& width, int& height, std::vector<unsigned char>& bytes) {
+    std::ifstream in(filename);
+    std::string magic;
+    int max_value;
+    if (!(in >> magic >> width >> height >> max_value) || magic != "P3") return false;
+
+    bytes.resize(size_t(width) * height * 3);
+    for (auto& b : bytes) {
+        int v;
+        if (!(in >> v)) return false;
+        b = (unsigned char)v;
+    }
+    return true;
+}
+
+bool write_ppm(const std::string& filename, int width, int height, const std::vector<color>& framebuffer) {
+    std::ofstream out(filename);
+    if (!out) return false;
+    out << "P3\n" << width << ' ' << height << "\n255\n";
+    for (const auto& c : framebuffer) write_color(out, c);
+    return true;
+}
+
+double psnr(const std::vector<unsigned char>& a, const std::vector<unsigned char>& b) {
+    double mse = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        double d = double(a[i]) - double(b[i]);
+        mse += d * d;
+    }
+    mse /= a.size();
+    return (mse == 0) ? 99.0 : 10 * std::log10(255.0 * 255.0 / mse);
+}
+
+bench_result run_scene(int id, const bench_config& config) {
+    bench_result result;
+    result.id = id;
+    result.name = scenes[id - 1].name;
+
+    // Scene construction consumes random numbers too (perlin tables), so seed it as well.
+    seed_random(config.seed);
+    texture_cache::global().reset_stats();
+    bvh_cache::global().reset_stats();
+    camera cam;
+    auto build_start = profile_clock::now();
+    hittable_list world = scenes[id - 1].build(cam);
+    result.build_seconds = std::chrono::duration<double>(profile_clock::now() - build_start).count();
+    result.bvhs = bvh_cache::global().stats();
+
+    cam.image_width = config.width;
+    cam.samples_per_pixel = config.spp;
+    cam.num_threads = config.threads;
+    cam.seed = config.seed;
+    cam.packet_size = config.packet;
+    cam.integrator = (config.integrator == "wavefront") ? integrator_type::wavefront : integrator_type::recursive;
+    cam.denoise = config.denoise;
+    cam.show_progress = false;
+    if (config.depth > 0) cam.max_depth = config.depth;
+
+    std::vector<color> framebuffer = cam.render_framebuffer(world);
+    result.width = config.width;
+    result.height = cam.height();
+    result.stats = cam.stats;
+    result.textures = texture_cache::global().stats();
+    result.peak_rss_kb = peak_rss_kb();
+
+    std::vector<unsigned char> bytes = to_bytes(framebuffer);
+    result.checksum = checksum(bytes);
+    result.psnr = -1;
+
+    std::string reference = config.reference_dir + "/" + result.name + ".ppm";
+    if (config.write_references) {
+        if (!write_ppm(reference, result.width, result.height, framebuffer)) {
+            std::cerr << "Could not write reference " << reference << std::endl;
+        }
+    } else {
+        int ref_width, ref_height;
+        std::vector<unsigned char> ref_bytes;
+        if (read_ppm(reference, ref_width, ref_height, ref_bytes)) {
+            if (ref_width == result.width && ref_height == result.height) {
+                result.psnr = psnr(bytes, ref_bytes);
+            } else {
+                std::cerr << "Reference " << reference << " has a different resolution, skipping PSNR" << std::endl;
+            }
+        }
+    }
+
+    return result;
+}
+
+void write_json(std::ostream& out, const bench_config& config, const std::vector<bench_result>& results) {
+    out << "{\n";
+    out << "  \"label\": \"" << config.label << "\",\n";
+    out << "  \"config\": {\"width\": " << config.width << ", \"spp\": " << config.spp
+        << ", \"threads\": " << config.threads << ", \"seed\": " << config.seed
+        << ", \"depth\": " << config.depth << ", \"packet\": " << config.packet
+        << ", \"integrator\": \"" << config.integrator << "\", \"denoise\": " << (config.denoise ? "true" : "false")
+        << ", \"texture_budget_bytes\": " << texture_cache::global().budget()
+        << ", \"texture_files\": \"" << config.texture_files << "\""
+        << ", \"bvh_files\": \"" << config.bvh_files << "\""
+        << ", \"sbvh\": " << (config.sbvh ? "true" : "false")
+        << ", \"motion_segments\": " << config.motion_segments << "},\n";
+    out << "  \"scenes\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const bench_result& r = results[i];
+        std::ostringstream hash;
+        hash << std::hex << r.checksum;
+        out << "    {\"id\": " << r.id << ", \"name\": \"" << r.name << "\""
+            << ", \"width\": " << r.width << ", \"height\": " << r.height
+            << ", \"build_seconds\": " << r.build_seconds
+            << ", \"render_seconds\": " << r.stats.seconds
+            << ", \"denoise_seconds\": " << r.stats.denoise_seconds
+            << ", \"rays\": " << r.stats.rays
+            << ", \"mrays_per_second\": " << r.stats.mrays_per_second()
+            << ", \"node_visits\": " << r.stats.node_visits
+            << ", \"prim_tests\": " << r.stats.prim_tests
+            << ", \"texture_lookups\": " << r.stats.texture_lookups
+            << ", \"texture_misses\": " << r.stats.texture_misses
+            << ", \"texture_loads\": " << r.textures.loads
+            << ", \"texture_evictions\": " << r.textures.evictions
+            << ", \"texture_peak_bytes\": " << r.textures.peak_bytes
+            << ", \"texture_files_mapped\": " << r.textures.files_mapped
+            << ", \"texture_files_written\": " << r.textures.files_written
+            << ", \"texture_load_seconds\": " << r.textures.load_seconds
+            << ", \"bvh_builds\": " << r.bvhs.builds
+            << ", \"bvh_build_seconds\": " << r.bvhs.build_seconds
+            << ", \"bvh_files_mapped\": " << r.bvhs.hits
+            << ", \"peak_rss_kb\": " << r.peak_rss_kb
+            << ", \"checksum\": \"" << hash.str() << "\"";
+        if (r.psnr >= 0) out << ", \"psnr\": " << r.psnr;
+        out << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+int main(int argc, const char* argv[]) {
+    bench_config config;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--width" && has_value) {
+            config.width = atoi(argv[++i]);
+        } else if (arg == "--spp" && has_value) {
+            config.spp = atoi(argv[++i]);
+        } else if (arg == "--threads" && has_value) {
+            config.threads = atoi(argv[++i]);
+        } else if (arg == "--seed" && has_value) {
+            config.seed = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--depth" && has_value) {
+            config.depth = atoi(argv[++i]);
+        } else if (arg == "--packet" && has_value) {
+            config.packet = atoi(argv[++i]);
+        } else if (arg == "--integrator" && has_value) {
+            config.integrator = argv[++i];
+        } else if (arg == "--denoise") {
+            config.denoise = true;
+        } else if (arg == "--simd" && has_value) {
+            if (!parse_simd_isa(argv[++i], config.simd) || !set_simd_isa(config.simd)) {
+                std::cerr << "Unsupported SIMD instruction set: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (arg == "--texture-budget" && has_value) {
+            config.texture_budget_mb = atof(argv[++i]);
+        } else if (arg == "--texture-cache" && has_value) {
+            config.texture_files = argv[++i];
+            if (config.texture_files == "off") config.texture_files.clear();
+        } else if (arg == "--bvh-cache" && has_value) {
+            config.bvh_files = argv[++i];
+            if (config.bvh_files == "off") config.bvh_files.clear();
+        } else if (arg == "--sbvh") {
+            config.sbvh = true;
+        } else if (arg == "--motion-segments" && has_value) {
+            config.motion_segments = atoi(argv[++i]);
+        } else if (arg == "--scenes" && has_value) {
+            std::stringstream list(argv[++i]);
+            std::string id;
+            while (std::getline(list, id, ',')) config.scene_ids.push_back(atoi(id.c_str()));
+        } else if (arg == "--references" && has_value) {
+            config.reference_dir = argv[++i];
+        } else if (arg == "--write-references") {
+            config.write_references = true;
+        } else if (arg == "--label" && has_value) {
+            config.label = argv[++i];
+        } else if (arg == "--out" && has_value) {
+            config.out_file = argv[++i];
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return -1;
+        }
+    }
+
+    if (config.scene_ids.empty()) {
+        for (int id = 1; id <= scene_count; id++) config.scene_ids.push_back(id);
+    }
+
+    if (config.texture_budget_mb > 0) {
+        texture_cache::global().set_budget(size_t(config.texture_budget_mb * (1 << 20)));
+    }
+    texture_cache::global().set_file_directory(config.texture_files);
+    bvh_cache::global().set_directory(config.bvh_files);
+    triangle_mesh::default_options().spatial_splits = config.sbvh;
+    sphere_set::motion_segments() = config.motion_segments;
+
+    std::vector<bench_result> results;
+    for (int id : config.scene_ids) {
+        if (id < 1 || id > scene_count) {
+            std::cerr << "Unknown scene: " << id << std::endl;
+            return -1;
+        }
+
+        bench_result r = run_scene(id, config);
+        std::clog << "scene " << r.id << " (" << r.name << "): " << r.stats.seconds << " s, "
+                  << r.stats.mrays_per_second() << " Mrays/s, peak RSS " << r.peak_rss_kb << " KB";
+        if (r.psnr >= 0) std::clog << ", PSNR " << r.psnr << " dB";
+        if (r.stats.texture_lookups > 0) {
+            std::clog << ", texture pages " << r.stats.texture_lookups - r.stats.texture_misses << " hits / "
+                      << r.stats.texture_misses << " misses, " << r.textures.loads << " decodes, "
+                      << r.textures.files_mapped << " files mapped";
+        }
+        if (r.bvhs.builds + r.bvhs.hits > 0) {
+            std::clog << ", mesh BVHs " << r.bvhs.builds << " built in " << r.bvhs.build_seconds << " s / "
+                      << r.bvhs.hits << " mapped";
+        }
+        std::clog << std::endl;
+        results.push_back(r);
+    }
+
+    std::ofstream out(config.out_file);
+    write_json(out, config, results);
+    std::clog << "Results written to " << config.out_file << std::endl;
+}
@@ -0,0 +1,180 @@
+/**
+ * Casey Gehling
+ *
+ * Render server latency. Renders the same job a number of times two ways and reports the time from asking to having
+ * the image: as separate renders would, setting the scene up again (textures, meshes, BVHs) and starting new threads
+ * each time, and as jobs sent to a render_server running on a thread of this process, which sets the scene up for the
+ * first job and keeps it for the rest. The server's images must match the separate renders. --no-file-caches turns
+ * off the texture and BVH files, so setting a scene up pays for decoding its images and building its mesh BVHs, as a
+ * first run would.
+ *
+ * Then it checks that the server survives bad clients: a second server on the same socket must be refused, a scene
+ * file with a bad camera setting must fail only its own job, and a client that asks for a large image and never
+ * reads it must not hold up the job after it.
+ *
+ * Usage (from the repository root, so scene assets resolve):
+ *   ./bench/bench_server [--scene 8] [--jobs 6] [--width 200] [--spp 8] [--threads 0] [--socket /tmp/bench_server.sock]
+ *                        [--no-file-caches]
+ */
+
+#include "../scenes.h"
+#include "../render_server.h"
+
+struct server_config {
+    int scene = 8;
+    int jobs = 6;
+    int width = 200;
+    int spp = 8;
+    int threads = 0;
+    std::string socket_path = "/tmp/bench_server.sock";
+    bool file_caches = true;
+};
+
+double seconds_since(profile_clock::time_point start) {
+    return std::chrono::duration<double>(profile_clock::now() - start).count();
+}
+
+// Connect and send request, then never read the reply. Returns the connection, to close when done, or -1.
+int stalled_client(const std::string& socket_path, const std::string& request) {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, socket_path.c_str(), std::min(socket_path.size(), sizeof(address.sun_path) - 1));
+    const int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0) return -1;
+    const std::string line = request + "\n";
+    if (connect(connection, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+        || send(connection, line.data(), line.size(), MSG_NOSIGNAL) != ssize_t(line.size())) {
+        close(connection);
+        return -1;
+    }
+    return connection;
+}
+
+int main(int argc, const char* argv[]) {
+    server_config config;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--scene" && has_value) {
+            config.scene = atoi(argv[++i]);
+        } else if (arg == "--jobs" && has_value) {
+            config.jobs = atoi(argv[++i]);
+        } else if (arg == "--width" && has_value) {
+            config.width = atoi(argv[++i]);
+        } else if (arg == "--spp" && has_value) {
+            config.spp = atoi(argv[++i]);
+        } else if (arg == "--threads" && has_value) {
+            config.threads = atoi(argv[++i]);
+        } else if (arg == "--socket" && has_value) {
+            config.socket_path = argv[++i];
+        } else if (arg == "--no-file-caches") {
+            config.file_caches = false;
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return -1;
+        }
+    }
+    if (config.scene < 1 || config.scene > scene_count) {
+        std::cerr << "Unknown scene: " << config.scene << std::endl;
+        return -1;
+    }
+
+    if (!config.file_caches) {
+        texture_cache::global().set_file_directory("");
+        bvh_cache::global().set_directory("");
+    }
+    std::clog.setstate(std::ios::failbit); // loaders and the server report every load and job
+
+    // Every job from nothing
+    double separate_seconds = 0, separate_setup = 0;
+    std::string reference;
+    int height = 0;
+    for (int job = 0; job < config.jobs; job++) {
+        const auto start = profile_clock::now();
+        camera cam;
+        seed_random(0);
+        hittable_list world = scenes[config.scene - 1].build(cam);
+        separate_setup += seconds_since(start);
+        cam.image_width = config.width;
+        cam.samples_per_pixel = config.spp;
+        cam.num_threads = config.threads;
+        cam.show_progress = false;
+        std::vector<color> framebuffer = cam.render_framebuffer(world);
+        std::ostringstream image;
+        image << "P3\n" << cam.image_width << ' ' << cam.height() << "\n255\n";
+        for (const color& pixel : framebuffer) {
+            write_color(image, pixel);
+        }
+        separate_seconds += seconds_since(start);
+        reference = image.str();
+        height = cam.height();
+    }
+
+    // The same jobs sent to a server
+    render_server server(config.socket_path);
+    server.num_threads = config.threads;
+    bool served = false;
+    std::thread serving([&]() { served = server.serve(); });
+    std::ostringstream request;
+    request << "render scene=" << config.scene << " width=" << config.width << " spp=" << config.spp;
+    std::vector<double> latency;
+    std::vector<job_result> results;
+    int different = 0;
+    for (int job = 0; job < config.jobs; job++) {
+        const auto start = profile_clock::now();
+        job_result result = submit_job(config.socket_path, request.str(), false);
+        for (int attempt = 0; !result.ok && job == 0 && attempt < 100; attempt++) {
+            // Server may not be listening yet
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            result = submit_job(config.socket_path, request.str(), false);
+        }
+        latency.push_back(seconds_since(start));
+        if (!result.ok || result.image != reference) different++;
+        results.push_back(result);
+    }
+
+    // Bad clients
+    render_server second(config.socket_path);
+    const bool second_refused = !second.serve();
+    const std::string bad_scene = config.socket_path + ".bad.scene";
+    std::ofstream(bad_scene) << "camera width -5\n";
+    const job_result bad = submit_job(config.socket_path, "render scene=" + bad_scene, false);
+    const bool bad_failed = !bad.ok && bad.error.find("could not build") != std::string::npos;
+    remove(bad_scene.c_str());
+    std::ostringstream large;
+    large << "render scene=" << config.scene << " width=1000 spp=1";
+    const int stalled = stalled_client(config.socket_path, large.str());
+    const auto after_start = profile_clock::now();
+    const job_result after = submit_job(config.socket_path, request.str(), false);
+    const double after_seconds = seconds_since(after_start);
+    const bool after_ok = stalled >= 0 && after.ok && after.image == reference;
+    if (stalled >= 0) close(stalled);
+
+    submit_job(config.socket_path, "stop", false);
+    serving.join();
+    std::clog.clear();
+    if (!served) return -1;
+
+    double warm_latency = 0, warm_setup = 0;
+    for (int job = 1; job < config.jobs; job++) {
+        warm_latency += latency[job];
+        warm_setup += results[job].setup_seconds;
+    }
+    const int warm_jobs = std::max(1, config.jobs - 1);
+
+    printf("scene %d (%s), %d jobs at %dx%d, %d spp\n", config.scene, scenes[config.scene - 1].name, config.jobs,
+        config.width, height, config.spp);
+    printf("%-22s %8.3f s a job   (%.4f s setting up the scene)\n", "separate renders",
+        separate_seconds / config.jobs, separate_setup / config.jobs);
+    printf("%-22s %8.3f s         (%.4f s setting up the scene)\n", "server, first job", latency[0],
+        results[0].setup_seconds);
+    printf("%-22s %8.3f s a job   (%.6f s setting up the scene), %.0f%% of a separate render\n", "server, warm jobs",
+        warm_latency / warm_jobs, warm_setup / warm_jobs, 100 * (warm_latency / warm_jobs) / (separate_seconds / config.jobs));
+    printf("%d of %d images differ\n", different, config.jobs);
+    printf("second server on the socket %s\n", second_refused ? "refused" : "NOT refused");
+    printf("job with a bad scene file %s\n", bad_failed ? "failed alone" : ("NOT failed: " + (bad.ok ? std::string("rendered") : bad.error)).c_str());
+    printf("job after a client that stopped reading %s in %.3f s\n", after_ok ? "served" : "NOT served", after_seconds);
+    return different == 0 && second_refused && bad_failed && after_ok ? 0 : 1;
+}
@@ -0,0 +1,180 @@
+/**
+ * Casey Gehling
+ *
+ * Defines boxes as one primitive. A box is axis aligned in its own frame, which may be rotated; a ray is
+ * taken into that frame and clipped against the three slabs, giving both the entry and the exit in one
+ * test. Faces, normals and texture coordinates match the six quads box() used to build.
+ */
+
+#ifndef BOX_H
+#define BOX_H
+
+#include "hittable.h"
+
+class oriented_box : public hittable {
+    public:
+        // Faces, numbered in the order box() used to add its quads
+        enum face { front, right, back, left, top, bottom };
+
+        // Axis aligned box with opposite corners a and b
+        oriented_box(const point3& a, const point3& b, shared_ptr<material> mat)
+            : axes{ vec3(1,0,0), vec3(0,1,0), vec3(0,0,1) }, mat(mat) {
+            lo = point3(std::fmin(a.x(),b.x()), std::fmin(a.y(),b.y()), std::fmin(a.z(),b.z()));
+            hi = point3(std::fmax(a.x(),b.x()), std::fmax(a.y(),b.y()), std::fmax(a.z(),b.z()));
+            set_bounding_box();
+        }
+
+        // Box around center, half_size along each of its axes: x along axis_x, y along the part of axis_y
+        // perpendicular to it, and z along their cross product.
+        oriented_box(const point3& center, const vec3& axis_x, const vec3& axis_y, const vec3& half_size, shared_ptr<material> mat)
+            : mat(mat) {
+            axes[0] = unit_vector(axis_x);
+            axes[1] = unit_vector(axis_y - dot(axis_y, axes[0]) * axes[0]);
+            axes[2] = cross(axes[0], axes[1]);
+            point3 c = to_local(center);
+            lo = c - half_size;
+            hi = c + half_size;
+            set_bounding_box();
+        }
+
+        aabb bounding_box() const override { return bbox; }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            thread_counters().prim_tests++;
+            const point3 origin = to_local(r.origin());
+            const vec3 direction = to_local(r.direction());
+
+            real t_enter, t_exit;
+            int enter_face, exit_face;
+            if (!slabs(origin, direction, t_enter, enter_face, t_exit, exit_face)) return false;
+
+            // From outside the box the entry is the hit, from inside (or past the entry) the exit is
+            if (ray_t.contains(t_enter)) {
+                record_hit(r, origin, direction, t_enter, enter_face, rec);
+            } else if (ray_t.contains(t_exit)) {
+                record_hit(r, origin, direction, t_exit, exit_face, rec);
+            } else {
+                return false;
+            }
+            return true;
+        }
+
+        int crossings(const ray& r, interval ray_t, real* ts, int max_count) const override {
+            thread_counters().prim_tests++;
+            real t_enter, t_exit;
+            int enter_face, exit_face;
+            if (!slabs(to_local(r.origin()), to_local(r.direction()), t_enter, enter_face, t_exit, exit_face)) return 0;
+
+            int count = 0;
+            if (count < max_count && ray_t.contains(t_enter)) ts[count++] = t_enter;
+            if (count < max_count && ray_t.contains(t_exit) && t_exit != t_enter) ts[count++] = t_exit;
+            return count;
+        }
+
+    private:
+        vec3 axes[3]; // orthonormal frame the box is axis aligned in
+        point3 lo, hi; // corners in that frame
+        shared_ptr<material> mat;
+        aabb bbox;
+
+        // Coordinates in the box's frame. Exact for an axis aligned box.
+        vec3 to_local(const vec3& v) const {
+            return vec3(dot(v, axes[0]), dot(v, axes[1]), dot(v, axes[2]));
+        }
+
+        vec3 to_world(const vec3& v) const {
+            return v.x() * axes[0] + v.y() * axes[1] + v.z() * axes[2];
+        }
+
+        void set_bounding_box() {
+            bbox = aabb::empty;
+            for (int corner = 0; corner < 8; corner++) {
+                point3 p(
+                    (corner & 1) ? hi.x() : lo.x(),
+                    (corner & 2) ? hi.y() : lo.y(),
+                    (corner & 4) ? hi.z() : lo.z()
+                );
+                p = to_world(p);
+                bbox = aabb(bbox, aabb(p, p));
+            }
+        }
+
+        // Face on the max (or min) side of a local axis
+        static int face_of(int axis, bool max_side) {
+            static const int faces[3][2] = { { left, right }, { bottom, top }, { back, front } };
+            return faces[axis][max_side ? 1 : 0];
+        }
+
+        // Clip the local ray against the slabs. Returns false if it misses the box entirely, otherwise the
+        // distances to the entry and exit (the entry is negative when the origin is inside) and their faces.
+        bool slabs(const point3& origin, const vec3& direction, real& t_enter, int& enter_face, real& t_exit, int& exit_face) const {
+            t_enter = -infinity;
+            t_exit = infinity;
+            enter_face = exit_face = front;
+            for (int axis = 0; axis < 3; axis++) {
+                const real inv_d = 1 / direction[axis];
+                const bool forward = inv_d >= 0;
+                const real t_lo = (lo[axis] - origin[axis]) * inv_d;
+                const real t_hi = (hi[axis] - origin[axis]) * inv_d;
+                const real t0 = forward ? t_lo : t_hi;
+                const real t1 = forward ? t_hi : t_lo;
+
+                if (t0 > t_enter) {
+                    t_enter = t0;
+                    enter_face = face_of(axis, !forward);
+                }
+                if (t1 < t_exit) {
+                    t_exit = t1;
+                    exit_face = face_of(axis, forward);
+                }
+            }
+            return t_enter <= t_exit;
+        }
+
+        void record_hit(const ray& r, const point3& origin, const vec3& direction, real t, int face_hit, hit_record& rec) const {
+            // The hit point in the box's frame: exactly on the face's plane and clamped to its rectangle
+            point3 local = origin + t * direction;
+            for (int axis = 0; axis < 3; axis++) {
+                local[axis] = std::min(std::max(local[axis], lo[axis]), hi[axis]);
+            }
+
+            vec3 normal;
+            switch (face_hit) {
+                case front:  local[2] = hi.z(); normal = axes[2]; break;
+                case right:  local[0] = hi.x(); normal = axes[0]; break;
+                case back:   local[2] = lo.z(); normal = -axes[2]; break;
+                case left:   local[0] = lo.x(); normal = -axes[0]; break;
+                case top:    local[1] = hi.y(); normal = axes[1]; break;
+                default:     local[1] = lo.y(); normal = -axes[1]; break;
+            }
+
+            // Texture coordinates run along each face as they did on its quad
+            const vec3 s = local - lo;
+            const vec3 size = hi - lo;
+            const real sx = s.x() / size.x(), sy = s.y() / size.y(), sz = s.z() / size.z();
+            const vec3 along_x = size.x() * axes[0], along_y = size.y() * axes[1], along_z = size.z() * axes[2];
+            switch (face_hit) {
+                case front:  rec.u = sx;     rec.v = sy;     rec.dpdu = along_x;  rec.dpdv = along_y;  break;
+                case right:  rec.u = 1 - sz; rec.v = sy;     rec.dpdu = -along_z; rec.dpdv = along_y;  break;
+                case back:   rec.u = 1 - sx; rec.v = sy;     rec.dpdu = -along_x; rec.dpdv = along_y;  break;
+                case left:   rec.u = sz;     rec.v = sy;     rec.dpdu = along_z;  rec.dpdv = along_y;  break;
+                case top:    rec.u = sx;     rec.v = 1 - sz; rec.dpdu = along_x;  rec.dpdv = -along_z; break;
+                default:     rec.u = sx;     rec.v = sz;     rec.dpdu = along_x;  rec.dpdv = along_z;  break;
+            }
+
+            rec.t = t;
+            rec.p = to_world(local);
+            // Rotating back out of the box's frame is the only rounding, three products and two sums per coordinate
+            rec.p_error = rounding_gamma<real>(5) * max_abs(local);
+            rec.mat = mat;
+            rec.object_id = object_id;
+            rec.set_face_normal(r, normal);
+        }
+};
+
+// Returns the 3D box (six sides) that contains the two opposite vertices a & b.
+inline shared_ptr<hittable> box(const point3& a, const point3& b, shared_ptr<material> mat) {
+    return make_shared<oriented_box>(a, b, mat);
+}
+
+#endif
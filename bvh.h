@@ -9,6 +9,7 @@
 #include "aabb.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "simd.h"
 #include "constants.h"
 
 #include <algorithm>
@@ -47,6 +48,7 @@ class bvh_node : public hittable {
         }
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            thread_counters().node_visits++;
             if (!bbox.hit(r, ray_t)) return false;
 
             bool hit_left = left->hit(r, ray_t, rec);
@@ -55,6 +57,35 @@ class bvh_node : public hittable {
             return hit_left || hit_right;
         }
 
+        unsigned hit_packet(ray_packet& packet, unsigned active, hit_record* recs) const override {
+            thread_counters().node_visits++;
+            active &= simd_kernels().aabb_hit(bbox, packet);
+            if (!active) return 0;
+
+            // Diverged packets finish traversal one ray at a time
+            if (packet.diverged(active)) {
+                return hittable::hit_packet(packet, active, recs);
+            }
+
+            // Left hits shorten tmax, so the right child is culled against the closest hits so far
+            unsigned hits = left->hit_packet(packet, active, recs);
+            if (right != left) {
+                hits |= right->hit_packet(packet, active, recs);
+            }
+            return hits;
+        }
+
+        int crossings(const ray& r, interval ray_t, real* ts, int max_count) const override {
+            thread_counters().node_visits++;
+            if (!bbox.hit(r, ray_t)) return 0;
+
+            real right_ts[max_crossings];
+            int count = left->crossings(r, ray_t, ts, max_count);
+            if (right == left) return count;
+            int n = right->crossings(r, ray_t, right_ts, std::min(max_count, max_crossings));
+            return merge_crossings(ts, count, right_ts, n, max_count);
+        }
+
         aabb bounding_box() const override {return bbox;}
 
     private:
@@ -0,0 +1,216 @@
+/**
+ * Casey Gehling
+ *
+ * Defines the BVH cache, built acceleration structures kept on disk so the same geometry isn't built again on every
+ * run. An entry is a file holding the flat nodes and the primitive each leaf slot references, named by a key
+ * hashed from the geometry and the build's settings. It is memory mapped and its nodes are traversed in place. A
+ * file whose version, key or sizes don't match is ignored, and the BVH is built and the file written again.
+ */
+
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+
+#include "mapped_file.h"
+#include "profile.h"
+
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Totals since the cache was made or last reset
+struct bvh_cache_stats {
+    unsigned long long hits = 0; // BVHs mapped from files, with nothing to build
+    unsigned long long builds = 0;
+    unsigned long long files_written = 0;
+    unsigned long long rejected = 0; // files found for a key but not usable
+    double build_seconds = 0;
+};
+
+// Laid out at the start of the file. The primitive of each leaf slot (uint32 each, in leaf order) and the nodes
+// follow at the given offsets, each 64 byte aligned.
+struct bvh_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_bytes; // sizeof the node type of the writer
+    uint64_t key;
+    uint64_t primitive_count, node_count;
+    uint64_t reference_count; // leaf slots, more than the primitives if a build repeats any
+    uint64_t order_offset, nodes_offset;
+};
+
+class bvh_cache {
+    public:
+        static const uint32_t version = 2;
+        static const uint64_t hash_basis = 0xcbf29ce484222325ull;
+        static const char* default_directory() { return ".bvh_cache"; }
+
+        // The cache meshes use
+        static bvh_cache& global() {
+            static bvh_cache cache;
+            return cache;
+        }
+
+        bvh_cache() : path(default_directory()), hits(0), builds(0), files_written(0), rejected(0), build_nanoseconds(0), temporaries(0) {}
+
+        // Where BVH files are kept, or empty to always build
+        void set_directory(const std::string& directory) { path = directory; }
+        const std::string& directory() const { return path; }
+
+        // Hash of count bytes continuing from hash, for keys. Whole 64 bit words at a time, so hashing a large mesh
+        // costs little next to building its BVH.
+        static uint64_t hash(const void* bytes, size_t count, uint64_t hash) {
+            const unsigned char* p = static_cast<const unsigned char*>(bytes);
+            auto mix = [&](uint64_t word) {
+                hash ^= word * 0x9e3779b97f4a7c15ull;
+                hash = ((hash << 27) | (hash >> 37)) * 0x100000001b3ull;
+            };
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8) {
+                uint64_t word;
+                std::memcpy(&word, p + i, 8);
+                mix(word);
+            }
+            uint64_t tail = 0;
+            if (count > i) std::memcpy(&tail, p + i, count - i);
+            mix(tail ^ (uint64_t(count) << 56));
+            return hash;
+        }
+
+        // Map the BVH stored for key over primitive_count primitives, with the primitive of each of its
+        // reference_count leaf slots in order. Null if there is none or it doesn't match. The nodes' own links are
+        // for the caller to check, as only it knows what they mean.
+        template <typename Node>
+        std::shared_ptr<mapped_file> find(
+            uint64_t key, size_t primitive_count, const uint32_t*& order, size_t& reference_count,
+            const Node*& nodes, size_t& node_count
+        ) {
+            if (path.empty()) return nullptr;
+            auto file = std::make_shared<mapped_file>();
+            if (!file->open(name(key))) return nullptr;
+
+            bvh_file_header header;
+            const uint64_t size = file->size();
+            bool valid = size >= sizeof(header);
+            if (valid) {
+                std::memcpy(&header, file->data(), sizeof(header));
+                valid = std::memcmp(header.magic, magic(), 8) == 0 && header.version == version
+                    && header.node_bytes == sizeof(Node) && header.key == key && header.primitive_count == primitive_count
+                    && header.node_count > 0 && header.reference_count >= primitive_count
+                    && fits(header.order_offset, header.reference_count, sizeof(uint32_t), size)
+                    && fits(header.nodes_offset, header.node_count, sizeof(Node), size);
+            }
+            if (valid) {
+                // Every primitive must be in some leaf, or rays would miss it
+                order = reinterpret_cast<const uint32_t*>(file->data() + header.order_offset);
+                std::vector<bool> seen(primitive_count);
+                size_t covered = 0;
+                for (size_t i = 0; valid && i < header.reference_count; i++) {
+                    valid = order[i] < primitive_count;
+                    if (valid && !seen[order[i]]) {
+                        seen[order[i]] = true;
+                        covered++;
+                    }
+                }
+                valid = valid && covered == primitive_count;
+            }
+            if (!valid) {
+                rejected++;
+                return nullptr;
+            }
+            reference_count = size_t(header.reference_count);
+            nodes = reinterpret_cast<const Node*>(file->data() + header.nodes_offset);
+            node_count = size_t(header.node_count);
+            return file;
+        }
+
+        // Write the BVH built for key over primitive_count primitives, order holding the primitive of each leaf slot.
+        // Written to a temporary name of this writer's own and renamed, so a reader never maps a partial file and
+        // writers of the same key, in this process or another, don't write into each other's.
+        template <typename Node>
+        bool store(uint64_t key, size_t primitive_count, const std::vector<uint32_t>& order, const std::vector<Node>& nodes) {
+#ifdef _WIN32
+            return false;
+#else
+            if (path.empty()) return false;
+            bvh_file_header header;
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.magic, magic(), 8);
+            header.version = version;
+            header.node_bytes = sizeof(Node);
+            header.key = key;
+            header.primitive_count = primitive_count;
+            header.reference_count = order.size();
+            header.node_count = nodes.size();
+            header.order_offset = align(sizeof(header));
+            header.nodes_offset = align(header.order_offset + sizeof(uint32_t) * order.size());
+
+            mkdir(path.c_str(), 0755);
+            const std::string file = name(key);
+            const std::string temporary = file + "." + std::to_string(getpid()) + "." + std::to_string(temporaries++) + ".tmp";
+            FILE* out = fopen(temporary.c_str(), "wb");
+            if (!out) return false;
+            static const char zeros[64] = {};
+            bool ok = fwrite(&header, sizeof(header), 1, out) == 1
+                && fwrite(zeros, 1, header.order_offset - sizeof(header), out) == header.order_offset - sizeof(header)
+                && fwrite(order.data(), sizeof(uint32_t), order.size(), out) == order.size()
+                && fwrite(zeros, 1, header.nodes_offset - header.order_offset - sizeof(uint32_t) * order.size(), out)
+                    == header.nodes_offset - header.order_offset - sizeof(uint32_t) * order.size()
+                && fwrite(nodes.data(), sizeof(Node), nodes.size(), out) == nodes.size();
+            ok = (fclose(out) == 0) && ok;
+            if (!ok || rename(temporary.c_str(), file.c_str()) != 0) {
+                remove(temporary.c_str());
+                return false;
+            }
+            files_written++;
+            return true;
+#endif
+        }
+
+        void record_hit() { hits++; }
+        void record_rejected() { rejected++; }
+        void record_build(double seconds) {
+            builds++;
+            build_nanoseconds += (unsigned long long)(seconds * 1e9);
+        }
+
+        bvh_cache_stats stats() const {
+            bvh_cache_stats s;
+            s.hits = hits;
+            s.builds = builds;
+            s.files_written = files_written;
+            s.rejected = rejected;
+            s.build_seconds = build_nanoseconds * 1e-9;
+            return s;
+        }
+
+        void reset_stats() {
+            hits = 0;
+            builds = 0;
+            files_written = 0;
+            rejected = 0;
+            build_nanoseconds = 0;
+        }
+
+    private:
+        std::string path;
+        std::atomic<unsigned long long> hits, builds, files_written, rejected, build_nanoseconds;
+        std::atomic<unsigned long long> temporaries; // names handed out to store
+
+        static const char* magic() { return "RTWBVH\0"; }
+
+        static uint64_t align(uint64_t offset) { return (offset + 63) & ~uint64_t(63); }
+
+        static bool fits(uint64_t offset, uint64_t count, uint64_t element, uint64_t size) {
+            return offset % 64 == 0 && offset <= size && count <= (size - offset) / element;
+        }
+
+        std::string name(uint64_t key) const {
+            char hex[17];
+            snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)key);
+            return path + "/" + hex + ".rbvh";
+        }
+};
+
+#endif
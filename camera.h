@@ -8,12 +8,33 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include "aov.h"
+#include "denoise.h"
+#include "environment.h"
 #include "hittable.h"
 #include "material.h"
+#include "thread_pool.h"
+#include "wavefront.h"
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <string>
 #include <thread>
 #include <vector>
 
+// Per-pixel cost recorded for the heatmap
+enum class heatmap_metric {
+    time, // wall time spent on the pixel
+    traversal // bvh nodes visited plus primitives tested
+};
+
+// Light transport algorithm used by camera::render
+enum class integrator_type {
+    recursive, // one path at a time, depth first
+    wavefront // batches of paths advanced a bounce at a time, shaded grouped by material
+};
+
 class camera {
 
     public:
@@ -23,6 +44,7 @@ class camera {
         int samples_per_pixel = 10; // sampling rate
         int max_depth = 10; // max recursion depth, i..e max number of ray "bounces" into scene
         color background; // scene background color
+        shared_ptr<environment_light> environment; // light from outside the scene, seen instead of background when set
 
         double vfov = 90; // vertical fov
         point3 lookfrom = point3(0,0,0); // camera position in scene
@@ -32,57 +54,210 @@ class camera {
         double defocus_angle = 0;
         double focus_dist = 10;
 
+        int tile_size = 16; // tiles are handed out to render threads on demand
+        int num_threads = 0; // render threads, 0 uses every hardware thread
+        shared_ptr<thread_pool> pool; // when set, renders on its threads instead of starting num_threads new ones
+        uint64_t seed = 0; // base random seed, each tile derives its own from it
+        bool show_progress = true; // print remaining tiles to stderr
+        std::function<void(int tiles_done, int tile_count)> on_tile; // called by render threads as tiles finish
+        int packet_size = 1; // trace primary rays of 4, 8 or 16 adjacent pixels as one packet, 1 disables
+        integrator_type integrator = integrator_type::recursive;
+        int wavefront_batch = 1 << 16; // paths in flight per thread for the wavefront integrator
+
+        // Extra output layers, a mask of aov_layer values. Rendered in the same pass as the image.
+        unsigned aov_layers = 0;
+        std::string aov_file; // multi-layer EXR of the image and its layers, disabled when empty
+        aov_buffers aovs; // filled in by the last render
+
+        // Denoising. Renders the albedo, normal and depth layers alongside color and filters with them.
+        bool denoise = false;
+        atrous_denoiser denoiser;
+
+        // Profiling output, disabled when empty
+        std::string heatmap_file; // false-colour PPM of per-pixel cost
+        std::string trace_file; // Chrome trace JSON of which thread rendered which tile and when
+        heatmap_metric heatmap_cost = heatmap_metric::time;
+
+        render_stats stats; // filled in by the last render
+
+        // Render and write the image to stdout as a PPM.
         void render(const hittable& world) {
-            initialize();
-
-            int lines_left = image_height;
+            std::vector<color> framebuffer = render_framebuffer(world);
 
             std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+            for (int j = 0; j < image_height; j++) {
+                for (int i = 0; i < image_width; i++) {
+                    write_color(std::cout, framebuffer[j * image_width + i]);
+                }
+            }
+        }
+
+        // Render into a row-major framebuffer of linear colors, image_width by height().
+        std::vector<color> render_framebuffer(const hittable& world) {
+            initialize();
 
             std::vector<color> framebuffer(image_width * image_height);
+            std::vector<double> pixel_cost(heatmap_file.empty() ? 0 : image_width * image_height);
+            aovs.allocate(aov_layers | (denoise ? aov_denoise_features : 0), image_width, image_height);
+
+            // Divide image into tiles, handed out to threads as they finish their previous tile
+            const int thread_count = pool ? pool->size()
+                : (num_threads > 0) ? num_threads : std::max(1u, std::thread::hardware_concurrency());
+
+            const int tiles_x = (image_width + tile_size - 1) / tile_size;
+            const int tiles_y = (image_height + tile_size - 1) / tile_size;
+            const int tile_count = tiles_x * tiles_y;
+            std::atomic<int> next_tile(0);
+            std::atomic<int> tiles_left(tile_count);
+
+            // Packets trace a block of adjacent pixels together, 4x4 for 16 rays, 4x2 for 8, 2x2 for 4
+            const int block_w = (packet_size >= 8) ? 4 : (packet_size >= 2) ? 2 : 1;
+            const int block_h = (packet_size >= 16) ? 4 : (packet_size >= 4) ? 2 : 1;
+
+            std::vector<std::vector<tile_event> > thread_events(thread_count);
+            std::vector<traversal_counters> thread_work(thread_count);
+            const auto render_start = profile_clock::now();
+
+            auto render_tiles = [&](int thread_index) {
+                const traversal_counters work_start = thread_counters();
+                wavefront_integrator wavefront;
+                wavefront.ray_dx = ray_dx;
+                wavefront.ray_dy = ray_dy;
+                wavefront.environment = environment.get();
+
+                for (int tile = next_tile++; tile < tile_count; tile = next_tile++) {
+                    const int tile_x = tile % tiles_x;
+                    const int tile_y = tile / tiles_x;
+                    const auto tile_start = profile_clock::now();
+                    seed_random(seed ^ mix_seed(tile));
+
+                    const int tile_end_x = std::min((tile_x + 1) * tile_size, image_width);
+                    const int tile_end_y = std::min((tile_y + 1) * tile_size, image_height);
+
+                    if (integrator == integrator_type::wavefront) {
+                        render_tile_wavefront(tile_x * tile_size, tile_y * tile_size, tile_end_x, tile_end_y,
+                            world, wavefront, framebuffer, pixel_cost);
+                    } else {
+                        for (int j = tile_y * tile_size; j < tile_end_y; j += block_h) {
+                            for (int i = tile_x * tile_size; i < tile_end_x; i += block_w) {
+                                const auto block_start = profile_clock::now();
+                                const auto traversal_start = thread_counters().total();
+
+                                // Pixels of the block in row-major order
+                                const int bw = std::min(block_w, tile_end_x - i);
+                                const int bh = std::min(block_h, tile_end_y - j);
+                                color block_colors[max_packet_size];
+                                if (bw * bh > 1) {
+                                    render_packet(i, j, bw, bh, world, block_colors);
+                                } else {
+                                    block_colors[0] = render_pixel(i, j, world);
+                                }
+
+                                // Block cost is shared evenly between its pixels
+                                double cost = 0;
+                                if (!pixel_cost.empty()) {
+                                    cost = (heatmap_cost == heatmap_metric::time)
+                                        ? std::chrono::duration<double, std::nano>(profile_clock::now() - block_start).count()
+                                        : double(thread_counters().total() - traversal_start);
+                                    cost /= bw * bh;
+                                }
+
+                                for (int lane = 0; lane < bw * bh; lane++) {
+                                    const int pixel = (j + lane / bw) * image_width + (i + lane % bw);
+                                    framebuffer[pixel] = pixel_samples_scale * block_colors[lane];
+                                    if (!pixel_cost.empty()) pixel_cost[pixel] = cost;
+                                }
+                            }
+                        }
+                    }
 
-            // Divide rendering into threads
-            const int num_threads = std::thread::hardware_concurrency();
-            std::vector<std::thread> threads;
+                    if (!trace_file.empty()) {
+                        const auto tile_end = profile_clock::now();
+                        tile_event e = {
+                            thread_index, tile_x, tile_y,
+                            microseconds_between(render_start, tile_start),
+                            microseconds_between(tile_start, tile_end)
+                        };
+                        thread_events[thread_index].push_back(e);
+                    }
 
-            // Per thread, render equally divided chunk of lines. 
-            auto render_chunk = [&](int start, int end) {
-                for (int j = start; j < end; j++) {
                     // Render debug output
-                    std::clog << "\nScanlines remaining: " << lines_left << ' ' << std::flush;
-                    for (int i = 0; i < image_width; i++) {
-                        color pixel_color(0, 0, 0);
-                        for (int sample = 0; sample < samples_per_pixel; sample++) {
-                            ray r = get_ray(i, j);
-                            pixel_color += ray_color(r, max_depth, world);
-                        }
-                        framebuffer[j * image_width + i] = pixel_samples_scale * pixel_color;
-                    }
-                    --lines_left;
+                    int remaining = --tiles_left;
+                    if (show_progress) std::clog << "\rTiles remaining: " << remaining << ' ' << std::flush;
+                    if (on_tile) on_tile(tile_count - remaining, tile_count);
                 }
+
+                traversal_counters& work = thread_work[thread_index];
+                work.rays = thread_counters().rays - work_start.rays;
+                work.node_visits = thread_counters().node_visits - work_start.node_visits;
+                work.prim_tests = thread_counters().prim_tests - work_start.prim_tests;
+                work.texture_lookups = thread_counters().texture_lookups - work_start.texture_lookups;
+                work.texture_misses = thread_counters().texture_misses - work_start.texture_misses;
             };
 
-            // Launch threads
-            int chunk_size = image_height / num_threads;
-            for (int t = 0; t < num_threads; t++) {
-                int start = t * chunk_size;
-                int end = (t == num_threads - 1) ? image_height : start + chunk_size;
-                threads.emplace_back(render_chunk, start, end);
+            if (pool) {
+                pool->run(render_tiles);
+            } else {
+                // Launch threads
+                std::vector<std::thread> threads;
+                for (int t = 0; t < thread_count; t++) {
+                    threads.emplace_back(render_tiles, t);
+                }
+
+                // Join threads
+                for (auto& thread : threads) {
+                    thread.join();
+                }
+            }
+            if (show_progress) std::clog << '\n';
+
+            stats = render_stats();
+            stats.seconds = std::chrono::duration<double>(profile_clock::now() - render_start).count();
+            for (const auto& work : thread_work) {
+                stats.rays += work.rays;
+                stats.node_visits += work.node_visits;
+                stats.prim_tests += work.prim_tests;
+                stats.texture_lookups += work.texture_lookups;
+                stats.texture_misses += work.texture_misses;
             }
 
-            // Join threads
-            for (auto& thread : threads) {
-                thread.join();
+            aovs.normalize(pixel_samples_scale);
+
+            if (denoise) {
+                const auto denoise_start = profile_clock::now();
+                denoiser.num_threads = thread_count;
+                denoiser.apply(framebuffer, aovs, image_width, image_height);
+                stats.denoise_seconds = std::chrono::duration<double>(profile_clock::now() - denoise_start).count();
+                stats.seconds += stats.denoise_seconds;
             }
 
-            // Write framebuffer to stdout
-            for (int j = 0; j < image_height; j++) {
-                for (int i = 0; i < image_width; i++) {
-                    write_color(std::cout, framebuffer[j * image_width + i]);
+            if (!aov_file.empty()) {
+                if (aovs.write_exr(aov_file, framebuffer)) {
+                    std::clog << "AOVs written to " << aov_file << '\n';
+                } else {
+                    std::cerr << "ERROR: Could not write " << aov_file << std::endl;
+                }
+            }
+
+            if (!pixel_cost.empty()) {
+                write_heatmap(heatmap_file, pixel_cost, image_width, image_height);
+            }
+
+            if (!trace_file.empty()) {
+                std::vector<tile_event> events;
+                for (const auto& e : thread_events) {
+                    events.insert(events.end(), e.begin(), e.end());
+                }
+                if (write_trace_json(trace_file, events, thread_count)) {
+                    std::clog << "Tile trace written to " << trace_file << '\n';
                 }
             }
+
+            return framebuffer;
         }
 
+        int height() const { return image_height; }
+
     private:
         int image_height;
         double pixel_samples_scale;
@@ -90,6 +265,7 @@ class camera {
         point3 pixel00_loc;
         vec3 pixel_delta_u;
         vec3 pixel_delta_v;
+        vec3 ray_dx, ray_dy; // change in a camera ray's direction to the next pixel's, scaled for texture footprints
         vec3 u,v,w;
         vec3 defocus_disk_u;
         vec3 defocus_disk_v;
@@ -122,6 +298,11 @@ class camera {
             pixel_delta_u = viewport_u / image_width;
             pixel_delta_v = viewport_v / image_height;
 
+            // A pixel's samples together cover it, so each one's footprint shrinks as there are more of them
+            auto differential_scale = std::max(0.125, 1.0 / std::sqrt(samples_per_pixel));
+            ray_dx = differential_scale * pixel_delta_u;
+            ray_dy = differential_scale * pixel_delta_v;
+
             // Calulate location of upper left pixel
             auto viewport_upper_left = center - (focus_dist * w) - viewport_u / 2 - viewport_v / 2;
             pixel00_loc = viewport_upper_left + 0.5 * (pixel_delta_u + pixel_delta_v);
@@ -151,30 +332,204 @@ class camera {
             return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
         }
 
-        color ray_color(const ray& r, int depth, const hittable& world) const {
+        // Render the tile [x0,x1) by [y0,y1) with the wavefront integrator, as many samples per batch as fit.
+        void render_tile_wavefront(
+            int x0, int y0, int x1, int y1, const hittable& world, wavefront_integrator& wavefront,
+            std::vector<color>& framebuffer, std::vector<double>& pixel_cost
+        ) {
+            const auto tile_start = profile_clock::now();
+            const auto traversal_start = thread_counters().total();
+
+            const int tile_w = x1 - x0;
+            const int pixels = tile_w * (y1 - y0);
+            const int samples_per_batch = std::max(1, wavefront_batch / pixels);
+
+            std::vector<color> tile_colors(pixels, color(0,0,0));
+            aov_buffers tile_aovs;
+            tile_aovs.allocate(aovs.layers, tile_w, y1 - y0);
+            std::vector<path_state> paths;
+            paths.reserve(pixels * std::min(samples_per_batch, samples_per_pixel));
+
+            for (int first = 0; first < samples_per_pixel; first += samples_per_batch) {
+                const int last = std::min(samples_per_pixel, first + samples_per_batch);
+                for (int p = 0; p < pixels; p++) {
+                    for (int sample = first; sample < last; sample++) {
+                        path_state path = { get_ray(x0 + p % tile_w, y0 + p / tile_w), color(1,1,1), p, max_depth, 0, 0 };
+                        paths.push_back(path);
+                    }
+                }
+                wavefront.trace(paths, world, background, tile_colors.data(), aovs.layers ? &tile_aovs : nullptr);
+            }
+
+            double cost = 0;
+            if (!pixel_cost.empty()) {
+                cost = (heatmap_cost == heatmap_metric::time)
+                    ? std::chrono::duration<double, std::nano>(profile_clock::now() - tile_start).count()
+                    : double(thread_counters().total() - traversal_start);
+                cost /= pixels;
+            }
+
+            for (int p = 0; p < pixels; p++) {
+                const int pixel = (y0 + p / tile_w) * image_width + (x0 + p % tile_w);
+                framebuffer[pixel] = pixel_samples_scale * tile_colors[p];
+                if (!pixel_cost.empty()) pixel_cost[pixel] = cost;
+            }
+            if (aovs.layers) aovs.copy_tile(tile_aovs, x0, y0);
+        }
+
+        color render_pixel(int i, int j, const hittable& world) {
+            color pixel_color(0, 0, 0);
+            for (int sample = 0; sample < samples_per_pixel; sample++) {
+                ray r = get_ray(i, j);
+                if (aovs.layers && max_depth > 0) {
+                    // Trace the first hit here so its layers can be recorded
+                    thread_counters().rays++;
+                    hit_record rec;
+                    bool hit = world.hit(r, interval(0, infinity), rec);
+                    if (hit) rec.set_footprint(r, ray_dx, ray_dy);
+                    pixel_color += shade_primary(j * image_width + i, r, hit ? &rec : nullptr, world);
+                } else {
+                    pixel_color += ray_color(r, max_depth, world);
+                }
+            }
+            return pixel_color;
+        }
+
+        // Render a bw by bh block of pixels at (i,j), tracing each sample's primary rays as one packet.
+        void render_packet(int i, int j, int bw, int bh, const hittable& world, color* pixel_colors) {
+            const int size = bw * bh;
+            for (int lane = 0; lane < size; lane++) pixel_colors[lane] = color(0,0,0);
+            if (max_depth <= 0) return;
+
+            ray_packet packet;
+            packet.size = size;
+            hit_record recs[max_packet_size];
+
+            for (int sample = 0; sample < samples_per_pixel; sample++) {
+                for (int lane = 0; lane < size; lane++) {
+                    packet.set(lane, get_ray(i + lane % bw, j + lane / bw), interval(0, infinity));
+                }
+
+                thread_counters().rays += size;
+                unsigned hits = world.hit_packet(packet, lane_mask(size), recs);
+
+                for (int lane = 0; lane < size; lane++) {
+                    bool hit = hits & (1u << lane);
+                    if (hit) recs[lane].set_footprint(packet.rays[lane], ray_dx, ray_dy);
+                    if (aovs.layers) {
+                        const int pixel = (j + lane / bw) * image_width + i + lane % bw;
+                        pixel_colors[lane] += shade_primary(pixel, packet.rays[lane], hit ? &recs[lane] : nullptr, world);
+                    } else {
+                        pixel_colors[lane] += hit ? shade(packet.rays[lane], recs[lane], max_depth, world) : primary_miss(packet.rays[lane]);
+                    }
+                }
+            }
+        }
+
+        // Color of one camera sample whose first hit (null on a miss) has already been traced, recording
+        // its layers for the pixel.
+        color shade_primary(int pixel, const ray& r, const hit_record* rec, const hittable& world) {
+            const color sky = rec ? background : primary_miss(r);
+            aovs.add_first_hit(pixel, r, rec, sky);
+            if (!aovs.has(aov_radiance_split)) {
+                return rec ? shade(r, *rec, max_depth, world) : sky;
+            }
+
+            color split[3] = { color(0,0,0), color(0,0,0), color(0,0,0) };
+            if (rec) {
+                shade_split(r, *rec, world, split);
+            } else {
+                split[0] = sky;
+            }
+            aovs.add_radiance(pixel, split);
+            return split[0] + split[1] + split[2];
+        }
+
+        // Light seen by a camera ray that leaves the scene, with the environment filtered over the pixel's footprint
+        color primary_miss(const ray& r) const {
+            return environment ? environment->radiance(r.direction(), ray_dx, ray_dy) : background;
+        }
+
+        // Light seen by a scattered ray that leaves the scene, see environment_light::radiance for scatter_pdf
+        color scattered_miss(const ray& r, real scatter_pdf) const {
+            return environment ? environment->radiance(r.direction(), scatter_pdf) : background;
+        }
+
+        // Color arriving along r. scatter_pdf is the density r was scattered with where the environment was also
+        // sampled, or 0.
+        color ray_color(const ray& r, int depth, const hittable& world, real scatter_pdf = 0) const {
             if (depth <= 0) {
                 return color(0,0,0);
             }
 
+            thread_counters().rays++;
             hit_record rec;
 
-            // if ray hits nothing, return background color.
-            if (!world.hit(r, interval(0.001, infinity), rec)) {
-                return background;
+            // if ray hits nothing, return the environment or background color.
+            if (!world.hit(r, interval(0, infinity), rec)) {
+                return (depth == max_depth) ? primary_miss(r) : scattered_miss(r, scatter_pdf);
             }
+            // Only camera rays have a footprint, every pixel's rays differ by the same change in direction
+            if (depth == max_depth) rec.set_footprint(r, ray_dx, ray_dy);
+
+            return shade(r, rec, depth, world);
+        }
 
-            // otherwise, calculate color and draw.
+        // Color carried back along r from its hit rec, recursing into the scattered ray.
+        color shade(const ray& r, const hit_record& rec, int depth, const hittable& world) const {
             ray scattered;
             color attenuation;
-            color emission_color = rec.mat->emitted(rec.u, rec.v, rec.p);
+            color emission_color = rec.mat->emitted(rec);
 
             if (!rec.mat->scatter(r, rec, attenuation, scattered)) {
                 return emission_color;
             }
 
-            color scatter_color = attenuation * ray_color(scattered, depth - 1, world);
+            // Diffuse hits also sample the environment directly, unless the path ends here anyway
+            color direct_color(0,0,0);
+            real scatter_pdf = 0;
+            if (environment && depth > 1 && rec.mat->is_diffuse()) {
+                direct_color = attenuation * environment->direct(world, rec, r.time());
+                scatter_pdf = diffuse_pdf(rec, scattered.direction());
+            }
+
+            color scatter_color = attenuation * ray_color(scattered, depth - 1, world, scatter_pdf);
 
-            return emission_color + scatter_color;
+            return emission_color + direct_color + scatter_color;
+        }
+
+        // The same path as shade(), followed iteratively so each bounce's radiance can be filed under
+        // emission (seen directly), direct (one bounce) or indirect (two or more) in split[0..2].
+        void shade_split(const ray& r, const hit_record& first, const hittable& world, color* split) const {
+            ray current = r;
+            hit_record rec = first;
+            color throughput(1,1,1);
+
+            for (int bounce = 0; ; bounce++) {
+                split[std::min(bounce, 2)] += throughput * rec.mat->emitted(rec);
+
+                ray scattered;
+                color attenuation;
+                if (!rec.mat->scatter(current, rec, attenuation, scattered)) return;
+                throughput = throughput * attenuation;
+
+                // shade() gives up once depth runs out, after scattering
+                if (bounce + 1 >= max_depth) return;
+
+                real scatter_pdf = 0;
+                if (environment && rec.mat->is_diffuse()) {
+                    split[std::min(bounce + 1, 2)] += throughput * environment->direct(world, rec, current.time());
+                    scatter_pdf = diffuse_pdf(rec, scattered.direction());
+                }
+
+                thread_counters().rays++;
+                if (!world.hit(scattered, interval(0, infinity), rec)) {
+                    split[std::min(bounce + 1, 2)] += throughput * scattered_miss(scattered, scatter_pdf);
+                    return;
+                }
+                rec.clear_footprint();
+                current = scattered;
+            }
         }
 
 };
@@ -19,22 +19,18 @@ inline double linear_to_gamma(double linear_component) {
     return 0;
 }
 
+// Gamma correct and quantize a linear color component to [0,255].
+inline int color_byte(double linear_component) {
+    static const interval intensity(0.000, 0.999);
+    return int(256 * intensity.clamp(linear_to_gamma(linear_component)));
+}
+
 // Write ray color to output stream written into pixel map. Configured only for ppm image type usage.
 void write_color(std::ostream& out, const color& pixel_color) {
-    auto r = pixel_color.x();
-    auto g = pixel_color.y();
-    auto b = pixel_color.z();
-
-    // Gamma correction
-    r = linear_to_gamma(r);
-    g = linear_to_gamma(g);
-    b = linear_to_gamma(b);
-
-    // Scale to [0,255]
-    static const interval intensity(0.000, 0.999);
-    int rb = int(256 * intensity.clamp(r));
-    int gb = int(256 * intensity.clamp(g));
-    int bb = int(256 * intensity.clamp(b));
+    // Gamma correction, scale to [0,255]
+    int rb = color_byte(pixel_color.x());
+    int gb = color_byte(pixel_color.y());
+    int bb = color_byte(pixel_color.z());
 
     // Write pixel components
     out << rb << ' ' << gb << ' ' << bb << '\n';
@@ -22,41 +22,51 @@ class constant_medium : public hittable {
         constant_medium(shared_ptr<hittable> boundary, double density, const color& albedo) : boundary(boundary), neg_inverse_density(-1 / density), phase_function(make_shared<isotropic>(albedo)) {}
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-            hit_record rec1, rec2;
-
-            if(!boundary->hit(r, interval::universe, rec1)) {
-                return false;
-            }
-
-            if(!boundary->hit(r, interval(rec1.t + 0.0001, infinity), rec2)) {
-                return false;
+            // Every boundary crossing in one query. They alternate entering and leaving, so each pair is a
+            // stretch of the ray inside the medium.
+            real ts[max_crossings];
+            int count = boundary->crossings(r, interval::universe, ts, max_crossings);
+
+            // Clip the stretches to ray_t
+            real starts[max_crossings / 2], ends[max_crossings / 2];
+            int stretches = 0;
+            real distance_within_boundary = 0;
+            auto ray_length = r.direction().length();
+            for (int i = 0; i + 1 < count; i += 2) {
+                real t0 = std::fmax(ts[i], ray_t.min);
+                real t1 = std::fmin(ts[i + 1], ray_t.max);
+                if (t0 >= t1) continue;
+                if (t0 < 0) t0 = 0;
+                starts[stretches] = t0;
+                ends[stretches++] = t1;
+                distance_within_boundary += (t1 - t0) * ray_length;
             }
 
-            if(rec1.t < ray_t.min) rec1.t = ray_t.min;
-            if(rec2.t > ray_t.max) rec2.t = ray_t.max;
-
-            if (rec1.t >= rec2.t) {
+            if (stretches == 0) {
                 return false;
             }
 
-            if (rec1.t < 0) {
-                rec1.t = 0;
-            }
-
-            auto ray_length = r.direction().length();
-            auto distance_within_boundary = (rec2.t - rec1.t) * ray_length;
             auto hit_distance = neg_inverse_density * std::log(random_double());
 
             if (hit_distance > distance_within_boundary) { 
                 return false;
             }
 
-            rec.t = rec1.t + hit_distance / ray_length;
+            // Find the stretch the scattering distance ends in
+            int k = 0;
+            while (k + 1 < stretches && hit_distance > (ends[k] - starts[k]) * ray_length) {
+                hit_distance -= (ends[k] - starts[k]) * ray_length;
+                k++;
+            }
+
+            rec.t = starts[k] + hit_distance / ray_length;
             rec.p = r.at(rec.t);
 
             rec.normal = vec3(1,0,0);
+            rec.dpdu = rec.dpdv = vec3(0,0,0);
             rec.front_face = true;
             rec.mat = phase_function; //texture
+            rec.object_id = object_id;
 
             return true;
         }
@@ -7,6 +7,7 @@
 #define CONSTANTS_H
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <limits>
@@ -17,6 +18,14 @@
 using std::make_shared;
 using std::shared_ptr;
 
+// Scalar type of geometry and shading math. Building with -DRT_SINGLE_PRECISION halves the size of every
+// vector, ray and box.
+#ifdef RT_SINGLE_PRECISION
+using real = float;
+#else
+using real = double;
+#endif
+
 // Constants
 const double infinity = std::numeric_limits<double>::infinity();
 const double pi = 3.1415926535897932385;
@@ -26,9 +35,32 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
+// Per-thread random state (splitmix64). Render threads reseed per tile so images are reproducible
+// regardless of thread count or scheduling.
+inline uint64_t& random_state() {
+    static thread_local uint64_t state = 0x853c49e6748fea9bULL;
+    return state;
+}
+
+inline uint64_t mix_seed(uint64_t x) {
+    // splitmix64 finalizer, also used to derive independent per-tile seeds
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+inline void seed_random(uint64_t seed) {
+    random_state() = mix_seed(seed);
+}
+
 inline double random_double() {
     // returns random real number [0,1)
-    return std::rand() / (RAND_MAX + 1.0);
+    uint64_t z = random_state() += 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return (z >> 11) * (1.0 / 9007199254740992.0);
 }
 
 inline double random_double(double min, double max) {
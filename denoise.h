@@ -0,0 +1,105 @@
+/**
+ * Casey Gehling
+ *
+ * Defines the denoiser: an edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) guided by
+ * the depth, normal and albedo AOVs. Color is demodulated by albedo so texture detail survives filtering, then
+ * smoothed with a 5x5 B3 spline kernel whose taps spread 1, 2, 4, ... pixels apart each pass. Taps are
+ * weighted down across edges in color, normal, albedo or depth. The filter itself is in denoise_kernels.h,
+ * run a register of pixels at a time with the SIMD kernels in use.
+ */
+
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include "aov.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <vector>
+
+class atrous_denoiser {
+    public:
+        int iterations = 5;
+        double sigma_color = 4.0; // halved every pass as the color estimate gets smoother
+        double sigma_normal = 0.3;
+        double sigma_albedo = 0.1;
+        double sigma_depth = 0.1; // relative to the pixel's own depth
+        int num_threads = 0; // 0 uses every hardware thread
+
+        // Filter image (width by height, row major) in place.
+        void apply(std::vector<color>& image, const aov_buffers& features, int width, int height) const {
+            const size_t pixels = image.size();
+
+            // Demodulate: filter irradiance, not texture. Kernels read each channel as its own plane.
+            std::vector<real> irradiance[3], filtered[3], normal[3], albedo[3], depth(pixels);
+            for (int c = 0; c < 3; c++) {
+                irradiance[c].resize(pixels);
+                filtered[c].resize(pixels);
+                normal[c].resize(pixels);
+                albedo[c].resize(pixels);
+            }
+            for (size_t i = 0; i < pixels; i++) {
+                const color a = features.albedo(int(i));
+                const color e = image[i] / safe_albedo(a);
+                const vec3 n = features.normal(int(i));
+                for (int c = 0; c < 3; c++) {
+                    irradiance[c][i] = e[c];
+                    normal[c][i] = n[c];
+                    albedo[c][i] = a[c];
+                }
+                depth[i] = real(features.depth(int(i)));
+            }
+
+            atrous_pass pass;
+            pass.nx = normal[0].data(); pass.ny = normal[1].data(); pass.nz = normal[2].data();
+            pass.ar = albedo[0].data(); pass.ag = albedo[1].data(); pass.ab = albedo[2].data();
+            pass.depth = depth.data();
+            pass.width = width;
+            pass.height = height;
+            pass.inv_normal = real(1.0 / (sigma_normal * sigma_normal));
+            pass.inv_albedo = real(1.0 / (sigma_albedo * sigma_albedo));
+            pass.inv_depth = real(1.0 / (sigma_depth * sigma_depth));
+
+            double sigma_c = sigma_color;
+            for (int iteration = 0; iteration < iterations; iteration++) {
+                pass.r = irradiance[0].data(); pass.g = irradiance[1].data(); pass.b = irradiance[2].data();
+                pass.out_r = filtered[0].data(); pass.out_g = filtered[1].data(); pass.out_b = filtered[2].data();
+                pass.step = 1 << iteration;
+                pass.inv_color = real(1.0 / (sigma_c * sigma_c));
+                filter_pass(pass);
+                for (int c = 0; c < 3; c++) irradiance[c].swap(filtered[c]);
+                sigma_c *= 0.5;
+            }
+
+            for (size_t i = 0; i < pixels; i++) {
+                image[i] = color(irradiance[0][i], irradiance[1][i], irradiance[2][i]) * safe_albedo(features.albedo(int(i)));
+            }
+        }
+
+    private:
+        static color safe_albedo(const color& a) {
+            const double floor = 0.01;
+            return color(std::fmax(a.x(), floor), std::fmax(a.y(), floor), std::fmax(a.z(), floor));
+        }
+
+        // One a-trous pass, rows split across threads and filtered by the active SIMD kernels.
+        void filter_pass(const atrous_pass& pass) const {
+            const simd_kernel_table& simd = simd_kernels();
+            int thread_count = (num_threads > 0) ? num_threads : std::max(1u, std::thread::hardware_concurrency());
+            thread_count = std::min(thread_count, pass.height);
+            std::vector<std::thread> threads;
+            const int rows_per_thread = (pass.height + thread_count - 1) / thread_count;
+            for (int t = 0; t < thread_count; t++) {
+                const int start = t * rows_per_thread;
+                const int end = std::min(pass.height, start + rows_per_thread);
+                if (start < end) threads.emplace_back(simd.atrous_rows, std::cref(pass), start, end);
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,106 @@
+/**
+ * Casey Gehling
+ *
+ * The a-trous denoising filter (denoise.h), written once against the vreal register wrapper. simd.h includes
+ * this file inside each instruction set's namespace, the scalar one included, so it deliberately has no include
+ * guard and includes nothing itself. A register of neighbouring pixels in a row is filtered at a time, and every
+ * set does the same arithmetic, so the denoised image doesn't depend on the CPU.
+ */
+
+// exp(x) for x <= 0, to about 1e-8 relative: a Taylor polynomial at x / 64, squared six times. Weights below
+// exp(-64) are taken as that.
+inline vreal filter_exp(vreal x) {
+    static const real terms[13] = {
+        1, 1, 1.0/2, 1.0/6, 1.0/24, 1.0/120, 1.0/720, 1.0/5040, 1.0/40320, 1.0/362880, 1.0/3628800,
+        1.0/39916800, 1.0/479001600
+    };
+    const vreal y = max(x, vreal(-64)) * vreal(real(1.0 / 64));
+    vreal e(terms[12]);
+    for (int k = 11; k >= 0; k--) e = e * y + vreal(terms[k]);
+    for (int k = 0; k < 6; k++) e = e * e;
+    return e;
+}
+
+// Register of row[x + offset] for the pixels from x, clamped to the row. Away from its ends that's one load;
+// near them, or past the last pixel, each lane is gathered.
+inline vreal load_row(const real* row, int x, int offset, int width, bool inside) {
+    if (inside) return vreal::load(row + x + offset);
+    real lanes[max_packet_size];
+    for (int l = 0; l < vreal::width; l++) {
+        const int q = std::min(x + l, width - 1) + offset;
+        lanes[l] = row[std::min(std::max(q, 0), width - 1)];
+    }
+    return vreal::load(lanes);
+}
+
+inline void store_row(real* row, int x, int width, vreal v) {
+    if (x + vreal::width <= width) {
+        v.store(row + x);
+        return;
+    }
+    real lanes[max_packet_size];
+    v.store(lanes);
+    for (int l = 0; x + l < width; l++) row[x + l] = lanes[l];
+}
+
+// Filter rows [row_start, row_end) of an a-trous pass with the 5x5 B3 spline kernel, each tap weighted down
+// by its differences from the centre pixel in color, normal, albedo and depth
+inline void atrous_rows(const atrous_pass& p, int row_start, int row_end) {
+    static const real kernel[5] = { 1.0/16, 1.0/4, 3.0/8, 1.0/4, 1.0/16 };
+    const int reach = 2 * p.step;
+    const int width = p.width;
+
+    for (int y = row_start; y < row_end; y++) {
+        const size_t row = size_t(y) * width;
+        for (int x = 0; x < width; x += vreal::width) {
+            const bool inside = x >= reach && x + vreal::width - 1 + reach < width;
+            const vreal cr = load_row(p.r + row, x, 0, width, inside);
+            const vreal cg = load_row(p.g + row, x, 0, width, inside);
+            const vreal cb = load_row(p.b + row, x, 0, width, inside);
+            const vreal nx = load_row(p.nx + row, x, 0, width, inside);
+            const vreal ny = load_row(p.ny + row, x, 0, width, inside);
+            const vreal nz = load_row(p.nz + row, x, 0, width, inside);
+            const vreal ar = load_row(p.ar + row, x, 0, width, inside);
+            const vreal ag = load_row(p.ag + row, x, 0, width, inside);
+            const vreal ab = load_row(p.ab + row, x, 0, width, inside);
+            const vreal dp = load_row(p.depth + row, x, 0, width, inside);
+            const vreal depth_scale = vreal(1) / max(dp, vreal(real(1e-3)));
+
+            vreal sum_r(0), sum_g(0), sum_b(0), weight_sum(0);
+            for (int ky = -2; ky <= 2; ky++) {
+                const size_t tap_row = size_t(std::min(std::max(y + ky * p.step, 0), p.height - 1)) * width;
+                for (int kx = -2; kx <= 2; kx++) {
+                    const int offset = kx * p.step;
+                    const vreal qr = load_row(p.r + tap_row, x, offset, width, inside);
+                    const vreal qg = load_row(p.g + tap_row, x, offset, width, inside);
+                    const vreal qb = load_row(p.b + tap_row, x, offset, width, inside);
+                    const vreal dr = qr - cr, dg = qg - cg, db = qb - cb;
+                    const vreal dnx = load_row(p.nx + tap_row, x, offset, width, inside) - nx;
+                    const vreal dny = load_row(p.ny + tap_row, x, offset, width, inside) - ny;
+                    const vreal dnz = load_row(p.nz + tap_row, x, offset, width, inside) - nz;
+                    const vreal dar = load_row(p.ar + tap_row, x, offset, width, inside) - ar;
+                    const vreal dag = load_row(p.ag + tap_row, x, offset, width, inside) - ag;
+                    const vreal dab = load_row(p.ab + tap_row, x, offset, width, inside) - ab;
+                    const vreal dd = (load_row(p.depth + tap_row, x, offset, width, inside) - dp) * depth_scale;
+
+                    const vreal dc = dr * dr + dg * dg + db * db;
+                    const vreal dn = dnx * dnx + dny * dny + dnz * dnz;
+                    const vreal da = dar * dar + dag * dag + dab * dab;
+                    const vreal exponent = dc * vreal(p.inv_color) + dn * vreal(p.inv_normal)
+                        + da * vreal(p.inv_albedo) + dd * dd * vreal(p.inv_depth);
+                    const vreal w = vreal(kernel[kx + 2] * kernel[ky + 2]) * filter_exp(vreal(0) - exponent);
+
+                    sum_r = sum_r + w * qr;
+                    sum_g = sum_g + w * qg;
+                    sum_b = sum_b + w * qb;
+                    weight_sum = weight_sum + w;
+                }
+            }
+
+            const vreal inv_weight = vreal(1) / weight_sum;
+            store_row(p.out_r + row, x, width, sum_r * inv_weight);
+            store_row(p.out_g + row, x, width, sum_g * inv_weight);
+            store_row(p.out_b + row, x, width, sum_b * inv_weight);
+        }
+    }
+}
@@ -0,0 +1,248 @@
+/**
+ * Casey Gehling
+ *
+ * Defines the dynamic BVH, a top level BVH over whole objects that is updated between frames of an animation
+ * instead of being built again. Objects are added as static or dynamic, and each kind gets its own side of the
+ * root. After dynamic objects move, update() refits the boxes of the nodes above them; the static side is left as
+ * it is. Refitting keeps the tree correct but not good, as objects drift away from the ones they were grouped with,
+ * so each node also tracks the total area of its subtree's boxes, and a subtree whose area has grown past
+ * rebuild_threshold times what it was when built is built again by binned SAH, in place.
+ */
+
+#ifndef DYNAMIC_BVH_H
+#define DYNAMIC_BVH_H
+
+#include "flat_bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// What one update() did
+struct bvh_update_stats {
+    size_t refit_nodes = 0;
+    size_t rebuilt_subtrees = 0;
+    size_t rebuilt_nodes = 0;
+};
+
+class dynamic_bvh : public hittable {
+    public:
+        // A subtree is built again once the area of its boxes grows past this many times what it was when built
+        real rebuild_threshold = 1.2;
+
+        dynamic_bvh() {}
+
+        // The objects of list, all static
+        dynamic_bvh(const hittable_list& list) {
+            for (const auto& object : list.objects) add(object);
+            build();
+        }
+
+        // Add an object, dynamic if it will move between updates. Returns its index. Call build() after the last.
+        size_t add(shared_ptr<hittable> object, bool is_dynamic = false) {
+            objects.push_back(object);
+            dynamic.push_back(is_dynamic);
+            boxes.push_back(object->bounding_box());
+            return objects.size() - 1;
+        }
+
+        size_t size() const { return objects.size(); }
+        size_t node_count() const { return nodes.size(); }
+
+        // Build the whole tree over the objects' current bounds. With both kinds of object, the static ones get
+        // one side of the root and the dynamic ones the other, so nothing a dynamic object does reaches into the
+        // static side.
+        void build() {
+            for (size_t i = 0; i < objects.size(); i++) boxes[i] = objects[i]->bounding_box();
+            std::vector<uint32_t> order(objects.size());
+            for (size_t i = 0; i < order.size(); i++) order[i] = uint32_t(i);
+            const size_t static_count = size_t(std::stable_partition(order.begin(), order.end(), [&](uint32_t i) {
+                return !dynamic[i];
+            }) - order.begin());
+
+            nodes.clear();
+            separated = static_count > 0 && static_count < order.size();
+            if (separated) {
+                nodes.push_back(flat_node());
+                const uint32_t first = build_node(nodes, 0, order, 0, static_count, 1);
+                const uint32_t second = build_node(nodes, 0, order, static_count, order.size(), 1);
+                flat_node& root = nodes[0];
+                root.bbox = aabb(nodes[first].bbox, nodes[second].bbox);
+                root.cost = root.built_cost = root.bbox.surface_area() + nodes[first].cost + nodes[second].cost;
+                root.offset = second;
+                root.count = 0;
+                root.axis = uint8_t(root.bbox.longest_axis());
+                root.dynamic = true;
+            } else if (!order.empty()) {
+                build_node(nodes, 0, order, 0, order.size(), 0);
+            }
+            find_dynamic_nodes();
+        }
+
+        // Take the dynamic objects' new bounds: refit the nodes above them, then build again any subtree that has
+        // degraded past rebuild_threshold. Static subtrees aren't touched.
+        bvh_update_stats update() {
+            bvh_update_stats stats;
+            if (nodes.empty()) return stats;
+            refit(stats);
+
+            // Top down, so a degraded subtree is built again whole rather than in pieces
+            std::vector<std::pair<uint32_t, int> > stack(1, std::make_pair(uint32_t(0), 0));
+            bool rebuilt = false;
+            while (!stack.empty()) {
+                const uint32_t index = stack.back().first;
+                const int depth = stack.back().second;
+                stack.pop_back();
+                const flat_node& node = nodes[index];
+                if (!node.dynamic || node.count > 0) continue;
+                if (node.cost > rebuild_threshold * node.built_cost && !(separated && index == 0)) {
+                    stats.rebuilt_nodes += rebuild(index, depth);
+                    stats.rebuilt_subtrees++;
+                    rebuilt = true;
+                    continue;
+                }
+                stack.push_back(std::make_pair(index + 1, depth + 1));
+                stack.push_back(std::make_pair(node.offset, depth + 1));
+            }
+            if (rebuilt) {
+                // Subtrees hold the same objects as before, so boxes above them stay the same, but areas shrink
+                find_dynamic_nodes();
+                for (auto i = dynamic_nodes.rbegin(); i != dynamic_nodes.rend(); ++i) {
+                    flat_node& node = nodes[*i];
+                    if (node.count == 0) node.cost = node.bbox.surface_area() + nodes[*i + 1].cost + nodes[node.offset].cost;
+                }
+            }
+            return stats;
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            if (nodes.empty()) return false;
+
+            bool hit_anything = false;
+            flat_bvh::traverse(nodes.data(), 0, r.direction(), [&](uint32_t, const flat_node& node) {
+                return node.bbox.hit(r, ray_t);
+            }, [&](const flat_node& node) {
+                if (objects[node.offset]->hit(r, ray_t, rec)) {
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                }
+            });
+            return hit_anything;
+        }
+
+        aabb bounding_box() const override { return nodes.empty() ? aabb::empty : nodes[0].bbox; }
+
+    private:
+        // Interior nodes have count 0, their first child next in the array and the second at offset. Leaves have
+        // count 1 and hold object offset, so a subtree over k objects is always 2k - 1 consecutive nodes.
+        struct flat_node {
+            aabb bbox;
+            real cost; // total surface area of the boxes in the subtree
+            real built_cost; // cost when the subtree was last built
+            uint32_t offset;
+            uint16_t count;
+            uint8_t axis;
+            bool dynamic; // some object under the node is dynamic
+        };
+
+        static const int sah_depth = 32;
+
+        std::vector<shared_ptr<hittable> > objects;
+        std::vector<bool> dynamic;
+        std::vector<aabb> boxes; // of each object, as of the last build or update
+        std::vector<flat_node> nodes;
+        std::vector<uint32_t> dynamic_nodes; // indices of the dynamic nodes, increasing
+        bool separated = false; // the root's first child holds the static objects and its second the dynamic ones
+
+        void find_dynamic_nodes() {
+            dynamic_nodes.clear();
+            for (size_t i = 0; i < nodes.size(); i++) {
+                if (nodes[i].dynamic) dynamic_nodes.push_back(uint32_t(i));
+            }
+        }
+
+        // Children come after their parents, so going backwards refits both children before the parent
+        void refit(bvh_update_stats& stats) {
+            for (auto i = dynamic_nodes.rbegin(); i != dynamic_nodes.rend(); ++i) {
+                flat_node& node = nodes[*i];
+                if (node.count > 0) {
+                    boxes[node.offset] = objects[node.offset]->bounding_box();
+                    node.bbox = boxes[node.offset];
+                    node.cost = node.bbox.surface_area();
+                } else {
+                    const flat_node& first = nodes[*i + 1];
+                    const flat_node& second = nodes[node.offset];
+                    node.bbox = aabb(first.bbox, second.bbox);
+                    node.cost = node.bbox.surface_area() + first.cost + second.cost;
+                }
+                stats.refit_nodes++;
+            }
+        }
+
+        // Build the subtree at index, depth deep, again over the same objects. Returns its node count.
+        size_t rebuild(uint32_t index, int depth) {
+            // The subtree ends after the last node down its right side
+            uint32_t last = index;
+            while (nodes[last].count == 0) last = nodes[last].offset;
+
+            std::vector<uint32_t> order;
+            for (uint32_t i = index; i <= last; i++) {
+                if (nodes[i].count > 0) order.push_back(nodes[i].offset);
+            }
+            std::vector<flat_node> subtree;
+            subtree.reserve(last - index + 1);
+            build_node(subtree, index, order, 0, order.size(), depth);
+            std::copy(subtree.begin(), subtree.end(), nodes.begin() + index);
+            return subtree.size();
+        }
+
+        // Build the subtree over order[begin, end) onto out, whose first node goes at index base of the tree, and
+        // return the tree index of its root
+        uint32_t build_node(
+            std::vector<flat_node>& out, uint32_t base, std::vector<uint32_t>& order, size_t begin, size_t end, int depth
+        ) {
+            const size_t local = out.size();
+            out.push_back(flat_node());
+
+            aabb bounds = aabb::empty;
+            aabb centroid_bounds = aabb::empty;
+            bool any_dynamic = false;
+            for (size_t i = begin; i < end; i++) {
+                bounds = aabb(bounds, boxes[order[i]]);
+                const point3 c = centroid(order[i]);
+                centroid_bounds = aabb(centroid_bounds, aabb(c, c));
+                any_dynamic = any_dynamic || dynamic[order[i]];
+            }
+            out[local].bbox = bounds;
+            out[local].dynamic = any_dynamic;
+            out[local].axis = 0;
+
+            if (end - begin == 1) {
+                out[local].offset = order[begin];
+                out[local].count = 1;
+                out[local].cost = out[local].built_cost = bounds.surface_area();
+                return base + uint32_t(local);
+            }
+
+            const int axis = centroid_bounds.longest_axis();
+            const size_t mid = flat_bvh::split(order, begin, end, depth, 1, sah_depth, axis, centroid_bounds.axis_interval(axis),
+                [&](uint32_t i) { return centroid(i); }, [&](uint32_t i) { return boxes[i]; });
+
+            out[local].count = 0;
+            out[local].axis = uint8_t(axis);
+            const uint32_t first = build_node(out, base, order, begin, mid, depth + 1);
+            const uint32_t second = build_node(out, base, order, mid, end, depth + 1);
+            out[local].offset = second;
+            out[local].cost = out[local].built_cost = bounds.surface_area() + out[first - base].cost + out[second - base].cost;
+            return base + uint32_t(local);
+        }
+
+        point3 centroid(uint32_t i) const {
+            const aabb& b = boxes[i];
+            return point3((b.x.min + b.x.max) / 2, (b.y.min + b.y.max) / 2, (b.z.min + b.z.max) / 2);
+        }
+};
+
+#endif
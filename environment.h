@@ -0,0 +1,251 @@
+/**
+ * Casey Gehling
+ *
+ * Defines environment lights, light arriving from infinitely far away in every direction. It is looked up when a
+ * ray leaves the scene, instead of being geometry the ray has to hit. An environment is either six cube map faces
+ * or one equirectangular map. A distribution over its luminance is built up front, so diffuse surfaces can sample
+ * bright parts of the sky directly. Those samples are combined with the surface's own scattering by multiple
+ * importance sampling.
+ */
+
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include "hittable.h"
+#include "texture.h"
+
+#include <algorithm>
+#include <vector>
+
+// Piecewise constant distribution over the unit square on an nu by nv grid, sampled by inverting its marginal
+// distribution over rows and then the conditional one within the row.
+class distribution_2d {
+    public:
+        distribution_2d() : nu(0), nv(0) {}
+
+        // Weights of the cells, row by row. Negative weights count as zero; if every weight is zero the
+        // distribution is uniform.
+        distribution_2d(const std::vector<double>& weights, int nu, int nv) : nu(nu), nv(nv) {
+            double total = 0;
+            for (double w : weights) total += std::max(w, 0.0);
+            density.resize(weights.size());
+            for (size_t i = 0; i < weights.size(); i++) {
+                density[i] = (total > 0) ? std::max(weights[i], 0.0) * nu * nv / total : 1.0;
+            }
+
+            conditional.resize(size_t(nu + 1) * nv);
+            marginal.resize(nv + 1);
+            marginal[0] = 0;
+            for (int j = 0; j < nv; j++) {
+                double* cdf = &conditional[size_t(j) * (nu + 1)];
+                cdf[0] = 0;
+                for (int i = 0; i < nu; i++) cdf[i + 1] = cdf[i] + density[size_t(j) * nu + i];
+                marginal[j + 1] = marginal[j] + cdf[nu];
+            }
+        }
+
+        // Point (u,v) drawn from two uniform numbers in [0,1), with its density
+        void sample(double r1, double r2, double& u, double& v, double& pdf) const {
+            const int j = find(marginal.data(), nv, r1 * marginal[nv]);
+            const double* cdf = &conditional[size_t(j) * (nu + 1)];
+            const int i = find(cdf, nu, r2 * cdf[nu]);
+
+            v = (j + within(marginal[j], marginal[j + 1], r1 * marginal[nv])) / nv;
+            u = (i + within(cdf[i], cdf[i + 1], r2 * cdf[nu])) / nu;
+            pdf = density[size_t(j) * nu + i];
+        }
+
+        double pdf(double u, double v) const {
+            const int i = std::min(std::max(int(u * nu), 0), nu - 1);
+            const int j = std::min(std::max(int(v * nv), 0), nv - 1);
+            return density[size_t(j) * nu + i];
+        }
+
+    private:
+        int nu, nv;
+        std::vector<double> density; // of each cell, averaging 1 over the square
+        std::vector<double> conditional; // CDF along each row, unnormalised, nu + 1 entries a row
+        std::vector<double> marginal; // CDF over the rows' totals, nv + 1 entries
+
+        // Cell whose CDF interval holds x, skipping empty cells
+        static int find(const double* cdf, int n, double x) {
+            const int found = int(std::upper_bound(cdf + 1, cdf + n + 1, x) - cdf) - 1;
+            return std::min(std::max(found, 0), n - 1);
+        }
+
+        static double within(double lo, double hi, double x) {
+            return (hi > lo) ? std::min(std::max((x - lo) / (hi - lo), 0.0), 1.0 - 1e-9) : 0.5;
+        }
+};
+
+// Power heuristic weight of a sample drawn with density pdf, against another strategy that draws it with other_pdf
+inline real power_heuristic(real pdf, real other_pdf) {
+    const real a = pdf * pdf, b = other_pdf * other_pdf;
+    return (a + b > 0) ? a / (a + b) : 0;
+}
+
+// Density per unit solid angle of a cosine weighted direction, the distribution diffuse materials scatter with
+inline real diffuse_pdf(const hit_record& rec, const vec3& direction) {
+    return std::max(dot(unit_vector(direction), rec.normal), real(0)) / pi;
+}
+
+class environment_light {
+    public:
+        // Six cube map faces, each seen as the quads of cube_map() showed it
+        environment_light(
+            shared_ptr<texture> left, shared_ptr<texture> right, shared_ptr<texture> front,
+            shared_ptr<texture> back, shared_ptr<texture> top, shared_ptr<texture> bottom
+        ) : faces{ left, right, front, back, top, bottom }, cube(true) {
+            build_distribution();
+        }
+
+        // Equirectangular map, u around the horizon and v from straight down to straight up, as spheres map it
+        explicit environment_light(shared_ptr<texture> map) : faces{ map }, cube(false) {
+            build_distribution();
+        }
+
+        // Light arriving from direction
+        color radiance(const vec3& direction) const {
+            const coords c = locate(direction);
+            hit_record rec;
+            rec.u = c.u;
+            rec.v = c.v;
+            rec.p = direction;
+            return faces[c.face]->value(rec);
+        }
+
+        // Filtered over the footprint of a camera ray whose neighbouring pixels' directions differ by ddx and ddy
+        color radiance(const vec3& direction, const vec3& ddx, const vec3& ddy) const {
+            const coords c = locate(direction), cx = locate(direction + ddx), cy = locate(direction + ddy);
+            hit_record rec;
+            rec.u = c.u;
+            rec.v = c.v;
+            rec.p = direction;
+            // A footprint across a cube edge has no single face to filter on
+            if (cx.face == c.face && cy.face == c.face) {
+                rec.dudx = wrap(cx.u - c.u);
+                rec.dvdx = cx.v - c.v;
+                rec.dudy = wrap(cy.u - c.u);
+                rec.dvdy = cy.v - c.v;
+            }
+            return faces[c.face]->value(rec);
+        }
+
+        // Light arriving from the direction a diffuse surface scattered into, drawn with scatter_pdf, weighted
+        // against the environment sample taken at the same surface. A scatter_pdf of zero means no sample was
+        // taken there and the light counts in full.
+        color radiance(const vec3& direction, real scatter_pdf) const {
+            const color light = radiance(direction);
+            return (scatter_pdf > 0) ? power_heuristic(scatter_pdf, pdf(direction)) * light : light;
+        }
+
+        // Direction drawn in proportion to luminance, with its density per unit solid angle (zero if unusable)
+        vec3 sample(real& direction_pdf) const {
+            double u, v, map_pdf;
+            distribution.sample(random_double(), random_double(), u, v, map_pdf);
+            const double theta = v * pi, phi = 2 * pi * u;
+            const double sin_theta = std::sin(theta);
+            direction_pdf = (sin_theta > 0) ? real(map_pdf / (2 * pi * pi * sin_theta)) : 0;
+            return vec3(-std::cos(phi) * sin_theta, -std::cos(theta), std::sin(phi) * sin_theta);
+        }
+
+        // Density per unit solid angle that sample() draws direction with
+        real pdf(const vec3& direction) const {
+            const vec3 d = unit_vector(direction);
+            const real sin_theta = std::sqrt(d.x() * d.x() + d.z() * d.z());
+            if (!(sin_theta > 0)) return 0;
+            real u, v;
+            sphere_uv(d, u, v);
+            return real(distribution.pdf(u, v) / (2 * pi * pi * sin_theta));
+        }
+
+        // Light from one sampled direction reaching a diffuse hit, per unit albedo and weighted against the
+        // surface's own scattering. Zero if the direction is below the surface or blocked by the scene.
+        color direct(const hittable& world, const hit_record& rec, real time) const {
+            real light_pdf;
+            const vec3 direction = sample(light_pdf);
+            if (!(light_pdf > 0)) return color(0,0,0);
+            const real scatter_pdf = diffuse_pdf(rec, direction);
+            if (scatter_pdf <= 0) return color(0,0,0);
+
+            thread_counters().rays++;
+            hit_record blocker;
+            if (world.hit(spawn_ray(rec, direction, time), interval(0, infinity), blocker)) return color(0,0,0);
+            return (scatter_pdf * power_heuristic(light_pdf, scatter_pdf) / light_pdf) * radiance(direction);
+        }
+
+    private:
+        static const int map_width = 512, map_height = 256; // cells of the luminance distribution
+
+        // Face and texture coordinates a direction looks up
+        struct coords {
+            int face;
+            real u, v;
+        };
+
+        shared_ptr<texture> faces[6]; // only the first for an equirectangular map
+        bool cube;
+        distribution_2d distribution; // over the equirectangular (u,v) of directions, whatever the map's layout
+
+        static void sphere_uv(const vec3& d, real& u, real& v) {
+            const real y = std::min(std::max(d.y(), real(-1)), real(1));
+            u = (std::atan2(-d.z(), d.x()) + pi) / (2 * pi);
+            v = std::acos(-y) / pi;
+        }
+
+        static real wrap(real du) {
+            return (du > 0.5) ? du - 1 : (du < -0.5) ? du + 1 : du;
+        }
+
+        coords locate(const vec3& direction) const {
+            coords c;
+            if (!cube) {
+                c.face = 0;
+                sphere_uv(unit_vector(direction), c.u, c.v);
+                return c;
+            }
+
+            // The face the direction leaves through, and where on the [-1,1] square of that face
+            const real ax = std::fabs(direction.x()), ay = std::fabs(direction.y()), az = std::fabs(direction.z());
+            if (ax >= ay && ax >= az) {
+                c.face = (direction.x() < 0) ? 0 : 1;
+                c.u = direction.z() / ax;
+                c.v = direction.y() / ax;
+            } else if (az >= ay) {
+                c.face = (direction.z() > 0) ? 2 : 3;
+                c.u = direction.x() / az;
+                c.v = direction.y() / az;
+            } else {
+                c.face = (direction.y() > 0) ? 4 : 5;
+                c.u = direction.x() / ay;
+                c.v = direction.z() / ay;
+            }
+            c.u = (c.u + 1) / 2;
+            c.v = (c.v + 1) / 2;
+            return c;
+        }
+
+        // Luminance over each cell, filtered at the cell's size, times the cell's share of the sphere
+        void build_distribution() {
+            std::vector<double> weights(size_t(map_width) * map_height);
+            for (int j = 0; j < map_height; j++) {
+                const double theta = (j + 0.5) * pi / map_height;
+                for (int i = 0; i < map_width; i++) {
+                    const double phi = (i + 0.5) * 2 * pi / map_width;
+                    const vec3 d = direction_at(theta, phi);
+                    const vec3 ddx = direction_at(theta, phi + 2 * pi / map_width) - d;
+                    const vec3 ddy = direction_at(theta + pi / map_height, phi) - d;
+                    const color c = radiance(d, ddx, ddy);
+                    const double luminance = 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+                    weights[size_t(j) * map_width + i] = luminance * std::sin(theta);
+                }
+            }
+            distribution = distribution_2d(weights, map_width, map_height);
+        }
+
+        static vec3 direction_at(double theta, double phi) {
+            return vec3(-std::cos(phi) * std::sin(theta), -std::cos(theta), std::sin(phi) * std::sin(theta));
+        }
+};
+
+#endif
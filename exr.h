@@ -0,0 +1,129 @@
+/**
+ * Casey Gehling
+ *
+ * Minimal OpenEXR writer: single part, scanline, uncompressed, 32 bit float channels. Enough for any
+ * EXR reader or compositor to pick up multi-layer output, where layers are channel name prefixes
+ * ("normal.X", "albedo.R", ...).
+ */
+
+#ifndef EXR_H
+#define EXR_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// One float plane, width * height values in row-major order.
+struct exr_channel {
+    std::string name;
+    const float* data;
+};
+
+class exr_writer {
+    public:
+        // Write the channels to filename. EXR requires channels in alphabetical order, so they are sorted here.
+        static bool write(const std::string& filename, int width, int height, std::vector<exr_channel> channels) {
+            std::sort(channels.begin(), channels.end(), [](const exr_channel& a, const exr_channel& b) {
+                return a.name < b.name;
+            });
+
+            std::vector<char> header;
+            put_bytes(header, "\x76\x2f\x31\x01", 4); // magic
+            put_int(header, 2); // version 2, single part scanline
+
+            // Channel list: name, pixel type (2 = float), pLinear, 3 reserved bytes, x and y sampling
+            std::vector<char> chlist;
+            for (const auto& c : channels) {
+                put_bytes(chlist, c.name.c_str(), c.name.size() + 1);
+                put_int(chlist, 2);
+                put_bytes(chlist, "\0\0\0\0", 4);
+                put_int(chlist, 1);
+                put_int(chlist, 1);
+            }
+            chlist.push_back(0);
+            put_attribute(header, "channels", "chlist", chlist);
+
+            std::vector<char> value;
+            value.push_back(0); // no compression
+            put_attribute(header, "compression", "compression", value);
+
+            value.clear();
+            put_int(value, 0);
+            put_int(value, 0);
+            put_int(value, width - 1);
+            put_int(value, height - 1);
+            put_attribute(header, "dataWindow", "box2i", value);
+            put_attribute(header, "displayWindow", "box2i", value);
+
+            value.assign(1, 0); // increasing y
+            put_attribute(header, "lineOrder", "lineOrder", value);
+
+            value.clear();
+            put_float(value, 1.0f);
+            put_attribute(header, "pixelAspectRatio", "float", value);
+
+            value.clear();
+            put_float(value, 0.0f);
+            put_float(value, 0.0f);
+            put_attribute(header, "screenWindowCenter", "v2f", value);
+
+            value.clear();
+            put_float(value, 1.0f);
+            put_attribute(header, "screenWindowWidth", "float", value);
+
+            header.push_back(0); // end of header
+
+            // Offset table, one entry per scanline block (one scanline each when uncompressed)
+            const uint64_t line_bytes = uint64_t(width) * channels.size() * sizeof(float);
+            const uint64_t block_bytes = 8 + line_bytes;
+            uint64_t offset = header.size() + uint64_t(height) * 8;
+            for (int y = 0; y < height; y++) {
+                put_bytes(header, reinterpret_cast<const char*>(&offset), 8);
+                offset += block_bytes;
+            }
+
+            std::ofstream out(filename, std::ios::binary);
+            if (!out) return false;
+            out.write(header.data(), header.size());
+
+            // Scanline blocks: y, data size, then each channel's row in channel order
+            std::vector<char> block;
+            for (int y = 0; y < height; y++) {
+                block.clear();
+                put_int(block, y);
+                put_int(block, int32_t(line_bytes));
+                for (const auto& c : channels) {
+                    put_bytes(block, reinterpret_cast<const char*>(c.data + size_t(y) * width), width * sizeof(float));
+                }
+                out.write(block.data(), block.size());
+            }
+
+            return bool(out);
+        }
+
+    private:
+        // EXR is little endian, as are the hosts this builds on, so values are copied as is.
+        static void put_bytes(std::vector<char>& out, const char* bytes, size_t count) {
+            out.insert(out.end(), bytes, bytes + count);
+        }
+
+        static void put_int(std::vector<char>& out, int32_t v) {
+            put_bytes(out, reinterpret_cast<const char*>(&v), 4);
+        }
+
+        static void put_float(std::vector<char>& out, float v) {
+            put_bytes(out, reinterpret_cast<const char*>(&v), 4);
+        }
+
+        static void put_attribute(std::vector<char>& out, const char* name, const char* type, const std::vector<char>& value) {
+            put_bytes(out, name, std::strlen(name) + 1);
+            put_bytes(out, type, std::strlen(type) + 1);
+            put_int(out, int32_t(value.size()));
+            put_bytes(out, value.data(), value.size());
+        }
+};
+
+#endif
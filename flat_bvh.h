@@ -0,0 +1,147 @@
+/**
+ * Casey Gehling
+ *
+ * What the flat BVHs (sphere_set, triangle_mesh, dynamic_bvh) share. Their nodes sit in one array, each interior
+ * node's first child right after it and its second at its offset, with count 0; leaves have a count. Trees are
+ * built top down, splitting at the cheapest bin boundary by the surface area heuristic, and walked nearest child
+ * first with a fixed stack. Each BVH keeps its own node layout and leaf test, and passes them in as callbacks.
+ */
+
+#ifndef FLAT_BVH_H
+#define FLAT_BVH_H
+
+#include "aabb.h"
+#include "profile.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+struct flat_bvh {
+    static const int bin_count = 16;
+    static const int max_depth = 64; // of any leaf, so traversal's stack can't overflow
+
+    // Levels a subtree over count primitives takes if every split under it is at the median
+    static int median_levels(size_t count, int leaf_size) {
+        int levels = 0;
+        for (; count > size_t(leaf_size); count = (count + 1) / 2) levels++;
+        return levels;
+    }
+
+    // Whether a node depth deep over count primitives may split by cost, rather than at the median. Past sah_depth
+    // it may not. Its children hold no more than it does, so while the median could still finish under them
+    // within max_depth, it always can.
+    static bool may_split_by_cost(int depth, size_t count, int leaf_size, int sah_depth) {
+        return depth < sah_depth && depth + 1 + median_levels(count, leaf_size) <= max_depth;
+    }
+
+    // Bin order[begin, end) by centroid(i)[axis] over extent and partition at the bin boundary where the bounds(i)
+    // on each side, times how many there are, have the least surface area. bounds returns any box type with an
+    // empty default, a union constructor and surface_area(). Returns the partition point, or end if the centroids
+    // don't spread over more than one bin.
+    template <typename Centroid, typename Bounds>
+    static size_t sah_split(
+        std::vector<uint32_t>& order, size_t begin, size_t end, int axis, const interval& extent,
+        const Centroid& centroid, const Bounds& bounds
+    ) {
+        typedef typename std::decay<decltype(bounds(uint32_t(0)))>::type box;
+        if (extent.size() <= 0) return end;
+
+        box bin_bounds[bin_count];
+        size_t bin_counts[bin_count] = {};
+        const real scale = bin_count / extent.size();
+        auto bin_of = [&](uint32_t i) {
+            int b = int((centroid(i)[axis] - extent.min) * scale);
+            return std::min(std::max(b, 0), bin_count - 1);
+        };
+        for (size_t i = begin; i < end; i++) {
+            int b = bin_of(order[i]);
+            bin_counts[b]++;
+            bin_bounds[b] = box(bin_bounds[b], bounds(order[i]));
+        }
+
+        // Sweep from the right for the cost of everything above each boundary, then from the left
+        real right_cost[bin_count];
+        box right;
+        size_t right_count = 0;
+        for (int b = bin_count - 1; b > 0; b--) {
+            right = box(right, bin_bounds[b]);
+            right_count += bin_counts[b];
+            right_cost[b] = right_count ? right_count * right.surface_area() : 0;
+        }
+
+        int best_bin = -1;
+        real best_cost = infinity;
+        box left;
+        size_t left_count = 0;
+        for (int b = 1; b < bin_count; b++) {
+            left = box(left, bin_bounds[b - 1]);
+            left_count += bin_counts[b - 1];
+            if (left_count == 0 || left_count == end - begin) continue;
+            real cost = left_count * left.surface_area() + right_cost[b];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_bin = b;
+            }
+        }
+        if (best_bin < 0) return end;
+
+        auto split = std::partition(order.begin() + begin, order.begin() + end, [&](uint32_t i) {
+            return bin_of(i) < best_bin;
+        });
+        return size_t(split - order.begin());
+    }
+
+    // Where to divide order[begin, end), a node depth deep, along axis: by sah_split where may_split_by_cost allows,
+    // and otherwise, or where binning doesn't divide them, at the median centroid
+    template <typename Centroid, typename Bounds>
+    static size_t split(
+        std::vector<uint32_t>& order, size_t begin, size_t end, int depth, int leaf_size, int sah_depth, int axis,
+        const interval& extent, const Centroid& centroid, const Bounds& bounds
+    ) {
+        const size_t count = end - begin;
+        size_t mid = may_split_by_cost(depth, count, leaf_size, sah_depth)
+            ? sah_split(order, begin, end, axis, extent, centroid, bounds) : end;
+        if (mid == begin || mid == end) {
+            mid = begin + count / 2;
+            std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end, [&](uint32_t a, uint32_t b) {
+                return centroid(a)[axis] < centroid(b)[axis];
+            });
+        }
+        return mid;
+    }
+
+    // Walk the tree under root, calling leaf(node) for each leaf whose box the ray enters. enters(index, node)
+    // tests a node's box against the ray's current interval, which leaf shrinks on a hit.
+    template <typename Node, typename Enters, typename Leaf>
+    static void traverse(const Node* nodes, uint32_t root, const vec3& direction, const Enters& enters, const Leaf& leaf) {
+        const bool dir_negative[3] = { direction.x() < 0, direction.y() < 0, direction.z() < 0 };
+        uint32_t stack[max_depth + 1];
+        int top = 0;
+        uint32_t index = root;
+        while (true) {
+            const Node& node = nodes[index];
+            thread_counters().node_visits++;
+            if (enters(index, node)) {
+                if (node.count > 0) {
+                    leaf(node);
+                } else {
+                    // Near child first, so the far one is culled by any hit in the near one
+                    if (dir_negative[node.axis]) {
+                        stack[top++] = index + 1;
+                        index = node.offset;
+                    } else {
+                        stack[top++] = node.offset;
+                        index = index + 1;
+                    }
+                    continue;
+                }
+            }
+            if (top == 0) break;
+            index = stack[--top];
+        }
+    }
+};
+
+#endif
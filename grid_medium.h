@@ -0,0 +1,279 @@
+/**
+ * Casey Gehling
+ *
+ * Defines heterogeneous media, whose density varies over a voxel grid filling a box. Distances are sampled by
+ * delta tracking against a coarse grid of majorants (the most any voxel in a block can reach), walked cell by
+ * cell with a 3D DDA, so empty blocks are stepped over whole and thin ones take few tentative collisions.
+ * Transmittance is estimated the same way by ratio tracking.
+ */
+#ifndef GRID_MEDIUM_H
+#define GRID_MEDIUM_H
+
+#include "hittable.h"
+#include "material.h"
+#include "perlin.h"
+
+#include <vector>
+
+// Densities sampled at nx * ny * nz points spread evenly over the unit cube, interpolated trilinearly between them.
+class density_grid {
+    public:
+        density_grid(int nx, int ny, int nz) : nx(std::max(nx, 2)), ny(std::max(ny, 2)), nz(std::max(nz, 2)) {
+            values.assign(size_t(this->nx) * this->ny * this->nz, 0.0f);
+        }
+
+        // Grid from existing voxel data, x fastest then y then z
+        density_grid(int nx, int ny, int nz, const std::vector<float>& data) : density_grid(nx, ny, nz) {
+            if (data.size() != values.size()) {
+                std::cerr << "density_grid: expected " << values.size() << " values, got " << data.size() << std::endl;
+                return;
+            }
+            for (size_t i = 0; i < data.size(); i++) values[i] = std::max(data[i], 0.0f);
+        }
+
+        // Grid of density(p) at each sample point p in the unit cube
+        template <typename F>
+        static shared_ptr<density_grid> bake(int nx, int ny, int nz, F density) {
+            auto grid = make_shared<density_grid>(nx, ny, nz);
+            for (int k = 0; k < grid->nz; k++)
+                for (int j = 0; j < grid->ny; j++)
+                    for (int i = 0; i < grid->nx; i++)
+                        grid->set(i, j, k, density(point3(double(i) / (grid->nx - 1), double(j) / (grid->ny - 1), double(k) / (grid->nz - 1))));
+            return grid;
+        }
+
+        // Cloud baked from perlin turbulence: noise above threshold, fading out towards the edges of the cube
+        static shared_ptr<density_grid> perlin_cloud(int resolution, double frequency, double threshold) {
+            perlin noise;
+            return bake(resolution, resolution, resolution, [&](const point3& p) {
+                vec3 from_center = p - point3(0.5, 0.5, 0.5);
+                double falloff = std::fmax(0, 1 - 4 * from_center.length_squared());
+                return std::fmax(0, noise.turbulance(frequency * p, 5) - threshold) * falloff;
+            });
+        }
+
+        int size(int axis) const { return axis == 0 ? nx : (axis == 1 ? ny : nz); }
+
+        float at(int i, int j, int k) const { return values[(size_t(k) * ny + j) * nx + i]; }
+
+        void set(int i, int j, int k, double density) { values[(size_t(k) * ny + j) * nx + i] = float(std::fmax(density, 0)); }
+
+        // Density at p in the unit cube
+        real sample(const point3& p) const {
+            real gx = p.x() * (nx - 1), gy = p.y() * (ny - 1), gz = p.z() * (nz - 1);
+            int i = std::min(std::max(int(std::floor(gx)), 0), nx - 2);
+            int j = std::min(std::max(int(std::floor(gy)), 0), ny - 2);
+            int k = std::min(std::max(int(std::floor(gz)), 0), nz - 2);
+            real fx = std::min(std::max(gx - i, real(0)), real(1));
+            real fy = std::min(std::max(gy - j, real(0)), real(1));
+            real fz = std::min(std::max(gz - k, real(0)), real(1));
+
+            const float* v = &values[(size_t(k) * ny + j) * nx + i];
+            const size_t dy = nx, dz = size_t(nx) * ny;
+            real x00 = v[0] + fx * (v[1] - v[0]);
+            real x10 = v[dy] + fx * (v[dy + 1] - v[dy]);
+            real x01 = v[dz] + fx * (v[dz + 1] - v[dz]);
+            real x11 = v[dz + dy] + fx * (v[dz + dy + 1] - v[dz + dy]);
+            real y0 = x00 + fy * (x10 - x00);
+            real y1 = x01 + fy * (x11 - x01);
+            return y0 + fz * (y1 - y0);
+        }
+
+    private:
+        int nx, ny, nz;
+        std::vector<float> values;
+};
+
+class grid_medium : public hittable {
+    public:
+        // Medium filling the box with corners a and b, density_scale times the grid's density, scattering with albedo.
+        grid_medium(shared_ptr<density_grid> grid, const point3& a, const point3& b, double density_scale, const color& albedo)
+            : grid_medium(grid, a, b, density_scale, make_shared<solid_color>(albedo)) {}
+
+        grid_medium(shared_ptr<density_grid> grid, const point3& a, const point3& b, double density_scale, shared_ptr<texture> tex)
+            : grid(grid), density_scale(density_scale), phase_function(make_shared<isotropic>(tex)) {
+            lo = point3(std::fmin(a.x(),b.x()), std::fmin(a.y(),b.y()), std::fmin(a.z(),b.z()));
+            hi = point3(std::fmax(a.x(),b.x()), std::fmax(a.y(),b.y()), std::fmax(a.z(),b.z()));
+            bbox = aabb(lo, hi);
+            build_majorants();
+        }
+
+        aabb bounding_box() const override { return bbox; }
+
+        // Density at a world space point inside the box
+        real density(const point3& p) const {
+            return density_scale * grid->sample(to_unit(p));
+        }
+
+        // Delta tracking: tentative collisions at the cell's majorant rate, each real with probability density / majorant
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            thread_counters().prim_tests++;
+            dda walk;
+            if (!start(r, ray_t, walk)) return false;
+
+            do {
+                const real rate = walk.majorant * walk.speed;
+                if (rate <= 0) continue;
+                real t = walk.t;
+                while (true) {
+                    t -= std::log(1 - random_double()) / rate;
+                    if (t >= walk.t_exit) break;
+                    if (random_double() * walk.majorant < density(r.at(t))) {
+                        record_hit(r, t, rec);
+                        return true;
+                    }
+                }
+            } while (advance(walk));
+            return false;
+        }
+
+        // Ratio tracking estimate of the fraction of light that crosses the medium along r within ray_t
+        real transmittance(const ray& r, interval ray_t) const {
+            dda walk;
+            if (!start(r, ray_t, walk)) return 1;
+
+            real transmitted = 1;
+            do {
+                const real rate = walk.majorant * walk.speed;
+                if (rate <= 0) continue;
+                real t = walk.t;
+                while (true) {
+                    t -= std::log(1 - random_double()) / rate;
+                    if (t >= walk.t_exit) break;
+                    transmitted *= 1 - density(r.at(t)) / walk.majorant;
+                }
+            } while (advance(walk));
+            return transmitted;
+        }
+
+    private:
+        static const int majorant_block = 4; // grid cells per majorant cell along each axis
+
+        shared_ptr<density_grid> grid;
+        real density_scale;
+        shared_ptr<material> phase_function;
+        point3 lo, hi;
+        aabb bbox;
+        int cells[3]; // majorant cells along each axis
+        std::vector<real> majorants;
+
+        // Where a ray is in its walk through the majorant cells. t is in the ray's own units.
+        struct dda {
+            int cell[3];
+            int step[3];
+            real t_next[3]; // t at which the ray leaves the cell across each axis
+            real t_delta[3]; // t to cross one cell along each axis
+            real t, t_exit, t_end;
+            real majorant; // of the current cell
+            real speed; // length of the ray's direction, to turn densities into rates per unit t
+        };
+
+        point3 to_unit(const point3& p) const {
+            return point3((p.x() - lo.x()) / (hi.x() - lo.x()), (p.y() - lo.y()) / (hi.y() - lo.y()), (p.z() - lo.z()) / (hi.z() - lo.z()));
+        }
+
+        // Each majorant is the largest grid value at the corners of the cells it covers, which bounds the
+        // trilinear density anywhere inside them.
+        void build_majorants() {
+            for (int axis = 0; axis < 3; axis++) {
+                cells[axis] = (grid->size(axis) - 2) / majorant_block + 1;
+            }
+            majorants.assign(size_t(cells[0]) * cells[1] * cells[2], 0);
+            for (int k = 0; k < grid->size(2); k++)
+                for (int j = 0; j < grid->size(1); j++)
+                    for (int i = 0; i < grid->size(0); i++) {
+                        const real value = density_scale * grid->at(i, j, k);
+                        if (value <= 0) continue;
+                        // A sample point on a block boundary is a corner of the blocks on both sides
+                        const int index[3] = { i, j, k };
+                        int first[3], last[3];
+                        for (int axis = 0; axis < 3; axis++) {
+                            first[axis] = std::min(std::max(index[axis] - 1, 0) / majorant_block, cells[axis] - 1);
+                            last[axis] = std::min(index[axis] / majorant_block, cells[axis] - 1);
+                        }
+                        for (int z = first[2]; z <= last[2]; z++)
+                            for (int y = first[1]; y <= last[1]; y++)
+                                for (int x = first[0]; x <= last[0]; x++) {
+                                    real& m = majorants[(size_t(z) * cells[1] + y) * cells[0] + x];
+                                    m = std::max(m, value);
+                                }
+                    }
+        }
+
+        // Clip r to the box and ray_t and set up the walk from the first cell. False if the ray misses.
+        bool start(const ray& r, interval ray_t, dda& walk) const {
+            const point3& origin = r.origin();
+            const vec3& direction = r.direction();
+            real t0 = ray_t.min, t1 = ray_t.max;
+            for (int axis = 0; axis < 3; axis++) {
+                const real inv_d = 1 / direction[axis];
+                real t_lo = (lo[axis] - origin[axis]) * inv_d;
+                real t_hi = (hi[axis] - origin[axis]) * inv_d;
+                if (t_lo > t_hi) std::swap(t_lo, t_hi);
+                if (t_lo > t0) t0 = t_lo;
+                if (t_hi < t1) t1 = t_hi;
+            }
+            if (!(t0 < t1)) return false;
+
+            walk.t = t0;
+            walk.t_end = t1;
+            walk.speed = direction.length();
+            const point3 entry = r.at(t0);
+            for (int axis = 0; axis < 3; axis++) {
+                // Majorant cells per unit of world space along this axis
+                const real cell_scale = real(grid->size(axis) - 1) / (majorant_block * (hi[axis] - lo[axis]));
+                const real position = (entry[axis] - lo[axis]) * cell_scale;
+                walk.cell[axis] = std::min(std::max(int(std::floor(position)), 0), cells[axis] - 1);
+
+                const real d = direction[axis] * cell_scale; // cells per unit t
+                if (d > 0) {
+                    walk.step[axis] = 1;
+                    walk.t_delta[axis] = 1 / d;
+                    walk.t_next[axis] = t0 + (walk.cell[axis] + 1 - position) / d;
+                } else if (d < 0) {
+                    walk.step[axis] = -1;
+                    walk.t_delta[axis] = -1 / d;
+                    walk.t_next[axis] = t0 + (walk.cell[axis] - position) / d;
+                } else {
+                    walk.step[axis] = 0;
+                    walk.t_delta[axis] = infinity;
+                    walk.t_next[axis] = infinity;
+                }
+            }
+            enter_cell(walk);
+            return true;
+        }
+
+        void enter_cell(dda& walk) const {
+            walk.t_exit = std::min(std::min(std::min(walk.t_next[0], walk.t_next[1]), walk.t_next[2]), walk.t_end);
+            walk.majorant = majorants[(size_t(walk.cell[2]) * cells[1] + walk.cell[1]) * cells[0] + walk.cell[0]];
+        }
+
+        // Step into the next cell along the ray. False once the ray leaves the box or ray_t.
+        bool advance(dda& walk) const {
+            if (walk.t_exit >= walk.t_end) return false;
+            int axis = 0;
+            if (walk.t_next[1] < walk.t_next[axis]) axis = 1;
+            if (walk.t_next[2] < walk.t_next[axis]) axis = 2;
+
+            walk.cell[axis] += walk.step[axis];
+            if (walk.cell[axis] < 0 || walk.cell[axis] >= cells[axis]) return false;
+            walk.t = walk.t_exit;
+            walk.t_next[axis] += walk.t_delta[axis];
+            enter_cell(walk);
+            return true;
+        }
+
+        void record_hit(const ray& r, real t, hit_record& rec) const {
+            rec.t = t;
+            rec.p = r.at(t);
+            rec.u = rec.v = 0;
+            rec.normal = vec3(1,0,0);
+            rec.dpdu = rec.dpdv = vec3(0,0,0);
+            rec.front_face = true;
+            rec.mat = phase_function;
+            rec.object_id = object_id;
+        }
+};
+
+#endif
@@ -8,18 +8,31 @@
 #define HITTABLE_H
 
 #include "aabb.h"
+#include "profile.h"
+
+#include <atomic>
 
 class material;
 
+// Ids start at 1 so 0 can stand for "nothing hit" in the object id AOV.
+inline int next_object_id() {
+    static std::atomic<int> counter(0);
+    return ++counter;
+}
+
 class hit_record {
     public:
         point3 p;
+        real p_error = 0; // bound on the rounding error in each coordinate of p
         vec3 normal;
         shared_ptr<material> mat;
-        double t;
-        double u; // texture coord
-        double v; // texture coord
+        real t;
+        real u; // texture coord
+        real v; // texture coord
         bool front_face;
+        int object_id; // hittable::object_id of the primitive hit
+        vec3 dpdu, dpdv; // change in p along the texture coordinates, zero where the primitive has none
+        real dudx = 0, dvdx = 0, dudy = 0, dvdy = 0; // change in texture coordinates to the next pixel over, see set_footprint
 
         // Sets the hit record normal vector
         // Assuming outward_normal is of unit length
@@ -27,12 +40,97 @@ class hit_record {
             front_face = dot(r.direction(), outward_normal) < 0;
             normal = front_face ? outward_normal : -outward_normal;
         }
+
+        // Texture footprint of the pixel r came through: where the rays through the neighbouring pixels, sharing
+        // r's origin with directions offset by ddx and ddy, meet the tangent plane at p, expressed in texture
+        // coordinates through dpdu and dpdv.
+        void set_footprint(const ray& r, const vec3& ddx, const vec3& ddy) {
+            clear_footprint();
+
+            // Normal equations for dp = du * dpdu + dv * dpdv, least squares off the surface
+            const real uu = dot(dpdu, dpdu), uv = dot(dpdu, dpdv), vv = dot(dpdv, dpdv);
+            const real det = uu * vv - uv * uv;
+            if (!(det > 0)) return;
+
+            const real plane = dot(normal, p - r.origin());
+            const vec3 offsets[2] = { ddx, ddy };
+            real du[2], dv[2];
+            for (int k = 0; k < 2; k++) {
+                const vec3 d = r.direction() + offsets[k];
+                const real denom = dot(normal, d);
+                if (denom == 0) return;
+                const vec3 dp = r.origin() + (plane / denom) * d - p;
+                const real pu = dot(dpdu, dp), pv = dot(dpdv, dp);
+                du[k] = (vv * pu - uv * pv) / det;
+                dv[k] = (uu * pv - uv * pu) / det;
+            }
+            if (!std::isfinite(du[0] + dv[0] + du[1] + dv[1])) return;
+            dudx = du[0]; dvdx = dv[0];
+            dudy = du[1]; dvdy = dv[1];
+        }
+
+        // No footprint, for hits of rays that aren't from the camera. Textures take a single lookup.
+        void clear_footprint() {
+            dudx = dvdx = dudy = dvdy = 0;
+        }
 };
 
+// Ray leaving the surface at rec, starting just off the surface on the side it heads into.
+inline ray spawn_ray(const hit_record& rec, const vec3& direction, real time) {
+    const vec3 n = (dot(direction, rec.normal) > 0) ? rec.normal : -rec.normal;
+    return ray(offset_ray_origin(rec.p, rec.p_error, n), direction, time);
+}
+
+// Most crossings a ray has with one shape that callers ask for
+const int max_crossings = 16;
+
+// Merge the sorted crossings b[0, nb) into the sorted crossings a[0, na), keeping the first max_count.
+inline int merge_crossings(real* a, int na, const real* b, int nb, int max_count) {
+    for (int i = 0; i < nb; i++) {
+        int at = na;
+        while (at > 0 && a[at - 1] > b[i]) at--;
+        if (at >= max_count) break;
+        for (int j = std::min(na, max_count - 1); j > at; j--) a[j] = a[j - 1];
+        a[at] = b[i];
+        if (na < max_count) na++;
+    }
+    return na;
+}
+
 class hittable {
     public:
+        int object_id = next_object_id(); // primitives that make up one object (box sides, mesh tris) share an id
+
         virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
         virtual aabb bounding_box() const = 0;
+
+        // Intersect the active lanes of a packet. Lanes that hit get recs[lane] filled in and their tmax
+        // shortened to the hit. Returns the mask of lanes that hit. By default each lane is traced alone;
+        // aggregates override this to share traversal across the packet.
+        virtual unsigned hit_packet(ray_packet& packet, unsigned active, hit_record* recs) const {
+            unsigned hits = 0;
+            for (int lane = 0; lane < packet.size; lane++) {
+                if (!(active & (1u << lane))) continue;
+                if (hit(packet.rays[lane], packet.lane_interval(lane), recs[lane])) {
+                    packet.tmax[lane] = recs[lane].t;
+                    hits |= 1u << lane;
+                }
+            }
+            return hits;
+        }
+
+        // Distances at which the ray crosses the surface within ray_t, in increasing order, at most max_count
+        // of them. For a closed shape they alternate between entering and leaving it. By default each one is
+        // found with another hit() from just past the previous one; shapes that can do better override this.
+        virtual int crossings(const ray& r, interval ray_t, real* ts, int max_count) const {
+            int count = 0;
+            hit_record rec;
+            while (count < max_count && hit(r, ray_t, rec)) {
+                ts[count++] = rec.t;
+                ray_t.min = rec.t + 0.0001;
+            }
+            return count;
+        }
 };
 
 // Wrapper for pre-instantiated hittable. Translate intersectable by specified offset vector.
@@ -41,6 +139,13 @@ class translate : public hittable {
         translate(shared_ptr<hittable> object, const vec3& offset) : object(object), offset(offset) {
             bbox = object->bounding_box() + offset;
         }
+
+        // Move the object, between frames of an animation. Not while rendering.
+        void set_offset(const vec3& new_offset) {
+            offset = new_offset;
+            bbox = object->bounding_box() + offset;
+        }
+
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
             ray offset_r(r.origin() - offset, r.direction(), r.time());
 
@@ -49,10 +154,15 @@ class translate : public hittable {
             }
 
             rec.p += offset;
+            rec.p_error += rounding_gamma<real>(1) * max_abs(rec.p);
 
             return true;
         }
 
+        int crossings(const ray& r, interval ray_t, real* ts, int max_count) const override {
+            return object->crossings(ray(r.origin() - offset, r.direction(), r.time()), ray_t, ts, max_count);
+        }
+
         aabb bounding_box() const override {return bbox;}
     private:
         shared_ptr<hittable> object;
@@ -94,6 +204,33 @@ class rotate_y : public hittable {
             bbox = aabb(min, max);
         }
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            if(!object->hit(to_object(r), ray_t, rec)) {
+                return false;
+            }
+
+            rec.p = to_world(rec.p);
+            rec.p_error = rec.p_error * (std::fabs(cos_theta) + std::fabs(sin_theta)) + rounding_gamma<real>(3) * max_abs(rec.p);
+
+            rec.normal = to_world(rec.normal);
+            rec.dpdu = to_world(rec.dpdu);
+            rec.dpdv = to_world(rec.dpdv);
+
+            return true;
+        }
+
+        int crossings(const ray& r, interval ray_t, real* ts, int max_count) const override {
+            return object->crossings(to_object(r), ray_t, ts, max_count);
+        }
+
+        aabb bounding_box() const override { return bbox; }
+    private:
+        shared_ptr<hittable> object;
+        double sin_theta;
+        double cos_theta;
+        aabb bbox;
+
+        // The ray in the object's unrotated space, with the same parametrisation
+        ray to_object(const ray& r) const {
             auto origin = point3(
                 (cos_theta * r.origin().x()) - (sin_theta * r.origin().z()),
                 r.origin().y(),
@@ -106,32 +243,17 @@ class rotate_y : public hittable {
                 (sin_theta * r.direction().x()) + (cos_theta * r.direction().z())
             );
 
-            ray rotated_r(origin, direction, r.time());
-
-            if(!object->hit(rotated_r, ray_t, rec)) {
-                return false;
-            }
-
-            rec.p = point3(
-                (cos_theta * rec.p.x()) + (sin_theta * rec.p.z()),
-                rec.p.y(),
-                (-sin_theta * rec.p.x()) + (cos_theta * rec.p.z())
-            );
+            return ray(origin, direction, r.time());
+        }
 
-            rec.normal = vec3(
-                (cos_theta * rec.normal.x()) + (sin_theta * rec.normal.z()),
-                rec.normal.y(),
-                (-sin_theta * rec.normal.x()) + (cos_theta * rec.normal.z())
+        // A point or vector from the object's space back to the world's
+        vec3 to_world(const vec3& v) const {
+            return vec3(
+                (cos_theta * v.x()) + (sin_theta * v.z()),
+                v.y(),
+                (-sin_theta * v.x()) + (cos_theta * v.z())
             );
-
-            return true;
         }
-        aabb bounding_box() const override { return bbox; }
-    private:
-        shared_ptr<hittable> object;
-        double sin_theta;
-        double cos_theta;
-        aabb bbox;
 };
 
 #endif
\ No newline at end of file
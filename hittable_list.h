@@ -42,6 +42,24 @@ class hittable_list : public hittable {
             return hit_anything;
         }
 
+        unsigned hit_packet(ray_packet& packet, unsigned active, hit_record* recs) const override {
+            unsigned hits = 0;
+            for (const auto& object : objects) {
+                hits |= object->hit_packet(packet, active, recs);
+            }
+            return hits;
+        }
+
+        int crossings(const ray& r, interval ray_t, real* ts, int max_count) const override {
+            int count = 0;
+            real object_ts[max_crossings];
+            for (const auto& object : objects) {
+                int n = object->crossings(r, ray_t, object_ts, std::min(max_count, max_crossings));
+                count = merge_crossings(ts, count, object_ts, n, max_count);
+            }
+            return count;
+        }
+
         aabb bounding_box() const override { return bbox; }
 
     private:
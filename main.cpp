@@ -1,466 +1,200 @@
 /**
  * Casey Gehling
  * 
- * Defines multiple scenes to be rendered.
- * Usage: ./main <scene_number> > <output_file.ppm>
+ * Renders one of the built-in scenes or a scene file, or every frame of its animation.
+ * Usage: ./main <scene_number>|<file.scene>|<file.rscene> [options] > <output_file.ppm>
+ *        ./main <file.scene> --write-scene <file.rscene>
+ *        ./main <scene_number>|<file.scene> --animate <frame_%04d.ppm> [--frames <first>:<last>] [options]
+ *        ./main --serve <socket> [--threads <n>] [--scene-cache <n>]
+ *        ./main --submit <socket> <scene_number>|<file.scene>|stop [--width <n>] [--spp <n>] [--seed <n>] [--priority <n>] > <output_file.ppm>
  */
 
-#include "constants.h"
-#include "camera.h"
-#include "material.h"
-#include "sphere.h"
-#include "hittable_list.h"
-#include "bvh.h"
-#include <iostream>
-#include "quad.h"
-#include "constant_medium.h"
-#include "tri.h"
-
-
-void moon_scene() {
-    auto moon_texture = make_shared<image_texture>("textures/moon_texture.jpeg");
-    auto moon_surface = make_shared<lambertian>(moon_texture);
-    auto moon = make_shared<sphere>(point3(0,0,0), 2, moon_surface);
-
-    camera cam;
-
-    cam.aspect_ratio      = 16.0 / 9.0;
-    cam.image_width       = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth         = 50;
-    cam.background = color(0, 0, 0);
-
-    cam.vfov     = 20;
-    cam.lookfrom = point3(0,0,12);
-    cam.lookat   = point3(0,0,0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(hittable_list(moon));
-}
-
-void perlin_scene() {
-    hittable_list world;
-
-    auto pertext = make_shared<noise_texture>(4);
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(pertext)));
-    world.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<lambertian>(pertext)));
-
-    camera cam;
-
-    cam.aspect_ratio      = 16.0 / 9.0;
-    cam.image_width       = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth         = 50;
-    cam.background = color(0.7, 0.5, 1.00);
-
-    cam.vfov     = 20;
-    cam.lookfrom = point3(13,2,3);
-    cam.lookat   = point3(0,0,0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-
-void quads_scene() {
-    hittable_list world;
-
-    // Materials
-    auto left_red     = make_shared<lambertian>(color(1.0, 0.2, 0.2));
-    auto back_green   = make_shared<lambertian>(color(0.2, 1.0, 0.2));
-    auto right_blue   = make_shared<lambertian>(color(0.2, 0.2, 1.0));
-    auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.0));
-    auto lower_teal   = make_shared<lambertian>(color(0.2, 0.8, 0.8));
-
-    // Quads
-    world.add(make_shared<quad>(point3(-3,-2, 5), vec3(0, 0,-4), vec3(0, 4, 0), left_red));
-    world.add(make_shared<quad>(point3(-2,-2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
-    world.add(make_shared<quad>(point3( 3,-2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
-    world.add(make_shared<quad>(point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
-    world.add(make_shared<quad>(point3(-2,-3, 5), vec3(4, 0, 0), vec3(0, 0,-4), lower_teal));
-
-    camera cam;
-
-    cam.aspect_ratio      = 1.0;
-    cam.image_width       = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth         = 50;
-    cam.background = color(0.7, 0.5, 1.00);
-
-    cam.vfov     = 80;
-    cam.lookfrom = point3(0,0,9);
-    cam.lookat   = point3(0,0,0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-void light_scene() {
-    hittable_list world;
-
-    auto pertext = make_shared<noise_texture>(4);
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(pertext)));
-    world.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<lambertian>(pertext)));
-
-    auto difflight = make_shared<diffuse_light>(color(4,4,4));
-    world.add(make_shared<quad>(point3(3,1,-2), vec3(2,0,0), vec3(0,2,0), difflight));
-    world.add(make_shared<sphere>(point3(0,7,0), 2, difflight));
-
-    camera cam;
-
-    cam.aspect_ratio      = 16.0 / 9.0;
-    cam.image_width       = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth         = 50;
-    cam.background        = color(0,0,0);
-
-    cam.vfov     = 20;
-    cam.lookfrom = point3(26,3,6);
-    cam.lookat   = point3(0,2,0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-void cornell_smoke_scene() {
-    hittable_list world;
-
-    auto red   = make_shared<lambertian>(color(.65, .05, .05));
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    auto green = make_shared<lambertian>(color(.12, .45, .15));
-    auto light = make_shared<diffuse_light>(color(7, 7, 7));
-
-    world.add(make_shared<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
-    world.add(make_shared<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
-    world.add(make_shared<quad>(point3(113,554,127), vec3(330,0,0), vec3(0,0,305), light));
-    world.add(make_shared<quad>(point3(0,555,0), vec3(555,0,0), vec3(0,0,555), white));
-    world.add(make_shared<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
-    world.add(make_shared<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
-
-    shared_ptr<hittable> box1 = box(point3(0,0,0), point3(165,330,165), white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265,0,295));
-
-    shared_ptr<hittable> box2 = box(point3(0,0,0), point3(165,165,165), white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3(130,0,65));
-
-    world.add(make_shared<constant_medium>(box1, 0.01, color(0,0,0)));
-    world.add(make_shared<constant_medium>(box2, 0.01, color(1,1,1)));
-
-    camera cam;
-
-    cam.aspect_ratio      = 1.0;
-    cam.image_width       = 400;
-    cam.samples_per_pixel = 200;
-    cam.max_depth         = 50;
-    cam.background        = color(0,0,0);
-
-    cam.vfov     = 40;
-    cam.lookfrom = point3(278, 278, -800);
-    cam.lookat   = point3(278, 278, 0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-void diamond_block_scene() {
-    hittable_list world;
-
-    // Floor
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9)))));
-
-    // Diamond block
-    auto diamond_block_texture = make_shared<image_texture>("textures/diamond.jpg");
-    shared_ptr<hittable> diamond_block = box(point3(0,0,0), point3(2,2,2), make_shared<lambertian>(diamond_block_texture));
-    world.add(diamond_block);
-
-    camera cam;
-
-    cam.aspect_ratio      = 1.0;
-    cam.image_width       = 400;
-    cam.samples_per_pixel = 400;
-    cam.max_depth         = 50;
-    cam.background        = color(0.70, 0.80, 1.00);
-
-    cam.vfov     = 20;
-    cam.lookfrom = point3(13,2,3);
-    cam.lookat   = point3(0,0,0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-void tri_test_scene() {
-    hittable_list world;
-
-
-    // Mats
-    auto red = make_shared<lambertian>(color(.65, .05, .05));
-    auto diamond_block_texture = make_shared<image_texture>("textures/diamond.jpg");
-
-    // Solid color triangle
-    world.add(make_shared<tri>(point3(-3,-2, 5), vec3(0, 0,-4), vec3(0, 4, 0), red));
-
-    // Textured triangle
-    world.add(make_shared<tri>(point3( 3,-2, 1), vec3(0, 0, 4), vec3(0, 4, 0), make_shared<lambertian>(diamond_block_texture)));
-
-    camera cam;
-
-    cam.aspect_ratio      = 1.0;
-    cam.image_width       = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth         = 50;
-    cam.background = color(0.7, 0.5, 1.00);
-
-    cam.vfov     = 80;
-    cam.lookfrom = point3(0,0,9);
-    cam.lookat   = point3(0,0,0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-void obj_test_scene() {
-    hittable_list world;
-
-    // Floor
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9)))));
-
-    // Mats
-    auto red = make_shared<metal>(color(.65, .05, .05), 0.5);
-
-    // Solid color triangle
-    world.add(mesh("models/sword.obj", red));
-
-    // skybox textures
-    auto left = make_shared<image_texture>("skybox/left.jpg");
-    auto right = make_shared<image_texture>("skybox/right.jpg");
-    auto top = make_shared<image_texture>("skybox/top.jpg");
-    auto bottom = make_shared<image_texture>("skybox/bottom.jpg");
-    auto front = make_shared<image_texture>("skybox/front.jpg");
-    auto back = make_shared<image_texture>("skybox/back.jpg");
-
-    world.add(cube_map(left,right,front,back,top,bottom,100));
-
-    camera cam;
-
-    cam.aspect_ratio      = 1.0;
-    cam.image_width       = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth         = 50;
-    cam.background = color(0.7, 0.5, 1.00);
-
-    cam.vfov     = 80;
-    cam.lookfrom = point3(0,5,10);
-    cam.lookat   = point3(0,0,0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 3;
-
-    cam.render(world);
-}
-
-void skybox_test_scene() {
-    hittable_list world;
-
-    // skybox textures
-    auto left = make_shared<image_texture>("skybox/left.jpg");
-    auto right = make_shared<image_texture>("skybox/right.jpg");
-    auto top = make_shared<image_texture>("skybox/top.jpg");
-    auto bottom = make_shared<image_texture>("skybox/bottom.jpg");
-    auto front = make_shared<image_texture>("skybox/front.jpg");
-    auto back = make_shared<image_texture>("skybox/back.jpg");
-
-    world.add(cube_map(left,right,front,back,top,bottom,100));
-
-    camera cam;
-
-    cam.aspect_ratio      = 1.0;
-    cam.image_width       = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth         = 500;
-    cam.background = color(0.7, 0.5, 1.00);
-
-    cam.lookfrom = point3(0, 11, 10);  // Position inside the cube
-    cam.vfov = 90;             
-    cam.lookat   = point3(200,0,0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-void ray_intersection_scene() {
-    hittable_list world;
-    auto red = make_shared<lambertian>(color(.65, .05, .05));
-
-    world.add(make_shared<sphere>(point3(-2,0, 0), 3, make_shared<lambertian>(color(0.5,0.5,0.5))));
-    world.add(make_shared<tri>(point3(5,-2, 5), vec3(0, 0,-4), vec3(0, 4, 0), red));
-
-    camera cam;
-
-    cam.aspect_ratio      = 1.0;
-    cam.image_width       = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth         = 500;
-    cam.background = color(0.7, 0.5, 1.00);
-
-    cam.lookfrom = point3(0, 11, 10);  // Position inside the cube
-    cam.vfov = 90;             
-    cam.lookat   = point3(0,0,0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-
-}
-
-void volume_scene() {
-    hittable_list world;
-
-    auto sphere_ob = make_shared<sphere>(point3(0,3, 0), 3, make_shared<lambertian>(color(0,0,0)));
-    world.add(make_shared<constant_medium>(sphere_ob, 0.5, color(0,0,0)));
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9)))));
-
-    camera cam;
-
-    cam.aspect_ratio      = 1.0;
-    cam.image_width       = 400;
-    cam.samples_per_pixel = 200;
-    cam.max_depth         = 500;
-    cam.background = color(1, 1, 1.00);
-
-    cam.lookfrom = point3(0, 8, 6);  // Position inside the cube
-    cam.vfov = 90;             
-    cam.lookat   = point3(0,0,0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
+#include "scenes.h"
+#include "scene_file.h"
+#include "render_server.h"
+
+// Run a render server on the socket in argv[2] until it is sent stop
+int serve(int argc, const char * argv[]) {
+    render_server server(argv[2]);
+    for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            server.num_threads = atoi(argv[++i]);
+        } else if (arg == "--scene-cache" && i + 1 < argc) {
+            server.scene_limit = size_t(std::max(1, atoi(argv[++i])));
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return -1;
+        }
+    }
+    return server.serve() ? 0 : -1;
 }
 
-void motion_blur_scene() {
-    hittable_list world;
-
-    auto sphere_ob = make_shared<sphere>(point3(0,3, 0), point3(0,0,0), 3, make_shared<lambertian>(color(0,0,0)));
-    world.add(sphere_ob);
-
-    camera cam;
-
-    cam.aspect_ratio      = 1.0;
-    cam.image_width       = 400;
-    cam.samples_per_pixel = 200;
-    cam.max_depth         = 500;
-    cam.background = color(1, 1, 1.00);
-
-    cam.lookfrom = point3(0, 8, 6);  // Position inside the cube
-    cam.vfov = 90;             
-    cam.lookat   = point3(0,0,0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
+// Send a job, or stop, to the render server on the socket in argv[2] and write the image it renders to stdout
+int submit(int argc, const char * argv[]) {
+    if (argc < 4) {
+        std::cerr << "--submit needs a socket and a scene number or stop" << std::endl;
+        return -1;
+    }
+    std::string request = std::string(argv[3]) == "stop" ? "stop" : "render scene=" + std::string(argv[3]);
+    for (int i = 4; i < argc; i++) {
+        std::string arg = argv[i];
+        if ((arg == "--width" || arg == "--spp" || arg == "--seed" || arg == "--priority") && i + 1 < argc) {
+            request += " " + arg.substr(2) + "=" + argv[++i];
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return -1;
+        }
+    }
+    job_result result = submit_job(argv[2], request, true);
+    if (!result.ok) {
+        std::cerr << "ERROR: " << result.error << std::endl;
+        return -1;
+    }
+    if (request != "stop") {
+        std::cout << result.image;
+        std::clog << "Queued " << result.queued_seconds << " s, scene setup " << result.setup_seconds << " s"
+                  << (result.warm ? " (warm)" : "") << ", render " << result.render_seconds << " s" << std::endl;
+    }
+    return 0;
 }
 
-void perlin_ball_scene() {
-    hittable_list world;
-
-    auto tex1 = make_shared<noise_texture>(0);
-    auto tex2 = make_shared<noise_texture>(4);
-    world.add(make_shared<sphere>(point3(-3.5,3, 0), 3, make_shared<lambertian>(tex1)));
-    world.add(make_shared<sphere>(point3(3.5,3, 0), 3, make_shared<lambertian>(tex2)));
 
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9)))));
+int main(int argc, const char * argv[]) {
+    if (argc < 2) {
+        printf("Usage: ./main <scene_number>|<file.scene>|<file.rscene> [--write-scene <file.scene>|<file.rscene>] [--heatmap <file.ppm>] [--heatmap-metric time|traversal] [--trace <file.json>] [--threads <n>] [--seed <n>] [--packet 4|8|16] [--integrator recursive|wavefront] [--denoise] [--simd scalar|sse4.2|avx2|avx512] [--aov <layer,...|all> --aov-file <file.exr>] [--texture-budget <MB>] [--texture-cache <dir>|off] [--bvh-cache <dir>|off] [--sbvh] [--motion-segments <n>] [--animate <frame_%%04d.ppm> [--frames <first>:<last>]] > <output_file.ppm>\n       ./main --serve <socket> [--threads <n>] [--scene-cache <n>]\n       ./main --submit <socket> <scene_number>|<file.scene>|stop [--width <n>] [--spp <n>] [--seed <n>] [--priority <n>] > <output_file.ppm>\n");
+        return -1;
+    }
+    if (argc >= 3 && std::string(argv[1]) == "--serve") return serve(argc, argv);
+    if (argc >= 3 && std::string(argv[1]) == "--submit") return submit(argc, argv);
+    int scene = atoi(argv[1]);
+    std::string scene_path; // scene file, when not given a scene number
+    if (std::string(argv[1]).find_first_not_of("0123456789") != std::string::npos) scene_path = argv[1];
+    std::string written_scene; // where to write the scene file back out to, instead of rendering
 
+    // Render and profiling options
     camera cam;
+    std::string animation_pattern; // frame image names, when rendering the animation
+    int first_frame = -1, last_frame = -1; // of the animation's own range, when given
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--write-scene" && i + 1 < argc) {
+            written_scene = argv[++i];
+        } else if (arg == "--heatmap" && i + 1 < argc) {
+            cam.heatmap_file = argv[++i];
+        } else if (arg == "--heatmap-metric" && i + 1 < argc) {
+            std::string metric = argv[++i];
+            cam.heatmap_cost = (metric == "traversal") ? heatmap_metric::traversal : heatmap_metric::time;
+        } else if (arg == "--trace" && i + 1 < argc) {
+            cam.trace_file = argv[++i];
+        } else if (arg == "--threads" && i + 1 < argc) {
+            cam.num_threads = atoi(argv[++i]);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            cam.seed = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--packet" && i + 1 < argc) {
+            cam.packet_size = atoi(argv[++i]);
+        } else if (arg == "--integrator" && i + 1 < argc) {
+            std::string name = argv[++i];
+            cam.integrator = (name == "wavefront") ? integrator_type::wavefront : integrator_type::recursive;
+        } else if (arg == "--denoise") {
+            cam.denoise = true;
+        } else if (arg == "--simd" && i + 1 < argc) {
+            simd_isa isa;
+            if (!parse_simd_isa(argv[++i], isa) || !set_simd_isa(isa)) {
+                std::cerr << "Unsupported SIMD instruction set: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (arg == "--aov" && i + 1 < argc) {
+            if (!parse_aov_layers(argv[++i], cam.aov_layers)) {
+                std::cerr << "Unknown AOV layer in: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (arg == "--aov-file" && i + 1 < argc) {
+            cam.aov_file = argv[++i];
+        } else if (arg == "--texture-budget" && i + 1 < argc) {
+            texture_cache::global().set_budget(size_t(atof(argv[++i]) * (1 << 20)));
+        } else if (arg == "--texture-cache" && i + 1 < argc) {
+            std::string directory = argv[++i];
+            texture_cache::global().set_file_directory(directory == "off" ? "" : directory);
+        } else if (arg == "--bvh-cache" && i + 1 < argc) {
+            std::string directory = argv[++i];
+            bvh_cache::global().set_directory(directory == "off" ? "" : directory);
+        } else if (arg == "--sbvh") {
+            triangle_mesh::default_options().spatial_splits = true;
+        } else if (arg == "--motion-segments" && i + 1 < argc) {
+            sphere_set::motion_segments() = atoi(argv[++i]);
+        } else if (arg == "--animate" && i + 1 < argc) {
+            animation_pattern = argv[++i];
+            if (!valid_frame_pattern(animation_pattern)) {
+                std::cerr << "Bad frame pattern (needs one %d): " << animation_pattern << std::endl;
+                return -1;
+            }
+        } else if (arg == "--frames" && i + 1 < argc) {
+            if (sscanf(argv[++i], "%d:%d", &first_frame, &last_frame) != 2 || first_frame > last_frame) {
+                std::cerr << "Bad frame range: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return -1;
+        }
+    }
 
-    cam.aspect_ratio      = 1.0;
-    cam.image_width       = 400;
-    cam.samples_per_pixel = 200;
-    cam.max_depth         = 500;
-    cam.background = color(1, 1, 1.00);
-
-    cam.lookfrom = point3(0, 9, 7);  // Position inside the cube
-    cam.vfov = 90;             
-    cam.lookat   = point3(0,0,0);
-    cam.vup      = vec3(0,1,0);
+    if (scene_path.empty() && (scene < 1 || scene > scene_count)) {
+        std::cerr << "Unknown scene: " << scene << std::endl;
+        return -1;
+    }
 
-    cam.defocus_angle = 0;
+    if (cam.aov_layers && cam.aov_file.empty()) {
+        std::cerr << "--aov needs --aov-file" << std::endl;
+        return -1;
+    }
 
-    cam.render(world);
-}
+    seed_random(cam.seed);
+    scene_file file;
+    if (!scene_path.empty() && !file.read(scene_path)) return -1;
+    if (!written_scene.empty()) {
+        if (scene_path.empty()) {
+            std::cerr << "--write-scene needs a scene file" << std::endl;
+            return -1;
+        }
+        return file.write(written_scene) ? 0 : -1;
+    }
 
-void materials_scene() {
     hittable_list world;
-    // auto sphere_ob = make_shared<sphere>(point3(0,3, 0), 3, make_shared<perlin>());
-    world.add(make_shared<sphere>(point3(-3,3, 0), 1, make_shared<lambertian>(color(0.5,1,0.5))));
-    world.add(make_shared<sphere>(point3(0,3, 0), 1, make_shared<metal>(color(1,0.5,0.5), 0.5)));
-    world.add(make_shared<sphere>(point3(3,3, 0), 1, make_shared<dielectric>(0.5)));
-    world.add(make_shared<sphere>(point3(-3,6, -1), 0.5, make_shared<diffuse_light>(color(7,7,7))));
-    world.add(make_shared<sphere>(point3(0,6, -1), 0.5, make_shared<diffuse_light>(color(7,7,7))));
-    world.add(make_shared<sphere>(point3(3,6, -1), 0.5, make_shared<diffuse_light>(color(7,7,7))));
-
-
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9)))));
-
-    camera cam;
-
-    cam.aspect_ratio      = 1.0;
-    cam.image_width       = 400;
-    cam.samples_per_pixel = 200;
-    cam.max_depth         = 500;
-    cam.background = color(0.5, 0.5, 0.5);
-
-    cam.lookfrom = point3(0, 3, -5);  // Position inside the cube
-    cam.vfov = 90;             
-    cam.lookat   = point3(0,3,10);
-    cam.vup      = vec3(0,1,0);
+    if (!scene_path.empty()) {
+        scene_load_stats loaded;
+        if (!file.build(cam, world, &loaded)) return -1;
+        std::clog << "Loaded " << scene_path << ": " << file.statement_count() << " statements, " << loaded.images
+                  << " images and " << loaded.meshes << " meshes in " << loaded.asset_seconds << " s, "
+                  << loaded.objects << " objects built in " << loaded.build_seconds << " s" << std::endl;
+    }
 
-    cam.defocus_angle = 0;
+    if (!animation_pattern.empty()) {
+        animation anim;
+        if (scene_path.empty()) scene_animation(scene, cam, anim);
+        else orbit_animation(world, cam, anim);
+        if (first_frame >= 0) {
+            anim.first_frame = first_frame;
+            anim.last_frame = last_frame;
+        }
+        animation_stats stats = render_animation(anim, cam, animation_pattern);
+        std::clog << "Rendered " << stats.frames << " frames in " << stats.seconds << " s, "
+                  << stats.frames_per_minute() << " frames/min (" << stats.render_seconds << " s rendering, "
+                  << stats.update_seconds << " s updating the BVH, " << stats.write_seconds
+                  << " s writing alongside)" << std::endl;
+        return 0;
+    }
 
+    if (scene_path.empty()) world = scenes[scene - 1].build(cam);
     cam.render(world);
-}
-
-int main(int argc, const char * argv[]) {
-    if (argc != 2) {
-        printf("Usage: ./main <scene_number> > <output_file.ppm>");
-        return -1;
-    }
-    int scene = atoi(argv[1]);
 
-    switch(scene) {
-        case 1: moon_scene(); break;
-        case 2: perlin_scene(); break;
-        case 3: quads_scene(); break;
-        case 4: light_scene(); break;
-        case 5: cornell_smoke_scene(); break;
-        case 6: diamond_block_scene(); break;
-        case 7: tri_test_scene(); break;
-        case 8: obj_test_scene(); break;
-        case 9: skybox_test_scene(); break;
-        case 10: ray_intersection_scene(); break;
-        case 11: volume_scene(); break;
-        case 12: motion_blur_scene(); break;
-        case 13: perlin_ball_scene(); break;
-        case 14: materials_scene(); break;
+    if (cam.stats.texture_lookups > 0) {
+        texture_cache_stats textures = texture_cache::global().stats();
+        std::clog << "Texture pages: " << cam.stats.texture_lookups - cam.stats.texture_misses << " hits, "
+                  << cam.stats.texture_misses << " misses, " << textures.loads << " image decodes, "
+                  << textures.evictions << " evictions, peak " << (textures.peak_bytes >> 20) << " of "
+                  << (textures.budget_bytes >> 20) << " MB, " << textures.files_mapped << " texture files mapped, "
+                  << textures.files_written << " written, " << textures.load_seconds << " s decoding\n";
     }
 }
\ No newline at end of file
@@ -0,0 +1,83 @@
+/**
+ * Casey Gehling
+ *
+ * Defines read only memory mapped files. The whole file is mapped at once and the OS reads its pages in as they
+ * are first touched, so callers use the bytes in place without reading or copying them first. Where there is no
+ * mmap the file is read into memory instead.
+ */
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+class mapped_file {
+    public:
+        mapped_file() {}
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+        ~mapped_file() { close(); }
+
+        // Map the file at path. False if it can't be opened or is empty.
+        bool open(const std::string& path) {
+            close();
+#ifdef _WIN32
+            FILE* in = fopen(path.c_str(), "rb");
+            if (!in) return false;
+            char buffer[1 << 16];
+            size_t count;
+            while ((count = fread(buffer, 1, sizeof(buffer), in)) > 0) copy.insert(copy.end(), buffer, buffer + count);
+            fclose(in);
+            if (copy.empty()) return false;
+            bytes = copy.data();
+            length = copy.size();
+            return true;
+#else
+            const int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+            struct stat info;
+            void* mapping = MAP_FAILED;
+            if (fstat(fd, &info) == 0 && info.st_size > 0) {
+                mapping = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            }
+            ::close(fd);
+            if (mapping == MAP_FAILED) return false;
+            bytes = static_cast<const char*>(mapping);
+            length = size_t(info.st_size);
+            return true;
+#endif
+        }
+
+        void close() {
+#ifdef _WIN32
+            std::vector<char>().swap(copy);
+#else
+            if (bytes) munmap(const_cast<char*>(bytes), length);
+#endif
+            bytes = nullptr;
+            length = 0;
+        }
+
+        bool is_open() const { return bytes != nullptr; }
+        const char* data() const { return bytes; }
+        size_t size() const { return length; }
+
+    private:
+        const char* bytes = nullptr;
+        size_t length = 0;
+#ifdef _WIN32
+        std::vector<char> copy;
+#endif
+};
+
+#endif
@@ -10,27 +10,51 @@
 #include "hittable.h"
 #include "texture.h"
 
+// Ids start at 1 so 0 can stand for "nothing hit" in the material id AOV.
+inline int next_material_id() {
+    static std::atomic<int> counter(0);
+    return ++counter;
+}
+
 class material {
     public:
+        int id = next_material_id();
+
         virtual ~material() = default;
 
         virtual color emitted(double u, double v, const point3& p) const {
             return color(0,0,0);
         }
 
+        // Emission at a hit, filtered over its texture footprint where the material can
+        virtual color emitted(const hit_record& rec) const {
+            return emitted(rec.u, rec.v, rec.p);
+        }
+
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {
                 return false;
         }
+
+        // Surface color at the hit, without lighting. Feeds the albedo AOV.
+        virtual color albedo(const hit_record& rec) const {
+            return color(0,0,0);
+        }
+
+        // True if scatter() draws cosine weighted directions about the normal and attenuates by the albedo alone.
+        // Integrators also sample lights directly at such hits.
+        virtual bool is_diffuse() const {
+            return false;
+        }
 };
 
 // Diffuse material
 class lambertian : public material {
     public:
         // Solid color diffuse
-        lambertian(const color& albedo) : texture(make_shared<solid_color>(albedo)) {}
+        lambertian(const color& albedo) : tex(make_shared<solid_color>(albedo)) {}
         // Textured diffuse
-        lambertian(shared_ptr<texture> tex) : texture(tex) {}
+        lambertian(shared_ptr<texture> tex) : tex(tex) {}
 
         bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
             auto scatter_direction = rec.normal + random_unit_vector();
@@ -39,13 +63,21 @@ class lambertian : public material {
                 scatter_direction = rec.normal;
             }
 
-            scattered = ray(rec.p, scatter_direction, r_in.time());
-            attenuation = texture->value(rec.u, rec.v, rec.p);
+            scattered = spawn_ray(rec, scatter_direction, r_in.time());
+            attenuation = tex->value(rec);
+            return true;
+        }
+
+        color albedo(const hit_record& rec) const override {
+            return tex->value(rec);
+        }
+
+        bool is_diffuse() const override {
             return true;
         }
 
     private:
-        shared_ptr<texture> texture;
+        shared_ptr<texture> tex;
 };
 
 // Metallic material
@@ -60,10 +92,14 @@ class metal : public material {
         bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
             vec3 reflected = reflect(r_in.direction(), rec.normal);
             reflected = unit_vector(reflected) + (fuzz * random_unit_vector());
-            scattered = ray(rec.p, reflected, r_in.time());
-            attenuation = tex->value(rec.u, rec.v, rec.p);
+            scattered = spawn_ray(rec, reflected, r_in.time());
+            attenuation = tex->value(rec);
             return (dot(scattered.direction(), rec.normal) > 0);
         }
+
+        color albedo(const hit_record& rec) const override {
+            return tex->value(rec);
+        }
     
     private:
         shared_ptr<texture> tex;
@@ -95,10 +131,14 @@ class dielectric : public material {
                 direction = refract(unit_direction, rec.normal, ri);
             }
 
-            scattered = ray(rec.p, direction, r_in.time());
+            scattered = spawn_ray(rec, direction, r_in.time());
             
             return true;
         }
+
+        color albedo(const hit_record& rec) const override {
+            return color(1.0,1.0,1.0);
+        }
     private:
         double refraction_index;
 
@@ -125,6 +165,14 @@ class diffuse_light : public material {
         color emitted(double u, double v, const point3& p) const override {
             return tex->value(u,v,p);
         }
+
+        color emitted(const hit_record& rec) const override {
+            return tex->value(rec);
+        }
+
+        color albedo(const hit_record& rec) const override {
+            return tex->value(rec);
+        }
     private:
         shared_ptr<texture> tex;
 };
@@ -133,18 +181,22 @@ class diffuse_light : public material {
 class isotropic : public material {
     public:
         // Solid color volume material
-        isotropic(const color& albedo) : texture(make_shared<solid_color>(albedo)) {}
+        isotropic(const color& albedo) : tex(make_shared<solid_color>(albedo)) {}
 
         // Textured volume material
-        isotropic(shared_ptr<texture> texture) : texture(texture) {}
+        isotropic(shared_ptr<texture> tex) : tex(tex) {}
 
         bool scatter(const ray& r_in, const hit_record& rec, color& attentuation, ray& scattered) const override {
             scattered = ray(rec.p, random_unit_vector(), r_in.time());
-            attentuation = texture->value(rec.u, rec.v, rec.p);
+            attentuation = tex->value(rec);
             return true;
         }
+
+        color albedo(const hit_record& rec) const override {
+            return tex->value(rec);
+        }
     private:
-        shared_ptr<texture> texture;
+        shared_ptr<texture> tex;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,325 @@
+/**
+ * Casey Gehling
+ *
+ * Loads triangle meshes. OBJ files are memory mapped and parsed in parallel, each thread taking a run of whole
+ * lines: a first pass counts the vertices and triangles in each run, so every thread knows where its share goes,
+ * and a second parses straight into the mesh's vertex and index buffers. Only vertex positions and faces are read.
+ * Mesh files (.rmesh) are mapped and used as they are.
+ */
+
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+
+#include "mapped_file.h"
+#include "triangle_mesh.h"
+
+#include <thread>
+
+namespace obj_parse {
+    inline bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    inline const char* skip_space(const char* p, const char* end) {
+        while (p < end && is_space(*p)) p++;
+        return p;
+    }
+
+    inline const char* line_end(const char* p, const char* end) {
+        while (p < end && *p != '\n') p++;
+        return p;
+    }
+
+    // mantissa times ten to the exponent
+    inline double scale_decimal(uint64_t mantissa, int exponent) {
+        static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18 };
+        double v = double(mantissa);
+        if (exponent < 0) {
+            v = (exponent >= -18) ? v / powers[-exponent] : v * std::pow(10.0, exponent);
+        } else if (exponent > 0) {
+            v = (exponent <= 18) ? v * powers[exponent] : v * std::pow(10.0, exponent);
+        }
+        return v;
+    }
+
+    // Decimal number at p, as written by modelling tools: sign, digits, fraction and exponent, without strtod's
+    // locale handling, as its first 18 significant digits and a power of ten. False if there are no digits.
+    inline bool parse_decimal(const char*& p, const char* end, bool& negative, uint64_t& mantissa, int& exponent) {
+        negative = false;
+        if (p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+
+        mantissa = 0;
+        exponent = 0;
+        int digits = 0;
+        bool any = false;
+        for (; p < end && *p >= '0' && *p <= '9'; p++, any = true) {
+            if (digits < 18) {
+                mantissa = mantissa * 10 + uint64_t(*p - '0');
+                if (mantissa > 0) digits++;
+            } else {
+                exponent++;
+            }
+        }
+        if (p < end && *p == '.') {
+            for (p++; p < end && *p >= '0' && *p <= '9'; p++, any = true) {
+                if (digits < 18) {
+                    mantissa = mantissa * 10 + uint64_t(*p - '0');
+                    if (mantissa > 0) digits++;
+                    exponent--;
+                }
+            }
+        }
+        if (!any) return false;
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            p++;
+            bool exponent_negative = false;
+            if (p < end && (*p == '-' || *p == '+')) exponent_negative = (*p++ == '-');
+            int e = 0;
+            for (; p < end && *p >= '0' && *p <= '9'; p++) e = std::min(e * 10 + (*p - '0'), 1000);
+            exponent += exponent_negative ? -e : e;
+        }
+        return true;
+    }
+
+    inline bool parse_double(const char*& p, const char* end, double& value) {
+        bool negative;
+        uint64_t mantissa;
+        int exponent;
+        if (!parse_decimal(p, end, negative, mantissa, exponent)) return false;
+        const double v = scale_decimal(mantissa, exponent);
+        value = negative ? -v : v;
+        return true;
+    }
+
+    inline bool parse_float(const char*& p, const char* end, float& value) {
+        double v;
+        if (!parse_double(p, end, v)) return false;
+        value = float(v);
+        return true;
+    }
+
+    inline bool parse_int(const char*& p, const char* end, long long& value) {
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+        if (p >= end || *p < '0' || *p > '9') return false;
+        long long v = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; p++) v = std::min(v * 10 + (*p - '0'), 1LL << 40);
+        value = negative ? -v : v;
+        return true;
+    }
+
+    // Number of vertices in the face whose vertex list starts at p: one per whitespace separated token
+    inline int face_size(const char* p, const char* end) {
+        int count = 0;
+        while (true) {
+            p = skip_space(p, end);
+            if (p == end) return count;
+            count++;
+            while (p < end && !is_space(*p)) p++;
+        }
+    }
+
+    // What a line declares, with p moved past the keyword
+    enum line_kind { other_line, vertex_line, face_line };
+
+    inline line_kind classify(const char*& p, const char* end) {
+        p = skip_space(p, end);
+        if (end - p >= 2 && is_space(p[1])) {
+            if (p[0] == 'v') { p += 2; return vertex_line; }
+            if (p[0] == 'f') { p += 2; return face_line; }
+        }
+        return other_line;
+    }
+
+    // One thread's run of lines, with its counts and where its share of the mesh starts
+    struct chunk {
+        const char* begin;
+        const char* end;
+        size_t vertices = 0, triangles = 0;
+        size_t vertex_base = 0, triangle_base = 0;
+        std::vector<size_t> quads; // first of the two triangles each quad was split into
+        std::string error;
+    };
+
+    inline void count(chunk& c) {
+        for (const char* line = c.begin; line < c.end; ) {
+            const char* end = line_end(line, c.end);
+            const char* p = line;
+            switch (classify(p, end)) {
+                case vertex_line: c.vertices++; break;
+                case face_line: c.triangles += size_t(std::max(face_size(p, end) - 2, 0)); break;
+                default: break;
+            }
+            line = end + (end < c.end);
+        }
+    }
+
+    inline void parse(chunk& c, float* positions, uint32_t* indices, size_t vertex_count) {
+        float* position = positions + 3 * c.vertex_base;
+        uint32_t* triangle = indices + 3 * c.triangle_base;
+        size_t vertices_so_far = c.vertex_base;
+        uint32_t face[3];
+
+        for (const char* line = c.begin; line < c.end && c.error.empty(); ) {
+            const char* end = line_end(line, c.end);
+            const char* p = line;
+            const line_kind kind = classify(p, end);
+            if (kind == vertex_line) {
+                for (int axis = 0; axis < 3; axis++) {
+                    p = skip_space(p, end);
+                    if (!parse_float(p, end, position[axis])) c.error = "bad vertex";
+                }
+                position += 3;
+                vertices_so_far++;
+            } else if (kind == face_line) {
+                const int n = face_size(p, end);
+                if (n == 4) c.quads.push_back(size_t(triangle - indices) / 3);
+                for (int k = 0; k < n; k++) {
+                    // Of "v", "v/vt", "v//vn" or "v/vt/vn", only v is used. Negative indices count back from
+                    // the last vertex declared so far.
+                    p = skip_space(p, end);
+                    long long index;
+                    if (!parse_int(p, end, index) || index == 0) {
+                        c.error = "bad face";
+                        break;
+                    }
+                    index = (index > 0) ? index - 1 : (long long)vertices_so_far + index;
+                    if (index < 0 || index >= (long long)vertex_count) {
+                        c.error = "face index out of range";
+                        break;
+                    }
+                    while (p < end && !is_space(*p)) p++;
+
+                    // Fan around the first vertex
+                    if (k < 2) {
+                        face[k] = uint32_t(index);
+                    } else {
+                        triangle[0] = face[0];
+                        triangle[1] = face[1];
+                        triangle[2] = uint32_t(index);
+                        triangle += 3;
+                        face[1] = uint32_t(index);
+                    }
+                }
+            }
+            line = end + (end < c.end);
+        }
+    }
+
+    // Split quads across their shorter diagonal, as tinyobjloader does. Parsing split every quad across the
+    // diagonal from its first vertex, before all of the vertices were known.
+    inline void split_quads(const chunk& c, const float* positions, uint32_t* indices) {
+        auto at = [&](uint32_t v) { return vec3(positions[3 * v], positions[3 * v + 1], positions[3 * v + 2]); };
+        for (size_t first : c.quads) {
+            uint32_t* t = indices + 3 * first;
+            const uint32_t i0 = t[0], i1 = t[1], i2 = t[2], i3 = t[5];
+            if ((at(i2) - at(i0)).length_squared() < (at(i3) - at(i1)).length_squared()) continue;
+            t[0] = i0; t[1] = i1; t[2] = i3;
+            t[3] = i1; t[4] = i2; t[5] = i3;
+        }
+    }
+
+    template <typename F>
+    void for_each_chunk(std::vector<chunk>& chunks, F work) {
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < chunks.size(); i++) threads.emplace_back(work, std::ref(chunks[i]));
+        if (!chunks.empty()) work(chunks[0]);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+}
+
+// Mesh of the triangles of an OBJ file, faces with more than three vertices split into triangles. Null if the file
+// can't be read or is malformed. num_threads of 0 uses one per hardware thread.
+inline shared_ptr<triangle_mesh> parse_obj(
+    const std::string& path, shared_ptr<material> mat, int num_threads = 0,
+    const mesh_build_options& options = triangle_mesh::default_options()
+) {
+    using namespace obj_parse;
+
+    mapped_file file;
+    if (!file.open(path)) {
+        std::cerr << "ERROR: Could not read OBJ file '" << path << "'.\n";
+        return nullptr;
+    }
+
+    // Runs of at least a megabyte, so small files aren't split up for nothing
+    const size_t min_chunk = size_t(1) << 20;
+    int thread_count = (num_threads > 0) ? num_threads : std::max(1u, std::thread::hardware_concurrency());
+    thread_count = int(std::max<size_t>(1, std::min<size_t>(size_t(thread_count), file.size() / min_chunk)));
+
+    const char* data = file.data();
+    const char* data_end = data + file.size();
+    std::vector<chunk> chunks(thread_count);
+    const char* start = data;
+    for (int t = 0; t < thread_count; t++) {
+        const char* end = (t + 1 == thread_count) ? data_end : data + file.size() * (t + 1) / thread_count;
+        end = std::min(line_end(std::max(end, start), data_end) + 1, data_end);
+        chunks[t].begin = start;
+        chunks[t].end = end;
+        start = end;
+    }
+
+    for_each_chunk(chunks, count);
+    size_t vertex_count = 0, triangle_count = 0;
+    for (auto& c : chunks) {
+        c.vertex_base = vertex_count;
+        c.triangle_base = triangle_count;
+        vertex_count += c.vertices;
+        triangle_count += c.triangles;
+    }
+    if (vertex_count > UINT32_MAX) {
+        std::cerr << "ERROR: OBJ file '" << path << "' has too many vertices.\n";
+        return nullptr;
+    }
+
+    std::vector<float> positions(3 * vertex_count);
+    std::vector<uint32_t> indices(3 * triangle_count);
+    for_each_chunk(chunks, [&](chunk& c) { parse(c, positions.data(), indices.data(), vertex_count); });
+    for (const auto& c : chunks) {
+        if (!c.error.empty()) {
+            std::cerr << "ERROR: Could not parse OBJ file '" << path << "': " << c.error << ".\n";
+            return nullptr;
+        }
+    }
+    for_each_chunk(chunks, [&](chunk& c) { split_quads(c, positions.data(), indices.data()); });
+
+    return make_shared<triangle_mesh>(std::move(positions), std::move(indices), mat, options);
+}
+
+// Mesh from a mesh file if path ends in .rmesh, otherwise from an OBJ file. Null if it can't be loaded.
+inline shared_ptr<triangle_mesh> open_mesh(const std::string& path, shared_ptr<material> mat) {
+    const std::string extension = ".rmesh";
+    const bool is_mesh_file = path.size() >= extension.size()
+        && path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+    return is_mesh_file ? triangle_mesh::open(path, mat) : parse_obj(path, mat);
+}
+
+// Whether load_mesh exits when a mesh can't be loaded. The render server turns this off, so a scene missing a
+// mesh fails that job and not the server.
+inline bool& exit_on_missing_mesh() {
+    static bool exits = true;
+    return exits;
+}
+
+// Meshes load_mesh couldn't load on this thread without exiting
+inline size_t& mesh_load_failures() {
+    static thread_local size_t failures = 0;
+    return failures;
+}
+
+// As open_mesh, but exits if it can't be loaded, like mesh(). Without exit_on_missing_mesh it counts the failure
+// in mesh_load_failures and returns an empty mesh instead.
+inline shared_ptr<triangle_mesh> load_mesh(const std::string& path, shared_ptr<material> mat) {
+    auto loaded = open_mesh(path, mat);
+    if (!loaded) {
+        std::cerr << "Error loading mesh file: " << path << std::endl;
+        if (exit_on_missing_mesh()) exit(EXIT_FAILURE);
+        mesh_load_failures()++;
+        return make_shared<triangle_mesh>(std::vector<float>(), std::vector<uint32_t>(), mat);
+    }
+    std::clog << "Finished loading " << path << " (" << loaded->triangles() << " triangles"
+              << (loaded->bvh_from_cache() ? ", BVH from cache" : "") << ")" << std::endl;
+    return loaded;
+}
+
+#endif
@@ -0,0 +1,147 @@
+/**
+ * Casey Gehling
+ *
+ * Defines mip pyramids for image textures. Each level halves the one above with a box filter over linear texels.
+ * A pyramid is built whole when an image is decoded and then cut into texture pages, the unit the texture cache
+ * keeps and evicts. Within a page texels are stored as 4x4 tiles of RGBA bytes, so a tile is one 64 byte cache
+ * line and the four texels of a bilinear lookup usually come from the same one.
+ */
+
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include "rtw_stb_image.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+class mipmap {
+    public:
+        // Pyramid of a loaded image, down to a single texel
+        explicit mipmap(const rtw_image& image) {
+            if (image.width() <= 0 || image.height() <= 0) return;
+
+            levels.push_back(mip_level(image.width(), image.height()));
+            for (int y = 0; y < image.height(); y++) {
+                for (int x = 0; x < image.width(); x++) {
+                    const unsigned char* pixel = image.pixel_data(x, y);
+                    uint8_t* texel = levels[0].texel(x, y);
+                    texel[0] = pixel[0];
+                    texel[1] = pixel[1];
+                    texel[2] = pixel[2];
+                    texel[3] = 255;
+                }
+            }
+
+            while (levels.back().width > 1 || levels.back().height > 1) {
+                const mip_level& above = levels.back();
+                mip_level below(next_size(above.width), next_size(above.height));
+                for (int y = 0; y < below.height; y++) {
+                    for (int x = 0; x < below.width; x++) {
+                        // Average the 2x2 block above, repeating the edge of an odd sized level
+                        int sum[3] = { 0, 0, 0 };
+                        for (int dy = 0; dy < 2; dy++) {
+                            for (int dx = 0; dx < 2; dx++) {
+                                const uint8_t* t = above.texel(std::min(2 * x + dx, above.width - 1), std::min(2 * y + dy, above.height - 1));
+                                for (int c = 0; c < 3; c++) sum[c] += t[c];
+                            }
+                        }
+                        uint8_t* texel = below.texel(x, y);
+                        for (int c = 0; c < 3; c++) texel[c] = uint8_t((sum[c] + 2) / 4);
+                        texel[3] = 255;
+                    }
+                }
+                levels.push_back(below);
+            }
+        }
+
+        // Width or height of the level below one of the given size
+        static int next_size(int size) { return std::max(1, size / 2); }
+
+        int level_count() const { return int(levels.size()); }
+        int width(int level) const { return levels[level].width; }
+        int height(int level) const { return levels[level].height; }
+
+        // RGBA bytes of a texel, rows running from the top of the image down
+        const uint8_t* texel(int level, int x, int y) const { return levels[level].texel(x, y); }
+
+    private:
+        struct mip_level {
+            int width, height;
+            std::vector<uint8_t> texels; // RGBA, in rows
+
+            mip_level(int width, int height) : width(width), height(height), texels(size_t(width) * height * 4, 0) {}
+
+            const uint8_t* texel(int x, int y) const { return &texels[(size_t(y) * width + x) * 4]; }
+            uint8_t* texel(int x, int y) { return &texels[(size_t(y) * width + x) * 4]; }
+        };
+
+        std::vector<mip_level> levels;
+};
+
+// A square block of one mip level, 4096 bytes of RGBA texels in 4x4 tiles
+struct texture_page {
+    static const int shift = 5;
+    static const int size = 1 << shift; // texels along each side
+    static const int tile_shift = 2;
+    static const int tile_size = 1 << tile_shift;
+
+    uint8_t texels[size * size * 4];
+
+    // Texel at (x,y) within the page
+    const uint8_t* texel(int x, int y) const { return &texels[offset(x, y)]; }
+    uint8_t* texel(int x, int y) { return &texels[offset(x, y)]; }
+
+    static size_t offset(int x, int y) {
+        const int tile = (y >> tile_shift) * (size >> tile_shift) + (x >> tile_shift);
+        return size_t((tile << (2 * tile_shift)) + ((y & (tile_size - 1)) << tile_shift) + (x & (tile_size - 1))) * 4;
+    }
+};
+
+#ifdef __SSE2__
+inline __m128i load_texel(const uint8_t* texel) {
+    int32_t bits;
+    std::memcpy(&bits, texel, 4);
+    return _mm_cvtsi32_si128(bits);
+}
+#endif
+
+// Bilinear blend of four RGBA texels, fx of the way from t00 to t10 and fy of the way from t00 to t01
+inline color blend_texels(const uint8_t* t00, const uint8_t* t10, const uint8_t* t01, const uint8_t* t11, float fx, float fy) {
+    const float w00 = (1 - fx) * (1 - fy), w10 = fx * (1 - fy), w01 = (1 - fx) * fy, w11 = fx * fy;
+#ifdef __SSE2__
+    // All four channels of a texel at once: widen its bytes to floats and sum the weighted texels
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i top = _mm_unpacklo_epi8(_mm_unpacklo_epi32(load_texel(t00), load_texel(t10)), zero);
+    const __m128i bottom = _mm_unpacklo_epi8(_mm_unpacklo_epi32(load_texel(t01), load_texel(t11)), zero);
+    __m128 sum = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(top, zero)), _mm_set1_ps(w00));
+    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(top, zero)), _mm_set1_ps(w10)));
+    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(bottom, zero)), _mm_set1_ps(w01)));
+    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(bottom, zero)), _mm_set1_ps(w11)));
+    float rgba[4];
+    _mm_storeu_ps(rgba, _mm_mul_ps(sum, _mm_set1_ps(float(1.0 / 255.0))));
+    return color(rgba[0], rgba[1], rgba[2]);
+#else
+    auto channel = [&](int c) {
+        return real(float(1.0 / 255.0) * (w00 * t00[c] + w10 * t10[c] + w01 * t01[c] + w11 * t11[c]));
+    };
+    return color(channel(0), channel(1), channel(2));
+#endif
+}
+
+// log2 for x >= 1, exact at powers of two and linear in between. Off by less than 0.09, which only
+// shifts the blend between mip levels slightly.
+inline float approx_log2(float x) {
+    uint32_t bits;
+    std::memcpy(&bits, &x, 4);
+    const int exponent = int(bits >> 23) - 127;
+    const float mantissa = float(bits & 0x7fffff) * (1.0f / (1 << 23));
+    return exponent + mantissa;
+}
+
+#endif
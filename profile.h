@@ -0,0 +1,124 @@
+/**
+ * Casey Gehling
+ *
+ * Render profiling utilities. Per-thread traversal counters, per-tile timing events exported as a
+ * Chrome trace (chrome://tracing, ui.perfetto.dev), and false-colour heatmaps of per-pixel cost.
+ */
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "constants.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using profile_clock = std::chrono::steady_clock;
+
+// Traversal work done by the calling thread. Incremented by bvh nodes and primitives on every hit test,
+// and by the camera for every ray it traces. The texture cache counts its page lookups here too.
+struct traversal_counters {
+    unsigned long long rays = 0;
+    unsigned long long node_visits = 0;
+    unsigned long long prim_tests = 0;
+    unsigned long long texture_lookups = 0;
+    unsigned long long texture_misses = 0; // lookups of pages that weren't resident and had to be decoded
+
+    unsigned long long total() const { return node_visits + prim_tests; }
+};
+
+inline traversal_counters& thread_counters() {
+    static thread_local traversal_counters counters;
+    return counters;
+}
+
+// Totals for one call to camera::render.
+struct render_stats {
+    double seconds = 0;
+    double denoise_seconds = 0; // included in seconds
+    unsigned long long rays = 0;
+    unsigned long long node_visits = 0;
+    unsigned long long prim_tests = 0;
+    unsigned long long texture_lookups = 0;
+    unsigned long long texture_misses = 0;
+
+    double mrays_per_second() const {
+        double tracing = seconds - denoise_seconds;
+        return tracing > 0 ? rays / tracing * 1e-6 : 0;
+    }
+};
+
+// One rendered tile, in microseconds since the start of the render.
+struct tile_event {
+    int thread;
+    int tile_x, tile_y;
+    long long start_us;
+    long long duration_us;
+};
+
+inline long long microseconds_between(profile_clock::time_point a, profile_clock::time_point b) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(b - a).count();
+}
+
+// Write tile events in Chrome trace event format, one track per render thread.
+inline bool write_trace_json(const std::string& filename, const std::vector<tile_event>& events, int num_threads) {
+    std::ofstream out(filename);
+    if (!out) {
+        std::cerr << "ERROR: Could not write trace file '" << filename << "'.\n";
+        return false;
+    }
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    for (int t = 0; t < num_threads; t++) {
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << t
+            << ",\"args\":{\"name\":\"render " << t << "\"}},\n";
+    }
+    for (size_t i = 0; i < events.size(); i++) {
+        const tile_event& e = events[i];
+        out << "{\"name\":\"tile " << e.tile_x << "," << e.tile_y << "\",\"cat\":\"tile\",\"ph\":\"X\""
+            << ",\"pid\":0,\"tid\":" << e.thread << ",\"ts\":" << e.start_us << ",\"dur\":" << e.duration_us
+            << ",\"args\":{\"x\":" << e.tile_x << ",\"y\":" << e.tile_y << "}}"
+            << (i + 1 < events.size() ? ",\n" : "\n");
+    }
+    out << "]}\n";
+    return true;
+}
+
+// Map t in [0,1] onto a blue -> cyan -> green -> yellow -> red ramp.
+inline color heat_color(double t) {
+    static const color stops[5] = {
+        color(0,0,1), color(0,1,1), color(0,1,0), color(1,1,0), color(1,0,0)
+    };
+    t = interval(0,1).clamp(t) * 4;
+    int i = std::min(int(t), 3);
+    double f = t - i;
+    return (1 - f) * stops[i] + f * stops[i + 1];
+}
+
+// Write per-pixel cost as a false-colour PPM. Costs are normalised to the 99th percentile so a few
+// outlier pixels don't flatten the rest of the image.
+inline bool write_heatmap(const std::string& filename, const std::vector<double>& cost, int width, int height) {
+    std::ofstream out(filename);
+    if (!out) {
+        std::cerr << "ERROR: Could not write heatmap file '" << filename << "'.\n";
+        return false;
+    }
+
+    std::vector<double> sorted(cost);
+    std::sort(sorted.begin(), sorted.end());
+    double scale = sorted.empty() ? 0 : sorted[size_t(0.99 * (sorted.size() - 1))];
+    if (scale <= 0) scale = 1;
+
+    out << "P3\n" << width << ' ' << height << "\n255\n";
+    for (size_t i = 0; i < cost.size(); i++) {
+        color c = heat_color(cost[i] / scale);
+        out << int(255.999 * c.x()) << ' ' << int(255.999 * c.y()) << ' ' << int(255.999 * c.z()) << '\n';
+    }
+
+    std::clog << "Heatmap written to " << filename << " (99th percentile cost " << scale << ")\n";
+    return true;
+}
+
+#endif
@@ -1,13 +1,14 @@
 /**
  * Casey Gehling
  * 
- * Defines quad intersection logic as well as box instance mesh generation and cub map generation.
+ * Defines quad intersection logic as well as cube map generation.
  */
 
 #ifndef QUAD_H
 #define QUAD_H
 
 #include "hittable.h"
+#include "simd.h"
 
 class quad : public hittable {
     public:
@@ -19,6 +20,7 @@ class quad : public hittable {
             normal = unit_vector(inward_normals ? -n : n); // Flip normal if inward_normals is true
             D = dot(normal, Q);
             w = n / dot(n, n);
+            p_error = rounding_gamma<real>(7) * (max_abs(Q) + max_abs(u) + max_abs(v)); // of points rebuilt from Q, u and v
 
             set_bounding_box();
         }
@@ -32,40 +34,46 @@ class quad : public hittable {
         aabb bounding_box() const override { return bbox; }
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-            auto denom = dot(normal, r.direction());
-
-            // Don't hit if ray is parallel to plane
-            if (std::fabs(denom) < 1e-8) {
-                return false;
-            }
-
-            // Return false if hit point t is outside ray interval
-            auto t = (D - dot(normal, r.origin())) / denom;
-            if (!ray_t.contains(t)) {
+            real t, alpha, beta;
+            if (!find_hit(r, ray_t, t, alpha, beta, rec)) {
                 return false;
             }
 
-            auto intersection = r.at(t);
+            // Ray hits the shape
+            record_hit(r, t, alpha, beta, rec);
+            return true;
+        }
 
-            // Determine if ray hits within shape
-            vec3 planar_hitpt = intersection - Q;
-            auto alpha = dot(w, cross(planar_hitpt, v));
-            auto beta = dot(w, cross(u, planar_hitpt));
+        // A plane is crossed at most once. Only its t is wanted, so no hit record is filled.
+        int crossings(const ray& r, interval ray_t, real* ts, int max_count) const override {
+            hit_record rec; // takes is_interior's u and v, which aren't used
+            real t, alpha, beta;
+            if (max_count < 1 || !find_hit(r, ray_t, t, alpha, beta, rec)) return 0;
+            ts[0] = t;
+            return 1;
+        }
 
-            if (!is_interior(alpha, beta, rec)) {
-                return false;
+        unsigned hit_packet(ray_packet& packet, unsigned active, hit_record* recs) const override {
+            const simd_kernel_table& simd = simd_kernels();
+            if (!simd.plane_hit) return hittable::hit_packet(packet, active, recs);
+
+            // The kernel finds the plane hits, the interior test stays virtual
+            thread_counters().prim_tests += lane_count(active);
+            real t[max_packet_size], alpha[max_packet_size], beta[max_packet_size];
+            unsigned hits = simd.plane_hit(Q, u, v, w, normal, D, packet, active, false, t, alpha, beta) & active;
+            for (int lane = 0; lane < packet.size; lane++) {
+                if (!(hits & (1u << lane))) continue;
+                if (!is_interior(alpha[lane], beta[lane], recs[lane])) {
+                    hits &= ~(1u << lane);
+                    continue;
+                }
+                record_hit(packet.rays[lane], t[lane], alpha[lane], beta[lane], recs[lane]);
+                packet.tmax[lane] = t[lane];
             }
-
-            // Ray hits the shape
-            rec.t = t;
-            rec.p = intersection;
-            rec.mat = mat;
-            rec.set_face_normal(r, normal); // Normal direction depends on constructor setting
-
-            return true;
+            return hits;
         }
 
-        virtual bool is_interior(double a, double b, hit_record& rec) const {
+        virtual bool is_interior(real a, real b, hit_record& rec) const {
             interval unit_interval = interval(0, 1);
 
             if (!unit_interval.contains(a) || !unit_interval.contains(b)) {
@@ -84,32 +92,48 @@ class quad : public hittable {
         shared_ptr<material> mat;
         aabb bbox;
         vec3 normal;
-        double D;
-};
+        real D;
+        real p_error;
 
+        // Where r crosses the quad's plane within ray_t, if it does so inside the quad. is_interior may set rec's u and v.
+        bool find_hit(const ray& r, interval ray_t, real& t, real& alpha, real& beta, hit_record& rec) const {
+            thread_counters().prim_tests++;
+            auto denom = dot(normal, r.direction());
 
-inline shared_ptr<hittable_list> box(const point3& a, const point3& b, shared_ptr<material> mat) {
-    // Returns the 3D box (six sides) that contains the two opposite vertices a & b.
+            // Don't hit if ray is parallel to plane
+            if (std::fabs(denom) < 1e-8) {
+                return false;
+            }
+
+            // Return false if hit point t is outside ray interval
+            t = (D - dot(normal, r.origin())) / denom;
+            if (!ray_t.contains(t)) {
+                return false;
+            }
 
-    auto sides = make_shared<hittable_list>();
+            auto intersection = r.at(t);
 
-    // Construct the two opposite vertices with the minimum and maximum coordinates.
-    auto min = point3(std::fmin(a.x(),b.x()), std::fmin(a.y(),b.y()), std::fmin(a.z(),b.z()));
-    auto max = point3(std::fmax(a.x(),b.x()), std::fmax(a.y(),b.y()), std::fmax(a.z(),b.z()));
+            // Determine if ray hits within shape
+            vec3 planar_hitpt = intersection - Q;
+            alpha = dot(w, cross(planar_hitpt, v));
+            beta = dot(w, cross(u, planar_hitpt));
 
-    auto dx = vec3(max.x() - min.x(), 0, 0);
-    auto dy = vec3(0, max.y() - min.y(), 0);
-    auto dz = vec3(0, 0, max.z() - min.z());
+            return is_interior(alpha, beta, rec);
+        }
 
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), max.z()),  dx,  dy, mat)); // front
-    sides->add(make_shared<quad>(point3(max.x(), min.y(), max.z()), -dz,  dy, mat)); // right
-    sides->add(make_shared<quad>(point3(max.x(), min.y(), min.z()), -dx,  dy, mat)); // back
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()),  dz,  dy, mat)); // left
-    sides->add(make_shared<quad>(point3(min.x(), max.y(), max.z()),  dx, -dz, mat)); // top
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()),  dx,  dz, mat)); // bottom
+        void record_hit(const ray& r, real t, real alpha, real beta, hit_record& rec) const {
+            // Rebuild the point from the plane's own parametrisation, which bounds its error by the quad's scale
+            rec.t = t;
+            rec.p = Q + alpha * u + beta * v;
+            rec.p_error = p_error;
+            rec.dpdu = u;
+            rec.dpdv = v;
+            rec.mat = mat;
+            rec.object_id = object_id;
+            rec.set_face_normal(r, normal); // Normal direction depends on constructor setting
+        }
+};
 
-    return sides;
-}
 
 // Used for creating a skybox
 inline shared_ptr<hittable_list> cube_map(
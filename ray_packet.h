@@ -0,0 +1,74 @@
+/**
+ * Casey Gehling
+ *
+ * Defines ray packets: groups of up to 16 coherent rays (adjacent camera pixels) stored as structure of
+ * arrays, traced through the BVH together so box tests and traversal decisions are shared.
+ */
+
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "ray.h"
+
+const int max_packet_size = 16;
+
+// Lane bitmask helpers
+inline unsigned lane_mask(int size) { return (size >= 32) ? ~0u : (1u << size) - 1; }
+
+inline int lane_count(unsigned mask) {
+    int n = 0;
+    for (; mask; mask &= mask - 1) n++;
+    return n;
+}
+
+class ray_packet {
+    public:
+        int size = 0;
+
+        // Per-lane origin, direction, inverse direction, time and valid interval, laid out for vectorised tests
+        real ox[max_packet_size], oy[max_packet_size], oz[max_packet_size];
+        real dx[max_packet_size], dy[max_packet_size], dz[max_packet_size];
+        real inv_dx[max_packet_size], inv_dy[max_packet_size], inv_dz[max_packet_size];
+        real time[max_packet_size];
+        real tmin[max_packet_size], tmax[max_packet_size];
+
+        // The rays themselves, for primitives and diverged lanes traced one at a time
+        ray rays[max_packet_size];
+
+        // Unused lanes stay empty so full-width box tests read defined values
+        ray_packet() {
+            for (int lane = 0; lane < max_packet_size; lane++) {
+                ox[lane] = oy[lane] = oz[lane] = 0;
+                dx[lane] = dy[lane] = dz[lane] = 0;
+                inv_dx[lane] = inv_dy[lane] = inv_dz[lane] = 0;
+                time[lane] = 0;
+                tmin[lane] = 1;
+                tmax[lane] = 0;
+            }
+        }
+
+        void set(int lane, const ray& r, interval ray_t) {
+            rays[lane] = r;
+            ox[lane] = r.origin().x();
+            oy[lane] = r.origin().y();
+            oz[lane] = r.origin().z();
+            dx[lane] = r.direction().x();
+            dy[lane] = r.direction().y();
+            dz[lane] = r.direction().z();
+            inv_dx[lane] = 1 / r.direction().x();
+            inv_dy[lane] = 1 / r.direction().y();
+            inv_dz[lane] = 1 / r.direction().z();
+            time[lane] = r.time();
+            tmin[lane] = ray_t.min;
+            tmax[lane] = ray_t.max;
+        }
+
+        interval lane_interval(int lane) const { return interval(tmin[lane], tmax[lane]); }
+
+        // Once a quarter or fewer of the lanes are still active, traversing together costs more than it saves.
+        bool diverged(unsigned active) const {
+            return lane_count(active) * 4 <= size;
+        }
+};
+
+#endif
@@ -0,0 +1,422 @@
+/**
+ * Casey Gehling
+ *
+ * Defines the render server, a long running process that takes render jobs over a Unix domain socket. Scenes it
+ * has built are kept, with their decoded textures, meshes and BVHs, so a job for a scene it has already rendered
+ * starts tracing at once, and the render threads wait in a pool between jobs. Jobs wait in a queue by priority,
+ * and each one's progress and finished image are sent back over its connection.
+ *
+ * The protocol is lines of text. A client sends one request:
+ *   render scene=<id or scene file> [width=<n>] [spp=<n>] [seed=<n>] [priority=<n>]
+ *   stop
+ * and for a render gets back
+ *   queued <job> <jobs ahead of it>
+ *   progress <job> <tiles done> <tiles>               (every 5%)
+ *   done <job> <queued s> <scene setup s> <render s> <scene was warm, 0 or 1>
+ *   image <job> <bytes>                               followed by that many bytes of PPM
+ * or "error <message>". Higher priorities go first, and equal ones in the order they came.
+ */
+
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+#include "scenes.h"
+#include "scene_file.h"
+
+#include <condition_variable>
+#include <cstring>
+#include <list>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <sstream>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// One render, as asked for
+struct render_job {
+    uint64_t id = 0;
+    int scene = 0;
+    std::string scene_path; // scene file, when not a built-in scene
+    int width = 0; // 0 keeps the scene's own
+    int spp = 0;
+    uint64_t seed = 0;
+    int priority = 0;
+    int connection = -1; // socket the results go back on
+    uint64_t sequence = 0; // order of arrival, for jobs of equal priority
+    profile_clock::time_point queued_at;
+
+    // Parse "render key=value ...". False with error set if it isn't a valid request.
+    bool parse(const std::string& line, std::string& error) {
+        std::istringstream fields(line);
+        std::string word;
+        fields >> word;
+        if (word != "render") {
+            error = "unknown request";
+            return false;
+        }
+        while (fields >> word) {
+            const size_t equals = word.find('=');
+            const std::string key = word.substr(0, equals);
+            const std::string value = (equals == std::string::npos) ? "" : word.substr(equals + 1);
+            if (key == "scene" && value.find_first_not_of("0123456789") != std::string::npos) scene_path = value;
+            else if (key == "scene") scene = atoi(value.c_str());
+            else if (key == "width") width = atoi(value.c_str());
+            else if (key == "spp") spp = atoi(value.c_str());
+            else if (key == "seed") seed = strtoull(value.c_str(), nullptr, 10);
+            else if (key == "priority") priority = atoi(value.c_str());
+            else {
+                error = "unknown field " + key;
+                return false;
+            }
+        }
+        if (scene_path.empty() && (scene < 1 || scene > scene_count)) {
+            error = "unknown scene";
+            return false;
+        }
+        if (width < 0 || spp < 0) {
+            error = "bad width or spp";
+            return false;
+        }
+        return true;
+    }
+};
+
+class render_server {
+    public:
+        int num_threads = 0; // render threads, 0 uses every hardware thread
+        size_t scene_limit = 8; // built scenes kept, the least recently used dropped past this
+
+        explicit render_server(const std::string& socket_path) : path(socket_path) {}
+
+        // Listen on the socket and render jobs until a stop request. False if the socket can't be made.
+        bool serve() {
+#ifdef _WIN32
+            std::cerr << "ERROR: The render server needs Unix domain sockets." << std::endl;
+            return false;
+#else
+            sockaddr_un address;
+            if (path.size() >= sizeof(address.sun_path)) {
+                std::cerr << "ERROR: Socket path '" << path << "' is too long." << std::endl;
+                return false;
+            }
+            std::memset(&address, 0, sizeof(address));
+            address.sun_family = AF_UNIX;
+            std::memcpy(address.sun_path, path.c_str(), path.size());
+            // A socket left by a server that has gone is replaced, but not one a server still answers on
+            if (answers(address)) {
+                std::cerr << "ERROR: A render server is already listening on '" << path << "'." << std::endl;
+                return false;
+            }
+            const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+            unlink(path.c_str());
+            if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+                || listen(listener, 64) != 0) {
+                std::cerr << "ERROR: Could not listen on '" << path << "'." << std::endl;
+                if (listener >= 0) ::close(listener);
+                return false;
+            }
+            std::clog << "Listening on " << path << std::endl;
+
+            exit_on_missing_mesh() = false;
+            pool = make_shared<thread_pool>(num_threads);
+            std::thread renderer(&render_server::render_jobs, this);
+
+            while (true) {
+                const int connection = accept(listener, nullptr, nullptr);
+                if (connection < 0) continue;
+
+                // Requests are one short line sent straight away, so one slow client can only hold this up briefly.
+                // Replies time out too, so a client that stops reading only loses its own job.
+                timeval timeout = { 5, 0 };
+                setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                std::string line;
+                if (!read_line(connection, line)) {
+                    ::close(connection);
+                    continue;
+                }
+                if (line == "stop") {
+                    send_line(connection, "stopping");
+                    ::close(connection);
+                    break;
+                }
+
+                render_job job;
+                std::string error;
+                if (!job.parse(line, error)) {
+                    send_line(connection, "error " + error);
+                    ::close(connection);
+                    continue;
+                }
+                std::lock_guard<std::mutex> guard(lock);
+                job.id = ++jobs_received;
+                job.sequence = job.id;
+                job.connection = connection;
+                job.queued_at = profile_clock::now();
+                send_line(connection, "queued " + std::to_string(job.id) + " " + std::to_string(queue.size() + busy));
+                queue.push(job);
+                wake.notify_one();
+            }
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                stopping = true;
+            }
+            wake.notify_one();
+            renderer.join();
+            ::close(listener);
+            unlink(path.c_str());
+            return true;
+#endif
+        }
+
+    private:
+        // A built scene and the camera settings it came with
+        struct built_scene {
+            hittable_list world;
+            camera cam;
+        };
+
+        struct later_job {
+            bool operator()(const render_job& a, const render_job& b) const {
+                return a.priority != b.priority ? a.priority < b.priority : a.sequence > b.sequence;
+            }
+        };
+
+        std::string path;
+        shared_ptr<thread_pool> pool;
+        std::mutex lock;
+        std::condition_variable wake;
+        std::priority_queue<render_job, std::vector<render_job>, later_job> queue;
+        uint64_t jobs_received = 0;
+        int busy = 0; // jobs rendering now
+        bool stopping = false;
+
+        // Built scenes by scene (number or file) and seed, most recently used first
+        std::list<std::pair<std::pair<std::string, uint64_t>, built_scene> > scenes_built;
+
+#ifndef _WIN32
+        static bool answers(const sockaddr_un& address) {
+            const int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (probe < 0) return false;
+            const bool connected = connect(probe, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+            ::close(probe);
+            return connected;
+        }
+
+        static bool read_line(int connection, std::string& line) {
+            char c;
+            while (line.size() < 4096) {
+                if (recv(connection, &c, 1, 0) != 1) return false;
+                if (c == '\n') return true;
+                line += c;
+            }
+            return false;
+        }
+
+        static bool send_bytes(int connection, const char* bytes, size_t count) {
+            while (count > 0) {
+                const ssize_t sent = send(connection, bytes, count, MSG_NOSIGNAL);
+                if (sent <= 0) return false;
+                bytes += sent;
+                count -= size_t(sent);
+            }
+            return true;
+        }
+
+        static bool send_line(int connection, const std::string& line) {
+            const std::string out = line + "\n";
+            return send_bytes(connection, out.data(), out.size());
+        }
+
+        // The scene built for job, from the ones kept if it is there. Null if it can't be built, its scene file
+        // or a mesh it loads missing or bad.
+        const built_scene* scene_for(const render_job& job, bool& warm) {
+            const std::pair<std::string, uint64_t> key(key_name(job), job.seed);
+            for (auto entry = scenes_built.begin(); entry != scenes_built.end(); ++entry) {
+                if (entry->first == key) {
+                    scenes_built.splice(scenes_built.begin(), scenes_built, entry);
+                    warm = true;
+                    return &scenes_built.front().second;
+                }
+            }
+            warm = false;
+            built_scene built;
+            seed_random(job.seed);
+            const size_t failures = mesh_load_failures();
+            if (job.scene_path.empty()) built.world = scenes[job.scene - 1].build(built.cam);
+            else if (!load_scene_file(job.scene_path, built.cam, built.world)) return nullptr;
+            if (mesh_load_failures() != failures) return nullptr;
+            scenes_built.emplace_front(key, built);
+            while (scenes_built.size() > scene_limit) scenes_built.pop_back();
+            return &scenes_built.front().second;
+        }
+
+        void render_jobs() {
+            while (true) {
+                render_job job;
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    wake.wait(guard, [&]() { return stopping || !queue.empty(); });
+                    if (stopping && queue.empty()) return;
+                    job = queue.top();
+                    queue.pop();
+                    busy = 1;
+                }
+                render(job);
+                std::lock_guard<std::mutex> guard(lock);
+                busy = 0;
+            }
+        }
+
+        static std::string key_name(const render_job& job) {
+            return job.scene_path.empty() ? std::to_string(job.scene) : job.scene_path;
+        }
+
+        void render(const render_job& job) {
+            const auto start = profile_clock::now();
+            const double queued_seconds = std::chrono::duration<double>(start - job.queued_at).count();
+            bool warm;
+            const built_scene* scene = scene_for(job, warm);
+            if (!scene) {
+                send_line(job.connection, "error could not build scene " + key_name(job));
+                ::close(job.connection);
+                return;
+            }
+            const double setup_seconds = std::chrono::duration<double>(profile_clock::now() - start).count();
+
+            camera cam = scene->cam;
+            if (job.width > 0) cam.image_width = job.width;
+            if (job.spp > 0) cam.samples_per_pixel = job.spp;
+            cam.seed = job.seed;
+            cam.pool = pool;
+            cam.show_progress = false;
+            std::mutex progress_lock;
+            int progress_sent = 0;
+            bool connected = true; // until a send fails or times out, after which nothing more is sent
+            cam.on_tile = [&](int done, int count) {
+                std::lock_guard<std::mutex> guard(progress_lock);
+                const int step = 20 * done / count;
+                if (!connected || step <= progress_sent) return;
+                progress_sent = step;
+                connected = send_line(job.connection, "progress " + std::to_string(job.id) + " " + std::to_string(done) + " " + std::to_string(count));
+            };
+            std::vector<color> framebuffer = cam.render_framebuffer(scene->world);
+
+            std::ostringstream image;
+            image << "P3\n" << cam.image_width << ' ' << cam.height() << "\n255\n";
+            for (const color& pixel : framebuffer) {
+                write_color(image, pixel);
+            }
+            const std::string bytes = image.str();
+            std::ostringstream done;
+            done << "done " << job.id << ' ' << queued_seconds << ' ' << setup_seconds << ' ' << cam.stats.seconds
+                 << ' ' << (warm ? 1 : 0);
+            connected = connected && send_line(job.connection, done.str())
+                && send_line(job.connection, "image " + std::to_string(job.id) + " " + std::to_string(bytes.size()))
+                && send_bytes(job.connection, bytes.data(), bytes.size());
+            ::close(job.connection);
+            std::clog << "Job " << job.id << " (scene " << key_name(job) << ", priority " << job.priority << "): "
+                      << queued_seconds << " s queued, " << setup_seconds << " s scene setup" << (warm ? " (warm)" : "")
+                      << ", " << cam.stats.seconds << " s render" << (connected ? "" : ", not sent: client stopped reading")
+                      << std::endl;
+        }
+#else
+        void render_jobs() {}
+#endif
+};
+
+// Result of a job sent to a render server
+struct job_result {
+    bool ok = false;
+    std::string error;
+    double queued_seconds = 0, setup_seconds = 0, render_seconds = 0;
+    bool warm = false;
+    std::string image; // PPM bytes
+};
+
+// Send request to the server at socket_path and wait for the job's image, printing its progress to std::clog if
+// show_progress is set
+inline job_result submit_job(const std::string& socket_path, const std::string& request, bool show_progress) {
+    job_result result;
+#ifdef _WIN32
+    result.error = "the render server needs Unix domain sockets";
+#else
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, socket_path.c_str(), std::min(socket_path.size(), sizeof(address.sun_path) - 1));
+    const int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0 || connect(connection, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        result.error = "could not connect to " + socket_path;
+        if (connection >= 0) ::close(connection);
+        return result;
+    }
+
+    const std::string line = request + "\n";
+    send(connection, line.data(), line.size(), MSG_NOSIGNAL);
+
+    // Lines until the image, read a buffer at a time
+    std::string buffer;
+    char chunk[1 << 16];
+    auto fill = [&]() {
+        const ssize_t count = recv(connection, chunk, sizeof(chunk), 0);
+        if (count <= 0) return false;
+        buffer.append(chunk, size_t(count));
+        return true;
+    };
+    while (true) {
+        size_t end;
+        while ((end = buffer.find('\n')) == std::string::npos) {
+            if (!fill()) {
+                if (result.error.empty()) result.error = "connection closed";
+                ::close(connection);
+                return result;
+            }
+        }
+        const std::string reply = buffer.substr(0, end);
+        buffer.erase(0, end + 1);
+
+        std::istringstream fields(reply);
+        std::string kind;
+        uint64_t id;
+        fields >> kind;
+        if (kind == "error") {
+            result.error = reply.substr(std::min(reply.size(), size_t(6)));
+        } else if (kind == "stopping") {
+            result.ok = true;
+            break;
+        } else if (kind == "queued" && show_progress) {
+            int ahead;
+            fields >> id >> ahead;
+            std::clog << "Job " << id << " queued behind " << ahead << std::endl;
+        } else if (kind == "progress" && show_progress) {
+            int done, count;
+            fields >> id >> done >> count;
+            std::clog << "\rTiles remaining: " << count - done << ' ' << std::flush;
+        } else if (kind == "done") {
+            int warm;
+            fields >> id >> result.queued_seconds >> result.setup_seconds >> result.render_seconds >> warm;
+            result.warm = warm != 0;
+            if (show_progress) std::clog << '\n';
+        } else if (kind == "image") {
+            size_t size;
+            fields >> id >> size;
+            while (buffer.size() < size && fill()) {}
+            result.ok = buffer.size() >= size;
+            if (result.ok) result.image = buffer.substr(0, size);
+            else result.error = "image cut short";
+            break;
+        }
+    }
+    ::close(connection);
+#endif
+    return result;
+}
+
+#endif
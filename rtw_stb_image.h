@@ -16,61 +16,74 @@
 #define STBI_FAILURE_USERMSG
 #include "third_party/stb_image.h"
 
+#include <cmath>
 #include <cstdlib>
 #include <iostream>
+#include <string>
+#include <vector>
 
 class rtw_image {
   public:
     rtw_image() {}
 
     rtw_image(const char* image_filename) {
-        // Loads image data from the specified file. If the RTW_IMAGES environment variable is
-        // defined, looks only in that directory for the image file. If the image was not found,
-        // searches for the specified image file first from the current directory, then in the
-        // images/ subdirectory, then the _parent's_ images/ subdirectory, and then _that_
-        // parent, on so on, for six levels up. If the image was not loaded successfully,
-        // width() and height() will return 0.
+        // Loads image data from the specified file, found as resolve() describes. If the image
+        // was not loaded successfully, width() and height() will return 0.
 
+        auto filename = resolve(image_filename);
+        if (!filename.empty() && load(filename)) return;
+
+        std::cerr << "ERROR: Could not load image file '" << image_filename << "'.\n";
+    }
+
+    ~rtw_image() {
+        STBI_FREE(bdata);
+    }
+
+    // Path the image file is found at, or empty if there is no readable image. If the RTW_IMAGES
+    // environment variable is defined, looks first in that directory for the image file. If the
+    // image was not found there, searches for the specified image file first from the current
+    // directory, then in the images/ subdirectory, then the _parent's_ images/ subdirectory,
+    // and then _that_ parent, on so on, for six levels up. Only the file headers are read.
+    static std::string resolve(const char* image_filename) {
         auto filename = std::string(image_filename);
         auto imagedir = getenv("RTW_IMAGES");
 
         // Hunt for the image file in some likely locations.
-        if (imagedir && load(std::string(imagedir) + "/" + image_filename)) return;
-        if (load(filename)) return;
-        if (load("images/" + filename)) return;
-        if (load("../images/" + filename)) return;
-        if (load("../../images/" + filename)) return;
-        if (load("../../../images/" + filename)) return;
-        if (load("../../../../images/" + filename)) return;
-        if (load("../../../../../images/" + filename)) return;
-        if (load("../../../../../../images/" + filename)) return;
-
-        std::cerr << "ERROR: Could not load image file '" << image_filename << "'.\n";
+        if (imagedir && readable(std::string(imagedir) + "/" + filename)) return std::string(imagedir) + "/" + filename;
+        std::string prefix;
+        for (int up = 0; up <= 7; up++) {
+            auto path = (up == 0) ? filename : prefix + "images/" + filename;
+            if (readable(path)) return path;
+            if (up > 0) prefix += "../";
+        }
+        return std::string();
     }
 
-    ~rtw_image() {
-        delete[] bdata;
-        STBI_FREE(fdata);
+    // Size of the image in a file, from its header alone
+    static bool info(const std::string& filename, int& width, int& height) {
+        int n;
+        return stbi_info(filename.c_str(), &width, &height, &n) != 0;
     }
 
     bool load(const std::string& filename) {
         // Loads the linear (gamma=1) image data from the given file name. Returns true if the
-        // load succeeded. The resulting data buffer contains the three [0.0, 1.0]
-        // floating-point values for the first pixel (red, then green, then blue). Pixels are
-        // contiguous, going left to right for the width of the image, followed by the next row
-        // below, for the full height of the image.
+        // load succeeded. The resulting data buffer contains the three [0, 255] byte values for
+        // the first pixel (red, then green, then blue). Pixels are contiguous, going left to
+        // right for the width of the image, followed by the next row below, for the full height
+        // of the image.
 
         auto n = bytes_per_pixel; // Dummy out parameter: original components per pixel
-        fdata = stbi_loadf(filename.c_str(), &image_width, &image_height, &n, bytes_per_pixel);
-        if (fdata == nullptr) return false;
+        bdata = stbi_load(filename.c_str(), &image_width, &image_height, &n, bytes_per_pixel);
+        if (bdata == nullptr) return false;
 
         bytes_per_scanline = image_width * bytes_per_pixel;
-        convert_to_bytes();
+        convert_to_linear();
         return true;
     }
 
-    int width()  const { return (fdata == nullptr) ? 0 : image_width; }
-    int height() const { return (fdata == nullptr) ? 0 : image_height; }
+    int width()  const { return (bdata == nullptr) ? 0 : image_width; }
+    int height() const { return (bdata == nullptr) ? 0 : image_height; }
 
     const unsigned char* pixel_data(int x, int y) const {
         // Return the address of the three RGB bytes of the pixel at x,y. If there is no image
@@ -86,7 +99,6 @@ class rtw_image {
 
   private:
     const int      bytes_per_pixel = 3;
-    float         *fdata = nullptr;         // Linear floating point pixel data
     unsigned char *bdata = nullptr;         // Linear 8-bit pixel data
     int            image_width = 0;         // Loaded image width
     int            image_height = 0;        // Loaded image height
@@ -99,6 +111,11 @@ class rtw_image {
         return high - 1;
     }
 
+    static bool readable(const std::string& filename) {
+        int width, height;
+        return info(filename, width, height);
+    }
+
     static unsigned char float_to_byte(float value) {
         if (value <= 0.0)
             return 0;
@@ -107,20 +124,21 @@ class rtw_image {
         return static_cast<unsigned char>(256.0 * value);
     }
 
-    void convert_to_bytes() {
-        // Convert the linear floating point pixel data to bytes, storing the resulting byte
-        // data in the `bdata` member.
+    void convert_to_linear() {
+        // Convert the gamma encoded bytes to linear ones in place, through the same curve
+        // stbi_loadf applies, so there is never a floating point copy of the image.
 
+        static const std::vector<unsigned char> linear = linear_table();
         int total_bytes = image_width * image_height * bytes_per_pixel;
-        bdata = new unsigned char[total_bytes];
-
-        // Iterate through all pixel components, converting from [0.0, 1.0] float values to
-        // unsigned [0, 255] byte values.
+        for (auto i=0; i < total_bytes; i++)
+            bdata[i] = linear[bdata[i]];
+    }
 
-        auto *bptr = bdata;
-        auto *fptr = fdata;
-        for (auto i=0; i < total_bytes; i++, fptr++, bptr++)
-            *bptr = float_to_byte(*fptr);
+    static std::vector<unsigned char> linear_table() {
+        std::vector<unsigned char> table(256);
+        for (int i = 0; i < 256; i++)
+            table[i] = float_to_byte(std::pow(i / 255.0f, 2.2f));
+        return table;
     }
 };
 
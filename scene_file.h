@@ -0,0 +1,883 @@
+/**
+ * Casey Gehling
+ *
+ * Defines scene files, scenes described as data instead of built by code, so a new shot doesn't need a recompile.
+ * A file is read into statements of tokens, each a word or a number, from either of two forms:
+ *   text (.scene), a statement a line, "#" starting a comment, quotes around words with spaces in them
+ *   binary (.rscene), the same statements with the words in a table and the numbers stored as their decimal
+ *                     digits and exponent when that is short, so they come out as they would from the text
+ * and then built into a camera and a world. Assets named more than once (an image by several textures, a mesh by
+ * several statements with the same material) are loaded once, and distinct ones are loaded in parallel: images
+ * first, then meshes. The top level objects go straight into one bvh_node, plain spheres gathered into a sphere_set
+ * first when there are many of them.
+ *
+ * Statements, where a color, point or vector is three numbers and <texture>, <material> and <object> are names given
+ * by earlier statements:
+ *   camera <setting> <value>...   any of aspect_ratio, width, spp, max_depth, vfov, lookfrom, lookat, vup,
+ *                                 defocus_angle, focus_dist and background. width, spp and max_depth are at
+ *                                 least 1, aspect_ratio is positive and vfov between 0 and 180.
+ *   texture <name> image <path>
+ *   texture <name> solid <color>
+ *   texture <name> checker <scale> <color or texture> <color or texture>
+ *   texture <name> noise <scale>
+ *   material <name> lambertian|light|isotropic <color or texture>
+ *   material <name> metal <color or texture> <fuzz>
+ *   material <name> dielectric <refraction index>
+ *   environment <texture>                                  an equirectangular map
+ *   environment <left> <right> <front> <back> <top> <bottom>  a cube map
+ *   sphere <center> [<center at time 1>] <radius> <material>
+ *   quad|tri <corner> <u> <v> <material>
+ *   box <corner> <opposite corner> <material>
+ *   mesh <path> <material>
+ *   cloud <resolution> <frequency> <threshold> <corner> <opposite corner> <density> <color or texture>
+ *   object <name> <any of the six above>                   named, for instances, but not added itself
+ *   instance <object> [rotate_y <degrees>] [translate <offset>]...
+ *   medium <object> <density> <color or texture> [rotate_y <degrees>] [translate <offset>]...
+ * Transforms apply in the order written. Numbers may be written as fractions, such as 16/9.
+ */
+
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "constants.h"
+#include "camera.h"
+#include "material.h"
+#include "sphere.h"
+#include "sphere_set.h"
+#include "hittable_list.h"
+#include "bvh.h"
+#include "quad.h"
+#include "box.h"
+#include "constant_medium.h"
+#include "grid_medium.h"
+#include "tri.h"
+#include "mesh_loader.h"
+
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <unordered_map>
+
+// A word (an index into the file's words) or a number
+struct scene_token {
+    bool is_number;
+    uint32_t word;
+    double number;
+};
+
+// Where the time building a scene went
+struct scene_load_stats {
+    double asset_seconds = 0; // loading images and meshes
+    double build_seconds = 0; // everything else, the top level BVH included
+    size_t images = 0, meshes = 0; // distinct ones loaded
+    size_t objects = 0; // under the top level BVH
+};
+
+class scene_file {
+    public:
+        int num_threads = 0; // loading assets, 0 uses one per hardware thread
+        size_t sphere_set_minimum = 64; // top level spheres gathered into a sphere_set when there are this many
+
+        // Read the file at path, binary if it starts like one and text otherwise. False if it can't be read or parsed.
+        bool read(const std::string& path) {
+            mapped_file file;
+            if (!file.open(path)) {
+                std::cerr << "ERROR: Could not read scene file '" << path << "'." << std::endl;
+                return false;
+            }
+            source = path;
+            if (file.size() >= 4 && std::memcmp(file.data(), binary_magic(), 4) == 0) {
+                return read_binary(file.data(), file.size());
+            }
+            return parse(file.data(), file.size());
+        }
+
+        // Parse the text form
+        bool parse(const char* text, size_t size) {
+            clear();
+            std::unordered_map<std::string, uint32_t> word_index;
+            const char* p = text;
+            const char* const end = text + size;
+            uint32_t line = 0;
+            while (p < end) {
+                line++;
+                const char* const line_end = obj_parse::line_end(p, end);
+                const uint32_t first = uint32_t(tokens.size());
+                while (true) {
+                    p = obj_parse::skip_space(p, line_end);
+                    if (p == line_end || *p == '#') break;
+
+                    scene_token token;
+                    token.is_number = is_digit(*p) || ((*p == '-' || *p == '+' || *p == '.') && p + 1 < line_end
+                        && (is_digit(p[1]) || (p[1] == '.' && p + 2 < line_end && is_digit(p[2]))));
+                    token.word = 0;
+                    token.number = 0;
+                    if (token.is_number) {
+                        double denominator;
+                        bool ok = obj_parse::parse_double(p, line_end, token.number);
+                        if (ok && p < line_end && *p == '/') {
+                            p++;
+                            ok = obj_parse::parse_double(p, line_end, denominator) && denominator != 0;
+                            if (ok) token.number /= denominator;
+                        }
+                        if (!ok || (p < line_end && !obj_parse::is_space(*p) && *p != '#')) {
+                            return parse_error(line, "bad number");
+                        }
+                    } else {
+                        const bool quoted = *p == '"';
+                        const char* start = quoted ? ++p : p;
+                        if (quoted) {
+                            while (p < line_end && *p != '"') p++;
+                            if (p == line_end) return parse_error(line, "unterminated quote");
+                        } else {
+                            while (p < line_end && !obj_parse::is_space(*p) && *p != '#') p++;
+                        }
+                        auto found = word_index.emplace(std::string(start, p), uint32_t(words.size()));
+                        if (found.second) words.push_back(found.first->first);
+                        token.word = found.first->second;
+                        if (quoted) p++;
+                    }
+                    tokens.push_back(token);
+                }
+                if (tokens.size() > first) {
+                    if (tokens[first].is_number) return parse_error(line, "statement starts with a number");
+                    starts.push_back(first);
+                    lines.push_back(line);
+                }
+                p = (line_end < end) ? line_end + 1 : end;
+            }
+            starts.push_back(uint32_t(tokens.size()));
+            return true;
+        }
+
+        // Write the statements out, in binary if path ends in .rscene and as text otherwise
+        bool write(const std::string& path) const {
+            const std::string extension = ".rscene";
+            const bool binary = path.size() >= extension.size()
+                && path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+            std::ofstream out(path, std::ios::binary);
+            if (!out || !(binary ? write_binary(out) : write_text(out)) || !out.flush()) {
+                std::cerr << "ERROR: Could not write scene file '" << path << "'." << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        size_t statement_count() const { return starts.empty() ? 0 : starts.size() - 1; }
+
+        // Set cam up and fill world as the statements describe. False, having said why, if they don't make sense or
+        // an asset can't be loaded.
+        bool build(camera& cam, hittable_list& world, scene_load_stats* stats = nullptr) const {
+            scene_builder builder(*this, cam);
+            const bool built = builder.build(world);
+            if (!built) std::cerr << "ERROR: " << builder.error << std::endl;
+            if (stats) *stats = builder.stats;
+            return built;
+        }
+
+    private:
+        static const char* binary_magic() { return "RSCN"; }
+        static const uint32_t binary_version = 1;
+
+        std::string source; // path, for messages
+        std::vector<std::string> words;
+        std::vector<scene_token> tokens;
+        std::vector<uint32_t> starts; // first token of each statement, then the token count
+        std::vector<uint32_t> lines; // of each statement in the text, 0 when read from binary
+
+        static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+        void clear() {
+            words.clear();
+            tokens.clear();
+            starts.clear();
+            lines.clear();
+        }
+
+        bool parse_error(uint32_t line, const char* message) {
+            std::cerr << "ERROR: " << source << ":" << line << ": " << message << std::endl;
+            clear();
+            return false;
+        }
+
+        static double read_number(const char* text) {
+            double value = 0;
+            obj_parse::parse_double(text, text + std::strlen(text), value);
+            return value;
+        }
+
+        // Shortest form that parse reads back the same
+        static std::string format_number(double value) {
+            char text[32];
+            for (int precision = 6; precision <= 17; precision++) {
+                snprintf(text, sizeof(text), "%.*g", precision, value);
+                if (read_number(text) == value) break;
+            }
+            return text;
+        }
+
+        // value as decimal digits and a power of ten that give it back exactly, if there are few enough digits
+        static bool decimal_form(double value, int32_t& mantissa, int8_t& exponent) {
+            const std::string text = format_number(value);
+            const char* p = text.c_str();
+            bool negative;
+            uint64_t digits;
+            int power;
+            if (!obj_parse::parse_decimal(p, p + text.size(), negative, digits, power) || digits > INT32_MAX
+                || power < INT8_MIN || power > INT8_MAX) {
+                return false;
+            }
+            const double back = negative ? -obj_parse::scale_decimal(digits, power) : obj_parse::scale_decimal(digits, power);
+            if (std::memcmp(&back, &value, sizeof(double)) != 0) return false;
+            mantissa = negative ? -int32_t(digits) : int32_t(digits);
+            exponent = int8_t(power);
+            return true;
+        }
+
+        bool write_text(std::ostream& out) const {
+            for (size_t s = 0; s < statement_count(); s++) {
+                for (uint32_t t = starts[s]; t < starts[s + 1]; t++) {
+                    if (t > starts[s]) out << ' ';
+                    const scene_token& token = tokens[t];
+                    if (token.is_number) {
+                        out << format_number(token.number);
+                        continue;
+                    }
+                    const std::string& word = words[token.word];
+                    const bool quote = word.empty() || word.find_first_of(" \t#") != std::string::npos
+                        || std::strchr("0123456789-+.", word[0]);
+                    if (quote) out << '"' << word << '"';
+                    else out << word;
+                }
+                out << '\n';
+            }
+            return bool(out);
+        }
+
+        // Binary layout, in the machine's byte order: magic, version, then the counts of words, statements,
+        // tokens, decimal numbers and double numbers (u32 each); each word as a u32 length and its bytes; each
+        // statement's token count (u16); each token's kind (u8: word, decimal or double); the word tokens' indices
+        // (u32); the decimal numbers' digits (i32) and then their powers of ten (i8); the rest of the numbers (f64).
+        enum token_kind : uint8_t { word_token, decimal_token, double_token };
+
+        bool write_binary(std::ostream& out) const {
+            std::vector<uint16_t> counts;
+            std::vector<uint8_t> kinds;
+            std::vector<uint32_t> word_refs;
+            std::vector<int32_t> mantissas;
+            std::vector<int8_t> exponents;
+            std::vector<double> doubles;
+            for (size_t s = 0; s < statement_count(); s++) {
+                if (starts[s + 1] - starts[s] > UINT16_MAX) return false;
+                counts.push_back(uint16_t(starts[s + 1] - starts[s]));
+            }
+            int32_t mantissa;
+            int8_t exponent;
+            for (const scene_token& token : tokens) {
+                if (!token.is_number) {
+                    kinds.push_back(word_token);
+                    word_refs.push_back(token.word);
+                } else if (decimal_form(token.number, mantissa, exponent)) {
+                    kinds.push_back(decimal_token);
+                    mantissas.push_back(mantissa);
+                    exponents.push_back(exponent);
+                } else {
+                    kinds.push_back(double_token);
+                    doubles.push_back(token.number);
+                }
+            }
+
+            const uint32_t header[] = { binary_version, uint32_t(words.size()), uint32_t(counts.size()),
+                uint32_t(tokens.size()), uint32_t(mantissas.size()), uint32_t(doubles.size()) };
+            out.write(binary_magic(), 4);
+            out.write(reinterpret_cast<const char*>(header), sizeof(header));
+            for (const std::string& word : words) {
+                const uint32_t length = uint32_t(word.size());
+                out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+                out.write(word.data(), length);
+            }
+            out.write(reinterpret_cast<const char*>(counts.data()), counts.size() * sizeof(uint16_t));
+            out.write(reinterpret_cast<const char*>(kinds.data()), kinds.size());
+            out.write(reinterpret_cast<const char*>(word_refs.data()), word_refs.size() * sizeof(uint32_t));
+            out.write(reinterpret_cast<const char*>(mantissas.data()), mantissas.size() * sizeof(int32_t));
+            out.write(reinterpret_cast<const char*>(exponents.data()), exponents.size());
+            out.write(reinterpret_cast<const char*>(doubles.data()), doubles.size() * sizeof(double));
+            return bool(out);
+        }
+
+        bool read_binary(const char* data, size_t size) {
+            clear();
+            size_t at = 4;
+            auto take = [&](void* to, size_t count) {
+                if (count > size - at) return false;
+                if (count > 0) std::memcpy(to, data + at, count);
+                at += count;
+                return true;
+            };
+            uint32_t header[6];
+            if (!take(header, sizeof(header)) || header[0] != binary_version) return binary_error();
+            const uint32_t word_count = header[1], statements = header[2], token_count = header[3];
+            const uint32_t decimal_count = header[4], double_count = header[5];
+            if (uint64_t(decimal_count) + double_count > token_count) return binary_error();
+            const uint64_t word_tokens = token_count - decimal_count - double_count;
+            if (4 * uint64_t(word_count) + 2 * uint64_t(statements) + token_count + 4 * word_tokens
+                + 5 * uint64_t(decimal_count) + 8 * uint64_t(double_count) > size - at) {
+                return binary_error();
+            }
+
+            words.reserve(word_count);
+            for (uint32_t w = 0; w < word_count; w++) {
+                uint32_t length;
+                if (!take(&length, sizeof(length)) || length > size - at) return binary_error();
+                words.push_back(std::string(data + at, length));
+                at += length;
+            }
+
+            std::vector<uint16_t> counts(statements);
+            std::vector<uint8_t> kinds(token_count);
+            std::vector<uint32_t> word_refs(word_tokens);
+            std::vector<int32_t> mantissas(decimal_count);
+            std::vector<int8_t> exponents(decimal_count);
+            std::vector<double> doubles(double_count);
+            if (!take(counts.data(), counts.size() * sizeof(uint16_t)) || !take(kinds.data(), kinds.size())
+                || !take(word_refs.data(), word_refs.size() * sizeof(uint32_t))
+                || !take(mantissas.data(), mantissas.size() * sizeof(int32_t)) || !take(exponents.data(), exponents.size())
+                || !take(doubles.data(), doubles.size() * sizeof(double))) {
+                return binary_error();
+            }
+
+            tokens.resize(token_count);
+            size_t next_word = 0, next_decimal = 0, next_double = 0;
+            for (uint32_t t = 0; t < token_count; t++) {
+                scene_token& token = tokens[t];
+                token.is_number = kinds[t] != word_token;
+                token.word = 0;
+                token.number = 0;
+                if (kinds[t] == word_token && next_word < word_refs.size() && word_refs[next_word] < word_count) {
+                    token.word = word_refs[next_word++];
+                } else if (kinds[t] == decimal_token && next_decimal < mantissas.size()) {
+                    const int32_t digits = mantissas[next_decimal];
+                    const double v = obj_parse::scale_decimal(uint64_t(digits < 0 ? -int64_t(digits) : digits), exponents[next_decimal++]);
+                    token.number = digits < 0 ? -v : v;
+                } else if (kinds[t] == double_token && next_double < doubles.size()) {
+                    token.number = doubles[next_double++];
+                } else {
+                    return binary_error();
+                }
+            }
+
+            uint32_t first = 0;
+            for (uint16_t count : counts) {
+                if (count == 0 || count > token_count - first || tokens[first].is_number) return binary_error();
+                starts.push_back(first);
+                first += count;
+            }
+            if (first != token_count) return binary_error();
+            starts.push_back(first);
+            lines.assign(statements, 0);
+            return true;
+        }
+
+        bool binary_error() {
+            std::cerr << "ERROR: Scene file '" << source << "' is damaged." << std::endl;
+            clear();
+            return false;
+        }
+
+        // Call work(i) for i below count, spread over num_threads threads
+        template <typename F>
+        static void for_each_index(size_t count, int num_threads, F work) {
+            size_t thread_count = (num_threads > 0) ? size_t(num_threads) : std::max(1u, std::thread::hardware_concurrency());
+            thread_count = std::min(thread_count, count);
+            std::atomic<size_t> next(0);
+            auto run = [&]() {
+                for (size_t i; (i = next++) < count; ) work(i);
+            };
+            std::vector<std::thread> threads;
+            for (size_t t = 1; t < thread_count; t++) threads.emplace_back(run);
+            run();
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        }
+
+        // Builds one scene from the statements, reading them a token at a time
+        class scene_builder {
+            public:
+                std::string error;
+                scene_load_stats stats;
+
+                scene_builder(const scene_file& file, camera& cam)
+                    : file(file), cam(cam), textures(file.words.size()), materials(file.words.size()),
+                      objects(file.words.size()), images(file.words.size()) {}
+
+                bool build(hittable_list& world) {
+                    auto start = profile_clock::now();
+                    if (!load_images()) return false;
+                    stats.asset_seconds += seconds_since(start);
+
+                    // Camera, textures and materials, in file order
+                    start = profile_clock::now();
+                    for (size_t s = 0; s < file.statement_count(); s++) {
+                        begin(s);
+                        const std::string& keyword = word_text(next_word());
+                        if (keyword == "camera") {
+                            if (!camera_settings()) return false;
+                        } else if (keyword == "texture") {
+                            if (!texture_statement()) return false;
+                        } else if (keyword == "material") {
+                            if (!material_statement()) return false;
+                        } else if (keyword == "environment") {
+                            if (!environment_statement()) return false;
+                        } else if (!is_shape(keyword) && keyword != "object" && keyword != "instance" && keyword != "medium") {
+                            return fail("unknown statement '" + keyword + "'");
+                        }
+                    }
+                    double build_seconds = seconds_since(start);
+
+                    start = profile_clock::now();
+                    if (!load_meshes()) return false;
+                    stats.asset_seconds += seconds_since(start);
+
+                    // Shapes, in file order
+                    start = profile_clock::now();
+                    std::vector<shared_ptr<hittable> > top;
+                    for (size_t s = 0; s < file.statement_count(); s++) {
+                        begin(s);
+                        const std::string& keyword = word_text(next_word());
+                        shared_ptr<hittable> object;
+                        if (is_shape(keyword)) {
+                            if (!shape(keyword, object, true)) return false;
+                        } else if (keyword == "object") {
+                            uint32_t name, kind;
+                            if (!word(name) || !word(kind) || !shape(word_text(kind), objects[name], false) || !finished()) {
+                                return false;
+                            }
+                            continue;
+                        } else if (keyword == "instance") {
+                            if (!instance(object)) return false;
+                        } else if (keyword == "medium") {
+                            if (!medium(object)) return false;
+                        } else {
+                            continue;
+                        }
+                        if (!finished()) return false;
+                        if (object) top.push_back(object);
+                    }
+
+                    if (spheres.size() >= file.sphere_set_minimum) {
+                        auto set = make_shared<sphere_set>();
+                        for (const sphere_entry& entry : spheres) {
+                            set->add(entry.center1, entry.center2, entry.radius, entry.mat);
+                        }
+                        set->build();
+                        top.push_back(set);
+                    } else {
+                        for (const sphere_entry& entry : spheres) {
+                            top.push_back(!entry.moving
+                                ? make_shared<sphere>(entry.center1, entry.radius, entry.mat)
+                                : make_shared<sphere>(entry.center1, entry.center2, entry.radius, entry.mat));
+                        }
+                    }
+
+                    world.clear();
+                    stats.objects = top.size();
+                    if (top.size() > 1) world.add(make_shared<bvh_node>(top, 0, top.size()));
+                    else if (!top.empty()) world.add(top[0]);
+                    stats.build_seconds = build_seconds + seconds_since(start);
+                    return true;
+                }
+
+            private:
+                struct sphere_entry {
+                    point3 center1, center2;
+                    bool moving;
+                    double radius;
+                    shared_ptr<material> mat;
+                };
+
+                const scene_file& file;
+                camera& cam;
+                // By the index of their name among the file's words
+                std::vector<shared_ptr<texture> > textures;
+                std::vector<shared_ptr<material> > materials;
+                std::vector<shared_ptr<hittable> > objects;
+                std::vector<shared_ptr<texture> > images; // by path
+                std::map<std::pair<uint32_t, uint32_t>, shared_ptr<triangle_mesh> > meshes; // by path and material, sharing geometry by path
+                std::vector<sphere_entry> spheres; // top level, to go in the world together
+
+                static const uint32_t no_word = UINT32_MAX;
+
+                size_t statement = 0;
+                uint32_t at = 0, end = 0; // tokens of the statement left to read
+
+                static double seconds_since(profile_clock::time_point start) {
+                    return std::chrono::duration<double>(profile_clock::now() - start).count();
+                }
+
+                static bool is_shape(const std::string& keyword) {
+                    return keyword == "sphere" || keyword == "quad" || keyword == "tri" || keyword == "box"
+                        || keyword == "mesh" || keyword == "cloud";
+                }
+
+                void begin(size_t s) {
+                    statement = s;
+                    at = file.starts[s];
+                    end = file.starts[s + 1];
+                }
+
+                bool fail(const std::string& message) {
+                    if (error.empty()) {
+                        std::ostringstream where;
+                        where << file.source << ":";
+                        if (file.lines[statement] > 0) where << file.lines[statement];
+                        else where << "statement " << statement + 1;
+                        error = where.str() + ": " + message;
+                    }
+                    return false;
+                }
+
+                const std::string& word_text(uint32_t word) const { return file.words[word]; }
+
+                // Next token's word, or no_word past the end or at a number
+                uint32_t next_word() {
+                    if (at < end && !file.tokens[at].is_number) return file.tokens[at++].word;
+                    return no_word;
+                }
+
+                // Next token's word as text, empty past the end or at a number
+                std::string next_text() {
+                    const uint32_t w = next_word();
+                    return (w == no_word) ? std::string() : word_text(w);
+                }
+
+                bool next_is_number() const { return at < end && file.tokens[at].is_number; }
+
+                bool word(uint32_t& w) {
+                    if (at >= end || file.tokens[at].is_number) return fail("expected a name");
+                    w = file.tokens[at++].word;
+                    return true;
+                }
+
+                bool number(double& n) {
+                    if (!next_is_number()) return fail("expected a number");
+                    n = file.tokens[at++].number;
+                    return true;
+                }
+
+                bool vector(vec3& v) {
+                    double x = 0, y = 0, z = 0;
+                    if (!number(x) || !number(y) || !number(z)) return false;
+                    v = vec3(x, y, z);
+                    return true;
+                }
+
+                bool finished() {
+                    return at == end || fail("unexpected '" + token_text(at) + "'");
+                }
+
+                std::string token_text(uint32_t t) const {
+                    const scene_token& token = file.tokens[t];
+                    return token.is_number ? format_number(token.number) : word_text(token.word);
+                }
+
+                bool named(std::vector<shared_ptr<texture> >& table, const char* kind, shared_ptr<texture>& out) {
+                    uint32_t name = 0;
+                    if (!word(name)) return false;
+                    out = table[name];
+                    return out || fail(std::string("no ") + kind + " named '" + word_text(name) + "'");
+                }
+
+                bool color_or_texture(shared_ptr<texture>& out) {
+                    if (!next_is_number()) return named(textures, "texture", out);
+                    vec3 albedo;
+                    if (!vector(albedo)) return false;
+                    out = make_shared<solid_color>(albedo);
+                    return true;
+                }
+
+                bool material_named(shared_ptr<material>& out) {
+                    uint32_t name = 0;
+                    if (!word(name)) return false;
+                    out = materials[name];
+                    return out || fail("no material named '" + word_text(name) + "'");
+                }
+
+                bool camera_settings() {
+                    while (at < end) {
+                        const std::string setting = next_text();
+                        if (setting == "lookfrom" || setting == "lookat" || setting == "vup" || setting == "background") {
+                            vec3 v;
+                            if (!vector(v)) return false;
+                            if (setting == "lookfrom") cam.lookfrom = v;
+                            else if (setting == "lookat") cam.lookat = v;
+                            else if (setting == "vup") cam.vup = v;
+                            else cam.background = v;
+                            continue;
+                        }
+                        double n;
+                        if (setting.empty() || !number(n)) return fail("expected a camera setting and its value");
+                        const bool count = setting == "width" || setting == "spp" || setting == "max_depth";
+                        if (count && !(n >= 1)) return fail("camera " + setting + " must be at least 1");
+                        if (count && !(n <= INT_MAX)) return fail("camera " + setting + " is too large");
+                        if (setting == "aspect_ratio") {
+                            if (!(n > 0)) return fail("camera aspect_ratio must be positive");
+                            cam.aspect_ratio = n;
+                        } else if (setting == "width") {
+                            cam.image_width = int(n);
+                        } else if (setting == "spp") {
+                            cam.samples_per_pixel = int(n);
+                        } else if (setting == "max_depth") {
+                            cam.max_depth = int(n);
+                        } else if (setting == "vfov") {
+                            if (!(n > 0 && n < 180)) return fail("camera vfov must be between 0 and 180 degrees");
+                            cam.vfov = n;
+                        } else if (setting == "defocus_angle") {
+                            cam.defocus_angle = n;
+                        } else if (setting == "focus_dist") {
+                            cam.focus_dist = n;
+                        } else {
+                            return fail("unknown camera setting '" + setting + "'");
+                        }
+                    }
+                    if (!(cam.image_width / cam.aspect_ratio <= INT_MAX)) return fail("camera image too tall for its width and aspect_ratio");
+                    return true;
+                }
+
+                bool texture_statement() {
+                    uint32_t name;
+                    if (!word(name)) return false;
+                    const std::string type = next_text();
+                    shared_ptr<texture>& out = textures[name];
+                    double scale;
+                    if (type == "image") {
+                        uint32_t path;
+                        if (!word(path)) return false;
+                        out = images[path];
+                    } else if (type == "solid") {
+                        vec3 albedo;
+                        if (!vector(albedo)) return false;
+                        out = make_shared<solid_color>(albedo);
+                    } else if (type == "checker") {
+                        shared_ptr<texture> even, odd;
+                        if (!number(scale) || !color_or_texture(even) || !color_or_texture(odd)) return false;
+                        out = make_shared<checker_texture>(scale, even, odd);
+                    } else if (type == "noise") {
+                        if (!number(scale)) return false;
+                        out = make_shared<noise_texture>(scale);
+                    } else {
+                        return fail("unknown texture type '" + type + "'");
+                    }
+                    return finished();
+                }
+
+                bool material_statement() {
+                    uint32_t name;
+                    if (!word(name)) return false;
+                    const std::string type = next_text();
+                    shared_ptr<material>& out = materials[name];
+                    shared_ptr<texture> tex;
+                    double n;
+                    if (type == "lambertian") {
+                        if (!color_or_texture(tex)) return false;
+                        out = make_shared<lambertian>(tex);
+                    } else if (type == "light") {
+                        if (!color_or_texture(tex)) return false;
+                        out = make_shared<diffuse_light>(tex);
+                    } else if (type == "isotropic") {
+                        if (!color_or_texture(tex)) return false;
+                        out = make_shared<isotropic>(tex);
+                    } else if (type == "metal") {
+                        if (!color_or_texture(tex) || !number(n)) return false;
+                        out = make_shared<metal>(tex, n);
+                    } else if (type == "dielectric") {
+                        if (!number(n)) return false;
+                        out = make_shared<dielectric>(n);
+                    } else {
+                        return fail("unknown material type '" + type + "'");
+                    }
+                    return finished();
+                }
+
+                bool environment_statement() {
+                    shared_ptr<texture> faces[6];
+                    int count = 0;
+                    while (at < end && count < 6) {
+                        if (!named(textures, "texture", faces[count++])) return false;
+                    }
+                    if (count == 1) cam.environment = make_shared<environment_light>(faces[0]);
+                    else if (count == 6) cam.environment = make_shared<environment_light>(faces[0], faces[1], faces[2], faces[3], faces[4], faces[5]);
+                    else return fail("environment takes one texture or six");
+                    return finished();
+                }
+
+                // Shape whose keyword has been read. Top level plain spheres are kept to go in the world together,
+                // leaving object empty.
+                bool shape(const std::string& keyword, shared_ptr<hittable>& object, bool top_level) {
+                    point3 a, b;
+                    vec3 u, v;
+                    double n;
+                    shared_ptr<material> mat;
+                    if (keyword == "sphere") {
+                        double numbers[7];
+                        int count = 0;
+                        while (next_is_number() && count < 7) number(numbers[count++]);
+                        if (count != 4 && count != 7) {
+                            return fail("sphere takes a center, an optional second center, a radius and a material");
+                        }
+                        if (!material_named(mat)) return false;
+                        sphere_entry entry;
+                        entry.center1 = point3(numbers[0], numbers[1], numbers[2]);
+                        entry.moving = count == 7;
+                        entry.center2 = entry.moving ? point3(numbers[3], numbers[4], numbers[5]) : entry.center1;
+                        entry.radius = numbers[count - 1];
+                        entry.mat = mat;
+                        if (top_level) spheres.push_back(entry);
+                        else if (count == 4) object = make_shared<sphere>(entry.center1, entry.radius, mat);
+                        else object = make_shared<sphere>(entry.center1, entry.center2, entry.radius, mat);
+                    } else if (keyword == "quad" || keyword == "tri") {
+                        if (!vector(a) || !vector(u) || !vector(v) || !material_named(mat)) return false;
+                        if (keyword == "quad") object = make_shared<quad>(a, u, v, mat);
+                        else object = make_shared<tri>(a, u, v, mat);
+                    } else if (keyword == "box") {
+                        if (!vector(a) || !vector(b) || !material_named(mat)) return false;
+                        object = box(a, b, mat);
+                    } else if (keyword == "mesh") {
+                        uint32_t path, material_name;
+                        if (!word(path) || !word(material_name)) return false;
+                        object = meshes[std::make_pair(path, material_name)];
+                    } else if (keyword == "cloud") {
+                        double resolution, frequency, threshold;
+                        shared_ptr<texture> tex;
+                        if (!number(resolution) || !number(frequency) || !number(threshold) || !vector(a) || !vector(b)
+                            || !number(n) || !color_or_texture(tex)) {
+                            return false;
+                        }
+                        if (resolution < 2) return fail("cloud resolution must be at least 2");
+                        object = make_shared<grid_medium>(density_grid::perlin_cloud(int(resolution), frequency, threshold), a, b, n, tex);
+                    } else {
+                        return fail("unknown shape '" + keyword + "'");
+                    }
+                    return true;
+                }
+
+                // Rotations and translations of object, in the order given
+                bool transforms(shared_ptr<hittable>& object) {
+                    while (at < end) {
+                        const std::string type = next_text();
+                        double degrees = 0;
+                        vec3 offset;
+                        if (type == "rotate_y") {
+                            if (!number(degrees)) return false;
+                            object = make_shared<rotate_y>(object, degrees);
+                        } else if (type == "translate") {
+                            if (!vector(offset)) return false;
+                            object = make_shared<translate>(object, offset);
+                        } else {
+                            return fail("expected rotate_y or translate");
+                        }
+                    }
+                    return true;
+                }
+
+                bool object_named(shared_ptr<hittable>& out) {
+                    uint32_t name = 0;
+                    if (!word(name)) return false;
+                    out = objects[name];
+                    return out || fail("no object named '" + word_text(name) + "'");
+                }
+
+                bool instance(shared_ptr<hittable>& object) {
+                    return object_named(object) && transforms(object);
+                }
+
+                bool medium(shared_ptr<hittable>& object) {
+                    double density;
+                    shared_ptr<texture> tex;
+                    if (!object_named(object) || !number(density) || !color_or_texture(tex) || !transforms(object)) {
+                        return false;
+                    }
+                    if (density <= 0) return fail("medium density must be positive");
+                    object = make_shared<constant_medium>(object, density, tex);
+                    return true;
+                }
+
+                // Every image path named, each opened once
+                bool load_images() {
+                    std::vector<uint32_t> paths;
+                    std::vector<bool> named(file.words.size());
+                    for (size_t s = 0; s < file.statement_count(); s++) {
+                        begin(s);
+                        if (next_text() != "texture" || !skip(1) || next_text() != "image") continue;
+                        uint32_t path;
+                        if (!word(path)) return false;
+                        if (!named[path]) {
+                            named[path] = true;
+                            paths.push_back(path);
+                        }
+                    }
+                    for_each_index(paths.size(), file.num_threads, [&](size_t i) {
+                        images[paths[i]] = make_shared<image_texture>(word_text(paths[i]).c_str());
+                    });
+                    stats.images = paths.size();
+                    return true;
+                }
+
+                // Every mesh named, each path loaded once with the material it is first named with. Other
+                // materials get a copy sharing its geometry.
+                bool load_meshes() {
+                    std::vector<std::pair<uint32_t, uint32_t> > keys, paths;
+                    std::map<uint32_t, size_t> path_index;
+                    for (size_t s = 0; s < file.statement_count(); s++) {
+                        begin(s);
+                        std::string keyword = next_text();
+                        if (keyword == "object" && skip(1)) keyword = next_text();
+                        if (keyword != "mesh") continue;
+                        uint32_t path, material_name;
+                        if (!word(path) || !word(material_name)) return false;
+                        if (!materials[material_name]) return fail("no material named '" + word_text(material_name) + "'");
+                        const auto key = std::make_pair(path, material_name);
+                        if (!meshes.emplace(key, nullptr).second) continue;
+                        keys.push_back(key);
+                        if (path_index.emplace(path, paths.size()).second) paths.push_back(key);
+                    }
+
+                    std::vector<shared_ptr<triangle_mesh> > loaded(paths.size());
+                    for_each_index(paths.size(), file.num_threads, [&](size_t i) {
+                        loaded[i] = open_mesh(word_text(paths[i].first), materials[paths[i].second]);
+                    });
+                    for (size_t i = 0; i < paths.size(); i++) {
+                        const std::string& path = word_text(paths[i].first);
+                        if (!loaded[i]) {
+                            error = file.source + ": could not load mesh '" + path + "'";
+                            return false;
+                        }
+                        std::clog << "Finished loading " << path << " (" << loaded[i]->triangles() << " triangles"
+                                  << (loaded[i]->bvh_from_cache() ? ", BVH from cache" : "") << ")" << std::endl;
+                    }
+                    for (const auto& key : keys) {
+                        const size_t i = path_index[key.first];
+                        meshes[key] = (key == paths[i]) ? loaded[i] : triangle_mesh::with_material(loaded[i], materials[key.second]);
+                    }
+                    stats.meshes = paths.size();
+                    return true;
+                }
+
+                bool skip(uint32_t count) {
+                    if (end - at < count) return false;
+                    at += count;
+                    return true;
+                }
+        };
+};
+
+// Read the scene file at path and build it into cam and world. False, having said why, if it can't be.
+inline bool load_scene_file(const std::string& path, camera& cam, hittable_list& world) {
+    scene_file file;
+    return file.read(path) && file.build(cam, world);
+}
+
+#endif
@@ -0,0 +1,618 @@
+/**
+ * Casey Gehling
+ * 
+ * Defines multiple scenes to be rendered. Each scene fills in the camera settings and returns the world.
+ */
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "constants.h"
+#include "camera.h"
+#include "material.h"
+#include "sphere.h"
+#include "sphere_set.h"
+#include "hittable_list.h"
+#include "bvh.h"
+#include <iostream>
+#include "quad.h"
+#include "box.h"
+#include "constant_medium.h"
+#include "grid_medium.h"
+#include "tri.h"
+#include "mesh_loader.h"
+#include "animation.h"
+
+
+hittable_list moon_scene(camera& cam) {
+    auto moon_texture = make_shared<image_texture>("textures/moon_texture.jpeg");
+    auto moon_surface = make_shared<lambertian>(moon_texture);
+    auto moon = make_shared<sphere>(point3(0,0,0), 2, moon_surface);
+
+    cam.aspect_ratio      = 16.0 / 9.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth         = 50;
+    cam.background = color(0, 0, 0);
+
+    cam.vfov     = 20;
+    cam.lookfrom = point3(0,0,12);
+    cam.lookat   = point3(0,0,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return hittable_list(moon);
+}
+
+hittable_list perlin_scene(camera& cam) {
+    hittable_list world;
+
+    auto pertext = make_shared<noise_texture>(4);
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(pertext)));
+    world.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<lambertian>(pertext)));
+
+    cam.aspect_ratio      = 16.0 / 9.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth         = 50;
+    cam.background = color(0.7, 0.5, 1.00);
+
+    cam.vfov     = 20;
+    cam.lookfrom = point3(13,2,3);
+    cam.lookat   = point3(0,0,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return world;
+}
+
+
+hittable_list quads_scene(camera& cam) {
+    hittable_list world;
+
+    // Materials
+    auto left_red     = make_shared<lambertian>(color(1.0, 0.2, 0.2));
+    auto back_green   = make_shared<lambertian>(color(0.2, 1.0, 0.2));
+    auto right_blue   = make_shared<lambertian>(color(0.2, 0.2, 1.0));
+    auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.0));
+    auto lower_teal   = make_shared<lambertian>(color(0.2, 0.8, 0.8));
+
+    // Quads
+    world.add(make_shared<quad>(point3(-3,-2, 5), vec3(0, 0,-4), vec3(0, 4, 0), left_red));
+    world.add(make_shared<quad>(point3(-2,-2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
+    world.add(make_shared<quad>(point3( 3,-2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
+    world.add(make_shared<quad>(point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
+    world.add(make_shared<quad>(point3(-2,-3, 5), vec3(4, 0, 0), vec3(0, 0,-4), lower_teal));
+
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth         = 50;
+    cam.background = color(0.7, 0.5, 1.00);
+
+    cam.vfov     = 80;
+    cam.lookfrom = point3(0,0,9);
+    cam.lookat   = point3(0,0,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return world;
+}
+
+hittable_list light_scene(camera& cam) {
+    hittable_list world;
+
+    auto pertext = make_shared<noise_texture>(4);
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(pertext)));
+    world.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<lambertian>(pertext)));
+
+    auto difflight = make_shared<diffuse_light>(color(4,4,4));
+    world.add(make_shared<quad>(point3(3,1,-2), vec3(2,0,0), vec3(0,2,0), difflight));
+    world.add(make_shared<sphere>(point3(0,7,0), 2, difflight));
+
+    cam.aspect_ratio      = 16.0 / 9.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth         = 50;
+    cam.background        = color(0,0,0);
+
+    cam.vfov     = 20;
+    cam.lookfrom = point3(26,3,6);
+    cam.lookat   = point3(0,2,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return world;
+}
+
+hittable_list cornell_smoke_scene(camera& cam) {
+    hittable_list world;
+
+    auto red   = make_shared<lambertian>(color(.65, .05, .05));
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    auto green = make_shared<lambertian>(color(.12, .45, .15));
+    auto light = make_shared<diffuse_light>(color(7, 7, 7));
+
+    world.add(make_shared<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
+    world.add(make_shared<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
+    world.add(make_shared<quad>(point3(113,554,127), vec3(330,0,0), vec3(0,0,305), light));
+    world.add(make_shared<quad>(point3(0,555,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(make_shared<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(make_shared<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
+
+    shared_ptr<hittable> box1 = box(point3(0,0,0), point3(165,330,165), white);
+    box1 = make_shared<rotate_y>(box1, 15);
+    box1 = make_shared<translate>(box1, vec3(265,0,295));
+
+    shared_ptr<hittable> box2 = box(point3(0,0,0), point3(165,165,165), white);
+    box2 = make_shared<rotate_y>(box2, -18);
+    box2 = make_shared<translate>(box2, vec3(130,0,65));
+
+    world.add(make_shared<constant_medium>(box1, 0.01, color(0,0,0)));
+    world.add(make_shared<constant_medium>(box2, 0.01, color(1,1,1)));
+
+    world = hittable_list(make_shared<bvh_node>(world));
+
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 200;
+    cam.max_depth         = 50;
+    cam.background        = color(0,0,0);
+
+    cam.vfov     = 40;
+    cam.lookfrom = point3(278, 278, -800);
+    cam.lookat   = point3(278, 278, 0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return world;
+}
+
+hittable_list diamond_block_scene(camera& cam) {
+    hittable_list world;
+
+    // Floor
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9)))));
+
+    // Diamond block
+    auto diamond_block_texture = make_shared<image_texture>("textures/diamond.jpg");
+    shared_ptr<hittable> diamond_block = box(point3(0,0,0), point3(2,2,2), make_shared<lambertian>(diamond_block_texture));
+    world.add(diamond_block);
+
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 400;
+    cam.max_depth         = 50;
+    cam.background        = color(0.70, 0.80, 1.00);
+
+    cam.vfov     = 20;
+    cam.lookfrom = point3(13,2,3);
+    cam.lookat   = point3(0,0,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return world;
+}
+
+hittable_list tri_test_scene(camera& cam) {
+    hittable_list world;
+
+
+    // Mats
+    auto red = make_shared<lambertian>(color(.65, .05, .05));
+    auto diamond_block_texture = make_shared<image_texture>("textures/diamond.jpg");
+
+    // Solid color triangle
+    world.add(make_shared<tri>(point3(-3,-2, 5), vec3(0, 0,-4), vec3(0, 4, 0), red));
+
+    // Textured triangle
+    world.add(make_shared<tri>(point3( 3,-2, 1), vec3(0, 0, 4), vec3(0, 4, 0), make_shared<lambertian>(diamond_block_texture)));
+
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth         = 50;
+    cam.background = color(0.7, 0.5, 1.00);
+
+    cam.vfov     = 80;
+    cam.lookfrom = point3(0,0,9);
+    cam.lookat   = point3(0,0,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return world;
+}
+
+hittable_list obj_test_scene(camera& cam) {
+    hittable_list world;
+
+    // Floor
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9)))));
+
+    // Mats
+    auto red = make_shared<metal>(color(.65, .05, .05), 0.5);
+
+    // Solid color triangle
+    world.add(load_mesh("models/sword.obj", red));
+
+    // skybox textures
+    auto left = make_shared<image_texture>("skybox/left.jpg");
+    auto right = make_shared<image_texture>("skybox/right.jpg");
+    auto top = make_shared<image_texture>("skybox/top.jpg");
+    auto bottom = make_shared<image_texture>("skybox/bottom.jpg");
+    auto front = make_shared<image_texture>("skybox/front.jpg");
+    auto back = make_shared<image_texture>("skybox/back.jpg");
+
+    cam.environment = make_shared<environment_light>(left,right,front,back,top,bottom);
+
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth         = 50;
+    cam.background = color(0.7, 0.5, 1.00);
+
+    cam.vfov     = 80;
+    cam.lookfrom = point3(0,5,10);
+    cam.lookat   = point3(0,0,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 3;
+
+    return world;
+}
+
+hittable_list skybox_test_scene(camera& cam) {
+    hittable_list world;
+
+    // skybox textures
+    auto left = make_shared<image_texture>("skybox/left.jpg");
+    auto right = make_shared<image_texture>("skybox/right.jpg");
+    auto top = make_shared<image_texture>("skybox/top.jpg");
+    auto bottom = make_shared<image_texture>("skybox/bottom.jpg");
+    auto front = make_shared<image_texture>("skybox/front.jpg");
+    auto back = make_shared<image_texture>("skybox/back.jpg");
+
+    cam.environment = make_shared<environment_light>(left,right,front,back,top,bottom);
+
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth         = 500;
+    cam.background = color(0.7, 0.5, 1.00);
+
+    cam.lookfrom = point3(0, 11, 10);  // Position inside the cube
+    cam.vfov = 90;             
+    cam.lookat   = point3(200,0,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return world;
+}
+
+hittable_list ray_intersection_scene(camera& cam) {
+    hittable_list world;
+    auto red = make_shared<lambertian>(color(.65, .05, .05));
+
+    world.add(make_shared<sphere>(point3(-2,0, 0), 3, make_shared<lambertian>(color(0.5,0.5,0.5))));
+    world.add(make_shared<tri>(point3(5,-2, 5), vec3(0, 0,-4), vec3(0, 4, 0), red));
+
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth         = 500;
+    cam.background = color(0.7, 0.5, 1.00);
+
+    cam.lookfrom = point3(0, 11, 10);  // Position inside the cube
+    cam.vfov = 90;             
+    cam.lookat   = point3(0,0,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return world;
+}
+
+hittable_list volume_scene(camera& cam) {
+    hittable_list world;
+
+    auto sphere_ob = make_shared<sphere>(point3(0,3, 0), 3, make_shared<lambertian>(color(0,0,0)));
+    world.add(make_shared<constant_medium>(sphere_ob, 0.5, color(0,0,0)));
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9)))));
+
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 200;
+    cam.max_depth         = 500;
+    cam.background = color(1, 1, 1.00);
+
+    cam.lookfrom = point3(0, 8, 6);  // Position inside the cube
+    cam.vfov = 90;             
+    cam.lookat   = point3(0,0,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return world;
+}
+
+hittable_list motion_blur_scene(camera& cam) {
+    hittable_list world;
+
+    auto sphere_ob = make_shared<sphere>(point3(0,3, 0), point3(0,0,0), 3, make_shared<lambertian>(color(0,0,0)));
+    world.add(sphere_ob);
+
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 200;
+    cam.max_depth         = 500;
+    cam.background = color(1, 1, 1.00);
+
+    cam.lookfrom = point3(0, 8, 6);  // Position inside the cube
+    cam.vfov = 90;             
+    cam.lookat   = point3(0,0,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return world;
+}
+
+hittable_list perlin_ball_scene(camera& cam) {
+    hittable_list world;
+
+    auto tex1 = make_shared<noise_texture>(0);
+    auto tex2 = make_shared<noise_texture>(4);
+    world.add(make_shared<sphere>(point3(-3.5,3, 0), 3, make_shared<lambertian>(tex1)));
+    world.add(make_shared<sphere>(point3(3.5,3, 0), 3, make_shared<lambertian>(tex2)));
+
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9)))));
+
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 200;
+    cam.max_depth         = 500;
+    cam.background = color(1, 1, 1.00);
+
+    cam.lookfrom = point3(0, 9, 7);  // Position inside the cube
+    cam.vfov = 90;             
+    cam.lookat   = point3(0,0,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return world;
+}
+
+hittable_list materials_scene(camera& cam) {
+    hittable_list world;
+    // auto sphere_ob = make_shared<sphere>(point3(0,3, 0), 3, make_shared<perlin>());
+    world.add(make_shared<sphere>(point3(-3,3, 0), 1, make_shared<lambertian>(color(0.5,1,0.5))));
+    world.add(make_shared<sphere>(point3(0,3, 0), 1, make_shared<metal>(color(1,0.5,0.5), 0.5)));
+    world.add(make_shared<sphere>(point3(3,3, 0), 1, make_shared<dielectric>(0.5)));
+    world.add(make_shared<sphere>(point3(-3,6, -1), 0.5, make_shared<diffuse_light>(color(7,7,7))));
+    world.add(make_shared<sphere>(point3(0,6, -1), 0.5, make_shared<diffuse_light>(color(7,7,7))));
+    world.add(make_shared<sphere>(point3(3,6, -1), 0.5, make_shared<diffuse_light>(color(7,7,7))));
+
+
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9)))));
+
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 200;
+    cam.max_depth         = 500;
+    cam.background = color(0.5, 0.5, 0.5);
+
+    cam.lookfrom = point3(0, 3, -5);  // Position inside the cube
+    cam.vfov = 90;             
+    cam.lookat   = point3(0,3,10);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return world;
+}
+
+// A million small spheres over a ground plane, as one sphere_set.
+hittable_list million_spheres_scene(camera& cam) {
+    hittable_list world;
+
+    std::vector<shared_ptr<material> > palette;
+    for (int i = 0; i < 8; i++) palette.push_back(make_shared<lambertian>(color::random(0.1, 0.9)));
+    palette.push_back(make_shared<metal>(color(0.8, 0.8, 0.9), 0.1));
+    palette.push_back(make_shared<dielectric>(1.5));
+
+    auto particles = make_shared<sphere_set>();
+    for (int i = 0; i < 1000000; i++) {
+        point3 center(random_double(-40, 40), random_double(0, 6), random_double(-40, 40));
+        particles->add(center, random_double(0.03, 0.12), palette[random_int(0, int(palette.size()) - 1)]);
+    }
+    particles->build();
+    std::clog << "Built " << particles->size() << " spheres, " << particles->bytes_per_sphere() << " bytes each" << std::endl;
+    world.add(particles);
+
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+
+    cam.aspect_ratio      = 16.0 / 9.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 32;
+    cam.max_depth         = 20;
+    cam.background = color(0.70, 0.80, 1.00);
+
+    cam.vfov     = 30;
+    cam.lookfrom = point3(0, 12, 48);
+    cam.lookat   = point3(0, 2, 0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return world;
+}
+
+// A cloud of baked perlin density over a ground plane, as a grid_medium.
+hittable_list cloud_scene(camera& cam) {
+    hittable_list world;
+
+    auto density = density_grid::perlin_cloud(64, 3, 0.15);
+    world.add(make_shared<grid_medium>(density, point3(-5,0.5,-5), point3(5,6.5,5), 40, color(0.9, 0.9, 0.9)));
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9)))));
+
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 200;
+    cam.max_depth         = 50;
+    cam.background = color(0.70, 0.80, 1.00);
+
+    cam.vfov     = 60;
+    cam.lookfrom = point3(0, 6, 13);
+    cam.lookat   = point3(0, 3, 0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return world;
+}
+
+// Thousands of small spheres each moving many times its own size during the shutter, in one sphere_set.
+hittable_list motion_swarm_scene(camera& cam) {
+    hittable_list world;
+
+    std::vector<shared_ptr<material> > palette;
+    for (int i = 0; i < 6; i++) palette.push_back(make_shared<lambertian>(color::random(0.2, 0.9)));
+    palette.push_back(make_shared<metal>(color(0.8, 0.8, 0.9), 0.2));
+
+    auto swarm = make_shared<sphere_set>();
+    for (int i = 0; i < 20000; i++) {
+        point3 start(random_double(-12, 12), random_double(0.5, 8), random_double(-12, 12));
+        vec3 velocity = random_double(1.5, 4) * random_unit_vector();
+        swarm->add(start, start + velocity, random_double(0.05, 0.15), palette[random_int(0, int(palette.size()) - 1)]);
+    }
+    swarm->build();
+    std::clog << "Built " << swarm->size() << " moving spheres, " << swarm->bytes_per_sphere() << " bytes each" << std::endl;
+    world.add(swarm);
+
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+
+    cam.aspect_ratio      = 16.0 / 9.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 32;
+    cam.max_depth         = 20;
+    cam.background = color(0.70, 0.80, 1.00);
+
+    cam.vfov     = 40;
+    cam.lookfrom = point3(0, 10, 30);
+    cam.lookat   = point3(0, 3, 0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return world;
+}
+
+// Spheres bouncing around the moon while a teapot slides past behind it and the camera pulls back, over 48 frames.
+void bouncing_animation(camera& cam, animation& anim) {
+    anim.first_frame = 0;
+    anim.last_frame = 47;
+
+    anim.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9)))));
+    anim.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<lambertian>(make_shared<image_texture>("textures/moon_texture.jpeg"))));
+
+    keyframe_track<vec3> slide;
+    slide.key(0, vec3(-10, 0, -6)).key(47, vec3(10, 0, -6));
+    anim.add(load_mesh("models/teapot.obj", make_shared<metal>(color(.65, .05, .05), 0.3)), slide);
+
+    for (int i = 0; i < 12; i++) {
+        // Each bounce is keyed at its floor contacts and its peak, a few frames apart
+        const double angle = 2 * pi * i / 12;
+        const double radius = random_double(0.3, 0.6);
+        const double height = random_double(1.5, 4);
+        const int period = random_int(8, 16);
+        const int phase = random_int(0, period - 1);
+        const vec3 ground(4.5 * std::cos(angle), radius, 4.5 * std::sin(angle));
+        keyframe_track<vec3> bounce;
+        for (int frame = -phase; frame <= anim.last_frame + period; frame += period) {
+            bounce.key(frame, ground);
+            bounce.key(frame + period / 2.0, ground + vec3(0, height, 0));
+        }
+        auto mat = (i % 3 == 0) ? shared_ptr<material>(make_shared<dielectric>(1.5))
+            : shared_ptr<material>(make_shared<lambertian>(color::random(0.2, 0.9)));
+        anim.add(make_shared<sphere>(point3(0,0,0), radius, mat), bounce);
+    }
+
+    cam.aspect_ratio      = 16.0 / 9.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 32;
+    cam.max_depth         = 20;
+    cam.background = color(0.70, 0.80, 1.00);
+
+    cam.vfov     = 40;
+    cam.lookfrom = point3(0, 5, 14);
+    cam.lookat   = point3(0, 1.5, 0);
+    cam.vup      = vec3(0,1,0);
+    anim.lookfrom.key(0, point3(0, 5, 14)).key(47, point3(6, 7, 18));
+
+    cam.defocus_angle = 0;
+}
+
+// First frame of the bouncing animation
+hittable_list bouncing_scene(camera& cam) {
+    animation anim;
+    bouncing_animation(cam, anim);
+    anim.set_frame(anim.first_frame, cam);
+    return hittable_list(anim.world());
+}
+
+// Built-in scenes, numbered from 1 in this order on the command line.
+struct scene_info {
+    const char* name;
+    hittable_list (*build)(camera& cam);
+    void (*animate)(camera& cam, animation& anim); // the scene's own animation, if it has one
+};
+
+const scene_info scenes[] = {
+    {"moon", moon_scene, nullptr},
+    {"perlin", perlin_scene, nullptr},
+    {"quads", quads_scene, nullptr},
+    {"light", light_scene, nullptr},
+    {"cornell_smoke", cornell_smoke_scene, nullptr},
+    {"diamond_block", diamond_block_scene, nullptr},
+    {"tri_test", tri_test_scene, nullptr},
+    {"obj_test", obj_test_scene, nullptr},
+    {"skybox_test", skybox_test_scene, nullptr},
+    {"ray_intersection", ray_intersection_scene, nullptr},
+    {"volume", volume_scene, nullptr},
+    {"motion_blur", motion_blur_scene, nullptr},
+    {"perlin_ball", perlin_ball_scene, nullptr},
+    {"materials", materials_scene, nullptr},
+    {"million_spheres", million_spheres_scene, nullptr},
+    {"cloud", cloud_scene, nullptr},
+    {"motion_swarm", motion_swarm_scene, nullptr},
+    {"bouncing", bouncing_scene, bouncing_animation},
+};
+
+const int scene_count = sizeof(scenes) / sizeof(scenes[0]);
+
+// Animation of a still world: the camera circling it once over frame_count frames
+inline void orbit_animation(const hittable_list& world, camera& cam, animation& anim, int frame_count = 48) {
+    for (const auto& object : world.objects) anim.add(object);
+    anim.first_frame = 0;
+    anim.last_frame = frame_count - 1;
+    anim.orbit(cam);
+}
+
+// Animation of built-in scene id (from 1): its own, or else the camera circling it
+inline void scene_animation(int id, camera& cam, animation& anim, int frame_count = 48) {
+    if (scenes[id - 1].animate) {
+        scenes[id - 1].animate(cam, anim);
+        return;
+    }
+    orbit_animation(scenes[id - 1].build(cam), cam, anim, frame_count);
+}
+
+#endif
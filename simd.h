@@ -0,0 +1,396 @@
+/**
+ * Casey Gehling
+ *
+ * Explicit SIMD layer for packet intersection. Each supported instruction set (SSE4.2, AVX2, AVX-512) gets
+ * thin register wrappers (vreal, vmask) in its own namespace, compiled for that set with a target pragma, and
+ * the kernels in simd_kernels.h are compiled once against each. The best set the CPU supports is picked at
+ * run time, so one binary uses AVX-512 where it exists and still runs on older machines.
+ *
+ * A register holds 2, 4 or 8 doubles (SSE4.2, AVX2, AVX-512), or 4, 8 or 16 floats in single-precision
+ * builds. Other compilers and CPUs get the scalar set, which falls back to the per-ray code. The denoiser's
+ * filter (denoise_kernels.h) is compiled against every set, the scalar one included, with one lane registers.
+ */
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include "aabb.h"
+
+#include <string>
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define RT_SIMD_X86
+#include <immintrin.h>
+#endif
+
+enum class simd_isa { scalar, sse42, avx2, avx512 };
+
+// Structure of arrays spheres, as stored by sphere_set. Sphere i is at center + time * motion. Arrays are padded
+// past the last sphere so kernels can load whole registers.
+struct sphere_soa {
+    const real *cx, *cy, *cz;
+    const real *mx, *my, *mz;
+    const real *radius;
+};
+
+// One a-trous denoising pass (denoise.h) over planes of width by height pixels: demodulated color in, filtered
+// color out, and the features guiding it. Taps are step pixels apart; inv_color and the rest are 1 / sigma^2.
+struct atrous_pass {
+    const real *r, *g, *b;
+    const real *nx, *ny, *nz;
+    const real *ar, *ag, *ab;
+    const real *depth;
+    real *out_r, *out_g, *out_b;
+    int width, height, step;
+    real inv_color, inv_normal, inv_albedo, inv_depth;
+};
+
+// One instruction set's packet kernels. Each tests lanes [0, p.size) of a ray packet and returns the mask of
+// lanes that hit, writing per-lane results for the primitive to finish the hit record with.
+// A null sphere or plane kernel means primitives should trace the lanes one at a time.
+struct simd_kernel_table {
+    simd_isa isa;
+    int width; // lanes per register
+
+    // Slab test of every lane against box
+    unsigned (*aabb_hit)(const aabb& box, const ray_packet& p);
+
+    // Nearest root in (tmin, tmax) of a sphere moving from center along motion over the shutter
+    unsigned (*sphere_hit)(const point3& center, const vec3& motion, real radius, const ray_packet& p, unsigned active, real* t);
+
+    // Plane hit in [tmin, tmax] with plane coordinates alpha and beta. With triangle set, only hits inside the
+    // triangle Q, Q + u, Q + v count; otherwise the caller tests alpha and beta itself.
+    unsigned (*plane_hit)(
+        const point3& Q, const vec3& u, const vec3& v, const vec3& w, const vec3& normal, real D,
+        const ray_packet& p, unsigned active, bool triangle, real* t, real* alpha, real* beta
+    );
+
+    // One ray against spheres [first, first + count) of a set: index of the nearest hit in ray_t with its t
+    // written out, or -1. Roots are picked as in sphere::hit.
+    int (*sphere_set_hit)(const sphere_soa& s, int first, int count, const ray& r, interval ray_t, real& t);
+
+    // Rows [row_start, row_end) of an a-trous pass, a register of pixels at a time
+    void (*atrous_rows)(const atrous_pass& p, int row_start, int row_end);
+};
+
+namespace simd_scalar {
+    inline unsigned aabb_hit(const aabb& box, const ray_packet& p) { return box.hit_packet(p, ~0u); }
+
+    inline int sphere_set_hit(const sphere_soa& s, int first, int count, const ray& r, interval ray_t, real& t) {
+        const vec3& d = r.direction();
+        const real a = d.length_squared();
+        int nearest = -1;
+        for (int i = first; i < first + count; i++) {
+            vec3 oc = point3(s.cx[i], s.cy[i], s.cz[i]) + r.time() * vec3(s.mx[i], s.my[i], s.mz[i]) - r.origin();
+            real h = dot(d, oc);
+            real c = oc.length_squared() - s.radius[i] * s.radius[i];
+            real discriminant = h * h - a * c;
+            if (discriminant < 0) continue;
+
+            real sqrtd = std::sqrt(discriminant);
+            real root = (h - sqrtd) / a;
+            if (!ray_t.surrounds(root)) {
+                root = (h + sqrtd) / a;
+                if (!ray_t.surrounds(root)) continue;
+            }
+            ray_t.max = t = root;
+            nearest = i;
+        }
+        return nearest;
+    }
+
+    // One lane registers, for the kernels written against vreal that every set has
+    struct vreal {
+        static const int width = 1;
+        real v;
+        vreal() {}
+        vreal(real s) : v(s) {}
+        static vreal load(const real* p) { return *p; }
+        void store(real* p) const { *p = v; }
+    };
+
+    inline vreal operator+(vreal a, vreal b) { return a.v + b.v; }
+    inline vreal operator-(vreal a, vreal b) { return a.v - b.v; }
+    inline vreal operator*(vreal a, vreal b) { return a.v * b.v; }
+    inline vreal operator/(vreal a, vreal b) { return a.v / b.v; }
+    inline vreal max(vreal a, vreal b) { return a.v > b.v ? a.v : b.v; } // as maxpd, which takes b if either is NaN
+
+    #include "denoise_kernels.h"
+
+    const simd_kernel_table kernels = { simd_isa::scalar, 1, aabb_hit, nullptr, nullptr, sphere_set_hit, atrous_rows };
+}
+
+#ifdef RT_SIMD_X86
+
+// Kernels do exactly the arithmetic of the scalar primitives, so hits agree bit for bit whichever set runs.
+// Contracting into fused multiply-adds would round differently, so it's off.
+
+#pragma GCC push_options
+#pragma GCC target("sse4.2")
+#pragma GCC optimize("fp-contract=off")
+namespace simd_sse42 {
+#ifdef RT_SINGLE_PRECISION
+    struct vreal {
+        static const int width = 4;
+        __m128 v;
+        vreal() {}
+        vreal(__m128 v) : v(v) {}
+        vreal(real s) : v(_mm_set1_ps(s)) {}
+        static vreal load(const real* p) { return _mm_loadu_ps(p); }
+        void store(real* p) const { _mm_storeu_ps(p, v); }
+    };
+    struct vmask { __m128 m; };
+
+    inline vreal operator+(vreal a, vreal b) { return _mm_add_ps(a.v, b.v); }
+    inline vreal operator-(vreal a, vreal b) { return _mm_sub_ps(a.v, b.v); }
+    inline vreal operator*(vreal a, vreal b) { return _mm_mul_ps(a.v, b.v); }
+    inline vreal operator/(vreal a, vreal b) { return _mm_div_ps(a.v, b.v); }
+    inline vreal sqrt(vreal a) { return _mm_sqrt_ps(a.v); }
+    inline vreal min(vreal a, vreal b) { return _mm_min_ps(a.v, b.v); }
+    inline vreal max(vreal a, vreal b) { return _mm_max_ps(a.v, b.v); }
+    inline vreal abs(vreal a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+    inline vmask operator<(vreal a, vreal b) { return vmask{ _mm_cmplt_ps(a.v, b.v) }; }
+    inline vmask operator<=(vreal a, vreal b) { return vmask{ _mm_cmple_ps(a.v, b.v) }; }
+    inline vmask operator&(vmask a, vmask b) { return vmask{ _mm_and_ps(a.m, b.m) }; }
+    inline vmask operator|(vmask a, vmask b) { return vmask{ _mm_or_ps(a.m, b.m) }; }
+    inline vreal select(vmask m, vreal a, vreal b) { return _mm_blendv_ps(b.v, a.v, m.m); }
+    inline unsigned bits(vmask m) { return unsigned(_mm_movemask_ps(m.m)); }
+#else
+    struct vreal {
+        static const int width = 2;
+        __m128d v;
+        vreal() {}
+        vreal(__m128d v) : v(v) {}
+        vreal(real s) : v(_mm_set1_pd(s)) {}
+        static vreal load(const real* p) { return _mm_loadu_pd(p); }
+        void store(real* p) const { _mm_storeu_pd(p, v); }
+    };
+    struct vmask { __m128d m; };
+
+    inline vreal operator+(vreal a, vreal b) { return _mm_add_pd(a.v, b.v); }
+    inline vreal operator-(vreal a, vreal b) { return _mm_sub_pd(a.v, b.v); }
+    inline vreal operator*(vreal a, vreal b) { return _mm_mul_pd(a.v, b.v); }
+    inline vreal operator/(vreal a, vreal b) { return _mm_div_pd(a.v, b.v); }
+    inline vreal sqrt(vreal a) { return _mm_sqrt_pd(a.v); }
+    inline vreal min(vreal a, vreal b) { return _mm_min_pd(a.v, b.v); }
+    inline vreal max(vreal a, vreal b) { return _mm_max_pd(a.v, b.v); }
+    inline vreal abs(vreal a) { return _mm_andnot_pd(_mm_set1_pd(-0.0), a.v); }
+    inline vmask operator<(vreal a, vreal b) { return vmask{ _mm_cmplt_pd(a.v, b.v) }; }
+    inline vmask operator<=(vreal a, vreal b) { return vmask{ _mm_cmple_pd(a.v, b.v) }; }
+    inline vmask operator&(vmask a, vmask b) { return vmask{ _mm_and_pd(a.m, b.m) }; }
+    inline vmask operator|(vmask a, vmask b) { return vmask{ _mm_or_pd(a.m, b.m) }; }
+    inline vreal select(vmask m, vreal a, vreal b) { return _mm_blendv_pd(b.v, a.v, m.m); }
+    inline unsigned bits(vmask m) { return unsigned(_mm_movemask_pd(m.m)); }
+#endif
+
+    #include "simd_kernels.h"
+    #include "denoise_kernels.h"
+
+    const simd_kernel_table kernels = { simd_isa::sse42, vreal::width, aabb_hit, sphere_hit, plane_hit, sphere_set_hit, atrous_rows };
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#pragma GCC optimize("fp-contract=off")
+namespace simd_avx2 {
+#ifdef RT_SINGLE_PRECISION
+    struct vreal {
+        static const int width = 8;
+        __m256 v;
+        vreal() {}
+        vreal(__m256 v) : v(v) {}
+        vreal(real s) : v(_mm256_set1_ps(s)) {}
+        static vreal load(const real* p) { return _mm256_loadu_ps(p); }
+        void store(real* p) const { _mm256_storeu_ps(p, v); }
+    };
+    struct vmask { __m256 m; };
+
+    inline vreal operator+(vreal a, vreal b) { return _mm256_add_ps(a.v, b.v); }
+    inline vreal operator-(vreal a, vreal b) { return _mm256_sub_ps(a.v, b.v); }
+    inline vreal operator*(vreal a, vreal b) { return _mm256_mul_ps(a.v, b.v); }
+    inline vreal operator/(vreal a, vreal b) { return _mm256_div_ps(a.v, b.v); }
+    inline vreal sqrt(vreal a) { return _mm256_sqrt_ps(a.v); }
+    inline vreal min(vreal a, vreal b) { return _mm256_min_ps(a.v, b.v); }
+    inline vreal max(vreal a, vreal b) { return _mm256_max_ps(a.v, b.v); }
+    inline vreal abs(vreal a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+    inline vmask operator<(vreal a, vreal b) { return vmask{ _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+    inline vmask operator<=(vreal a, vreal b) { return vmask{ _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+    inline vmask operator&(vmask a, vmask b) { return vmask{ _mm256_and_ps(a.m, b.m) }; }
+    inline vmask operator|(vmask a, vmask b) { return vmask{ _mm256_or_ps(a.m, b.m) }; }
+    inline vreal select(vmask m, vreal a, vreal b) { return _mm256_blendv_ps(b.v, a.v, m.m); }
+    inline unsigned bits(vmask m) { return unsigned(_mm256_movemask_ps(m.m)); }
+#else
+    struct vreal {
+        static const int width = 4;
+        __m256d v;
+        vreal() {}
+        vreal(__m256d v) : v(v) {}
+        vreal(real s) : v(_mm256_set1_pd(s)) {}
+        static vreal load(const real* p) { return _mm256_loadu_pd(p); }
+        void store(real* p) const { _mm256_storeu_pd(p, v); }
+    };
+    struct vmask { __m256d m; };
+
+    inline vreal operator+(vreal a, vreal b) { return _mm256_add_pd(a.v, b.v); }
+    inline vreal operator-(vreal a, vreal b) { return _mm256_sub_pd(a.v, b.v); }
+    inline vreal operator*(vreal a, vreal b) { return _mm256_mul_pd(a.v, b.v); }
+    inline vreal operator/(vreal a, vreal b) { return _mm256_div_pd(a.v, b.v); }
+    inline vreal sqrt(vreal a) { return _mm256_sqrt_pd(a.v); }
+    inline vreal min(vreal a, vreal b) { return _mm256_min_pd(a.v, b.v); }
+    inline vreal max(vreal a, vreal b) { return _mm256_max_pd(a.v, b.v); }
+    inline vreal abs(vreal a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a.v); }
+    inline vmask operator<(vreal a, vreal b) { return vmask{ _mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ) }; }
+    inline vmask operator<=(vreal a, vreal b) { return vmask{ _mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ) }; }
+    inline vmask operator&(vmask a, vmask b) { return vmask{ _mm256_and_pd(a.m, b.m) }; }
+    inline vmask operator|(vmask a, vmask b) { return vmask{ _mm256_or_pd(a.m, b.m) }; }
+    inline vreal select(vmask m, vreal a, vreal b) { return _mm256_blendv_pd(b.v, a.v, m.m); }
+    inline unsigned bits(vmask m) { return unsigned(_mm256_movemask_pd(m.m)); }
+#endif
+
+    #include "simd_kernels.h"
+    #include "denoise_kernels.h"
+
+    const simd_kernel_table kernels = { simd_isa::avx2, vreal::width, aabb_hit, sphere_hit, plane_hit, sphere_set_hit, atrous_rows };
+}
+#pragma GCC pop_options
+
+// AVX-512 compares write mask registers rather than vectors, one bit per lane
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#pragma GCC optimize("fp-contract=off")
+namespace simd_avx512 {
+#ifdef RT_SINGLE_PRECISION
+    struct vreal {
+        static const int width = 16;
+        __m512 v;
+        vreal() {}
+        vreal(__m512 v) : v(v) {}
+        vreal(real s) : v(_mm512_set1_ps(s)) {}
+        static vreal load(const real* p) { return _mm512_loadu_ps(p); }
+        void store(real* p) const { _mm512_storeu_ps(p, v); }
+    };
+    struct vmask { __mmask16 m; };
+
+    inline vreal operator+(vreal a, vreal b) { return _mm512_add_ps(a.v, b.v); }
+    inline vreal operator-(vreal a, vreal b) { return _mm512_sub_ps(a.v, b.v); }
+    inline vreal operator*(vreal a, vreal b) { return _mm512_mul_ps(a.v, b.v); }
+    inline vreal operator/(vreal a, vreal b) { return _mm512_div_ps(a.v, b.v); }
+    // Masked forms with every lane set: the same instructions, but GCC 12's unmasked ones pass an undefined
+    // register that -Wmaybe-uninitialized reports wherever they are inlined
+    inline vreal sqrt(vreal a) { return _mm512_mask_sqrt_ps(a.v, 0xFFFF, a.v); }
+    inline vreal min(vreal a, vreal b) { return _mm512_mask_min_ps(a.v, 0xFFFF, a.v, b.v); }
+    inline vreal max(vreal a, vreal b) { return _mm512_mask_max_ps(a.v, 0xFFFF, a.v, b.v); }
+    inline vreal abs(vreal a) { return _mm512_abs_ps(a.v); }
+    inline vmask operator<(vreal a, vreal b) { return vmask{ _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ) }; }
+    inline vmask operator<=(vreal a, vreal b) { return vmask{ _mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ) }; }
+    inline vmask operator&(vmask a, vmask b) { return vmask{ __mmask16(a.m & b.m) }; }
+    inline vmask operator|(vmask a, vmask b) { return vmask{ __mmask16(a.m | b.m) }; }
+    inline vreal select(vmask m, vreal a, vreal b) { return _mm512_mask_blend_ps(m.m, b.v, a.v); }
+    inline unsigned bits(vmask m) { return m.m; }
+#else
+    struct vreal {
+        static const int width = 8;
+        __m512d v;
+        vreal() {}
+        vreal(__m512d v) : v(v) {}
+        vreal(real s) : v(_mm512_set1_pd(s)) {}
+        static vreal load(const real* p) { return _mm512_loadu_pd(p); }
+        void store(real* p) const { _mm512_storeu_pd(p, v); }
+    };
+    struct vmask { __mmask8 m; };
+
+    inline vreal operator+(vreal a, vreal b) { return _mm512_add_pd(a.v, b.v); }
+    inline vreal operator-(vreal a, vreal b) { return _mm512_sub_pd(a.v, b.v); }
+    inline vreal operator*(vreal a, vreal b) { return _mm512_mul_pd(a.v, b.v); }
+    inline vreal operator/(vreal a, vreal b) { return _mm512_div_pd(a.v, b.v); }
+    // Masked forms with every lane set: the same instructions, but GCC 12's unmasked ones pass an undefined
+    // register that -Wmaybe-uninitialized reports wherever they are inlined
+    inline vreal sqrt(vreal a) { return _mm512_mask_sqrt_pd(a.v, 0xFF, a.v); }
+    inline vreal min(vreal a, vreal b) { return _mm512_mask_min_pd(a.v, 0xFF, a.v, b.v); }
+    inline vreal max(vreal a, vreal b) { return _mm512_mask_max_pd(a.v, 0xFF, a.v, b.v); }
+    inline vreal abs(vreal a) { return _mm512_abs_pd(a.v); }
+    inline vmask operator<(vreal a, vreal b) { return vmask{ _mm512_cmp_pd_mask(a.v, b.v, _CMP_LT_OQ) }; }
+    inline vmask operator<=(vreal a, vreal b) { return vmask{ _mm512_cmp_pd_mask(a.v, b.v, _CMP_LE_OQ) }; }
+    inline vmask operator&(vmask a, vmask b) { return vmask{ __mmask8(a.m & b.m) }; }
+    inline vmask operator|(vmask a, vmask b) { return vmask{ __mmask8(a.m | b.m) }; }
+    inline vreal select(vmask m, vreal a, vreal b) { return _mm512_mask_blend_pd(m.m, b.v, a.v); }
+    inline unsigned bits(vmask m) { return m.m; }
+#endif
+
+    #include "simd_kernels.h"
+    #include "denoise_kernels.h"
+
+    const simd_kernel_table kernels = { simd_isa::avx512, vreal::width, aabb_hit, sphere_hit, plane_hit, sphere_set_hit, atrous_rows };
+}
+#pragma GCC pop_options
+
+#endif // RT_SIMD_X86
+
+inline const char* simd_isa_name(simd_isa isa) {
+    switch (isa) {
+        case simd_isa::sse42: return "sse4.2";
+        case simd_isa::avx2: return "avx2";
+        case simd_isa::avx512: return "avx512";
+        default: return "scalar";
+    }
+}
+
+inline bool parse_simd_isa(const std::string& name, simd_isa& isa) {
+    const simd_isa all[] = { simd_isa::scalar, simd_isa::sse42, simd_isa::avx2, simd_isa::avx512 };
+    for (simd_isa candidate : all) {
+        if (name == simd_isa_name(candidate)) {
+            isa = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether this build and CPU can run the given set.
+inline bool simd_supported(simd_isa isa) {
+#ifdef RT_SIMD_X86
+    switch (isa) {
+        case simd_isa::sse42: return __builtin_cpu_supports("sse4.2");
+        case simd_isa::avx2: return __builtin_cpu_supports("avx2");
+        case simd_isa::avx512: return __builtin_cpu_supports("avx512f");
+        default: return true;
+    }
+#else
+    return isa == simd_isa::scalar;
+#endif
+}
+
+inline const simd_kernel_table& simd_table(simd_isa isa) {
+#ifdef RT_SIMD_X86
+    if (isa == simd_isa::sse42) return simd_sse42::kernels;
+    if (isa == simd_isa::avx2) return simd_avx2::kernels;
+    if (isa == simd_isa::avx512) return simd_avx512::kernels;
+#endif
+    return simd_scalar::kernels;
+}
+
+inline simd_isa best_simd_isa() {
+    const simd_isa preferred[] = { simd_isa::avx512, simd_isa::avx2, simd_isa::sse42 };
+    for (simd_isa isa : preferred) {
+        if (simd_supported(isa)) return isa;
+    }
+    return simd_isa::scalar;
+}
+
+// The kernel set in use, the best the CPU supports unless set_simd_isa() picked another.
+inline const simd_kernel_table*& active_simd_table() {
+    static const simd_kernel_table* table = &simd_table(best_simd_isa());
+    return table;
+}
+
+inline const simd_kernel_table& simd_kernels() { return *active_simd_table(); }
+
+// Switch kernel sets, e.g. to compare them. Call before rendering; returns false if the CPU can't run it.
+inline bool set_simd_isa(simd_isa isa) {
+    if (!simd_supported(isa)) return false;
+    active_simd_table() = &simd_table(isa);
+    return true;
+}
+
+#endif
@@ -0,0 +1,180 @@
+/**
+ * Casey Gehling
+ *
+ * Packet intersection kernels, written once against the vreal and vmask register wrappers. simd.h includes
+ * this file inside each instruction set's namespace and target region, so it deliberately has no include
+ * guard and includes nothing itself. Each kernel repeats its scalar primitive's arithmetic in the same order.
+ */
+
+// Structure of arrays vec3s, one vector per lane
+struct vec3_packet {
+    vreal x, y, z;
+
+    vec3_packet() {}
+    vec3_packet(vreal x, vreal y, vreal z) : x(x), y(y), z(z) {}
+
+    // The same vector in every lane
+    explicit vec3_packet(const vec3& v) : x(v.x()), y(v.y()), z(v.z()) {}
+
+    static vec3_packet load(const real* x, const real* y, const real* z, int base) {
+        return vec3_packet(vreal::load(x + base), vreal::load(y + base), vreal::load(z + base));
+    }
+};
+
+inline vec3_packet operator+(const vec3_packet& a, const vec3_packet& b) { return vec3_packet(a.x + b.x, a.y + b.y, a.z + b.z); }
+inline vec3_packet operator-(const vec3_packet& a, const vec3_packet& b) { return vec3_packet(a.x - b.x, a.y - b.y, a.z - b.z); }
+inline vec3_packet operator*(const vec3_packet& a, const vec3_packet& b) { return vec3_packet(a.x * b.x, a.y * b.y, a.z * b.z); }
+inline vec3_packet operator*(vreal t, const vec3_packet& a) { return vec3_packet(t * a.x, t * a.y, t * a.z); }
+
+inline vreal dot(const vec3_packet& a, const vec3_packet& b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline vec3_packet cross(const vec3_packet& a, const vec3_packet& b) {
+    return vec3_packet(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+inline vec3_packet normalize(const vec3_packet& a) {
+    return (vreal(1) / sqrt(dot(a, a))) * a;
+}
+
+inline vec3_packet min(const vec3_packet& a, const vec3_packet& b) { return vec3_packet(min(a.x, b.x), min(a.y, b.y), min(a.z, b.z)); }
+inline vec3_packet max(const vec3_packet& a, const vec3_packet& b) { return vec3_packet(max(a.x, b.x), max(a.y, b.y), max(a.z, b.z)); }
+
+inline vec3_packet select(vmask m, const vec3_packet& a, const vec3_packet& b) {
+    return vec3_packet(select(m, a.x, b.x), select(m, a.y, b.y), select(m, a.z, b.z));
+}
+
+inline vec3_packet packet_origins(const ray_packet& p, int base) { return vec3_packet::load(p.ox, p.oy, p.oz, base); }
+inline vec3_packet packet_directions(const ray_packet& p, int base) { return vec3_packet::load(p.dx, p.dy, p.dz, base); }
+
+// Whether any of the lanes starting at base are active
+inline bool any_active(unsigned active, int base) { return (active >> base) & lane_mask(vreal::width); }
+
+// Slab test as in aabb::hit_packet, a register of lanes at a time.
+inline unsigned aabb_hit(const aabb& box, const ray_packet& p) {
+    const vec3_packet lo(point3(box.x.min, box.y.min, box.z.min));
+    const vec3_packet hi(point3(box.x.max, box.y.max, box.z.max));
+
+    unsigned mask = 0;
+    for (int base = 0; base < p.size; base += vreal::width) {
+        vec3_packet o = packet_origins(p, base);
+        vec3_packet inv_d = vec3_packet::load(p.inv_dx, p.inv_dy, p.inv_dz, base);
+        vec3_packet t0 = (lo - o) * inv_d;
+        vec3_packet t1 = (hi - o) * inv_d;
+        vec3_packet t_near = min(t0, t1);
+        vec3_packet t_far = max(t0, t1);
+
+        vreal t_enter = max(max(vreal::load(p.tmin + base), t_near.x), max(t_near.y, t_near.z));
+        vreal t_exit = min(min(vreal::load(p.tmax + base), t_far.x), min(t_far.y, t_far.z));
+        mask |= bits(t_enter < t_exit) << base;
+    }
+    return mask;
+}
+
+// As sphere::hit: the nearer root if it lies strictly inside the lane's interval, otherwise the farther one.
+inline unsigned sphere_hit(const point3& center, const vec3& motion, real radius, const ray_packet& p, unsigned active, real* t) {
+    const vec3_packet center0(center);
+    const vec3_packet center_motion(motion);
+    const vreal radius_squared(radius * radius);
+
+    unsigned mask = 0;
+    for (int base = 0; base < p.size; base += vreal::width) {
+        if (!any_active(active, base)) continue;
+
+        vec3_packet current_center = center0 + vreal::load(p.time + base) * center_motion;
+        vec3_packet oc = current_center - packet_origins(p, base);
+        vec3_packet d = packet_directions(p, base);
+        vreal a = dot(d, d);
+        vreal h = dot(d, oc);
+        vreal c = dot(oc, oc) - radius_squared;
+
+        vreal discriminant = h * h - a * c;
+        vreal sqrtd = sqrt(max(discriminant, vreal(0)));
+        vreal near_root = (h - sqrtd) / a;
+        vreal far_root = (h + sqrtd) / a;
+
+        vreal tmin = vreal::load(p.tmin + base);
+        vreal tmax = vreal::load(p.tmax + base);
+        vmask near_in = (tmin < near_root) & (near_root < tmax);
+        vmask far_in = (tmin < far_root) & (far_root < tmax);
+
+        select(near_in, near_root, far_root).store(t + base);
+        mask |= bits((vreal(0) <= discriminant) & (near_in | far_in)) << base;
+    }
+    return mask;
+}
+
+// As quad::hit and tri::hit up to the interior test, which is included for triangles.
+inline unsigned plane_hit(
+    const point3& Q, const vec3& u, const vec3& v, const vec3& w, const vec3& normal, real D,
+    const ray_packet& p, unsigned active, bool triangle, real* t, real* alpha, real* beta
+) {
+    const vec3_packet Qs(Q), us(u), vs(v), ws(w), ns(normal);
+
+    unsigned mask = 0;
+    for (int base = 0; base < p.size; base += vreal::width) {
+        if (!any_active(active, base)) continue;
+
+        vec3_packet o = packet_origins(p, base);
+        vec3_packet d = packet_directions(p, base);
+        vreal denom = dot(ns, d);
+        vreal hit_t = (vreal(D) - dot(ns, o)) / denom;
+
+        vmask hit = (vreal(1e-8) <= abs(denom)) & (vreal::load(p.tmin + base) <= hit_t) & (hit_t <= vreal::load(p.tmax + base));
+
+        vec3_packet planar_hitpt = (o + hit_t * d) - Qs;
+        vreal a = dot(ws, cross(planar_hitpt, vs));
+        vreal b = dot(ws, cross(us, planar_hitpt));
+        if (triangle) {
+            hit = hit & (vreal(0) <= a) & (vreal(0) <= b) & (a + b <= vreal(1));
+        }
+
+        hit_t.store(t + base);
+        a.store(alpha + base);
+        b.store(beta + base);
+        mask |= bits(hit) << base;
+    }
+    return mask;
+}
+
+// One ray against a run of spheres, a register of spheres at a time. Within a register every lane is tested
+// against the nearest hit from earlier registers, then the nearest lane wins.
+inline int sphere_set_hit(const sphere_soa& s, int first, int count, const ray& r, interval ray_t, real& t) {
+    const vec3_packet o(r.origin());
+    const vec3_packet d(r.direction());
+    const vreal time(r.time());
+    const vreal a(r.direction().length_squared());
+    const vreal tmin(ray_t.min);
+
+    int nearest = -1;
+    for (int base = 0; base < count; base += vreal::width) {
+        const int i = first + base;
+        vec3_packet current_center = vec3_packet::load(s.cx, s.cy, s.cz, i) + time * vec3_packet::load(s.mx, s.my, s.mz, i);
+        vec3_packet oc = current_center - o;
+        vreal radius = vreal::load(s.radius + i);
+        vreal h = dot(d, oc);
+        vreal c = dot(oc, oc) - radius * radius;
+
+        vreal discriminant = h * h - a * c;
+        vreal sqrtd = sqrt(max(discriminant, vreal(0)));
+        vreal near_root = (h - sqrtd) / a;
+        vreal far_root = (h + sqrtd) / a;
+
+        vreal tmax(ray_t.max);
+        vmask near_in = (tmin < near_root) & (near_root < tmax);
+        vmask far_in = (tmin < far_root) & (far_root < tmax);
+        unsigned hits = bits((vreal(0) <= discriminant) & (near_in | far_in)) & lane_mask(count - base);
+        if (!hits) continue;
+
+        real roots[vreal::width];
+        select(near_in, near_root, far_root).store(roots);
+        for (int lane = 0; lane < vreal::width; lane++) {
+            if ((hits & (1u << lane)) && roots[lane] < ray_t.max) {
+                ray_t.max = t = roots[lane];
+                nearest = i + lane;
+            }
+        }
+    }
+    return nearest;
+}
@@ -9,6 +9,7 @@
 #define SPHERE_H
 
 #include "hittable.h"
+#include "simd.h"
 
 class sphere : public hittable {
     public:
@@ -30,19 +31,13 @@ class sphere : public hittable {
         // sphere(const point3& center, double radius, shared_ptr<material> mat) : center(center), radius(std::fmax(0,radius)), mat(mat) {}
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            thread_counters().prim_tests++;
             point3 current_center = center.at(r.time());
-            vec3 oc = current_center - r.origin();
-            auto a = r.direction().length_squared();
-            auto h = dot(r.direction(), oc);
-            auto c = oc.length_squared() - radius * radius;
-
-            auto discriminant = h * h - a * c;
-            if (discriminant < 0) { 
+            real a, h, sqrtd;
+            if (!solve(r, current_center, a, h, sqrtd)) {
                 return false;
             }
 
-            auto sqrtd = std::sqrt(discriminant);
-
             // Find the nearest root that lines in the range (i.e. ray intersects circle in the middle, return closer intersection point)
             auto root = (h - sqrtd) / a;
             if (!ray_t.surrounds(root)) {
@@ -52,31 +47,98 @@ class sphere : public hittable {
                 }
             }
 
-            rec.t = root;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - current_center) / radius;
-            rec.set_face_normal(r, outward_normal);
-            get_sphere_uv(outward_normal, rec.u, rec.v);
-            rec.mat = mat;
-
+            record_hit(r, root, current_center, rec);
             return true;
         }
 
+        int crossings(const ray& r, interval ray_t, real* ts, int max_count) const override {
+            thread_counters().prim_tests++;
+            real a, h, sqrtd;
+            if (!solve(r, center.at(r.time()), a, h, sqrtd)) return 0;
+
+            int count = 0;
+            const real roots[2] = { (h - sqrtd) / a, (h + sqrtd) / a };
+            for (real root : roots) {
+                if (count < max_count && ray_t.surrounds(root)) ts[count++] = root;
+            }
+            return count;
+        }
+
+        unsigned hit_packet(ray_packet& packet, unsigned active, hit_record* recs) const override {
+            const simd_kernel_table& simd = simd_kernels();
+            if (!simd.sphere_hit) return hittable::hit_packet(packet, active, recs);
+
+            thread_counters().prim_tests += lane_count(active);
+            real t[max_packet_size];
+            unsigned hits = simd.sphere_hit(center.origin(), center.direction(), radius, packet, active, t) & active;
+            for (int lane = 0; lane < packet.size; lane++) {
+                if (!(hits & (1u << lane))) continue;
+                const ray& r = packet.rays[lane];
+                record_hit(r, t[lane], center.at(r.time()), recs[lane]);
+                packet.tmax[lane] = t[lane];
+            }
+            return hits;
+        }
+
         aabb bounding_box() const override {return bbox;}
 
+        // Texture coordinates of a point p on the unit sphere
+        static void get_sphere_uv(const point3& p, real& u, real& v) {
+            auto theta = std::acos(-p.y());
+            auto phi = std::atan2(-p.z(), p.x()) + pi;
+
+            u = phi / (2*pi);
+            v = theta / pi;
+        }
+
+        // Change in a point on a sphere of the given radius along u and v, at the unit normal n
+        static void get_sphere_tangents(const vec3& n, real radius, vec3& dpdu, vec3& dpdv) {
+            dpdu = (2*pi * radius) * vec3(n.z(), 0, -n.x());
+            // Zero at the poles, where v alone doesn't say which way the point moves
+            real ring = std::sqrt(n.x() * n.x() + n.z() * n.z());
+            if (!(ring > 0)) {
+                dpdv = vec3(0,0,0);
+                return;
+            }
+            real across = -(pi * radius) * n.y() / ring;
+            dpdv = vec3(across * n.x(), (pi * radius) * ring, across * n.z());
+        }
+
     private:
         ray center;
-        double radius;
+        real radius;
         shared_ptr<material> mat;
         aabb bbox;
 
-        static void get_sphere_uv(const point3& p, double& u, double& v) {
-            auto theta = std::acos(-p.y());
-            auto phi = std::atan2(-p.z(), p.x()) + pi;
+        // The roots along r are (h -+ sqrtd) / a. Returns false if the ray misses the sphere's line entirely.
+        bool solve(const ray& r, const point3& current_center, real& a, real& h, real& sqrtd) const {
+            vec3 oc = current_center - r.origin();
+            a = r.direction().length_squared();
+            h = dot(r.direction(), oc);
+            auto c = oc.length_squared() - radius * radius;
 
-            u = phi / (2*pi);
-            v = theta / pi;
+            auto discriminant = h * h - a * c;
+            if (discriminant < 0) {
+                return false;
+            }
+
+            sqrtd = std::sqrt(discriminant);
+            return true;
+        }
+
+        void record_hit(const ray& r, real root, const point3& current_center, hit_record& rec) const {
+            rec.t = root;
+            rec.p = r.at(rec.t);
+            // The center and radius are only known to their own precision, so they bound the error along with the ray
+            rec.p_error = rounding_gamma<real>(7) * (max_abs(r.origin()) + root * max_abs(r.direction()) + max_abs(current_center) + radius);
+            vec3 outward_normal = (rec.p - current_center) / radius;
+            rec.set_face_normal(r, outward_normal);
+            get_sphere_uv(outward_normal, rec.u, rec.v);
+            get_sphere_tangents(outward_normal, radius, rec.dpdu, rec.dpdv);
+            rec.mat = mat;
+            rec.object_id = object_id;
         }
+
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,257 @@
+/**
+ * Casey Gehling
+ *
+ * Defines sphere sets: many spheres in one hittable, for particles and point clouds. Centres (both ends of
+ * the motion for moving spheres), radii and material indices are stored as structure of arrays, with the
+ * set's own flat BVH built by binned SAH. Spheres are reordered so each leaf's spheres are contiguous,
+ * and a leaf is tested a register of spheres at a time. There are no per-sphere objects or allocations.
+ *
+ * When spheres move, the shutter is cut into time segments with a BVH each, over copies of the spheres. Each node
+ * keeps its bounds at both ends of its segment, and a ray tests the box between them at its own time. Spheres move
+ * linearly, so that box holds every sphere under the node at that time, and fast movers no longer stretch their
+ * nodes over their whole path. The SAH weighs the bounds at both ends. Segments cost a copy of the spheres each,
+ * but spheres moving different ways still share nodes within one, and less so the shorter it is.
+ */
+
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include "flat_bvh.h"
+#include "hittable.h"
+#include "simd.h"
+#include "sphere.h"
+
+#include <cstdint>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+
+class sphere_set : public hittable {
+    public:
+        // Time segments for sets with moving spheres built from now on. 0 bounds each sphere over its whole motion
+        // in one BVH instead, with no bounds to interpolate.
+        static int& motion_segments() {
+            static int segments = 4;
+            return segments;
+        }
+
+        // Stationary sphere
+        void add(const point3& center, double radius, shared_ptr<material> mat) {
+            add(center, center, radius, mat);
+        }
+
+        // Moving sphere
+        void add(const point3& center1, const point3& center2, double radius, shared_ptr<material> mat) {
+            vec3 motion = center2 - center1;
+            cx.push_back(center1.x()); cy.push_back(center1.y()); cz.push_back(center1.z());
+            mx.push_back(motion.x()); my.push_back(motion.y()); mz.push_back(motion.z());
+            radii.push_back(std::fmax(0, radius));
+
+            auto found = material_indices.find(mat.get());
+            if (found == material_indices.end()) {
+                found = material_indices.emplace(mat.get(), uint32_t(materials.size())).first;
+                materials.push_back(mat);
+            }
+            material_index.push_back(found->second);
+        }
+
+        size_t size() const { return material_index.size() / segments; }
+
+        // Build the BVH over the spheres added so far. Call once after the last add, before rendering.
+        void build() {
+            const size_t n = size();
+            bool moving = false;
+            for (size_t i = 0; i < n && !moving; i++) moving = mx[i] != 0 || my[i] != 0 || mz[i] != 0;
+            segments = moving ? std::max(motion_segments(), 0) : 0;
+
+            // Bounds at the start and end of each segment, or over all of the motion for both without segments
+            std::vector<aabb> starts(n), ends(n);
+            std::vector<point3> centroids(n);
+            std::vector<uint32_t> order, segment_order(n);
+            nodes.clear();
+            nodes.reserve((2 * n / leaf_size + 1) * std::max(segments, 1));
+            end_boxes.clear();
+            roots.clear();
+            bbox = aabb::empty;
+            for (int segment = 0; segment < std::max(segments, 1); segment++) {
+                const real t0 = real(segment) / std::max(segments, 1), t1 = real(segment + 1) / std::max(segments, 1);
+                for (size_t i = 0; i < n; i++) {
+                    vec3 rvec(radii[i], radii[i], radii[i]);
+                    point3 c(cx[i], cy[i], cz[i]);
+                    vec3 motion(mx[i], my[i], mz[i]);
+                    starts[i] = aabb(c + t0 * motion - rvec, c + t0 * motion + rvec);
+                    ends[i] = aabb(c + t1 * motion - rvec, c + t1 * motion + rvec);
+                    if (segments == 0) starts[i] = ends[i] = aabb(starts[i], ends[i]);
+                    centroids[i] = c + (t0 + t1) / 2 * motion;
+                }
+
+                const uint32_t root = uint32_t(nodes.size());
+                roots.push_back(root);
+                std::iota(segment_order.begin(), segment_order.end(), 0);
+                if (n > 0) {
+                    build_node(segment_order, starts, ends, centroids, 0, n, 0);
+                    bbox = aabb(bbox, aabb(nodes[root].bbox, end_boxes[root]));
+                }
+
+                // Each segment's spheres follow the last's
+                for (size_t i = root; i < nodes.size(); i++) {
+                    if (nodes[i].count > 0) nodes[i].offset += uint32_t(order.size());
+                }
+                order.insert(order.end(), segment_order.begin(), segment_order.end());
+            }
+            if (segments == 0) end_boxes.clear();
+            segments = std::max(segments, 1);
+
+            // Put each leaf's spheres next to each other, padded so kernels can read a full register past the end
+            const size_t padded = order.size() + max_packet_size;
+            reorder(cx, order, padded); reorder(cy, order, padded); reorder(cz, order, padded);
+            reorder(mx, order, padded); reorder(my, order, padded); reorder(mz, order, padded);
+            reorder(radii, order, padded);
+            reorder(material_index, order, order.size());
+        }
+
+        // Bytes held per sphere, BVH included
+        double bytes_per_sphere() const {
+            size_t bytes = (7 * sizeof(real) + sizeof(uint32_t)) * radii.capacity() + sizeof(flat_node) * nodes.size()
+                + sizeof(aabb) * end_boxes.size();
+            return size() ? double(bytes) / size() : 0;
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            if (nodes.empty()) return false;
+
+            const simd_kernel_table& simd = simd_kernels();
+            const sphere_soa spheres = { cx.data(), cy.data(), cz.data(), mx.data(), my.data(), mz.data(), radii.data() };
+            const bool moving = !end_boxes.empty();
+
+            // The segment holding the ray's time, and how far through it that is
+            real time = r.time() * segments;
+            const int segment = std::min(std::max(int(time), 0), segments - 1);
+            time -= segment;
+
+            int nearest = -1;
+            flat_bvh::traverse(nodes.data(), roots[segment], r.direction(), [&](uint32_t index, const flat_node& node) {
+                return moving ? box_at(node.bbox, end_boxes[index], time).hit(r, ray_t) : node.bbox.hit(r, ray_t);
+            }, [&](const flat_node& node) {
+                thread_counters().prim_tests += node.count;
+                real t;
+                int i = simd.sphere_set_hit(spheres, int(node.offset), node.count, r, ray_t, t);
+                if (i >= 0) {
+                    nearest = i;
+                    ray_t.max = t;
+                }
+            });
+
+            if (nearest < 0) return false;
+            record_hit(r, nearest, ray_t.max, rec);
+            return true;
+        }
+
+        aabb bounding_box() const override { return bbox; }
+
+    private:
+        // Interior nodes have count 0, their first child next in the array and the second at offset.
+        // Leaves hold spheres [offset, offset + count). With segments, bbox is the bounds at the segment's start.
+        struct flat_node {
+            aabb bbox;
+            uint32_t offset;
+            uint16_t count;
+            uint8_t axis;
+        };
+
+        // A sphere's bounds at the start and end of a segment. The SAH weighs the area of both.
+        struct swept_box {
+            aabb start, end;
+
+            swept_box() {}
+            swept_box(const aabb& start, const aabb& end) : start(start), end(end) {}
+            swept_box(const swept_box& a, const swept_box& b) : start(a.start, b.start), end(a.end, b.end) {}
+
+            real surface_area() const { return (start.surface_area() + end.surface_area()) / 2; }
+        };
+
+        static const int leaf_size = 16; // two AVX-512 registers of doubles
+        static const int sah_depth = 32;
+
+        std::vector<real> cx, cy, cz;
+        std::vector<real> mx, my, mz;
+        std::vector<real> radii;
+        std::vector<uint32_t> material_index;
+        std::vector<shared_ptr<material> > materials;
+        std::unordered_map<const material*, uint32_t> material_indices;
+        std::vector<flat_node> nodes;
+        std::vector<aabb> end_boxes; // bounds of each node at the end of its segment, if there are segments
+        std::vector<uint32_t> roots; // of each segment's BVH
+        int segments = 1; // copies of the spheres, one per segment
+        aabb bbox;
+
+        // Bounds at time through a segment, between those at its start and end
+        static aabb box_at(const aabb& start, const aabb& end, real time) {
+            return aabb(
+                interval(start.x.min + time * (end.x.min - start.x.min), start.x.max + time * (end.x.max - start.x.max)),
+                interval(start.y.min + time * (end.y.min - start.y.min), start.y.max + time * (end.y.max - start.y.max)),
+                interval(start.z.min + time * (end.z.min - start.z.min), start.z.max + time * (end.z.max - start.z.max))
+            );
+        }
+
+        // Build the subtree over order[begin, end) and return its node index. starts and ends bound the spheres at
+        // the start and end of the segment; without segments they are the same boxes.
+        uint32_t build_node(
+            std::vector<uint32_t>& order, const std::vector<aabb>& starts, const std::vector<aabb>& ends,
+            const std::vector<point3>& centroids, size_t begin, size_t end, int depth
+        ) {
+            const uint32_t index = uint32_t(nodes.size());
+            nodes.push_back(flat_node());
+            end_boxes.push_back(aabb());
+
+            aabb bounds = aabb::empty, end_bounds = aabb::empty;
+            aabb centroid_bounds = aabb::empty;
+            for (size_t i = begin; i < end; i++) {
+                bounds = aabb(bounds, starts[order[i]]);
+                end_bounds = aabb(end_bounds, ends[order[i]]);
+                centroid_bounds = aabb(centroid_bounds, aabb(centroids[order[i]], centroids[order[i]]));
+            }
+            nodes[index].bbox = bounds;
+            end_boxes[index] = end_bounds;
+
+            const size_t count = end - begin;
+            if (count <= size_t(leaf_size)) {
+                nodes[index].offset = uint32_t(begin);
+                nodes[index].count = uint16_t(count);
+                return index;
+            }
+
+            const int axis = centroid_bounds.longest_axis();
+            const size_t mid = flat_bvh::split(order, begin, end, depth, leaf_size, sah_depth, axis, centroid_bounds.axis_interval(axis),
+                [&](uint32_t i) { return centroids[i]; }, [&](uint32_t i) { return swept_box(starts[i], ends[i]); });
+
+            nodes[index].count = 0;
+            nodes[index].axis = uint8_t(axis);
+            build_node(order, starts, ends, centroids, begin, mid, depth + 1);
+            uint32_t second = build_node(order, starts, ends, centroids, mid, end, depth + 1);
+            nodes[index].offset = second;
+            return index;
+        }
+
+        template <typename T>
+        static void reorder(std::vector<T>& values, const std::vector<uint32_t>& order, size_t padded_size) {
+            std::vector<T> sorted(padded_size, T(0));
+            for (size_t i = 0; i < order.size(); i++) sorted[i] = values[order[i]];
+            values.swap(sorted);
+        }
+
+        void record_hit(const ray& r, int i, real root, hit_record& rec) const {
+            point3 current_center = point3(cx[i], cy[i], cz[i]) + r.time() * vec3(mx[i], my[i], mz[i]);
+            rec.t = root;
+            rec.p = r.at(rec.t);
+            rec.p_error = rounding_gamma<real>(7) * (max_abs(r.origin()) + root * max_abs(r.direction()) + max_abs(current_center) + radii[i]);
+            vec3 outward_normal = (rec.p - current_center) / radii[i];
+            rec.set_face_normal(r, outward_normal);
+            sphere::get_sphere_uv(outward_normal, rec.u, rec.v);
+            sphere::get_sphere_tangents(outward_normal, radii[i], rec.dpdu, rec.dpdv);
+            rec.mat = materials[material_index[i]];
+            rec.object_id = object_id;
+        }
+};
+
+#endif
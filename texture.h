@@ -7,35 +7,39 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
-#include "rtw_stb_image.h"
+#include "hittable.h"
+#include "texture_cache.h"
 #include "perlin.h"
 
 class texture {
     public:
         virtual ~texture() = default;
         virtual color value(double u, double v, const point3& p) const = 0;
+
+        // Value at a hit, filtered over its footprint (hit_record::set_footprint) by textures that can
+        virtual color value(const hit_record& rec) const {
+            return value(rec.u, rec.v, rec.p);
+        }
 };
 
-// Image texture mapping
+// Image texture mapping, from the mip pyramid in the shared texture cache. The file is decoded when first sampled.
 class image_texture : public texture {
     public:
-        image_texture(const char* filename) : image(filename) {}
+        image_texture(const char* filename) : image(texture_cache::global().open(filename)) {}
 
+        // Bilinear lookup on the full resolution image
         color value(double u, double v, const point3& p) const override {
-            if (image.height() <= 0) return color(0,1,1);
-
-            u = interval(0,1).clamp(u);
-            v = 1.0 - interval(0,1).clamp(v);
-            
-            auto i = int(u * image.width()); 
-            auto j = int(v * image.height());
-            auto pixel = image.pixel_data(i,j);
+            if (!image) return color(0,1,1);
+            return image->bilinear(0, u, v);
+        }
 
-            auto color_scale = 1.0 / 255.0;
-            return color(color_scale * pixel[0], color_scale * pixel[1], color_scale * pixel[2]);
+        // Trilinear lookup on the levels matching the footprint
+        color value(const hit_record& rec) const override {
+            if (!image) return color(0,1,1);
+            return image->trilinear(rec.u, rec.v, rec.dudx, rec.dvdx, rec.dudy, rec.dvdy);
         }
     private:
-        rtw_image image;
+        shared_ptr<cached_image> image;
 };
 
 // Perlin noise texture
@@ -76,18 +80,24 @@ class checker_texture : public texture {
             : checker_texture(scale, make_shared<solid_color>(c1), make_shared<solid_color>(c2)) {}
 
         color value(double u, double v, const point3& p) const override {
-            auto x_int = int(std::floor(inv_scale * p.x()));
-            auto y_int = int(std::floor(inv_scale * p.y()));
-            auto z_int = int(std::floor(inv_scale * p.z()));
-
-            bool is_even = (x_int + y_int + z_int) % 2 == 0;
+            return is_even(p) ? even->value(u,v,p) : odd->value(u,v,p);
+        }
 
-            return is_even ? even->value(u,v,p) : odd->value(u,v,p);
+        color value(const hit_record& rec) const override {
+            return is_even(rec.p) ? even->value(rec) : odd->value(rec);
         }
     private:
         double inv_scale;
         shared_ptr<texture> even;
         shared_ptr<texture> odd;
+
+        bool is_even(const point3& p) const {
+            auto x_int = int(std::floor(inv_scale * p.x()));
+            auto y_int = int(std::floor(inv_scale * p.y()));
+            auto z_int = int(std::floor(inv_scale * p.z()));
+
+            return (x_int + y_int + z_int) % 2 == 0;
+        }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,449 @@
+/**
+ * Casey Gehling
+ *
+ * Defines the texture cache, shared by every image texture and keyed by the path of the file. Opening an image
+ * reads only its header, and textures opening the same file share one entry. The image is decoded the first time
+ * it is sampled, and its mip pyramid is kept as pages (mipmap.h). Once the cache is over its byte budget, the
+ * least recently used pages are dropped. A dropped page is decoded again the next time it is needed. Pages are
+ * spread over shards, each with its own lock and LRU order. Every thread also keeps the pages it used last in a
+ * small table of its own, so most lookups take no lock at all.
+ *
+ * A decoded pyramid is also written to a texture file (texture_file.h) in the cache's file directory. Later runs
+ * map that file instead of decoding, and sample its pages in place. Mapped pages are left to the OS page cache and
+ * don't count against the budget.
+ */
+
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "mipmap.h"
+#include "profile.h"
+#include "texture_file.h"
+
+#include <atomic>
+#include <chrono>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+class cached_image;
+
+// Totals since the cache was made or last reset. Per thread lookups and misses are in traversal_counters.
+struct texture_cache_stats {
+    unsigned long long loads = 0; // image files decoded, again after eviction included
+    unsigned long long evictions = 0; // pages dropped to stay within the budget
+    unsigned long long files_mapped = 0; // images opened from texture files, with nothing to decode
+    unsigned long long files_written = 0;
+    double load_seconds = 0; // spent decoding images and writing their texture files
+    size_t resident_bytes = 0; // held by the pages in the cache now
+    size_t peak_bytes = 0;
+    size_t budget_bytes = 0;
+};
+
+class texture_cache {
+    public:
+        static const size_t default_budget = size_t(1) << 30;
+        static const char* default_file_directory() { return ".texture_cache"; }
+
+        // The cache image textures use
+        static texture_cache& global() {
+            static texture_cache cache;
+            return cache;
+        }
+
+        texture_cache()
+            : directory(default_file_directory()), budget_bytes(default_budget), resident(0), peak(0), loads(0), evictions(0),
+              files_mapped(0), files_written(0), load_nanoseconds(0) {}
+
+        // Pages held past this many bytes are evicted. Each shard holds its share of the budget, and each thread
+        // may keep a few more alive in its table of recent pages.
+        void set_budget(size_t bytes) { budget_bytes = bytes; }
+        size_t budget() const { return budget_bytes; }
+
+        // Where texture files are kept, or empty to always decode. Only images opened afterwards use it.
+        void set_file_directory(const std::string& path) { directory = path; }
+        const std::string& file_directory() const { return directory; }
+
+        // Entry for an image file, found as rtw_image::resolve describes. Null if there is no readable image.
+        shared_ptr<cached_image> open(const char* filename);
+
+        texture_cache_stats stats() const {
+            texture_cache_stats s;
+            s.loads = loads;
+            s.evictions = evictions;
+            s.files_mapped = files_mapped;
+            s.files_written = files_written;
+            s.load_seconds = load_nanoseconds * 1e-9;
+            s.resident_bytes = resident;
+            s.peak_bytes = peak;
+            s.budget_bytes = budget_bytes;
+            return s;
+        }
+
+        // Zero the counts and restart the peak from what is resident now
+        void reset_stats() {
+            loads = 0;
+            evictions = 0;
+            files_mapped = 0;
+            files_written = 0;
+            load_nanoseconds = 0;
+            peak = size_t(resident);
+        }
+
+        // Page (px,py) of a level of the image, decoding the image if the page isn't resident. The pointer stays
+        // valid while the calling thread looks up pages of other 2x2 blocks of pages, see recent_slot.
+        const texture_page* page(const cached_image& image, int level, int px, int py);
+
+    private:
+        friend class cached_image;
+
+        static const int shard_count = 16;
+        static const int recent_count = 256; // pages in each thread's table
+
+        typedef std::pair<uint64_t, shared_ptr<const texture_page> > page_entry;
+
+        struct shard {
+            std::mutex lock;
+            std::list<page_entry> lru; // most recently used first
+            std::unordered_map<uint64_t, std::list<page_entry>::iterator> pages;
+            size_t bytes = 0;
+        };
+
+        // Plain data, so the table needs no initialisation check on the fast path. Image ids start at 1, so
+        // no page has key 0.
+        struct recent_page {
+            uint64_t key;
+            const texture_page* page;
+        };
+
+        std::mutex open_lock;
+        std::unordered_map<std::string, std::weak_ptr<cached_image> > images;
+        std::string directory;
+        shard shards[shard_count];
+        std::atomic<size_t> budget_bytes, resident, peak;
+        std::atomic<unsigned long long> loads, evictions, files_mapped, files_written, load_nanoseconds;
+
+        // Image ids come from one counter for every cache, so keys are never reused
+        static uint32_t next_image_id() {
+            static std::atomic<uint32_t> counter(0);
+            return ++counter;
+        }
+
+        // 24 bits of image id, 6 of level, 17 each of page row and column
+        static uint64_t page_key(uint32_t image, int level, int px, int py) {
+            return (uint64_t(image) << 40) | (uint64_t(level) << 34) | (uint64_t(py) << 17) | uint64_t(px);
+        }
+
+        shard& shard_of(uint64_t key) {
+            return shards[(key * 0x9e3779b97f4a7c15ull) >> 60];
+        }
+
+        // Slot in the thread's table. The low bits are the page's row and column parity, so the (up to) four pages
+        // under one bilinear lookup always land in different slots and none evicts another mid lookup.
+        static int recent_slot(uint32_t image, int level, int px, int py) {
+            const uint64_t block = page_key(image, level, px >> 1, py >> 1) * 0x9e3779b97f4a7c15ull;
+            return int(((block >> 32) << 2) | ((py & 1) << 1) | (px & 1)) & (recent_count - 1);
+        }
+
+        // The calling thread's table of the pages it used last
+        static recent_page* recent_pages() {
+            static thread_local recent_page recent[recent_count];
+            return recent;
+        }
+
+        // Page missing from the thread's table, from its shard or decoded, and put in the table at slot
+        const texture_page* fetch(const cached_image& image, uint64_t key, int slot, int level, int px, int py);
+
+        shared_ptr<const texture_page> find(uint64_t key) {
+            shard& s = shard_of(key);
+            std::lock_guard<std::mutex> guard(s.lock);
+            auto found = s.pages.find(key);
+            if (found == s.pages.end()) return nullptr;
+            s.lru.splice(s.lru.begin(), s.lru, found->second);
+            return found->second->second;
+        }
+
+        // Add a page as the most recently used of its shard, evicting from the other end to stay in budget. Pages
+        // decoded along with the one wanted go in as the least recently used instead, so they only fill room
+        // that is free and never push out pages in use.
+        void insert(uint64_t key, shared_ptr<const texture_page> page, bool wanted) {
+            shard& s = shard_of(key);
+            std::lock_guard<std::mutex> guard(s.lock);
+            auto found = s.pages.find(key);
+            if (found != s.pages.end()) {
+                if (wanted) s.lru.splice(s.lru.begin(), s.lru, found->second);
+                return;
+            }
+            if (wanted) {
+                s.lru.push_front(page_entry(key, page));
+                s.pages[key] = s.lru.begin();
+            } else {
+                s.lru.push_back(page_entry(key, page));
+                s.pages[key] = std::prev(s.lru.end());
+            }
+            s.bytes += sizeof(texture_page);
+            const size_t now = resident += sizeof(texture_page);
+            size_t before = peak;
+            while (now > before && !peak.compare_exchange_weak(before, now)) {}
+
+            const size_t shard_budget = budget_bytes / shard_count;
+            while (s.bytes > shard_budget && s.lru.size() > 1) {
+                s.pages.erase(s.lru.back().first);
+                s.lru.pop_back();
+                s.bytes -= sizeof(texture_page);
+                resident -= sizeof(texture_page);
+                evictions++;
+            }
+        }
+
+        void erase(uint64_t key) {
+            shard& s = shard_of(key);
+            std::lock_guard<std::mutex> guard(s.lock);
+            auto found = s.pages.find(key);
+            if (found == s.pages.end()) return;
+            s.lru.erase(found->second);
+            s.pages.erase(found);
+            s.bytes -= sizeof(texture_page);
+            resident -= sizeof(texture_page);
+        }
+};
+
+// An image file in the texture cache. Sampling it decodes the file when the pages needed aren't resident, unless
+// its texture file is mapped.
+class cached_image {
+    public:
+        cached_image(texture_cache& cache, const std::string& path, int width, int height)
+            : cache(cache), id(texture_cache::next_image_id()), path(path), page_count(0), mapped(nullptr) {
+            int w = width, h = height;
+            while (true) {
+                level_info level = { w, h, (w + texture_page::size - 1) >> texture_page::shift, (h + texture_page::size - 1) >> texture_page::shift, page_count };
+                levels.push_back(level);
+                page_count += size_t(level.pages_x) * level.pages_y;
+                if (w == 1 && h == 1) break;
+                w = mipmap::next_size(w);
+                h = mipmap::next_size(h);
+            }
+
+            if (!cache.directory.empty() && stored.map(file_name(), path, width, height, level_count(), uint32_t(page_count))) {
+                mapped = stored.pages();
+                cache.files_mapped++;
+            }
+        }
+
+        ~cached_image() {
+            for (int level = 0; level < level_count(); level++)
+                for (int py = 0; py < levels[level].pages_y; py++)
+                    for (int px = 0; px < levels[level].pages_x; px++)
+                        cache.erase(texture_cache::page_key(id, level, px, py));
+        }
+
+        const std::string& file() const { return path; }
+        int width() const { return levels[0].width; }
+        int height() const { return levels[0].height; }
+        int level_count() const { return int(levels.size()); }
+
+        // Page (px,py) of a level, in place in the texture file if it is mapped and otherwise from the cache
+        const texture_page* page(int level, int px, int py) const {
+            const texture_page* pages = mapped.load(std::memory_order_acquire);
+            if (!pages) return cache.page(*this, level, px, py);
+            thread_counters().texture_lookups++;
+            return pages + levels[level].first_page + size_t(py) * levels[level].pages_x + px;
+        }
+
+        // Bilinear filtered color at texture coordinates (u,v) on one level, v running from the bottom row up.
+        // Coordinates outside [0,1] clamp to the edge.
+        color bilinear(int level, real u, real v) const {
+            level = std::min(std::max(level, 0), level_count() - 1);
+            const level_info& l = levels[level];
+            u = std::min(std::max(u, real(0)), real(1));
+            v = 1 - std::min(std::max(v, real(0)), real(1));
+
+            // Texel centres sit at half integers. Shifted by one texel the coordinates can't be negative, so
+            // truncating them rounds down.
+            const real x = u * l.width + real(0.5), y = v * l.height + real(0.5);
+            const int x1 = int(x), y1 = int(y);
+            const int xa = std::max(x1 - 1, 0), xb = std::min(x1, l.width - 1);
+            const int ya = std::max(y1 - 1, 0), yb = std::min(y1, l.height - 1);
+
+            // The four texels are usually on one page, and at most on four
+            const int s = texture_page::shift, mask = texture_page::size - 1;
+            const int pxa = xa >> s, pxb = xb >> s, pya = ya >> s, pyb = yb >> s;
+            const texture_page* p00 = page(level, pxa, pya);
+            const texture_page* p10 = (pxb == pxa) ? p00 : page(level, pxb, pya);
+            const texture_page* p01 = (pyb == pya) ? p00 : page(level, pxa, pyb);
+            const texture_page* p11 = (pyb == pya) ? p10 : (pxb == pxa) ? p01 : page(level, pxb, pyb);
+
+            return blend_texels(
+                p00->texel(xa & mask, ya & mask), p10->texel(xb & mask, ya & mask),
+                p01->texel(xa & mask, yb & mask), p11->texel(xb & mask, yb & mask),
+                float(x - x1), float(y - y1)
+            );
+        }
+
+        // Trilinear filtered color over a footprint given by the change in (u,v) to the next pixel in x and y.
+        // The level is the one whose texels are as wide as the longer side of the footprint.
+        color trilinear(real u, real v, real dudx, real dvdx, real dudy, real dvdy) const {
+            const real w = width(), h = height();
+            const real x_width = (dudx * w) * (dudx * w) + (dvdx * h) * (dvdx * h);
+            const real y_width = (dudy * w) * (dudy * w) + (dvdy * h) * (dvdy * h);
+            const real squared = std::max(x_width, y_width);
+            if (!(squared > 1)) return bilinear(0, u, v);
+
+            // log2 of the width in texels, from the squared width
+            const float lod = std::min(0.5f * approx_log2(float(std::min(squared, real(1e30)))), float(level_count() - 1));
+            const int fine = int(lod);
+            const float blend = lod - fine;
+            if (blend <= 0 || fine + 1 >= level_count()) return bilinear(fine, u, v);
+            return (1 - blend) * bilinear(fine, u, v) + blend * bilinear(fine + 1, u, v);
+        }
+
+    private:
+        friend class texture_cache;
+
+        struct level_info {
+            int width, height;
+            int pages_x, pages_y;
+            size_t first_page; // index of the level's first page in the texture file
+        };
+
+        texture_cache& cache;
+        const uint32_t id;
+        const std::string path;
+        std::vector<level_info> levels;
+        size_t page_count;
+        mutable std::mutex load_lock; // one thread decodes the file while others wanting it wait
+        mutable texture_file stored; // the image's texture file, when mapped
+        mutable std::atomic<const texture_page*> mapped; // pages of the file, once it is mapped
+
+        std::string file_name() const { return texture_file::name(cache.directory, path); }
+
+        // Page of the mapped file, shared without an owner since the file stays mapped as long as the image lives
+        shared_ptr<const texture_page> mapped_page(int level, int px, int py) const {
+            const texture_page* pages = mapped.load(std::memory_order_acquire);
+            return shared_ptr<const texture_page>(shared_ptr<const texture_page>(), pages + levels[level].first_page + size_t(py) * levels[level].pages_x + px);
+        }
+
+        // Decode the file and write its texture file, then map that. Without a texture file, put every page of the
+        // pyramid in the cache instead, the one asked for as the most recently used. An image that fails to decode
+        // is magenta, as rtw_image shows a missing one.
+        shared_ptr<const texture_page> load(int level, int px, int py) const {
+            const uint64_t wanted = texture_cache::page_key(id, level, px, py);
+            std::lock_guard<std::mutex> guard(load_lock);
+            if (mapped) return mapped_page(level, px, py);
+            shared_ptr<const texture_page> page = cache.find(wanted);
+            if (page) return page;
+
+            const auto start = std::chrono::steady_clock::now();
+            const mipmap pyramid = decode();
+            cache.loads++;
+            const bool written = pyramid.level_count() > 0 && !cache.directory.empty() && write_file(pyramid);
+            cache.load_nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            if (written) return mapped_page(level, px, py);
+
+            for (int l = 0; l < level_count(); l++) {
+                for (int y = 0; y < levels[l].pages_y; y++) {
+                    for (int x = 0; x < levels[l].pages_x; x++) {
+                        if (l == level && x == px && y == py) continue;
+                        cache.insert(texture_cache::page_key(id, l, x, y), cut_page(pyramid, l, x, y), false);
+                    }
+                }
+            }
+            page = cut_page(pyramid, level, px, py);
+            cache.insert(wanted, page, true);
+            return page;
+        }
+
+        // Pyramid of the file's image, empty if it can't be decoded any more
+        mipmap decode() const {
+            rtw_image decoded;
+            if (!decoded.load(path) || decoded.width() != width() || decoded.height() != height()) {
+                std::cerr << "ERROR: Could not decode image file '" << path << "'.\n";
+                return mipmap(rtw_image());
+            }
+            return mipmap(decoded);
+        }
+
+        // Write the pyramid to the texture file and map it. False, leaving the pages to the cache, if either fails.
+        bool write_file(const mipmap& pyramid) const {
+            const std::string name = file_name();
+            size_t level = 0;
+            const bool ok = texture_file::write(name, path, width(), height(), level_count(), uint32_t(page_count),
+                [&](uint32_t index, texture_page& page) {
+                    while (level + 1 < levels.size() && index >= levels[level + 1].first_page) level++;
+                    const size_t in_level = index - levels[level].first_page;
+                    fill_page(pyramid, int(level), int(in_level % levels[level].pages_x), int(in_level / levels[level].pages_x), page);
+                });
+            if (!ok || !stored.map(name, path, width(), height(), level_count(), uint32_t(page_count))) {
+                std::cerr << "WARNING: Could not write texture file '" << name << "' for '" << path << "'.\n";
+                return false;
+            }
+            cache.files_written++;
+            mapped.store(stored.pages(), std::memory_order_release);
+            return true;
+        }
+
+        // Copy of one page of a level, or a magenta page if the pyramid is empty
+        shared_ptr<const texture_page> cut_page(const mipmap& pyramid, int level, int px, int py) const {
+            auto page = make_shared<texture_page>();
+            fill_page(pyramid, level, px, py, *page);
+            return page;
+        }
+
+        void fill_page(const mipmap& pyramid, int level, int px, int py, texture_page& page) const {
+            std::memset(page.texels, 0, sizeof(page.texels));
+            const int x0 = px << texture_page::shift, y0 = py << texture_page::shift;
+            const int x1 = std::min(x0 + texture_page::size, levels[level].width);
+            const int y1 = std::min(y0 + texture_page::size, levels[level].height);
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    static const uint8_t magenta[4] = { 255, 0, 255, 255 };
+                    const uint8_t* texel = (pyramid.level_count() > level) ? pyramid.texel(level, x, y) : magenta;
+                    std::memcpy(page.texel(x - x0, y - y0), texel, 4);
+                }
+            }
+        }
+};
+
+inline shared_ptr<cached_image> texture_cache::open(const char* filename) {
+    const std::string path = rtw_image::resolve(filename);
+    int width, height;
+    if (path.empty() || !rtw_image::info(path, width, height)) {
+        std::cerr << "ERROR: Could not load image file '" << filename << "'.\n";
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> guard(open_lock);
+    shared_ptr<cached_image> image = images[path].lock();
+    if (!image) {
+        image = make_shared<cached_image>(*this, path, width, height);
+        images[path] = image;
+    }
+    return image;
+}
+
+inline const texture_page* texture_cache::page(const cached_image& image, int level, int px, int py) {
+    thread_counters().texture_lookups++;
+    const uint64_t key = page_key(image.id, level, px, py);
+    const int slot = recent_slot(image.id, level, px, py);
+    const recent_page& recent = recent_pages()[slot];
+    if (recent.key == key) return recent.page;
+    return fetch(image, key, slot, level, px, py);
+}
+
+inline const texture_page* texture_cache::fetch(const cached_image& image, uint64_t key, int slot, int level, int px, int py) {
+    static thread_local shared_ptr<const texture_page> owners[recent_count]; // keep the recent pages alive
+
+    shared_ptr<const texture_page> found = find(key);
+    if (!found) {
+        thread_counters().texture_misses++;
+        found = image.load(level, px, py);
+    }
+    owners[slot] = found;
+    recent_page& recent = recent_pages()[slot];
+    recent.key = key;
+    recent.page = found.get();
+    return recent.page;
+}
+
+#endif
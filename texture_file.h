@@ -0,0 +1,170 @@
+/**
+ * Casey Gehling
+ *
+ * Defines texture files, images the texture cache has decoded once and kept on disk. A file holds every page of
+ * an image's mip pyramid in the layout the cache samples, level by level and row by row, after a one page header.
+ * It is memory mapped and its pages are used in place, so opening one needs no decoding or copying, and the OS
+ * faults each page in when it is first sampled. The header records the size, modification time and hash of the
+ * source image, and a file whose source has changed is ignored and rebuilt.
+ */
+
+#ifndef TEXTURE_FILE_H
+#define TEXTURE_FILE_H
+
+#include "mapped_file.h"
+#include "mipmap.h"
+
+#include <cstdio>
+#include <string>
+
+// Laid out at the start of the file, padded to a whole page
+struct texture_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t page_bytes; // sizeof(texture_page) of the writer
+    uint64_t source_size;
+    int64_t source_mtime;
+    uint64_t source_hash; // FNV-1a of the source file's bytes
+    int32_t width, height;
+    int32_t level_count;
+    uint32_t page_count;
+};
+
+class texture_file {
+    public:
+        static const uint32_t version = 1;
+
+        texture_file() {}
+        texture_file(const texture_file&) = delete;
+        texture_file& operator=(const texture_file&) = delete;
+
+        // Where the texture file for a source image goes in directory, named by a hash of the source's path
+        static std::string name(const std::string& directory, const std::string& source) {
+            char hex[17];
+            snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)fnv1a(source.data(), source.size(), fnv_basis));
+            return directory + "/" + hex + ".rtex";
+        }
+
+        // Map file if it holds the pyramid of source as it is now, width by height in level_count levels over
+        // page_count pages. A source whose modification time changed but whose bytes hash the same still matches.
+        bool map(const std::string& file, const std::string& source, int width, int height, int level_count, uint32_t page_count) {
+            source_state state;
+            if (!describe(source, state)) return false;
+
+            const size_t expected = sizeof(texture_page) * (size_t(page_count) + 1);
+            if (!mapping.open(file) || mapping.size() != expected) {
+                mapping.close();
+                return false;
+            }
+
+            texture_file_header header;
+            std::memcpy(&header, mapping.data(), sizeof(header));
+            bool valid = std::memcmp(header.magic, magic(), 8) == 0 && header.version == version
+                && header.page_bytes == sizeof(texture_page) && header.width == width && header.height == height
+                && header.level_count == level_count && header.page_count == page_count
+                && header.source_size == state.size;
+            if (valid && header.source_mtime != state.mtime) {
+                valid = hash_file(source) == header.source_hash;
+            }
+            if (!valid) mapping.close();
+            return valid;
+        }
+
+        // Write the texture file for source, page i of page_count filled in by fill_page(i, page). Written to a
+        // temporary name and renamed, so a reader never maps a partial file.
+        template <typename F>
+        static bool write(const std::string& file, const std::string& source, int width, int height, int level_count, uint32_t page_count, F fill_page) {
+#ifdef _WIN32
+            return false;
+#else
+            source_state state;
+            if (!describe(source, state)) return false;
+
+            texture_file_header header;
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.magic, magic(), 8);
+            header.version = version;
+            header.page_bytes = sizeof(texture_page);
+            header.source_size = state.size;
+            header.source_mtime = state.mtime;
+            header.source_hash = hash_file(source);
+            header.width = width;
+            header.height = height;
+            header.level_count = level_count;
+            header.page_count = page_count;
+
+            const std::string directory = file.substr(0, file.find_last_of('/'));
+            mkdir(directory.c_str(), 0755);
+            const std::string temporary = file + "." + std::to_string(getpid()) + ".tmp";
+            FILE* out = fopen(temporary.c_str(), "wb");
+            if (!out) return false;
+
+            texture_page page;
+            std::memset(page.texels, 0, sizeof(page.texels));
+            std::memcpy(page.texels, &header, sizeof(header));
+            bool ok = fwrite(&page, sizeof(page), 1, out) == 1;
+            for (uint32_t i = 0; ok && i < page_count; i++) {
+                fill_page(i, page);
+                ok = fwrite(&page, sizeof(page), 1, out) == 1;
+            }
+            ok = (fclose(out) == 0) && ok;
+            if (!ok || rename(temporary.c_str(), file.c_str()) != 0) {
+                remove(temporary.c_str());
+                return false;
+            }
+            return true;
+#endif
+        }
+
+        // Page i of the pyramid, once mapped
+        const texture_page* pages() const {
+            return mapping.is_open() ? reinterpret_cast<const texture_page*>(mapping.data()) + 1 : nullptr;
+        }
+
+    private:
+        mapped_file mapping;
+
+        static const uint64_t fnv_basis = 0xcbf29ce484222325ull;
+
+        struct source_state {
+            uint64_t size;
+            int64_t mtime;
+        };
+
+        static const char* magic() { return "RTWTEX\0"; }
+
+        static uint64_t fnv1a(const void* bytes, size_t count, uint64_t hash) {
+            const unsigned char* p = static_cast<const unsigned char*>(bytes);
+            for (size_t i = 0; i < count; i++) {
+                hash = (hash ^ p[i]) * 0x100000001b3ull;
+            }
+            return hash;
+        }
+
+        static bool describe(const std::string& source, source_state& state) {
+#ifdef _WIN32
+            return false;
+#else
+            struct stat info;
+            if (stat(source.c_str(), &info) != 0) return false;
+            state.size = uint64_t(info.st_size);
+            state.mtime = int64_t(info.st_mtime);
+            return true;
+#endif
+        }
+
+        static uint64_t hash_file(const std::string& source) {
+            uint64_t hash = fnv_basis;
+            FILE* in = fopen(source.c_str(), "rb");
+            if (!in) return hash;
+            unsigned char buffer[1 << 16];
+            size_t count;
+            while ((count = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+                hash = fnv1a(buffer, count, hash);
+            }
+            fclose(in);
+            return hash;
+        }
+};
+
+#endif
@@ -0,0 +1,82 @@
+/**
+ * Casey Gehling
+ *
+ * Defines the thread pool, render threads started once and kept waiting between renders, so each frame of an
+ * animation or each job of a long running process doesn't pay to start them again.
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class thread_pool {
+    public:
+        // num_threads of 0 starts one per hardware thread
+        explicit thread_pool(int num_threads = 0) {
+            const int count = (num_threads > 0) ? num_threads : std::max(1u, std::thread::hardware_concurrency());
+            for (int t = 0; t < count; t++) {
+                threads.emplace_back(&thread_pool::worker, this, t);
+            }
+        }
+
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        ~thread_pool() {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                stopping = true;
+            }
+            wake.notify_all();
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        }
+
+        int size() const { return int(threads.size()); }
+
+        // Call work(thread_index) once on each of the pool's threads and wait for every call to return. One run at
+        // a time.
+        void run(const std::function<void(int)>& work) {
+            std::unique_lock<std::mutex> guard(lock);
+            job = &work;
+            running = size();
+            generation++;
+            wake.notify_all();
+            done.wait(guard, [&]() { return running == 0; });
+            job = nullptr;
+        }
+
+    private:
+        std::vector<std::thread> threads;
+        std::mutex lock;
+        std::condition_variable wake, done;
+        const std::function<void(int)>* job = nullptr;
+        uint64_t generation = 0; // runs started
+        int running = 0; // threads still in the current run
+        bool stopping = false;
+
+        void worker(int index) {
+            uint64_t seen = 0;
+            std::unique_lock<std::mutex> guard(lock);
+            while (true) {
+                wake.wait(guard, [&]() { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+                const std::function<void(int)>* work = job;
+                guard.unlock();
+                (*work)(index);
+                guard.lock();
+                if (--running == 0) done.notify_all();
+            }
+        }
+};
+
+#endif
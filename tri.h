@@ -9,6 +9,7 @@
 #define TRI_H
 
 #include "hittable.h"
+#include "simd.h"
 #include "third_party/tiny_obj_loader.h"
 
 class tri : public hittable {
@@ -19,6 +20,7 @@ class tri : public hittable {
             normal = unit_vector(n);
             D = dot(normal, Q);
             w = n / dot(n,n);
+            p_error = rounding_gamma<real>(7) * (max_abs(Q) + max_abs(u) + max_abs(v)); // of points rebuilt from Q, u and v
 
             set_bounding_box();
         }
@@ -32,8 +34,53 @@ class tri : public hittable {
         aabb bounding_box() const override { return bbox; }
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            real t, alpha, beta;
+            if (!find_hit(r, ray_t, t, alpha, beta)) {
+                return false;
+            }
+
+            record_hit(r, t, alpha, beta, rec);
+            return true;
+        }
+
+        // A plane is crossed at most once. Only its t is wanted, so no hit record is filled.
+        int crossings(const ray& r, interval ray_t, real* ts, int max_count) const override {
+            real t, alpha, beta;
+            if (max_count < 1 || !find_hit(r, ray_t, t, alpha, beta)) return 0;
+            ts[0] = t;
+            return 1;
+        }
+
+        unsigned hit_packet(ray_packet& packet, unsigned active, hit_record* recs) const override {
+            const simd_kernel_table& simd = simd_kernels();
+            if (!simd.plane_hit) return hittable::hit_packet(packet, active, recs);
+
+            thread_counters().prim_tests += lane_count(active);
+            real t[max_packet_size], alpha[max_packet_size], beta[max_packet_size];
+            unsigned hits = simd.plane_hit(Q, u, v, w, normal, D, packet, active, true, t, alpha, beta) & active;
+            for (int lane = 0; lane < packet.size; lane++) {
+                if (!(hits & (1u << lane))) continue;
+                record_hit(packet.rays[lane], t[lane], alpha[lane], beta[lane], recs[lane]);
+                packet.tmax[lane] = t[lane];
+            }
+            return hits;
+        }
+        
+    private:
+        point3 Q;
+        vec3 u, v;
+        vec3 w;
+        shared_ptr<material> mat;
+        aabb bbox;
+        vec3 normal;
+        real D;
+        real p_error;
+
+        // Where r crosses the triangle's plane within ray_t, if it does so inside the triangle
+        bool find_hit(const ray& r, interval ray_t, real& t, real& alpha, real& beta) const {
+            thread_counters().prim_tests++;
         // Calculate the dot product of the normal and ray direction (denominator)
-            double denom = dot(normal, r.direction());
+            real denom = dot(normal, r.direction());
 
             // Early exit if the ray is parallel to the plane
             if (std::fabs(denom) < 1e-8) {
@@ -41,7 +88,7 @@ class tri : public hittable {
             }
 
             // Calculate intersection parameter t
-            double t = (D - dot(normal, r.origin())) / denom;
+            t = (D - dot(normal, r.origin())) / denom;
 
             // Exit early if t is outside the valid interval
             if (!ray_t.contains(t)) {
@@ -53,33 +100,26 @@ class tri : public hittable {
 
             // Perform the barycentric coordinate test
             vec3 planar_hitpt = intersection - Q;
-            double alpha = dot(w, cross(planar_hitpt, v));
-            double beta = dot(w, cross(u, planar_hitpt));
+            alpha = dot(w, cross(planar_hitpt, v));
+            beta = dot(w, cross(u, planar_hitpt));
 
             // Check if the intersection point is inside the triangle
-            if (alpha < 0 || beta < 0 || (alpha + beta) > 1) {
-                return false;
-            }
+            return !(alpha < 0 || beta < 0 || (alpha + beta) > 1);
+        }
 
-            // Populate the hit record
+        // Populate the hit record
+        void record_hit(const ray& r, real t, real alpha, real beta, hit_record& rec) const {
             rec.t = t;
-            rec.p = intersection;
+            rec.p = Q + alpha * u + beta * v; // on the triangle's plane, error bounded by its own scale
+            rec.p_error = p_error;
             rec.u = alpha;
             rec.v = beta;
+            rec.dpdu = u;
+            rec.dpdv = v;
             rec.mat = mat;
+            rec.object_id = object_id;
             rec.set_face_normal(r, normal);
-
-            return true;
         }
-        
-    private:
-        point3 Q;
-        vec3 u, v;
-        vec3 w;
-        shared_ptr<material> mat;
-        aabb bbox;
-        vec3 normal;
-        double D;
 };
 
 
@@ -148,6 +188,7 @@ inline shared_ptr<hittable_list> mesh(
 
             // Add the triangle
             tris->add(make_shared<tri>(Q, u, v, mat)); 
+            tris->objects.back()->object_id = tris->object_id; // the whole mesh is one object
         }
     }
 
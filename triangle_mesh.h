@@ -0,0 +1,816 @@
+/**
+ * Casey Gehling
+ *
+ * Defines triangle meshes held as one indexed buffer: float vertex positions, three vertex indices per triangle,
+ * and the mesh's own flat BVH built by binned SAH, with triangles reordered so each leaf's are contiguous. There
+ * are no per-triangle objects. The buffer is laid out the same in memory and in mesh files (.rmesh), so a mesh
+ * file is memory mapped and rendered from in place, with nothing to parse or build. A mesh loaded some other way
+ * takes its BVH from the BVH cache (bvh_cache.h) when the same geometry was built before.
+ *
+ * The build can also split space, as in Stich et al.'s SBVH: where the children of an object split would overlap,
+ * a plane may cut triangles instead, giving each side a reference bounding only its part. Long thin triangles then
+ * stop dragging large boxes through the tree. Referenced triangles are repeated in the index buffer, once per
+ * leaf, up to a cap on the extra references, and the triangle each reference is part of is kept alongside.
+ */
+
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "bvh_cache.h"
+#include "flat_bvh.h"
+#include "hittable.h"
+#include "mapped_file.h"
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <vector>
+
+// BVH node, the same in memory and in mesh files. Interior nodes have count 0, their first child next in the
+// array and the second at offset. Leaves hold references [offset, offset + count) of the index buffer. Bounds are
+// rounded outwards to float.
+struct mesh_node {
+    float lo[3], hi[3];
+    uint32_t offset;
+    uint16_t count;
+    uint8_t axis;
+    uint8_t pad;
+};
+
+// Start of a mesh file. The arrays follow at the given offsets, each 64 byte aligned.
+struct mesh_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_bytes; // sizeof(mesh_node) of the writer
+    uint64_t vertex_count, triangle_count, node_count; // node_count is 0 if the file has no BVH
+    uint64_t reference_count; // triangles in the index buffer, repeats from spatial splits included
+    uint64_t positions_offset, indices_offset, nodes_offset;
+    uint64_t sources_offset; // of the triangle each reference is part of, if there are repeats
+};
+
+// How a mesh's BVH is built
+struct mesh_build_options {
+    bool spatial_splits = false;
+    real min_overlap = real(1e-5); // overlap of an object split's children, over the root's surface area, past which spatial splits are tried
+    real max_duplicates = real(0.3); // extra references spatial splits may add, as a fraction of the triangles
+};
+
+class triangle_mesh : public hittable {
+    public:
+        static const uint32_t file_version = 3;
+
+        // Options of meshes built without any given
+        static mesh_build_options& default_options() {
+            static mesh_build_options options;
+            return options;
+        }
+
+        // Mesh of the given vertex positions (x, y, z each) and triangles (three vertex indices each), building
+        // its BVH. Indices must be less than the vertex count.
+        triangle_mesh(
+            std::vector<float> positions, std::vector<uint32_t> indices, shared_ptr<material> mat,
+            const mesh_build_options& options = default_options()
+        ) : owned_positions(std::move(positions)), owned_indices(std::move(indices)), mat(mat), options(options) {
+            this->positions = owned_positions.data();
+            vertex_count = owned_positions.size() / 3;
+            build();
+        }
+
+        // Mesh from a mesh file, mapped and used in place. Null if the file can't be mapped or isn't a mesh file.
+        // A file without a BVH has one built, on a copy of its triangles.
+        static shared_ptr<triangle_mesh> open(const std::string& path, shared_ptr<material> mat) {
+            auto file = make_shared<mapped_file>();
+            if (!file->open(path)) return nullptr;
+            mesh_file_header header;
+            if (file->size() < sizeof(header)) return nullptr;
+            std::memcpy(&header, file->data(), sizeof(header));
+
+            const uint64_t size = file->size();
+            auto fits = [&](uint64_t offset, uint64_t count, uint64_t element) {
+                return offset % 64 == 0 && offset <= size && count <= (size - offset) / element;
+            };
+            if (std::memcmp(header.magic, file_magic(), 8) != 0 || header.version != file_version
+                || header.node_bytes != sizeof(mesh_node) || header.vertex_count > UINT32_MAX
+                || !fits(header.positions_offset, header.vertex_count, 3 * sizeof(float))
+                || header.reference_count < header.triangle_count || (header.node_count == 0 && header.reference_count != header.triangle_count)
+                || !fits(header.indices_offset, header.reference_count, 3 * sizeof(uint32_t))
+                || !fits(header.nodes_offset, header.node_count, sizeof(mesh_node))
+                || (header.reference_count > header.triangle_count && !fits(header.sources_offset, header.reference_count, sizeof(uint32_t)))) {
+                std::cerr << "ERROR: '" << path << "' is not a version " << file_version << " mesh file.\n";
+                return nullptr;
+            }
+
+            auto mesh = shared_ptr<triangle_mesh>(new triangle_mesh(mat));
+            mesh->positions = reinterpret_cast<const float*>(file->data() + header.positions_offset);
+            mesh->vertex_count = size_t(header.vertex_count);
+            mesh->triangle_count = size_t(header.triangle_count);
+            mesh->reference_count = size_t(header.reference_count);
+            const uint32_t* stored = reinterpret_cast<const uint32_t*>(file->data() + header.indices_offset);
+            for (size_t i = 0; i < 3 * mesh->reference_count; i++) {
+                if (stored[i] >= mesh->vertex_count) {
+                    std::cerr << "ERROR: '" << path << "' has a vertex index out of range.\n";
+                    return nullptr;
+                }
+            }
+            if (header.node_count > 0) {
+                mesh->indices = stored;
+                mesh->nodes = reinterpret_cast<const mesh_node*>(file->data() + header.nodes_offset);
+                mesh->node_count = size_t(header.node_count);
+                if (!valid_tree(mesh->nodes, mesh->node_count, mesh->reference_count)) {
+                    std::cerr << "ERROR: '" << path << "' has a BVH that isn't a tree over its triangles.\n";
+                    return nullptr;
+                }
+                if (mesh->reference_count > mesh->triangle_count) {
+                    mesh->sources = reinterpret_cast<const uint32_t*>(file->data() + header.sources_offset);
+                    if (!covers_triangles(mesh->sources, mesh->reference_count, mesh->triangle_count)) {
+                        std::cerr << "ERROR: '" << path << "' has references that don't cover its triangles once each.\n";
+                        return nullptr;
+                    }
+                }
+                mesh->bbox = node_box(mesh->nodes[0]);
+            } else {
+                mesh->owned_indices.assign(stored, stored + 3 * mesh->triangle_count);
+                mesh->build();
+            }
+            mesh->file = file;
+            return mesh;
+        }
+
+        // The mesh with another material, sharing its vertices, triangles and BVH, and keeping it alive
+        static shared_ptr<triangle_mesh> with_material(const shared_ptr<const triangle_mesh>& mesh, shared_ptr<material> mat) {
+            auto copy = shared_ptr<triangle_mesh>(new triangle_mesh(mat));
+            copy->positions = mesh->positions;
+            copy->indices = mesh->indices;
+            copy->nodes = mesh->nodes;
+            copy->sources = mesh->sources;
+            copy->vertex_count = mesh->vertex_count;
+            copy->triangle_count = mesh->triangle_count;
+            copy->reference_count = mesh->reference_count;
+            copy->node_count = mesh->node_count;
+            copy->file = mesh->file;
+            copy->bvh_file = mesh->bvh_file;
+            copy->options = mesh->options;
+            copy->bbox = mesh->bbox;
+            copy->geometry = mesh;
+            return copy;
+        }
+
+        // Write the mesh, and its BVH unless with_bvh is false, as a mesh file. Written to a temporary name and
+        // renamed, so a reader never maps a partial file. Without the BVH, triangles repeated by spatial splits are
+        // written once.
+        bool write(const std::string& path, bool with_bvh = true) const {
+            const uint32_t* written = indices;
+            size_t written_references = with_bvh ? reference_count : triangle_count;
+            std::vector<uint32_t> unique;
+            if (!with_bvh && reference_count > triangle_count) {
+                unique = unique_triangles();
+                written = unique.data();
+                written_references = unique.size() / 3;
+            }
+
+            mesh_file_header header;
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.magic, file_magic(), 8);
+            header.version = file_version;
+            header.node_bytes = sizeof(mesh_node);
+            header.vertex_count = vertex_count;
+            header.triangle_count = with_bvh ? triangle_count : written_references;
+            header.reference_count = written_references;
+            header.node_count = with_bvh ? node_count : 0;
+            header.positions_offset = align(sizeof(header));
+            header.indices_offset = align(header.positions_offset + 3 * sizeof(float) * vertex_count);
+            header.nodes_offset = align(header.indices_offset + 3 * sizeof(uint32_t) * header.reference_count);
+            const bool with_sources = header.reference_count > header.triangle_count;
+            header.sources_offset = with_sources ? align(header.nodes_offset + sizeof(mesh_node) * header.node_count) : 0;
+
+            const std::string temporary = path + ".tmp";
+            FILE* out = fopen(temporary.c_str(), "wb");
+            if (!out) return false;
+            uint64_t at = 0;
+            auto put = [&](uint64_t offset, const void* data, size_t bytes) {
+                static const char zeros[64] = {};
+                bool ok = true;
+                while (ok && at < offset) {
+                    const size_t gap = size_t(std::min<uint64_t>(offset - at, sizeof(zeros)));
+                    ok = fwrite(zeros, 1, gap, out) == gap;
+                    at += gap;
+                }
+                ok = ok && fwrite(data, 1, bytes, out) == bytes;
+                at += bytes;
+                return ok;
+            };
+            bool ok = put(0, &header, sizeof(header))
+                && put(header.positions_offset, positions, 3 * sizeof(float) * vertex_count)
+                && put(header.indices_offset, written, 3 * sizeof(uint32_t) * header.reference_count)
+                && put(header.nodes_offset, nodes, sizeof(mesh_node) * header.node_count)
+                && (!with_sources || put(header.sources_offset, sources, sizeof(uint32_t) * header.reference_count));
+            ok = (fclose(out) == 0) && ok;
+            if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+                remove(temporary.c_str());
+                return false;
+            }
+            return true;
+        }
+
+        size_t vertices() const { return vertex_count; }
+        size_t triangles() const { return triangle_count; }
+        size_t references() const { return reference_count; }
+        bool bvh_from_cache() const { return bvh_file != nullptr; }
+
+        // Bytes held per triangle, vertices and BVH included
+        double bytes_per_triangle() const {
+            size_t bytes = 3 * sizeof(float) * vertex_count + 3 * sizeof(uint32_t) * reference_count + sizeof(mesh_node) * node_count
+                + (sources ? sizeof(uint32_t) * reference_count : 0);
+            return triangle_count ? double(bytes) / triangle_count : 0;
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            if (node_count == 0) return false;
+
+            const point3& origin = r.origin();
+            const vec3& direction = r.direction();
+            const vec3 inv_d(1 / direction.x(), 1 / direction.y(), 1 / direction.z());
+
+            int64_t nearest = -1;
+            real alpha = 0, beta = 0;
+            flat_bvh::traverse(nodes, 0, direction, [&](uint32_t, const mesh_node& node) {
+                return node_hit(node, origin, inv_d, ray_t);
+            }, [&](const mesh_node& node) {
+                thread_counters().prim_tests += node.count;
+                for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                    real t, a, b;
+                    if (triangle_hit(i, origin, direction, ray_t, t, a, b)) {
+                        nearest = i;
+                        ray_t.max = t;
+                        alpha = a;
+                        beta = b;
+                    }
+                }
+            });
+
+            if (nearest < 0) return false;
+            record_hit(r, uint32_t(nearest), ray_t.max, alpha, beta, rec);
+            return true;
+        }
+
+        aabb bounding_box() const override { return bbox; }
+
+    private:
+        static const uint32_t build_version = 3; // bump when the builder changes the trees it makes
+        static const int leaf_size = 4;
+        static const int bin_count = flat_bvh::bin_count;
+        static const int spatial_bin_count = 16;
+        static const int max_depth = flat_bvh::max_depth;
+        static const int sah_depth = 48;
+
+        // Where the data is read from: the owned vectors, or the mapped file
+        const float* positions = nullptr;
+        const uint32_t* indices = nullptr;
+        const mesh_node* nodes = nullptr;
+        const uint32_t* sources = nullptr; // the triangle each reference is part of, if there are repeats
+        size_t vertex_count = 0, triangle_count = 0, reference_count = 0, node_count = 0;
+
+        std::vector<float> owned_positions;
+        std::vector<uint32_t> owned_indices;
+        std::vector<uint32_t> owned_sources;
+        std::vector<mesh_node> owned_nodes;
+        shared_ptr<mapped_file> file;
+        shared_ptr<mapped_file> bvh_file; // holding the nodes, if they came from the BVH cache
+        shared_ptr<const triangle_mesh> geometry; // owning the arrays, if they are another mesh's
+        shared_ptr<material> mat;
+        mesh_build_options options;
+        aabb bbox;
+
+        // Part of a triangle in a spatial split build, bounded by box
+        struct reference {
+            aabb box;
+            uint32_t triangle;
+        };
+
+        // Where a node's references divide: below the bin boundary on axis, by centroid for an object split or
+        // by position, at plane, for a spatial one
+        struct split_choice {
+            real cost = infinity;
+            int axis = 0;
+            int bin = -1;
+            bool spatial = false;
+            real plane = 0;
+            aabb left, right;
+            size_t left_count = 0, right_count = 0;
+        };
+
+        explicit triangle_mesh(shared_ptr<material> mat) : mat(mat), options(default_options()) {}
+
+        static const char* file_magic() { return "RTWMESH"; }
+
+        static uint64_t align(uint64_t offset) { return (offset + 63) & ~uint64_t(63); }
+
+        point3 vertex(uint32_t v) const {
+            return point3(positions[3 * v], positions[3 * v + 1], positions[3 * v + 2]);
+        }
+
+        static aabb node_box(const mesh_node& node) {
+            return aabb(point3(node.lo[0], node.lo[1], node.lo[2]), point3(node.hi[0], node.hi[1], node.hi[2]));
+        }
+
+        static bool node_hit(const mesh_node& node, const point3& origin, const vec3& inv_d, const interval& ray_t) {
+            real t_min = ray_t.min, t_max = ray_t.max;
+            for (int axis = 0; axis < 3; axis++) {
+                real t0 = (node.lo[axis] - origin[axis]) * inv_d[axis];
+                real t1 = (node.hi[axis] - origin[axis]) * inv_d[axis];
+                if (t0 > t1) std::swap(t0, t1);
+                if (t0 > t_min) t_min = t0;
+                if (t1 < t_max) t_max = t1;
+                if (t_max <= t_min) return false;
+            }
+            return true;
+        }
+
+        // Moller-Trumbore. alpha and beta are the hit's coordinates along the edges from the first vertex to the
+        // second and third, as tri uses.
+        bool triangle_hit(uint32_t i, const point3& origin, const vec3& direction, const interval& ray_t, real& t, real& alpha, real& beta) const {
+            const point3 p0 = vertex(indices[3 * i]);
+            const vec3 e1 = vertex(indices[3 * i + 1]) - p0;
+            const vec3 e2 = vertex(indices[3 * i + 2]) - p0;
+            const vec3 pvec = cross(direction, e2);
+            const real det = dot(e1, pvec);
+            if (det == 0) return false;
+            const real inv_det = 1 / det;
+
+            const vec3 tvec = origin - p0;
+            alpha = dot(tvec, pvec) * inv_det;
+            if (alpha < 0 || alpha > 1) return false;
+            const vec3 qvec = cross(tvec, e1);
+            beta = dot(direction, qvec) * inv_det;
+            if (beta < 0 || alpha + beta > 1) return false;
+            t = dot(e2, qvec) * inv_det;
+            return ray_t.contains(t);
+        }
+
+        void record_hit(const ray& r, uint32_t i, real t, real alpha, real beta, hit_record& rec) const {
+            const point3 p0 = vertex(indices[3 * i]);
+            const vec3 e1 = vertex(indices[3 * i + 1]) - p0;
+            const vec3 e2 = vertex(indices[3 * i + 2]) - p0;
+            rec.t = t;
+            rec.p = p0 + alpha * e1 + beta * e2; // on the triangle's plane, error bounded by its own scale
+            rec.p_error = rounding_gamma<real>(7) * (max_abs(p0) + max_abs(e1) + max_abs(e2));
+            rec.u = alpha;
+            rec.v = beta;
+            rec.dpdu = e1;
+            rec.dpdv = e2;
+            rec.mat = mat;
+            rec.object_id = object_id;
+            rec.set_face_normal(r, unit_vector(cross(e1, e2)));
+        }
+
+        // Build the BVH over positions and owned_indices, reordering the triangles into leaf order. The BVH cache
+        // is tried first, and a BVH that had to be built is stored there.
+        void build() {
+            triangle_count = owned_indices.size() / 3;
+            bvh_cache& cache = bvh_cache::global();
+            const bool caching = triangle_count > 0 && !cache.directory().empty();
+            const uint64_t key = caching ? bvh_key() : 0;
+            if (caching && map_cached_bvh(key)) return;
+            auto start = profile_clock::now();
+
+            std::vector<aabb> boxes(triangle_count);
+            std::vector<point3> centroids(triangle_count);
+            for (size_t i = 0; i < triangle_count; i++) {
+                const point3 a = vertex(owned_indices[3 * i]), b = vertex(owned_indices[3 * i + 1]), c = vertex(owned_indices[3 * i + 2]);
+                boxes[i] = aabb(aabb(a, b), aabb(c, c));
+                centroids[i] = (a + b + c) / 3;
+            }
+
+            // The triangle each leaf slot references, in leaf order
+            std::vector<uint32_t> order;
+            owned_nodes.clear();
+            owned_nodes.reserve(2 * triangle_count / leaf_size + 1);
+            if (options.spatial_splits && triangle_count > 0) {
+                std::vector<reference> references(triangle_count);
+                aabb bounds = aabb::empty;
+                for (size_t i = 0; i < triangle_count; i++) {
+                    references[i].box = boxes[i];
+                    references[i].triangle = uint32_t(i);
+                    bounds = aabb(bounds, boxes[i]);
+                }
+                std::vector<aabb>().swap(boxes);
+                std::vector<point3>().swap(centroids);
+                size_t budget = size_t(options.max_duplicates * triangle_count);
+                order.reserve(triangle_count + budget);
+                spatial_node(references, order, budget, bounds.surface_area(), 0);
+            } else {
+                order.resize(triangle_count);
+                std::iota(order.begin(), order.end(), 0);
+                if (triangle_count > 0) build_node(order, boxes, centroids, 0, triangle_count, 0);
+            }
+            reference_count = order.size();
+
+            std::vector<uint32_t> sorted(3 * reference_count);
+            for (size_t i = 0; i < reference_count; i++) {
+                for (int k = 0; k < 3; k++) sorted[3 * i + k] = owned_indices[3 * order[i] + k];
+            }
+            owned_indices.swap(sorted);
+
+            indices = owned_indices.data();
+            nodes = owned_nodes.data();
+            node_count = owned_nodes.size();
+            bbox = node_count ? node_box(nodes[0]) : aabb::empty;
+            assert(node_count == 0 || valid_tree(nodes, node_count, reference_count));
+            cache.record_build(std::chrono::duration<double>(profile_clock::now() - start).count());
+            if (caching) cache.store(key, triangle_count, order, owned_nodes);
+            if (reference_count > triangle_count) owned_sources.swap(order);
+            else owned_sources.clear();
+            sources = owned_sources.empty() ? nullptr : owned_sources.data();
+        }
+
+        // Key of the BVH this mesh builds: its geometry, and everything about the build that shapes the tree
+        uint64_t bvh_key() const {
+            const uint32_t settings[] = { build_version, uint32_t(sizeof(mesh_node)), uint32_t(sizeof(real)), leaf_size, bin_count, sah_depth, spatial_bin_count };
+            const real spatial[] = { real(options.spatial_splits), options.min_overlap, options.max_duplicates };
+            uint64_t key = bvh_cache::hash(settings, sizeof(settings), bvh_cache::hash_basis);
+            key = bvh_cache::hash(spatial, sizeof(spatial), key);
+            key = bvh_cache::hash(positions, 3 * sizeof(float) * vertex_count, key);
+            return bvh_cache::hash(owned_indices.data(), sizeof(uint32_t) * owned_indices.size(), key);
+        }
+
+        // Take the BVH stored in the cache for key, reordering the triangles as its build did. False if there is
+        // none, or its nodes don't form a tree over this mesh's triangles that traversal can walk.
+        bool map_cached_bvh(uint64_t key) {
+            bvh_cache& cache = bvh_cache::global();
+            const uint32_t* order;
+            const mesh_node* cached;
+            size_t cached_references, cached_count;
+            auto cached_file = cache.find(key, triangle_count, order, cached_references, cached, cached_count);
+            if (!cached_file) return false;
+
+            if (!valid_tree(cached, cached_count, cached_references)) {
+                cache.record_rejected();
+                return false;
+            }
+
+            std::vector<uint32_t> sorted(3 * cached_references);
+            for (size_t i = 0; i < cached_references; i++) {
+                for (int k = 0; k < 3; k++) sorted[3 * i + k] = owned_indices[3 * order[i] + k];
+            }
+            owned_indices.swap(sorted);
+            owned_nodes.clear();
+            owned_sources.clear();
+            reference_count = cached_references;
+            sources = (reference_count > triangle_count) ? order : nullptr;
+
+            indices = owned_indices.data();
+            nodes = cached;
+            node_count = cached_count;
+            bvh_file = cached_file;
+            bbox = node_box(nodes[0]);
+            cache.record_hit();
+            return true;
+        }
+
+        // Whether nodes form a tree that traversal can walk over references triangles: children inside the array
+        // and after their parents, leaves inside the index buffer, and no leaf deeper than max_depth
+        static bool valid_tree(const mesh_node* nodes, size_t count, size_t references) {
+            if (count == 0) return false;
+            // Parents come first, so each node's deepest parent has been seen by the time it is reached
+            std::vector<uint8_t> depth(count, 0);
+            for (size_t i = 0; i < count; i++) {
+                const mesh_node& node = nodes[i];
+                const bool valid = (node.count > 0)
+                    ? uint64_t(node.offset) + node.count <= references
+                    : node.axis < 3 && i + 1 < count && node.offset > i + 1 && node.offset < count && depth[i] < max_depth;
+                if (!valid) return false;
+                if (node.count == 0) {
+                    depth[i + 1] = std::max(depth[i + 1], uint8_t(depth[i] + 1));
+                    depth[node.offset] = std::max(depth[node.offset], uint8_t(depth[i] + 1));
+                }
+            }
+            return true;
+        }
+
+        // Build the subtree over order[begin, end) and return its node index
+        uint32_t build_node(
+            std::vector<uint32_t>& order, const std::vector<aabb>& boxes, const std::vector<point3>& centroids,
+            size_t begin, size_t end, int depth
+        ) {
+            const uint32_t index = uint32_t(owned_nodes.size());
+            owned_nodes.push_back(mesh_node());
+
+            aabb bounds = aabb::empty;
+            aabb centroid_bounds = aabb::empty;
+            for (size_t i = begin; i < end; i++) {
+                bounds = aabb(bounds, boxes[order[i]]);
+                centroid_bounds = aabb(centroid_bounds, aabb(centroids[order[i]], centroids[order[i]]));
+            }
+            set_bounds(owned_nodes[index], bounds);
+
+            const size_t count = end - begin;
+            if (count <= size_t(leaf_size)) {
+                owned_nodes[index].offset = uint32_t(begin);
+                owned_nodes[index].count = uint16_t(count);
+                return index;
+            }
+
+            const int axis = centroid_bounds.longest_axis();
+            const size_t mid = flat_bvh::split(order, begin, end, depth, leaf_size, sah_depth, axis, centroid_bounds.axis_interval(axis),
+                [&](uint32_t i) { return centroids[i]; }, [&](uint32_t i) { return boxes[i]; });
+
+            owned_nodes[index].count = 0;
+            owned_nodes[index].axis = uint8_t(axis);
+            build_node(order, boxes, centroids, begin, mid, depth + 1);
+            uint32_t second = build_node(order, boxes, centroids, mid, end, depth + 1);
+            owned_nodes[index].offset = second;
+            return index;
+        }
+
+        // Build the subtree over references with spatial splits allowed, appending its leaves' triangles to order,
+        // and return its node index. budget is how many more references splits may add.
+        uint32_t spatial_node(std::vector<reference>& references, std::vector<uint32_t>& order, size_t& budget, real root_area, int depth) {
+            const uint32_t index = uint32_t(owned_nodes.size());
+            owned_nodes.push_back(mesh_node());
+
+            aabb bounds = aabb::empty;
+            aabb centroid_bounds = aabb::empty;
+            for (const auto& ref : references) {
+                bounds = aabb(bounds, ref.box);
+                const point3 c = center(ref.box);
+                centroid_bounds = aabb(centroid_bounds, aabb(c, c));
+            }
+            set_bounds(owned_nodes[index], bounds);
+
+            if (references.size() <= size_t(leaf_size)) {
+                owned_nodes[index].offset = uint32_t(order.size());
+                owned_nodes[index].count = uint16_t(references.size());
+                for (const auto& ref : references) order.push_back(ref.triangle);
+                return index;
+            }
+
+            // An object split as build_node makes, and spatial splits on every axis if its children would overlap
+            const int axis = centroid_bounds.longest_axis();
+            split_choice best;
+            if (flat_bvh::may_split_by_cost(depth, references.size(), leaf_size, sah_depth)) {
+                best = object_split(references, axis, centroid_bounds.axis_interval(axis));
+                real overlap = 0;
+                if (best.bin >= 0) {
+                    const aabb both(
+                        interval(std::max(best.left.x.min, best.right.x.min), std::min(best.left.x.max, best.right.x.max)),
+                        interval(std::max(best.left.y.min, best.right.y.min), std::min(best.left.y.max, best.right.y.max)),
+                        interval(std::max(best.left.z.min, best.right.z.min), std::min(best.left.z.max, best.right.z.max))
+                    );
+                    if (both.x.size() > 0 && both.y.size() > 0 && both.z.size() > 0) overlap = both.surface_area();
+                }
+                if (budget > 0 && (best.bin < 0 || overlap > options.min_overlap * root_area)) {
+                    for (int a = 0; a < 3; a++) {
+                        split_choice spatial = spatial_split(references, bounds, a);
+                        if (spatial.cost < best.cost) best = spatial;
+                    }
+                }
+            }
+
+            std::vector<reference> left, right;
+            if (best.bin >= 0 && best.spatial) {
+                divide(references, best, budget, left, right);
+            } else if (best.bin >= 0) {
+                const interval extent = centroid_bounds.axis_interval(axis);
+                const real scale = bin_count / extent.size();
+                for (const auto& ref : references) {
+                    const int b = std::min(std::max(int((center(ref.box)[axis] - extent.min) * scale), 0), bin_count - 1);
+                    (b < best.bin ? left : right).push_back(ref);
+                }
+            }
+            if (left.empty() || right.empty()) {
+                // Median by centroid, which always divides
+                best.axis = axis;
+                const size_t mid = references.size() / 2;
+                std::nth_element(references.begin(), references.begin() + mid, references.end(), [&](const reference& a, const reference& b) {
+                    return center(a.box)[axis] < center(b.box)[axis];
+                });
+                left.assign(references.begin(), references.begin() + mid);
+                right.assign(references.begin() + mid, references.end());
+            }
+            std::vector<reference>().swap(references);
+
+            owned_nodes[index].count = 0;
+            owned_nodes[index].axis = uint8_t(best.axis);
+            spatial_node(left, order, budget, root_area, depth + 1);
+            uint32_t second = spatial_node(right, order, budget, root_area, depth + 1);
+            owned_nodes[index].offset = second;
+            return index;
+        }
+
+        // Cheapest object split of references along axis, binned by the centroids of their boxes
+        split_choice object_split(const std::vector<reference>& references, int axis, const interval& extent) const {
+            split_choice best;
+            best.axis = axis;
+            if (extent.size() <= 0) return best;
+
+            aabb bin_bounds[bin_count];
+            size_t bin_counts[bin_count] = {};
+            const real scale = bin_count / extent.size();
+            for (const auto& ref : references) {
+                const int b = std::min(std::max(int((center(ref.box)[axis] - extent.min) * scale), 0), bin_count - 1);
+                bin_counts[b]++;
+                bin_bounds[b] = aabb(bin_bounds[b], ref.box);
+            }
+            sweep(bin_bounds, bin_counts, bin_counts, bin_count, best);
+            return best;
+        }
+
+        // Cheapest spatial split of references across bounds along axis. Each reference is clipped into every bin
+        // it spans, and counts on the left of the boundaries past the bin it enters and the right of those before
+        // the bin it leaves.
+        split_choice spatial_split(const std::vector<reference>& references, const aabb& bounds, int axis) const {
+            split_choice best;
+            best.axis = axis;
+            best.spatial = true;
+            const interval extent = bounds.axis_interval(axis);
+            if (extent.size() <= 0) return best;
+
+            aabb bin_bounds[spatial_bin_count];
+            size_t entries[spatial_bin_count] = {}, exits[spatial_bin_count] = {};
+            const real width = extent.size() / spatial_bin_count;
+            auto bin_of = [&](real x) {
+                return std::min(std::max(int((x - extent.min) / width), 0), spatial_bin_count - 1);
+            };
+            for (const auto& ref : references) {
+                const interval& span = ref.box.axis_interval(axis);
+                const int first = bin_of(span.min), last = bin_of(span.max);
+                for (int b = first; b <= last; b++) {
+                    aabb piece = ref.box;
+                    if (first == last || clip(ref, axis, extent.min + b * width, extent.min + (b + 1) * width, piece)) {
+                        bin_bounds[b] = aabb(bin_bounds[b], piece);
+                    }
+                }
+                entries[first]++;
+                exits[last]++;
+            }
+            sweep(bin_bounds, entries, exits, spatial_bin_count, best);
+            best.plane = extent.min + best.bin * width;
+            return best;
+        }
+
+        // Lowest surface area heuristic cost over the boundaries between bins, left counts taken from entries and
+        // right counts from exits, into best
+        static void sweep(const aabb* bin_bounds, const size_t* entries, const size_t* exits, int bins, split_choice& best) {
+            std::vector<aabb> right_bounds(bins);
+            std::vector<size_t> right_counts(bins);
+            aabb right = aabb::empty;
+            size_t right_count = 0;
+            for (int b = bins - 1; b > 0; b--) {
+                right = aabb(right, bin_bounds[b]);
+                right_count += exits[b];
+                right_bounds[b] = right;
+                right_counts[b] = right_count;
+            }
+
+            aabb left = aabb::empty;
+            size_t left_count = 0;
+            for (int b = 1; b < bins; b++) {
+                left = aabb(left, bin_bounds[b - 1]);
+                left_count += entries[b - 1];
+                if (left_count == 0 || right_counts[b] == 0) continue;
+                real cost = left_count * left.surface_area() + right_counts[b] * right_bounds[b].surface_area();
+                if (cost < best.cost) {
+                    best.cost = cost;
+                    best.bin = b;
+                    best.left = left;
+                    best.right = right_bounds[b];
+                    best.left_count = left_count;
+                    best.right_count = right_counts[b];
+                }
+            }
+        }
+
+        // Send each reference to the side of a spatial split's plane it lies on. One straddling the plane is cut
+        // in two while the budget lasts, unless the cost says moving it whole to one side is cheaper.
+        void divide(
+            const std::vector<reference>& references, const split_choice& split, size_t& budget,
+            std::vector<reference>& left, std::vector<reference>& right
+        ) const {
+            const int axis = split.axis;
+            const real split_cost = split.left_count * split.left.surface_area() + split.right_count * split.right.surface_area();
+            for (const auto& ref : references) {
+                const interval& span = ref.box.axis_interval(axis);
+                if (span.max <= split.plane) {
+                    left.push_back(ref);
+                    continue;
+                }
+                if (span.min >= split.plane) {
+                    right.push_back(ref);
+                    continue;
+                }
+
+                reference below = ref, above = ref;
+                const bool has_below = clip(ref, axis, -infinity, split.plane, below.box);
+                const bool has_above = clip(ref, axis, split.plane, infinity, above.box);
+                if (!has_above) {
+                    left.push_back(ref);
+                    continue;
+                }
+                if (!has_below) {
+                    right.push_back(ref);
+                    continue;
+                }
+
+                const real left_cost = aabb(split.left, ref.box).surface_area() * split.left_count
+                    + split.right.surface_area() * (split.right_count - 1);
+                const real right_cost = split.left.surface_area() * (split.left_count - 1)
+                    + aabb(split.right, ref.box).surface_area() * split.right_count;
+                if (budget > 0 && split_cost < left_cost && split_cost < right_cost) {
+                    budget--;
+                    left.push_back(below);
+                    right.push_back(above);
+                } else if (left_cost <= right_cost) {
+                    left.push_back(ref);
+                } else {
+                    right.push_back(ref);
+                }
+            }
+        }
+
+        // Bounds of the part of ref's triangle within [lo, hi] along axis and within ref's box, into box. False if
+        // there is no such part.
+        bool clip(const reference& ref, int axis, real lo, real hi, aabb& box) const {
+            const uint32_t* t = &owned_indices[3 * size_t(ref.triangle)];
+            const point3 v[3] = { vertex(t[0]), vertex(t[1]), vertex(t[2]) };
+            const real far = infinity;
+            real min[3] = { far, far, far }, max[3] = { -far, -far, -far };
+            auto add = [&](const point3& p) {
+                for (int k = 0; k < 3; k++) {
+                    min[k] = std::min(min[k], p[k]);
+                    max[k] = std::max(max[k], p[k]);
+                }
+            };
+            // The corners inside the slab, and where the edges cross its planes
+            for (int i = 0; i < 3; i++) {
+                const point3& a = v[i];
+                const point3& b = v[(i + 1) % 3];
+                if (a[axis] >= lo && a[axis] <= hi) add(a);
+                for (real plane : { lo, hi }) {
+                    if ((a[axis] < plane && b[axis] > plane) || (a[axis] > plane && b[axis] < plane)) {
+                        point3 p = a + ((plane - a[axis]) / (b[axis] - a[axis])) * (b - a);
+                        p[axis] = plane;
+                        add(p);
+                    }
+                }
+            }
+
+            interval extents[3];
+            for (int k = 0; k < 3; k++) {
+                const interval& within = ref.box.axis_interval(k);
+                extents[k] = interval(std::max(min[k], within.min), std::min(max[k], within.max));
+            }
+            extents[axis] = interval(std::max(extents[axis].min, lo), std::min(extents[axis].max, hi));
+            for (int k = 0; k < 3; k++) {
+                if (extents[k].min > extents[k].max) return false;
+            }
+            box = aabb(extents[0], extents[1], extents[2]);
+            return true;
+        }
+
+        static point3 center(const aabb& box) {
+            return point3((box.x.min + box.x.max) / 2, (box.y.min + box.y.max) / 2, (box.z.min + box.z.max) / 2);
+        }
+
+        // Each triangle once, in the order first referenced. Repeats are told apart by the triangle they are part of,
+        // so a triangle the mesh itself holds twice is still written twice.
+        std::vector<uint32_t> unique_triangles() const {
+            std::vector<uint32_t> unique;
+            unique.reserve(3 * triangle_count);
+            std::vector<bool> written(triangle_count, false);
+            for (size_t i = 0; i < reference_count; i++) {
+                if (written[sources[i]]) continue;
+                written[sources[i]] = true;
+                unique.insert(unique.end(), indices + 3 * i, indices + 3 * i + 3);
+            }
+            return unique;
+        }
+
+        // Whether sources names every one of triangles triangles, and nothing past them
+        static bool covers_triangles(const uint32_t* sources, size_t references, size_t triangles) {
+            std::vector<bool> seen(triangles, false);
+            size_t covered = 0;
+            for (size_t i = 0; i < references; i++) {
+                if (sources[i] >= triangles) return false;
+                if (!seen[sources[i]]) {
+                    seen[sources[i]] = true;
+                    covered++;
+                }
+            }
+            return covered == triangles;
+        }
+
+        // Float bounds containing the box, rounded outwards where float can't hold it exactly
+        static void set_bounds(mesh_node& node, const aabb& box) {
+            for (int axis = 0; axis < 3; axis++) {
+                const interval& extent = box.axis_interval(axis);
+                float lo = float(extent.min), hi = float(extent.max);
+                if (lo > extent.min) lo = std::nextafter(lo, -std::numeric_limits<float>::infinity());
+                if (hi < extent.max) hi = std::nextafter(hi, std::numeric_limits<float>::infinity());
+                node.lo[axis] = lo;
+                node.hi[axis] = hi;
+            }
+        }
+};
+
+#endif
@@ -1,45 +1,51 @@
 /**
  * Casey Gehling
  * 
- * Defines vec3 type, <x,y,z> valued tuple.
+ * Defines vec3 type, <x,y,z> valued tuple. The scalar type is a template parameter; vec3 itself uses
+ * real, which is double unless built with RT_SINGLE_PRECISION.
  */
 
 
 #ifndef VEC3_H
 #define VEC3_H
 
-class vec3 {
+#include <algorithm>
+#include <cstring>
+
+template <typename T>
+class basic_vec3 {
     public:
+        typedef T scalar;
 
-        double e[3];
+        T e[3];
 
         // constructors
-        vec3() {
+        basic_vec3() {
             e[0] = 0;
             e[1] = 0;
             e[2] = 0;
         }
 
-        vec3(double e0, double e1, double e2) {
+        basic_vec3(T e0, T e1, T e2) {
             e[0] = e0;
             e[1] = e1;
             e[2] = e2;
         }
 
         // getters
-        double x() const {return e[0];}
-        double y() const {return e[1];}
-        double z() const {return e[2];}
+        T x() const {return e[0];}
+        T y() const {return e[1];}
+        T z() const {return e[2];}
 
         // Invert
-        vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]);}
+        basic_vec3 operator-() const { return basic_vec3(-e[0], -e[1], -e[2]);}
 
         // Index access
-        double operator[](int i) const {return e[i];}
-        double& operator[](int i) {return e[i];}
+        T operator[](int i) const {return e[i];}
+        T& operator[](int i) {return e[i];}
 
         // Vector addition
-        vec3& operator+=(const vec3& v) {
+        basic_vec3& operator+=(const basic_vec3& v) {
             e[0] += v.e[0];
             e[1] += v.e[1];
             e[2] += v.e[2];
@@ -47,23 +53,23 @@ class vec3 {
         }
 
         // Scalar mult
-        vec3& operator*=(double s) {
+        basic_vec3& operator*=(T s) {
             e[0] *= s;
             e[1] *= s;
             e[2] *= s;
             return *this;
         }
 
-        vec3& operator/=(double t) {
+        basic_vec3& operator/=(T t) {
             return *this *= 1/t;
         }
 
         // Magnitude
-        double length() const {
+        T length() const {
             return std::sqrt(length_squared());
         }
 
-        double length_squared() const {
+        T length_squared() const {
             return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
         }
 
@@ -72,69 +78,88 @@ class vec3 {
             return (std::fabs(e[0]) < s) && (std::fabs(e[1] < s)) && (std::fabs(e[2]) < s);
         }
 
-        static vec3 random() {
-            return vec3(random_double(), random_double(), random_double());
+        static basic_vec3 random() {
+            return basic_vec3(random_double(), random_double(), random_double());
         }
 
-        static vec3 random(double min, double max) {
-            return vec3(random_double(min,max), random_double(min,max), random_double(min,max));
+        static basic_vec3 random(double min, double max) {
+            return basic_vec3(random_double(min,max), random_double(min,max), random_double(min,max));
         }
 };
 
+using vec3 = basic_vec3<real>;
+
 // point3 and vec3 are synonymous but useful for clarity
 using point3 = vec3;
 
-// Vector utilities
+// Vector utilities. Scalars are taken as the vector's own scalar type (a non-deduced context), so double
+// and int constants still convert when T is float.
 
 // Output stream 'e1 e2 e3'
-inline std::ostream& operator<<(std::ostream& out, const vec3& v) {
+template <typename T>
+inline std::ostream& operator<<(std::ostream& out, const basic_vec3<T>& v) {
     return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
 
 // +
-inline vec3 operator+(const vec3& u, const vec3& v) {
-    return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+template <typename T>
+inline basic_vec3<T> operator+(const basic_vec3<T>& u, const basic_vec3<T>& v) {
+    return basic_vec3<T>(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
 }
 
 // -
-inline vec3 operator-(const vec3& u, const vec3& v) {
-    return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+template <typename T>
+inline basic_vec3<T> operator-(const basic_vec3<T>& u, const basic_vec3<T>& v) {
+    return basic_vec3<T>(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
 }
 
 // *
-inline vec3 operator*(const vec3& u, const vec3& v) {
-    return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+template <typename T>
+inline basic_vec3<T> operator*(const basic_vec3<T>& u, const basic_vec3<T>& v) {
+    return basic_vec3<T>(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+}
+
+// Component-wise /
+template <typename T>
+inline basic_vec3<T> operator/(const basic_vec3<T>& u, const basic_vec3<T>& v) {
+    return basic_vec3<T>(u.e[0] / v.e[0], u.e[1] / v.e[1], u.e[2] / v.e[2]);
 }
 
 // Scalar *
-inline vec3 operator*(const double s, const vec3& v) {
-    return vec3(s * v.e[0], s * v.e[1], s * v.e[2]);
+template <typename T>
+inline basic_vec3<T> operator*(typename basic_vec3<T>::scalar s, const basic_vec3<T>& v) {
+    return basic_vec3<T>(s * v.e[0], s * v.e[1], s * v.e[2]);
 }
 
 // Communative scalar *
-inline vec3 operator*(const vec3& v, const double s) {
+template <typename T>
+inline basic_vec3<T> operator*(const basic_vec3<T>& v, typename basic_vec3<T>::scalar s) {
     return s * v;
 }
 
 // /
-inline vec3 operator/(const vec3& v, double s) {
+template <typename T>
+inline basic_vec3<T> operator/(const basic_vec3<T>& v, typename basic_vec3<T>::scalar s) {
     return (1/s) * v;
 }
 
 // Dot product
-inline double dot(const vec3& u, const vec3& v) {
+template <typename T>
+inline T dot(const basic_vec3<T>& u, const basic_vec3<T>& v) {
     return u.e[0] * v.e[0] + u.e[1] * v.e[1] + u.e[2] * v.e[2];
 }
 
 // Cross product
-inline vec3 cross(const vec3& u, const vec3& v) {
-    return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
+template <typename T>
+inline basic_vec3<T> cross(const basic_vec3<T>& u, const basic_vec3<T>& v) {
+    return basic_vec3<T>(u.e[1] * v.e[2] - u.e[2] * v.e[1],
                 u.e[2] * v.e[0] - u.e[0] * v.e[2],
                 u.e[0] * v.e[1] - u.e[1] * v.e[0]);
 }
 
 // Normalize
-inline vec3 unit_vector(const vec3& v) {
+template <typename T>
+inline basic_vec3<T> unit_vector(const basic_vec3<T>& v) {
     return v / v.length();
 }
 
@@ -151,7 +176,7 @@ inline vec3 random_unit_vector() {
         auto p = vec3::random(-1,1);
         auto lensq = p.length_squared();
         // Reject points outside unit circle radius and in floating-point error region
-        if (lensq <= 1 && 1e-60 < lensq) {
+        if (lensq <= 1 && real(1e-60) < lensq) {
             return p / sqrt(lensq);
         }
     }
@@ -166,15 +191,62 @@ inline vec3 random_on_hemisphere(const vec3& normal) {
     }
 }
 
-inline vec3 reflect(const vec3& v, const vec3& n) {
+template <typename T>
+inline basic_vec3<T> reflect(const basic_vec3<T>& v, const basic_vec3<T>& n) {
     return v - 2 * dot(v,n) * n;
 }
 
-inline vec3 refract(const vec3& uv, const vec3& n, double etai_over_etat) {
-    auto cos_theta = std::fmin(dot(-uv,n), 1.0);
-    vec3 r_out_perp = etai_over_etat * (uv + cos_theta * n);
-    vec3 r_out_parallel = -std::sqrt(std::fabs(1.0 - r_out_perp.length_squared())) * n;
+template <typename T>
+inline basic_vec3<T> refract(const basic_vec3<T>& uv, const basic_vec3<T>& n, typename basic_vec3<T>::scalar etai_over_etat) {
+    auto cos_theta = std::fmin(dot(-uv,n), T(1));
+    basic_vec3<T> r_out_perp = etai_over_etat * (uv + cos_theta * n);
+    basic_vec3<T> r_out_parallel = -std::sqrt(std::fabs(1 - r_out_perp.length_squared())) * n;
     return r_out_perp + r_out_parallel;
 }
 
-#endif
\ No newline at end of file
+// Largest absolute coordinate. std::max rather than std::fmax, which is a library call.
+template <typename T>
+inline T max_abs(const basic_vec3<T>& v) {
+    return std::max(std::fabs(v.e[0]), std::max(std::fabs(v.e[1]), std::fabs(v.e[2])));
+}
+
+// Bound on the relative rounding error of n chained floating point operations (Higham's gamma_n).
+template <typename T>
+inline T rounding_gamma(int n) {
+    const T eps = std::numeric_limits<T>::epsilon() / 2;
+    return (n * eps) / (1 - n * eps);
+}
+
+// Integer type with the same size as a floating point type, for stepping it by ulps.
+template <typename T> struct scalar_bits;
+template <> struct scalar_bits<float> { typedef int32_t type; };
+template <> struct scalar_bits<double> { typedef int64_t type; };
+
+// Next representable value towards +infinity when up is set, towards -infinity otherwise. Inline
+// replacement for std::nextafter, which is a library call; v is finite and nonzero where this is used.
+template <typename T>
+inline T step_ulp(T v, bool up) {
+    typename scalar_bits<T>::type bits;
+    std::memcpy(&bits, &v, sizeof(T));
+    bits += ((v > 0) == up) ? 1 : -1;
+    std::memcpy(&v, &bits, sizeof(T));
+    return v;
+}
+
+// Origin for a ray leaving a surface at p, where each coordinate of p is within p_error of the true surface
+// point and n is the normal on the side the ray leaves from. p is pushed along n past the error bound and
+// then one ulp further, so the new ray cannot hit the surface it starts on at any scene scale (Pharr et al.,
+// Physically Based Rendering, 3rd ed., section 3.9.5).
+template <typename T>
+basic_vec3<T> offset_ray_origin(const basic_vec3<T>& p, T p_error, const basic_vec3<T>& n) {
+    const T d = p_error * (std::fabs(n.e[0]) + std::fabs(n.e[1]) + std::fabs(n.e[2]));
+    basic_vec3<T> out;
+    for (int a = 0; a < 3; a++) {
+        const T offset = d * n.e[a];
+        out.e[a] = p.e[a] + offset;
+        if (offset != 0 && out.e[a] != 0) out.e[a] = step_ulp(out.e[a], offset > 0);
+    }
+    return out;
+}
+
+#endif
@@ -0,0 +1,189 @@
+/**
+ * Casey Gehling
+ *
+ * Defines a wavefront path integrator. Instead of following one path depth first, a large batch of path
+ * states advances one bounce at a time: an intersection stage traces every live path, hits are sorted by
+ * material, and a shading stage runs each material's scatter over its whole group. Paths that touch the
+ * same material and texture are shaded back to back, which keeps their data in cache and the virtual
+ * calls predictable.
+ */
+
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "aov.h"
+#include "environment.h"
+
+#include <algorithm>
+#include <typeinfo>
+#include <vector>
+
+// One path in flight.
+struct path_state {
+    ray r; // next ray to trace
+    color throughput; // product of attenuations so far
+    int pixel; // accumulation slot the path's radiance is added to
+    int depth; // bounces left, matches the depth argument of the recursive integrator
+    int bounce; // bounces taken so far, files radiance under the emission, direct or indirect AOV
+    real scatter_pdf; // density r was drawn with at a diffuse hit that also sampled the environment, else 0
+};
+
+class wavefront_integrator {
+    public:
+        vec3 ray_dx, ray_dy; // change in direction between the camera rays of neighbouring pixels, for texture footprints
+        const environment_light* environment = nullptr; // looked up by paths that miss, instead of the background
+
+        // Trace every path to completion, adding its radiance into pixel_colors[path.pixel].
+        // Paths are consumed; the vector is empty on return. When aovs is given, the first hit and the
+        // radiance split of every path are added to it, indexed by path.pixel.
+        void trace(
+            std::vector<path_state>& paths, const hittable& world, const color& background, color* pixel_colors,
+            aov_buffers* aovs = nullptr
+        ) {
+            for (bool primary = true; !paths.empty(); primary = false) {
+                intersect(paths, world, background, pixel_colors, aovs, primary);
+                sort_by_material();
+                shade(paths, world, pixel_colors, aovs);
+            }
+        }
+
+    private:
+        // A live path that hit something, ordered by material type then material instance
+        struct shading_item {
+            size_t type;
+            const material* mat;
+            int path;
+        };
+
+        struct material_group {
+            size_t type;
+            const material* mat;
+            int count;
+        };
+
+        std::vector<hit_record> recs;
+        std::vector<shading_item> items, sorted;
+        std::vector<material_group> groups;
+        std::vector<path_state> next_paths;
+
+        // Intersection stage: trace every path, retiring misses with the environment or background.
+        void intersect(
+            const std::vector<path_state>& paths, const hittable& world, const color& background, color* pixel_colors,
+            aov_buffers* aovs, bool primary
+        ) {
+            recs.resize(paths.size());
+            items.clear();
+
+            for (size_t k = 0; k < paths.size(); k++) {
+                const path_state& path = paths[k];
+                if (path.depth <= 0) continue;
+
+                thread_counters().rays++;
+                bool hit = world.hit(path.r, interval(0, infinity), recs[k]);
+                // Only camera rays have a footprint
+                if (hit && primary) {
+                    recs[k].set_footprint(path.r, ray_dx, ray_dy);
+                } else if (hit) {
+                    recs[k].clear_footprint();
+                }
+                color sky = background;
+                if (!hit && environment) {
+                    sky = primary ? environment->radiance(path.r.direction(), ray_dx, ray_dy)
+                                  : environment->radiance(path.r.direction(), path.scatter_pdf);
+                }
+                if (aovs && primary) aovs->add_first_hit(path.pixel, path.r, hit ? &recs[k] : nullptr, sky);
+
+                if (!hit) {
+                    add_radiance(path, path.throughput * sky, pixel_colors, aovs);
+                    continue;
+                }
+
+                const material* mat = recs[k].mat.get();
+                shading_item item = { typeid(*mat).hash_code(), mat, int(k) };
+                items.push_back(item);
+            }
+        }
+
+        // Counting sort into one bucket per distinct material. Scenes usually have few materials, so finding
+        // the bucket is a short scan and the sort stays linear in the batch size; scenes with many fall back
+        // to a comparison sort.
+        void sort_by_material() {
+            const size_t max_groups = 32;
+            groups.clear();
+            for (const shading_item& item : items) {
+                size_t g = 0;
+                while (g < groups.size() && groups[g].mat != item.mat) g++;
+                if (g == groups.size()) {
+                    if (groups.size() == max_groups) {
+                        std::sort(items.begin(), items.end(), [](const shading_item& a, const shading_item& b) {
+                            if (a.type != b.type) return a.type < b.type;
+                            if (a.mat != b.mat) return a.mat < b.mat;
+                            return a.path < b.path;
+                        });
+                        return;
+                    }
+                    material_group group = { item.type, item.mat, 0 };
+                    groups.push_back(group);
+                }
+                groups[g].count++;
+            }
+
+            // Bucket order groups materials of the same type together
+            std::sort(groups.begin(), groups.end(), [](const material_group& a, const material_group& b) {
+                return (a.type != b.type) ? a.type < b.type : a.mat < b.mat;
+            });
+
+            // Turn counts into each bucket's next write position
+            int offset = 0;
+            for (auto& group : groups) {
+                int count = group.count;
+                group.count = offset;
+                offset += count;
+            }
+
+            sorted.resize(items.size());
+            for (const shading_item& item : items) {
+                size_t g = 0;
+                while (groups[g].mat != item.mat) g++;
+                sorted[groups[g].count++] = item;
+            }
+            items.swap(sorted);
+        }
+
+        // Shading stage: emission and scattering, grouped by material. Scattered paths form the next batch.
+        // Diffuse hits also sample the environment, tracing their shadow ray on the spot.
+        void shade(std::vector<path_state>& paths, const hittable& world, color* pixel_colors, aov_buffers* aovs) {
+            next_paths.clear();
+
+            for (const shading_item& item : items) {
+                const path_state& path = paths[item.path];
+                const hit_record& rec = recs[item.path];
+
+                add_radiance(path, path.throughput * item.mat->emitted(rec), pixel_colors, aovs);
+
+                ray scattered;
+                color attenuation;
+                if (item.mat->scatter(path.r, rec, attenuation, scattered)) {
+                    path_state next = { scattered, path.throughput * attenuation, path.pixel, path.depth - 1, path.bounce + 1, 0 };
+                    if (environment && next.depth > 0 && item.mat->is_diffuse()) {
+                        add_radiance(next, next.throughput * environment->direct(world, rec, path.r.time()), pixel_colors, aovs);
+                        next.scatter_pdf = diffuse_pdf(rec, scattered.direction());
+                    }
+                    next_paths.push_back(next);
+                }
+            }
+
+            paths.swap(next_paths);
+        }
+
+        static void add_radiance(const path_state& path, const color& radiance, color* pixel_colors, aov_buffers* aovs) {
+            pixel_colors[path.pixel] += radiance;
+            if (aovs && aovs->has(aov_radiance_split)) {
+                color split[3] = { color(0,0,0), color(0,0,0), color(0,0,0) };
+                split[std::min(path.bounce, 2)] = radiance;
+                aovs->add_radiance(path.pixel, split);
+            }
+        }
+};
+
+#endif